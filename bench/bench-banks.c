@@ -0,0 +1,135 @@
+/*
+ * bench-banks: measures dispatch throughput as the number of banks grows.
+ *
+ * For each bank count (1, 2, 4, ... up to the limit) a fresh controller is
+ * started, every bank gets a set of emulated cars that arrive instantly at
+ * whatever floor they are sent to, and a set of call threads per bank issue
+ * CALL requests back to back. Calls/sec is reported for the whole run and
+ * per bank; with independent shards the per-bank figure should stay roughly
+ * flat until the machine runs out of cores.
+ *
+ * Usage: ./bench-banks [max_banks] [cars_per_bank] [callers_per_bank] [seconds]
+ */
+
+#include "bench.h"
+
+#define FLOORS 20
+
+static volatile int running;
+static char bank_names[8][16];
+static unsigned long *bank_calls;
+
+struct car_arg {
+  int bank;
+  int idx;
+};
+
+static void *car_thread(void *p)
+{
+  struct car_arg *a = p;
+  char buf[256];
+  int fd = bench_connect(bench_port());
+  if (fd < 0) return NULL;
+  snprintf(buf, sizeof(buf), "CAR b%dc%d 1 %d BANK %s", a->bank, a->idx, FLOORS,
+           bank_names[a->bank]);
+  bench_send(fd, buf);
+  bench_send(fd, "STATUS Closed 1 1");
+  while (running && bench_recv(fd, buf, sizeof(buf)) == 0) {
+    int floor;
+    if (sscanf(buf, "FLOOR %d", &floor) == 1) {
+      snprintf(buf, sizeof(buf), "STATUS Opening %d %d", floor, floor);
+      bench_send(fd, buf);
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+static void *call_thread(void *p)
+{
+  int bank = *(int *)p;
+  unsigned int seed = bank * 7919 + (unsigned int)pthread_self();
+  char buf[256];
+  unsigned long done = 0;
+  while (running) {
+    int src = 1 + rand_r(&seed) % FLOORS;
+    int dst = 1 + rand_r(&seed) % FLOORS;
+    if (src == dst) continue;
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK %s", src, dst, bank_names[bank]);
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0) {
+      done++;
+    }
+    close(fd);
+  }
+  __atomic_add_fetch(&bank_calls[bank], done, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+static void run(int banks, int cars, int callers, int seconds)
+{
+  pid_t ctrl = bench_start_controller(NULL);
+  pthread_t car_tids[banks * cars];
+  pthread_t call_tids[banks * callers];
+  struct car_arg car_args[banks * cars];
+  int bank_ids[banks];
+
+  bank_calls = calloc(banks, sizeof(*bank_calls));
+  running = 1;
+  for (int b = 0; b < banks; b++) {
+    bank_ids[b] = b;
+    for (int c = 0; c < cars; c++) {
+      car_args[b * cars + c].bank = b;
+      car_args[b * cars + c].idx = c;
+      pthread_create(&car_tids[b * cars + c], NULL, car_thread, &car_args[b * cars + c]);
+    }
+  }
+  usleep(200000);
+
+  double start = bench_now();
+  for (int b = 0; b < banks; b++) {
+    for (int c = 0; c < callers; c++) {
+      pthread_create(&call_tids[b * callers + c], NULL, call_thread, &bank_ids[b]);
+    }
+  }
+  sleep(seconds);
+  running = 0;
+  for (int i = 0; i < banks * callers; i++) pthread_join(call_tids[i], NULL);
+  double elapsed = bench_now() - start;
+
+  //Stopping the controller closes the car sockets and releases their threads
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < banks * cars; i++) pthread_join(car_tids[i], NULL);
+
+  unsigned long total = 0, min = (unsigned long)-1;
+  for (int b = 0; b < banks; b++) {
+    total += bank_calls[b];
+    if (bank_calls[b] < min) min = bank_calls[b];
+  }
+  printf("%5d  %10.0f  %12.0f  %12.0f\n", banks, total / elapsed, total / elapsed / banks,
+         min / elapsed);
+  free(bank_calls);
+}
+
+int main(int argc, char **argv)
+{
+  int max_banks = argc > 1 ? atoi(argv[1]) : 8;
+  int cars = argc > 2 ? atoi(argv[2]) : 4;
+  int callers = argc > 3 ? atoi(argv[3]) : 2;
+  int seconds = argc > 4 ? atoi(argv[4]) : 2;
+
+  //The controller holds at most 8 banks, one of them being "default"
+  if (max_banks > 8) max_banks = 8;
+  strcpy(bank_names[0], "default");
+  for (int b = 1; b < 8; b++) snprintf(bank_names[b], sizeof(bank_names[b]), "bank%d", b);
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars and %d callers per bank, %ds per run, %ld cpus\n", cars, callers, seconds,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("banks     calls/s  calls/s/bank  slowest bank\n");
+  for (int banks = 1; banks <= max_banks; banks *= 2) {
+    run(banks, cars, callers, seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,338 @@
+/*
+ * bench-bidding: controller CPU and decision latency with the cars bidding for
+ * calls (--bidding) against the controller weighing them itself.
+ *
+ * A fresh controller is started per run with a fleet of emulated cars (1,000
+ * by default, ten to a bank), carried over WORKERS gateway connections as in
+ * bench-gateway. Each car moves a floor every TICK_MS towards the floor it was
+ * last sent and stops there within the tick. In the bidding run the cars
+ * register with BIDS 1 and answer each offer the way car --bid does, timing
+ * every placement of the call's stops in the queue they were sent (a floor and
+ * a stop each take TICK_MS here). CALLERS threads place calls at random banks
+ * at a fixed total rate, so both runs see the same load.
+ *
+ * Reported per run: calls answered per second, the caller's wait for the
+ * answer (mean and 99th percentile), the controller's CPU time per 1,000 calls
+ * and, for bidding, how many calls were decided by bids and how many fell back
+ * to the greedy rule (from the controller's shutdown counters).
+ *
+ * Usage: ./bench-bidding [cars] [calls per second] [seconds] [deadline ms]
+ */
+
+#include "bench.h"
+#include <poll.h>
+#include <sys/resource.h>
+
+#define FLOORS 20
+#define CARS_PER_BANK 10
+#define WORKERS 8
+#define CALLERS 8
+#define TICK_MS 10
+#define MAX_STOPS 24
+#define MAX_SAMPLES 200000 //Latencies kept per caller
+#define IN_SIZE 65536
+#define OUT_SIZE 65536
+#define LOG_FILE "bench-bidding.log"
+
+static volatile int running;
+static int fleet;
+static int bidding;
+static int call_rate;
+
+struct car {
+  int floor;
+  int target;
+  int moved; //Left its floor this tick, so it reports Between
+};
+
+static void add_frame(char *buf, size_t *len, const char *msg)
+{
+  uint16_t nlen = htons(strlen(msg));
+  if (*len + 2 + strlen(msg) > OUT_SIZE) return;
+  memcpy(buf + *len, &nlen, 2);
+  memcpy(buf + *len + 2, msg, strlen(msg));
+  *len += strlen(msg) + 2;
+}
+
+//Arrival at each stop from floor, a floor and a stop each taking one tick
+static void arrivals(int floor, const int *stops, int count, long *arrive)
+{
+  long t = 0;
+  for (int k = 0; k < count; k++) {
+    t += (long)abs(stops[k] - floor) * TICK_MS;
+    arrive[k] = t;
+    t += TICK_MS;
+    floor = stops[k];
+  }
+}
+
+static void insert_stop(int *stops, int *orig, int *count, int index, int floor)
+{
+  if (index > 0 && stops[index - 1] == floor) return;
+  memmove(&stops[index + 1], &stops[index], (*count - index) * sizeof(int));
+  memmove(&orig[index + 1], &orig[index], (*count - index) * sizeof(int));
+  stops[index] = floor;
+  orig[index] = -1;
+  (*count)++;
+}
+
+//The same search as answer_bid in car.c, on the emulated car's timing
+static void bid(const struct car *c, const char *offer, char *reply, size_t size)
+{
+  unsigned long seq;
+  int source, dest, offset, queue[MAX_STOPS], queued = 0;
+  if (sscanf(offer, "BID %lu %d %d%n", &seq, &source, &dest, &offset) != 3) return;
+  for (const char *p = offer + offset; queued < MAX_STOPS - 2;) {
+    int stop, used;
+    if (sscanf(p, "%d%n", &stop, &used) != 1) break;
+    queue[queued++] = stop;
+    p += used;
+  }
+  long before[MAX_STOPS], best = -1;
+  int best_i = 0, best_j = 0;
+  arrivals(c->floor, queue, queued, before);
+  for (int i = 0; i <= queued; i++) {
+    for (int j = i; j <= queued; j++) {
+      int stops[MAX_STOPS], orig[MAX_STOPS], count = queued, board = -1, alight = -1;
+      long arrive[MAX_STOPS];
+      for (int k = 0; k < queued; k++) {
+        stops[k] = queue[k];
+        orig[k] = k;
+      }
+      insert_stop(stops, orig, &count, j, dest);
+      insert_stop(stops, orig, &count, i, source);
+      for (int k = 0; k < count && alight < 0; k++) {
+        if (board < 0 && stops[k] == source) board = k;
+        else if (board >= 0 && stops[k] == dest) alight = k;
+      }
+      if (alight < 0) continue;
+      arrivals(c->floor, stops, count, arrive);
+      long cost = 2 * arrive[board] + (arrive[alight] - arrive[board]);
+      for (int k = 0; k < count; k++) {
+        if (orig[k] >= 0) cost += arrive[k] - before[orig[k]];
+      }
+      if (best < 0 || cost < best) {
+        best = cost;
+        best_i = i;
+        best_j = j;
+      }
+    }
+  }
+  if (best < 0) snprintf(reply, size, "BID %lu NONE", seq);
+  else snprintf(reply, size, "BID %lu %ld %d %d", seq, best, best_i, best_j);
+}
+
+static void *worker(void *p)
+{
+  int id = *(int *)p;
+  int first = fleet * id / WORKERS, last = fleet * (id + 1) / WORKERS;
+  struct car *cars = calloc(last - first, sizeof(*cars));
+  char *in = malloc(IN_SIZE), *out = malloc(OUT_SIZE);
+  size_t in_len = 0, out_len = 0;
+  char msg[256];
+  int gateway = bench_connect(bench_port());
+  if (gateway < 0) goto done;
+  bench_send(gateway, "GATEWAY");
+  for (int i = first; i < last; i++) {
+    cars[i - first].floor = cars[i - first].target = 1;
+    snprintf(msg, sizeof(msg), "%d CAR c%d 1 %d BANK f%d%s", i, i, FLOORS, i / CARS_PER_BANK, bidding ? " BIDS 1" : "");
+    add_frame(out, &out_len, msg);
+    snprintf(msg, sizeof(msg), "%d STATUS Closed 1 1", i);
+    add_frame(out, &out_len, msg);
+  }
+  if (bench_write_all(gateway, out, out_len) != 0) goto done;
+
+  double next_tick = bench_now() + TICK_MS / 1000.0;
+  while (running) {
+    out_len = 0;
+    int wait_ms = (int)((next_tick - bench_now()) * 1000);
+    struct pollfd pfd = {gateway, POLLIN, 0};
+    if (wait_ms > 0 && poll(&pfd, 1, wait_ms) > 0) {
+      ssize_t n = read(gateway, in + in_len, IN_SIZE - in_len);
+      if (n <= 0) break;
+      in_len += n;
+      size_t off = 0;
+      while (in_len - off >= 2) {
+        uint16_t nlen;
+        memcpy(&nlen, in + off, 2);
+        size_t len = ntohs(nlen);
+        if (in_len - off - 2 < len) break;
+        char frame[1024];
+        memcpy(frame, in + off + 2, len < sizeof(frame) ? len : sizeof(frame) - 1);
+        frame[len < sizeof(frame) ? len : sizeof(frame) - 1] = '\0';
+        off += 2 + len;
+        char *rest;
+        long car_id = strtol(frame, &rest, 10);
+        if (car_id < first || car_id >= last || *rest != ' ') continue;
+        struct car *c = &cars[car_id - first];
+        int floor;
+        if (sscanf(rest, " FLOOR %d", &floor) == 1) {
+          c->target = floor;
+        } else if (strncmp(rest, " BID ", 5) == 0) {
+          char reply[64];
+          int n_id = snprintf(msg, sizeof(msg), "%ld ", car_id);
+          bid(c, rest + 1, reply, sizeof(reply));
+          snprintf(msg + n_id, sizeof(msg) - n_id, "%s", reply);
+          add_frame(out, &out_len, msg);
+        }
+      }
+      memmove(in, in + off, in_len - off);
+      in_len -= off;
+    }
+    if (bench_now() >= next_tick) {
+      next_tick += TICK_MS / 1000.0;
+      for (int i = 0; i < last - first; i++) {
+        struct car *c = &cars[i];
+        if (c->floor == c->target) continue;
+        int from = c->floor;
+        c->floor += c->target > c->floor ? 1 : -1;
+        if (c->floor == c->target) {
+          snprintf(msg, sizeof(msg), "%d STATUS Opening %d %d", first + i, c->floor, c->floor);
+          add_frame(out, &out_len, msg);
+          snprintf(msg, sizeof(msg), "%d STATUS Closed %d %d", first + i, c->floor, c->floor);
+        } else {
+          snprintf(msg, sizeof(msg), "%d STATUS Between %d %d", first + i, from, c->target);
+        }
+        add_frame(out, &out_len, msg);
+      }
+    }
+    if (out_len > 0 && bench_write_all(gateway, out, out_len) != 0) break;
+  }
+done:
+  if (gateway >= 0) close(gateway);
+  free(in);
+  free(out);
+  free(cars);
+  return NULL;
+}
+
+struct caller {
+  unsigned int seed;
+  unsigned long done;
+  int samples;
+  double *latency;
+};
+
+static void *call_thread(void *p)
+{
+  struct caller *c = p;
+  char buf[256];
+  double interval = (double)CALLERS / call_rate, next = bench_now();
+  while (running) {
+    double now = bench_now();
+    if (now < next) {
+      usleep((useconds_t)((next - now) * 1e6));
+      continue;
+    }
+    next += interval;
+    int src = 1 + rand_r(&c->seed) % FLOORS;
+    int dst = 1 + rand_r(&c->seed) % FLOORS;
+    if (src == dst) continue;
+    double start = bench_now();
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK f%d", src, dst,
+             rand_r(&c->seed) % ((fleet + CARS_PER_BANK - 1) / CARS_PER_BANK));
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0 && strncmp(buf, "CAR ", 4) == 0) {
+      c->done++;
+      if (c->samples < MAX_SAMPLES) c->latency[c->samples++] = bench_now() - start;
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+static void run(const char *label, int bids, int deadline_ms, int seconds)
+{
+  char args[32];
+  snprintf(args, sizeof(args), "--bidding %d", deadline_ms);
+  pid_t ctrl = bench_start_controller_log(bids ? args : NULL, LOG_FILE);
+  pthread_t workers[WORKERS], callers[CALLERS];
+  int ids[WORKERS];
+  struct caller calls[CALLERS];
+
+  bidding = bids;
+  running = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    ids[i] = i;
+    pthread_create(&workers[i], NULL, worker, &ids[i]);
+  }
+  sleep(1); //Registration is not what is measured
+  for (int i = 0; i < CALLERS; i++) {
+    calls[i].seed = 7919 * (i + 1);
+    calls[i].done = 0;
+    calls[i].samples = 0;
+    calls[i].latency = malloc(MAX_SAMPLES * sizeof(double));
+    pthread_create(&callers[i], NULL, call_thread, &calls[i]);
+  }
+  double start = bench_now(), cpu_start = bench_cpu_seconds(ctrl);
+  sleep(seconds);
+  running = 0;
+  for (int i = 0; i < CALLERS; i++) pthread_join(callers[i], NULL);
+  double elapsed = bench_now() - start, cpu = bench_cpu_seconds(ctrl) - cpu_start;
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < WORKERS; i++) pthread_join(workers[i], NULL);
+
+  unsigned long total = 0;
+  int samples = 0;
+  for (int i = 0; i < CALLERS; i++) {
+    total += calls[i].done;
+    samples += calls[i].samples;
+  }
+  double *all = malloc((samples + 1) * sizeof(double)), sum = 0;
+  for (int i = 0, n = 0; i < CALLERS; i++) {
+    for (int s = 0; s < calls[i].samples; s++) {
+      all[n++] = calls[i].latency[s];
+      sum += calls[i].latency[s];
+    }
+    free(calls[i].latency);
+  }
+  qsort(all, samples, sizeof(double), bench_cmp_double);
+
+  unsigned long auctions = 0, central = 0;
+  FILE *log = fopen(LOG_FILE, "r");
+  char line[512];
+  while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+    //"Bidding: <n> auctions, <b> bids, <t> past the deadline, <s> shifted, <x> stale bids, <c> central, ..."
+    unsigned long b, t, s, x;
+    sscanf(line, "Bidding: %lu auctions, %lu bids, %lu past the deadline, %lu shifted, %lu stale bids, %lu central",
+           &auctions, &b, &t, &s, &x, &central);
+  }
+  if (log != NULL) fclose(log);
+  unlink(LOG_FILE);
+
+  printf("%-8s  %5d  %8.0f  %9.3f  %8.3f  %12.1f", label, fleet, total / elapsed,
+         samples ? sum / samples * 1000 : 0.0, samples ? all[samples * 99 / 100] * 1000 : 0.0,
+         total ? cpu / total * 1000 * 1000 : 0.0);
+  if (bids) printf("  %8lu  %7lu", auctions, central);
+  printf("\n");
+  free(all);
+}
+
+int main(int argc, char **argv)
+{
+  fleet = argc > 1 ? atoi(argv[1]) : 1000;
+  call_rate = argc > 2 ? atoi(argv[2]) : 1000;
+  int seconds = argc > 3 ? atoi(argv[3]) : 3;
+  int deadline_ms = argc > 4 ? atoi(argv[4]) : 20;
+
+  //The controller has 128 banks of ten
+  if (fleet > 1280) fleet = 1280;
+  if (fleet < WORKERS) fleet = WORKERS;
+  if (call_rate < CALLERS) call_rate = CALLERS;
+  if (seconds < 1) seconds = 1;
+  if (deadline_ms < 1) deadline_ms = 1;
+
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars (%d per bank) on %d gateways, %d calls/s from %d callers, %ds per run, deadline %d ms, %ld cpus\n",
+         fleet, CARS_PER_BANK, WORKERS, call_rate, CALLERS, seconds, deadline_ms, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("dispatch   cars   calls/s    mean ms    p99 ms  cpu ms/1000  auctions  central\n");
+  run("central", 0, deadline_ms, seconds);
+  run("bidding", 1, deadline_ms, seconds);
+  return 0;
+}
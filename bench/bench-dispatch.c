@@ -0,0 +1,281 @@
+/*
+ * bench-dispatch: per-call dispatch latency as the fleet grows from 10 to
+ * 1,000 cars.
+ *
+ * For each fleet size a fresh controller is started and the cars register
+ * ten to a bank, the most a bank holds. Emulated cars arrive instantly at
+ * whatever floor they are sent to (as in bench-banks), so their queues stay
+ * short and the work per call is the controller's own. A few call threads
+ * then issue calls back to back to random banks.
+ *
+ * Reported per fleet size, from the controller's shutdown report: the
+ * average time a call holds its bank lock, and the part of it spent weighing
+ * candidate cars; and the round-trip latency a call pad sees (connect, CALL,
+ * answer) at p50 and p99. The controller's greedy rule skips candidates
+ * whose lower bound cannot beat the best car found so far; the share of
+ * candidates it skipped is reported too.
+ *
+ * The emulated cars keep short queues, where the bound does the least work,
+ * so a second table times the greedy rule in-process on busier banks of ten:
+ * each car is given up to <load> random calls, then the same states are
+ * weighed with pruning (greedy_choice) and by walking every queue, and the
+ * two choices are checked to agree.
+ *
+ * Usage: ./bench-dispatch [max cars] [seconds per size] [extra controller args]
+ */
+
+#include "bench.h"
+#include "../controller.h"
+#include <poll.h>
+#include <sys/resource.h>
+
+#define FLOORS 20
+#define CARS_PER_BANK 10
+#define WORKERS 4
+#define CALLERS 4
+#define MAX_SAMPLES 200000 //Latencies kept per caller
+#define LOG_FILE "bench-dispatch.log"
+#define STATES 2000 //Bank states per load in the in-process table
+#define STATE_REPEATS 50
+
+static volatile int running;
+static int fleet;
+
+static void *car_worker(void *p)
+{
+  int id = *(int *)p;
+  int first = fleet * id / WORKERS, last = fleet * (id + 1) / WORKERS;
+  int n = last - first;
+  struct pollfd *pfds = calloc(n, sizeof(*pfds));
+  char buf[256];
+
+  for (int i = 0; i < n; i++) {
+    int car = first + i;
+    pfds[i].fd = bench_connect(bench_port());
+    pfds[i].events = POLLIN;
+    if (pfds[i].fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CAR c%d 1 %d BANK d%d", car, FLOORS, car / CARS_PER_BANK);
+    bench_send(pfds[i].fd, buf);
+    bench_send(pfds[i].fd, "STATUS Closed 1 1");
+  }
+  while (running) {
+    if (poll(pfds, n, 100) <= 0) continue;
+    for (int i = 0; i < n; i++) {
+      int floor;
+      if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      if (bench_recv(pfds[i].fd, buf, sizeof(buf)) != 0) {
+        close(pfds[i].fd);
+        pfds[i].fd = -1;
+        continue;
+      }
+      if (sscanf(buf, "FLOOR %d", &floor) == 1) {
+        snprintf(buf, sizeof(buf), "STATUS Opening %d %d", floor, floor);
+        bench_send(pfds[i].fd, buf);
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (pfds[i].fd >= 0) close(pfds[i].fd);
+  }
+  free(pfds);
+  return NULL;
+}
+
+struct caller {
+  unsigned int seed;
+  int count;
+  double *latency;
+};
+
+static void *call_thread(void *p)
+{
+  struct caller *c = p;
+  char buf[256];
+  int banks = (fleet + CARS_PER_BANK - 1) / CARS_PER_BANK;
+  while (running && c->count < MAX_SAMPLES) {
+    int src = 1 + rand_r(&c->seed) % FLOORS;
+    int dst = 1 + rand_r(&c->seed) % FLOORS;
+    if (src == dst) continue;
+    double start = bench_now();
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK d%d", src, dst, rand_r(&c->seed) % banks);
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0) {
+      c->latency[c->count++] = bench_now() - start;
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+static void run(int cars, int seconds, const char *extra)
+{
+  fleet = cars;
+  pid_t ctrl = bench_start_controller_log(extra, LOG_FILE);
+  pthread_t workers[WORKERS], callers[CALLERS];
+  int ids[WORKERS];
+  struct caller calls[CALLERS];
+
+  running = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    ids[i] = i;
+    pthread_create(&workers[i], NULL, car_worker, &ids[i]);
+  }
+  usleep(300000 + cars * 1000); //Let every car register
+  for (int i = 0; i < CALLERS; i++) {
+    calls[i].seed = 7919 * (i + 1);
+    calls[i].count = 0;
+    calls[i].latency = malloc(MAX_SAMPLES * sizeof(double));
+    pthread_create(&callers[i], NULL, call_thread, &calls[i]);
+  }
+  double start = bench_now();
+  sleep(seconds);
+  running = 0;
+  for (int i = 0; i < CALLERS; i++) pthread_join(callers[i], NULL);
+  double elapsed = bench_now() - start;
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < WORKERS; i++) pthread_join(workers[i], NULL);
+
+  //"Bank <name>: <n> cars, <calls> calls (...), ..., avg dispatch <ns> ns (<ns> choosing), <n> of <n> candidates pruned"
+  double dispatch_ns = 0, choose_ns = 0;
+  unsigned long dispatched = 0, registered = 0, candidates = 0, pruned = 0;
+  FILE *log = fopen(LOG_FILE, "r");
+  char line[512];
+  while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+    unsigned long n, calls;
+    char *at = strstr(line, "avg dispatch ");
+    if (strncmp(line, "Bank ", 5) != 0 || at == NULL) continue;
+    if (sscanf(strchr(line, ':'), ": %lu cars, %lu calls", &n, &calls) != 2) continue;
+    registered += n;
+    dispatched += calls;
+    dispatch_ns += atof(at + 13) * calls;
+    if ((at = strchr(at, '(')) != NULL) choose_ns += atof(at + 1) * calls;
+    unsigned long skipped, seen;
+    if (at != NULL && (at = strstr(at, "), ")) != NULL &&
+        sscanf(at, "), %lu of %lu candidates", &skipped, &seen) == 2) {
+      pruned += skipped;
+      candidates += seen;
+    }
+  }
+  if (log != NULL) fclose(log);
+  unlink(LOG_FILE);
+
+  int total = 0;
+  for (int i = 0; i < CALLERS; i++) total += calls[i].count;
+  double *all = malloc((total + 1) * sizeof(double));
+  int k = 0;
+  for (int i = 0; i < CALLERS; i++) {
+    memcpy(all + k, calls[i].latency, calls[i].count * sizeof(double));
+    k += calls[i].count;
+    free(calls[i].latency);
+  }
+  qsort(all, total, sizeof(double), bench_cmp_double);
+  printf("%5d  %5lu  %8.0f  %11.2f  %9.2f  %7.1f%%  %9.1f  %9.1f\n", cars, registered, total / elapsed,
+         dispatched ? dispatch_ns / dispatched / 1000 : 0.0, dispatched ? choose_ns / dispatched / 1000 : 0.0,
+         candidates ? pruned * 100.0 / candidates : 0.0,
+         total ? all[total / 2] * 1e6 : 0.0, total ? all[(int)(total * 0.99)] * 1e6 : 0.0);
+  free(all);
+}
+
+/// @brief The greedy rule without pruning: every candidate's queue is walked
+static int exhaustive_choice(const Car *cars, int source, int dest)
+{
+  int best = -1, best_cost = 0, best_len = 0, best_dist = 0;
+  for (int i = 0; i < MAX_CARS; i++) {
+    if (!cars[i].in_use || source < cars[i].floor_min || source > cars[i].floor_max ||
+        dest < cars[i].floor_min || dest > cars[i].floor_max) continue;
+    int pickup_idx, final_len;
+    int cost = calculate_insertion_cost(&cars[i], source, dest, &pickup_idx, &final_len);
+    if (cost < 0) continue;
+    int at = cars[i].current_floor;
+    if (cars[i].queue_size > 0 && (strcmp(cars[i].status, "Closing") == 0 || strcmp(cars[i].status, "Between") == 0)) {
+      at = cars[i].queue[0];
+    }
+    int dist = abs(source - at);
+    if (best < 0 || cost < best_cost || (cost == best_cost && (final_len < best_len ||
+        (final_len == best_len && dist < best_dist)))) {
+      best_cost = cost;
+      best_len = final_len;
+      best_dist = dist;
+      best = i;
+    }
+  }
+  return best;
+}
+
+static void weigh_states(int load)
+{
+  static Car states[STATES][MAX_CARS];
+  static int calls[STATES][2];
+  static const char *statuses[] = {"Closed", "Opening", "Open", "Closing", "Between"};
+  unsigned int seed = 4099 + load;
+  ChoiceStats stats = {0, 0};
+  int disagree = 0;
+  volatile int sink = 0;
+
+  for (int s = 0; s < STATES; s++) {
+    memset(states[s], 0, sizeof(states[s]));
+    for (int c = 0; c < MAX_CARS; c++) {
+      Car *car = &states[s][c];
+      car->in_use = 1;
+      car->floor_min = 1;
+      car->floor_max = FLOORS;
+      car->current_floor = 1 + rand_r(&seed) % FLOORS;
+      strcpy(car->status, statuses[rand_r(&seed) % 5]);
+      int n = load ? rand_r(&seed) % (load + 1) : 0;
+      for (int k = 0; k < n && car->queue_size + 2 <= MAX_QUEUE_DEPTH; k++) {
+        int src = 1 + rand_r(&seed) % FLOORS, dst = 1 + rand_r(&seed) % FLOORS;
+        if (src != dst) plan_insertion(car, src, dst);
+      }
+    }
+    do {
+      calls[s][0] = 1 + rand_r(&seed) % FLOORS;
+      calls[s][1] = 1 + rand_r(&seed) % FLOORS;
+    } while (calls[s][0] == calls[s][1]);
+    if (greedy_choice(states[s], calls[s][0], calls[s][1], &stats) != exhaustive_choice(states[s], calls[s][0], calls[s][1])) {
+      disagree++;
+    }
+  }
+
+  double start = bench_now();
+  for (int r = 0; r < STATE_REPEATS; r++) {
+    for (int s = 0; s < STATES; s++) sink += exhaustive_choice(states[s], calls[s][0], calls[s][1]);
+  }
+  double walk_all = (bench_now() - start) / (STATES * STATE_REPEATS);
+  start = bench_now();
+  for (int r = 0; r < STATE_REPEATS; r++) {
+    for (int s = 0; s < STATES; s++) sink += greedy_choice(states[s], calls[s][0], calls[s][1], NULL);
+  }
+  double bounded = (bench_now() - start) / (STATES * STATE_REPEATS);
+  (void)sink;
+  printf("%5d  %7.1f%%  %10.0f  %10.0f  %7.2fx  %9d\n", load, stats.pruned * 100.0 / stats.candidates,
+         walk_all * 1e9, bounded * 1e9, walk_all / bounded, disagree);
+}
+
+int main(int argc, char **argv)
+{
+  int max_cars = argc > 1 ? atoi(argv[1]) : 1000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 2;
+  const char *extra = argc > 3 ? argv[3] : NULL;
+  if (max_cars > 1280) max_cars = 1280; //128 banks of ten
+
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d callers, %ds per size, %ld cpus%s%s\n", CALLERS, seconds, sysconf(_SC_NPROCESSORS_ONLN),
+         extra ? ", controller " : "", extra ? extra : "");
+  printf(" cars  seen   calls/s  dispatch us  choose us   pruned  p50 us     p99 us\n");
+  static const int sizes[] = {10, 30, 100, 300, 1000, 1280};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= max_cars; i++) {
+    run(sizes[i], seconds, extra);
+  }
+
+  printf("\nGreedy rule in-process, %d banks of %d cars\n", STATES, MAX_CARS);
+  printf(" load   pruned  walk all ns  pruned ns  speedup  disagree\n");
+  static const int loads[] = {0, 1, 2, 4, 8};
+  for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) weigh_states(loads[i]);
+  return 0;
+}
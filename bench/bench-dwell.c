@@ -0,0 +1,246 @@
+/*
+ * bench-dwell: round trips of a real car (CAR, default ../car) with the fixed
+ * door dwell and with adaptive dwell (--dwell <lobby>).
+ *
+ * The bench stands in for both the controller and the safety system, as the
+ * car testers in test/ do: it listens on the controller port, keeps the car's
+ * safety heartbeat up in its shared memory and sends it on TOURS round trips,
+ * each from the lobby up through STOPS random floors and back. Riders board at
+ * some stops: several at the lobby and at BUSY_FLOOR, now and then one at any
+ * other floor. Each rider takes BOARD_MS to step in and presses the open
+ * button as they do. If the doors start Closing on riders still waiting to
+ * get in, they press it again once the doors have shut, and the doors go
+ * through another full cycle.
+ *
+ * Reported for each mode: the average round trip, how long the doors stayed
+ * Open in all at stops with and without riders, reopenings and the TIMING
+ * updates the car sent. Both modes see the same tours.
+ *
+ * Usage: ./bench-dwell [tours]
+ */
+
+#include "bench.h"
+#include "../shared_mem.h"
+#include <poll.h>
+#include <sys/mman.h>
+
+#define FLOORS 20
+#define LOBBY 1
+#define BUSY_FLOOR 12
+#define STOPS 4 //Above the lobby, per tour
+#define DELAY_MS 40 //The car's delay argument
+#define BOARD_MS 30
+#define MAX_RIDERS 4
+#define CAR_NAME "DwellBench"
+
+static car_shared_mem *shm;
+static volatile int heartbeat_cancel;
+
+static void *heartbeat(void *p)
+{
+  (void)p;
+  pthread_mutex_lock(&shm->mutex);
+  while (!heartbeat_cancel) {
+    if (shm->safety_system != 1) {
+      shm->safety_system = 1;
+      pthread_cond_broadcast(&shm->cond);
+    }
+    pthread_cond_wait(&shm->cond, &shm->mutex);
+  }
+  pthread_mutex_unlock(&shm->mutex);
+  return NULL;
+}
+
+static void set_open_button(int value)
+{
+  pthread_mutex_lock(&shm->mutex);
+  shm->open_button = value;
+  pthread_cond_broadcast(&shm->cond);
+  pthread_mutex_unlock(&shm->mutex);
+}
+
+static int riders_at(int floor, unsigned int *seed)
+{
+  if (floor == LOBBY) return MAX_RIDERS;
+  if (floor == BUSY_FLOOR) return 3;
+  return rand_r(seed) % 3 == 0;
+}
+
+struct result {
+  double trip;
+  double quiet_open;
+  int quiet_stops;
+  double boarding_open;
+  int boarding_stops;
+  int reopened;
+  int timing_updates;
+};
+
+/// @brief Sends the car to floor and plays the riders there. Returns -1 if the car went away
+static int stop(int fd, int floor, int riders, struct result *res)
+{
+  char buf[128], want[32];
+  double opened = 0, closing = 0;
+  int pressed = 0, left = riders;
+  snprintf(buf, sizeof(buf), "FLOOR %d", floor);
+  bench_send(fd, buf);
+  for (;;) {
+    int wait_ms = -1;
+    if (opened > 0 && closing == 0 && pressed < left) {
+      double due = opened + pressed * BOARD_MS / 1000.0;
+      wait_ms = (int)((due - bench_now()) * 1000);
+      if (wait_ms <= 0) {
+        set_open_button(1);
+        pressed++;
+        continue;
+      }
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, wait_ms) <= 0) continue;
+    if (bench_recv(fd, buf, sizeof(buf)) != 0) return -1;
+    if (strncmp(buf, "TIMING ", 7) == 0) res->timing_updates++;
+    snprintf(want, sizeof(want), "STATUS Open %d %d", floor, floor);
+    if (strcmp(buf, want) == 0 && opened == 0) opened = bench_now();
+    snprintf(want, sizeof(want), "STATUS Closing %d %d", floor, floor);
+    if (strcmp(buf, want) == 0 && opened > 0 && closing == 0) {
+      closing = bench_now();
+      set_open_button(0);
+      int boarded = 0;
+      while (boarded < left && opened + (boarded + 1) * BOARD_MS / 1000.0 <= closing) boarded++;
+      left -= boarded;
+      if (riders > 0) res->boarding_open += closing - opened;
+      else res->quiet_open += closing - opened;
+    }
+    snprintf(want, sizeof(want), "STATUS Closed %d %d", floor, floor);
+    if (strcmp(buf, want) == 0 && closing > 0) {
+      if (left == 0) break;
+      //The doors closed on someone: they press the button and the doors open again
+      res->reopened++;
+      opened = closing = 0;
+      pressed = 0;
+      set_open_button(1);
+    }
+  }
+  if (riders > 0) res->boarding_stops++;
+  else res->quiet_stops++;
+  return 0;
+}
+
+static int run(const char *dwell, int tours, struct result *res)
+{
+  const char *bin = getenv("CAR");
+  const char *prefix = getenv("ELEVATOR_SHM_PREFIX");
+  char name[128], delay[16], floors[16], lobby[16];
+  snprintf(name, sizeof(name), "%s%s", prefix ? prefix : "/car", CAR_NAME);
+  snprintf(delay, sizeof(delay), "%d", DELAY_MS);
+  snprintf(floors, sizeof(floors), "%d", FLOORS);
+  snprintf(lobby, sizeof(lobby), "%d", LOBBY);
+  if (bin == NULL) bin = "../car";
+  memset(res, 0, sizeof(*res));
+  shm_unlink(name);
+
+  int server = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(bench_port());
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, 4) != 0) {
+    perror("bind()");
+    return -1;
+  }
+
+  pid_t car = fork();
+  if (car == 0) {
+    if (dwell) {
+      execl(bin, bin, CAR_NAME, "1", floors, delay, "--dwell", lobby, (char *)NULL);
+    } else {
+      execl(bin, bin, CAR_NAME, "1", floors, delay, (char *)NULL);
+    }
+    perror("exec car");
+    _exit(1);
+  }
+  int shm_fd = -1;
+  for (int i = 0; i < 200 && shm_fd < 0; i++) {
+    usleep(10000);
+    shm_fd = shm_open(name, O_RDWR, 0666);
+  }
+  if (shm_fd < 0) {
+    fprintf(stderr, "The car did not create its shared memory.\n");
+    kill(car, SIGINT);
+    waitpid(car, NULL, 0);
+    close(server);
+    return -1;
+  }
+  usleep(10000); //Let the car finish initialising it
+  shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  pthread_t beat;
+  heartbeat_cancel = 0;
+  pthread_create(&beat, NULL, heartbeat, NULL);
+
+  int fd = accept(server, NULL, NULL);
+  char buf[128];
+  bench_recv(fd, buf, sizeof(buf)); //CAR registration
+  bench_recv(fd, buf, sizeof(buf)); //First STATUS
+
+  unsigned int seed = 31337;
+  int ok = 0;
+  double start = bench_now();
+  for (int t = 0; t < tours && ok == 0; t++) {
+    int floors_up[STOPS];
+    for (int s = 0; s < STOPS; s++) {
+      floors_up[s] = LOBBY + 1 + rand_r(&seed) % (FLOORS - LOBBY);
+      for (int p = s; p > 0 && floors_up[p] < floors_up[p - 1]; p--) {
+        int tmp = floors_up[p];
+        floors_up[p] = floors_up[p - 1];
+        floors_up[p - 1] = tmp;
+      }
+    }
+    ok = stop(fd, LOBBY, riders_at(LOBBY, &seed), res);
+    for (int s = 0; s < STOPS && ok == 0; s++) {
+      if (s > 0 && floors_up[s] == floors_up[s - 1]) continue;
+      ok = stop(fd, floors_up[s], riders_at(floors_up[s], &seed), res);
+    }
+  }
+  res->trip = (bench_now() - start) / tours;
+
+  close(fd);
+  close(server);
+  kill(car, SIGINT);
+  heartbeat_cancel = 1;
+  pthread_mutex_lock(&shm->mutex);
+  pthread_cond_broadcast(&shm->cond);
+  pthread_mutex_unlock(&shm->mutex);
+  pthread_join(beat, NULL);
+  waitpid(car, NULL, 0);
+  munmap(shm, sizeof(*shm));
+  close(shm_fd);
+  shm_unlink(name);
+  if (ok != 0) fprintf(stderr, "The car disconnected.\n");
+  return ok;
+}
+
+static void report(const char *label, const struct result *r)
+{
+  printf("%-9s  %9.0f  %10.0f  %13.0f  %9d  %6d\n", label, r->trip * 1000,
+         r->quiet_stops ? r->quiet_open / r->quiet_stops * 1000 : 0.0,
+         r->boarding_stops ? r->boarding_open / r->boarding_stops * 1000 : 0.0, r->reopened,
+         r->timing_updates);
+}
+
+int main(int argc, char **argv)
+{
+  int tours = argc > 1 ? atoi(argv[1]) : 8;
+  if (tours < 1) tours = 1;
+  signal(SIGPIPE, SIG_IGN);
+  printf("One car, %d floors, delay %d ms, %d tours of %d stops from lobby %d, %d ms per rider boarding\n",
+         FLOORS, DELAY_MS, tours, STOPS, LOBBY, BOARD_MS);
+  printf("dwell      trip (ms)  quiet open  boarding open  reopened  TIMING\n");
+  struct result fixed, adaptive;
+  if (run(NULL, tours, &fixed) != 0) return 1;
+  report("fixed", &fixed);
+  if (run("--dwell", tours, &adaptive) != 0) return 1;
+  report("adaptive", &adaptive);
+  return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * bench-express: a tall-building simulator that compares plain greedy
+ * dispatch with express service (--express <floors>), where trips of at
+ * least <floors> floors are grouped onto cars that skip short hops.
+ *
+ * One bank of emulated cars serves FLOORS floors, driving as in bench-reopt:
+ * one floor per FLOOR_MS, doors for DOOR_MS at each stop, timing the cars
+ * advertise when they register. Every door opening is logged with its floor
+ * and time. Callers arrive as a Poisson stream with uniformly random floors
+ * and are not kept informed, so each rider's journey is read back from its
+ * car's log afterwards: boarding is the car's first opening at the source
+ * floor after the call, arrival its next opening at the destination, and
+ * every opening in between is a stop the rider sat through.
+ *
+ * Reported for long trips (at least the threshold) and short ones apart:
+ * average wait, ride and round trip (call to arrival) in ms, and stops made
+ * during the ride. Every run uses the same seed, so the same calls arrive at
+ * the same times.
+ *
+ * Usage: ./bench-express [calls] [calls per second] [long trip floors]
+ */
+
+#include "bench.h"
+#include <poll.h>
+#include <math.h>
+
+#define FLOORS 100
+#define CARS 6
+#define FLOOR_MS 10
+#define DOOR_MS 80 //A stop costs as much time as eight floors of travel
+#define DRAIN_S 10 //How long riders still travelling after the last call are given
+#define LOG_FILE "bench-express.log"
+
+static volatile int running;
+
+struct opening {
+  int floor;
+  double at;
+};
+
+static struct {
+  pthread_mutex_t mutex;
+  struct opening *log;
+  int count;
+  int capacity;
+} openings[CARS];
+
+enum car_state { IDLE, MOVING, DOORS };
+
+static void status(int fd, const char *state, int floor, int dest)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "STATUS %s %d %d", state, floor, dest);
+  bench_send(fd, buf);
+}
+
+static void opened(int id, int floor)
+{
+  pthread_mutex_lock(&openings[id].mutex);
+  if (openings[id].count < openings[id].capacity) {
+    openings[id].log[openings[id].count].floor = floor;
+    openings[id].log[openings[id].count].at = bench_now();
+    openings[id].count++;
+  }
+  pthread_mutex_unlock(&openings[id].mutex);
+}
+
+static void *car_thread(void *p)
+{
+  int id = *(int *)p;
+  int floor = 1 + id * (FLOORS - 1) / CARS;
+  int target = floor;
+  enum car_state state = IDLE;
+  int door_step = 0;
+  int reopen = 0; //Sent this floor again after the doors opened here
+  double next = 0;
+  char buf[128];
+
+  int fd = bench_connect(bench_port());
+  if (fd < 0) return NULL;
+  snprintf(buf, sizeof(buf), "CAR x%d 1 %d TIMING %d,%d,%d,%d", id, FLOORS, FLOOR_MS, DOOR_MS / 4, DOOR_MS / 2, DOOR_MS / 4);
+  bench_send(fd, buf);
+  status(fd, "Closed", floor, floor);
+
+  while (running) {
+    double now = bench_now();
+    int wait_ms = state == IDLE ? 50 : (int)((next - now) * 1000);
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (wait_ms > 0 && poll(&pfd, 1, wait_ms) > 0) {
+      if (bench_recv(fd, buf, sizeof(buf)) != 0) break;
+      if (sscanf(buf, "FLOOR %d", &target) != 1) continue;
+      if (state == DOORS && target == floor && door_step > 0) reopen = 1;
+      if (state == IDLE) {
+        state = target == floor ? DOORS : MOVING;
+        door_step = 0;
+        next = bench_now();
+      }
+      continue;
+    }
+    if (state == IDLE) continue;
+
+    if (state == MOVING) {
+      if (floor == target) {
+        state = DOORS;
+        door_step = 0;
+        continue;
+      }
+      int to = floor + (target > floor ? 1 : -1);
+      status(fd, "Between", floor, to);
+      floor = to;
+      next += FLOOR_MS / 1000.0;
+      continue;
+    }
+
+    //Doors: Opening, Open, Closing, Closed, then on to the next target
+    static const char *steps[] = {"Opening", "Open", "Closing", "Closed"};
+    static const int step_ms[] = {DOOR_MS / 4, DOOR_MS / 2, DOOR_MS / 4, 0};
+    if (door_step < 4) {
+      if (door_step == 0) opened(id, floor);
+      status(fd, steps[door_step], floor, floor);
+      next += step_ms[door_step] / 1000.0;
+      door_step++;
+    } else if (reopen && target == floor) {
+      reopen = 0;
+      door_step = 0;
+    } else {
+      reopen = 0;
+      state = target == floor ? IDLE : MOVING;
+      next = bench_now();
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+struct rider {
+  int source;
+  int dest;
+  int car;
+  double called;
+};
+
+struct tally {
+  int riders;
+  int arrived;
+  double wait;
+  double ride;
+  double trip;
+  long stops;
+};
+
+/// @brief Follows a rider through its car's door log
+static void journey(const struct rider *r, struct tally *t)
+{
+  const struct opening *log = openings[r->car].log;
+  int n = openings[r->car].count, board = -1, arrive = -1;
+  t->riders++;
+  for (int i = 0; i < n && board < 0; i++) {
+    if (log[i].floor == r->source && log[i].at >= r->called) board = i;
+  }
+  for (int i = board + 1; board >= 0 && i < n && arrive < 0; i++) {
+    if (log[i].floor == r->dest) arrive = i;
+  }
+  if (arrive < 0) return;
+  t->arrived++;
+  t->wait += log[board].at - r->called;
+  t->ride += log[arrive].at - log[board].at;
+  t->trip += log[arrive].at - r->called;
+  t->stops += arrive - board - 1;
+}
+
+static void report(const char *label, const char *kind, const struct tally *t)
+{
+  int n = t->arrived ? t->arrived : 1;
+  printf("%-12s  %-5s  %6d  %8d  %7.0f  %7.0f  %7.0f  %6.1f\n", label, kind, t->riders,
+         t->riders - t->arrived, t->wait / n * 1000, t->ride / n * 1000, t->trip / n * 1000,
+         (double)t->stops / n);
+}
+
+static void run(const char *label, const char *flag, int calls, double rate, int long_trip)
+{
+  pid_t ctrl = bench_start_controller_log(flag, LOG_FILE);
+  pthread_t cars[CARS];
+  int ids[CARS];
+  running = 1;
+  for (int i = 0; i < CARS; i++) {
+    ids[i] = i;
+    openings[i].count = 0;
+    pthread_create(&cars[i], NULL, car_thread, &ids[i]);
+  }
+  usleep(300000); //Let every car register
+
+  struct rider *riders = calloc(calls, sizeof(*riders));
+  int placed = 0, refused = 0;
+  unsigned int seed = 2718;
+  char buf[128];
+
+  double arrival = bench_now();
+  for (int c = 0; c < calls; c++) {
+    int src = 1 + rand_r(&seed) % FLOORS, dst;
+    do {
+      dst = 1 + rand_r(&seed) % FLOORS;
+    } while (dst == src);
+    double now = bench_now();
+    if (arrival > now) usleep((useconds_t)((arrival - now) * 1e6));
+    arrival += -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / rate;
+
+    struct rider *r = &riders[placed];
+    r->called = bench_now();
+    int fd = bench_connect(bench_port());
+    snprintf(buf, sizeof(buf), "CALL %d %d", src, dst);
+    if (fd < 0 || bench_send(fd, buf) != 0 || bench_recv(fd, buf, sizeof(buf)) != 0 ||
+        sscanf(buf, "CAR x%d", &r->car) != 1 || r->car < 0 || r->car >= CARS) {
+      refused++;
+    } else {
+      r->source = src;
+      r->dest = dst;
+      placed++;
+    }
+    if (fd >= 0) close(fd);
+  }
+  sleep(DRAIN_S);
+
+  running = 0;
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < CARS; i++) pthread_join(cars[i], NULL);
+  unlink(LOG_FILE);
+
+  struct tally tallies[2];
+  memset(tallies, 0, sizeof(tallies));
+  for (int i = 0; i < placed; i++) {
+    journey(&riders[i], &tallies[abs(riders[i].dest - riders[i].source) >= long_trip]);
+  }
+  report(label, "long", &tallies[1]);
+  report(label, "short", &tallies[0]);
+  if (refused > 0) printf("%-12s  %d calls refused\n", label, refused);
+  free(riders);
+}
+
+int main(int argc, char **argv)
+{
+  int calls = argc > 1 ? atoi(argv[1]) : 300;
+  double rate = argc > 2 ? atof(argv[2]) : 10;
+  int long_trip = argc > 3 ? atoi(argv[3]) : 50;
+  if (calls < 1) calls = 1;
+  if (rate <= 0) rate = 10;
+  if (long_trip < 1) long_trip = 50;
+
+  for (int i = 0; i < CARS; i++) {
+    pthread_mutex_init(&openings[i].mutex, NULL);
+    openings[i].capacity = calls * 4 + 256;
+    openings[i].log = malloc(openings[i].capacity * sizeof(struct opening));
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars, %d floors (%d ms a floor, %d ms at a stop), %d calls at %.1f/s, long trips %d+ floors\n",
+         CARS, FLOORS, FLOOR_MS, DOOR_MS, calls, rate, long_trip);
+  printf("dispatch      trips  riders  stranded  wait ms  ride ms  trip ms  stops\n");
+  char flag[64];
+  run("greedy", NULL, calls, rate, long_trip);
+  snprintf(flag, sizeof(flag), "--express %d", long_trip);
+  run("express", flag, calls, rate, long_trip);
+  for (int i = 0; i < CARS; i++) free(openings[i].log);
+  return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * bench-gateway: what carrying a fleet over a few gateway connections saves
+ * the controller, against a connection per car.
+ *
+ * A fresh controller is started per run and a fleet of emulated cars (1,000 by
+ * default, ten to a bank) drives trips between random floors as in
+ * bench-status: several "Between" updates per floor, then Opening/Open/
+ * Closing/Closed at the stop. WORKERS threads each drive a share of the fleet.
+ * With sockets every car has its own connection and one write per pass; with
+ * gateways each worker opens one GATEWAY connection, registers its cars on it
+ * and writes a whole pass for all of them at once. A few call threads keep
+ * dispatch (and with it FLOOR replies) going meanwhile.
+ *
+ * Reported: STATUS frames the controller took per second, the controller's
+ * CPU time per 100,000 frames and its thread count during the run, and for
+ * gateways the frames it applied per read (from its shutdown counters).
+ *
+ * Usage: ./bench-gateway [cars] [seconds]
+ */
+
+#include "bench.h"
+#include <sys/resource.h>
+
+#define FLOORS 20
+#define CARS_PER_BANK 10
+#define WORKERS 8
+#define CALLERS 2
+#define UPDATES_PER_FLOOR 4 //Between frames per floor travelled
+#define PASS_SIZE 65536 //One gateway's frames for a pass
+#define LOG_FILE "bench-gateway.log"
+
+static volatile int running;
+static int fleet;
+static int use_gateway;
+
+struct car {
+  int fd;
+  int floor;
+  int target;
+};
+
+static void add_frame(char *buf, size_t *len, int id, const char *fmt, int a, int b)
+{
+  char frame[64];
+  int n = 0;
+  if (id >= 0) n = snprintf(frame, sizeof(frame), "%d ", id);
+  n += snprintf(frame + n, sizeof(frame) - n, fmt, a, b);
+  uint16_t nlen = htons(n);
+  memcpy(buf + *len, &nlen, 2);
+  memcpy(buf + *len + 2, frame, n);
+  *len += n + 2;
+}
+
+//FLOOR replies are not needed, just keep them from filling the socket
+static void discard_replies(int fd)
+{
+  char discard[4096];
+  while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+  }
+}
+
+static void *worker(void *p)
+{
+  int id = *(int *)p;
+  int first = fleet * id / WORKERS, last = fleet * (id + 1) / WORKERS;
+  struct car *cars = calloc(last - first, sizeof(*cars));
+  unsigned int seed = 104729 * (id + 1);
+  char *buf = malloc(PASS_SIZE);
+  size_t len = 0;
+  int gateway = -1;
+
+  if (use_gateway) {
+    gateway = bench_connect(bench_port());
+    if (gateway >= 0) bench_send(gateway, "GATEWAY");
+  }
+  for (int i = first; i < last; i++) {
+    struct car *c = &cars[i - first];
+    char msg[128];
+    c->floor = c->target = 1;
+    if (use_gateway) {
+      c->fd = gateway;
+      snprintf(msg, sizeof(msg), "%d CAR c%d 1 %d BANK f%d", i, i, FLOORS, i / CARS_PER_BANK);
+      if (gateway >= 0) bench_send(gateway, msg);
+      add_frame(buf, &len, i, "STATUS Closed %d %d", 1, 1);
+      continue;
+    }
+    c->fd = bench_connect(bench_port());
+    if (c->fd < 0) continue;
+    snprintf(msg, sizeof(msg), "CAR c%d 1 %d BANK f%d", i, FLOORS, i / CARS_PER_BANK);
+    bench_send(c->fd, msg);
+    bench_send(c->fd, "STATUS Closed 1 1");
+  }
+  if (gateway >= 0 && bench_write_all(gateway, buf, len) != 0) {
+    close(gateway);
+    gateway = -1;
+  }
+
+  while (running && (!use_gateway || gateway >= 0)) {
+    //Each pass moves every car one floor, or through its stop
+    len = 0;
+    for (int i = 0; i < last - first && running; i++) {
+      struct car *c = &cars[i];
+      int tag = use_gateway ? first + i : -1;
+      if (c->fd < 0) continue;
+      if (c->floor == c->target) {
+        add_frame(buf, &len, tag, "STATUS Opening %d %d", c->floor, c->floor);
+        add_frame(buf, &len, tag, "STATUS Open %d %d", c->floor, c->floor);
+        add_frame(buf, &len, tag, "STATUS Closing %d %d", c->floor, c->floor);
+        add_frame(buf, &len, tag, "STATUS Closed %d %d", c->floor, c->floor);
+        do {
+          c->target = 1 + rand_r(&seed) % FLOORS;
+        } while (c->target == c->floor);
+      } else {
+        int next = c->floor + (c->target > c->floor ? 1 : -1);
+        for (int u = 0; u < UPDATES_PER_FLOOR; u++) {
+          add_frame(buf, &len, tag, "STATUS Between %d %d", c->floor, next);
+        }
+        c->floor = next;
+      }
+      if (use_gateway) continue;
+      if (bench_write_all(c->fd, buf, len) != 0) {
+        close(c->fd);
+        c->fd = -1;
+      } else {
+        discard_replies(c->fd);
+      }
+      len = 0;
+    }
+    if (use_gateway) {
+      if (bench_write_all(gateway, buf, len) != 0) break;
+      discard_replies(gateway);
+    }
+  }
+  if (use_gateway) {
+    if (gateway >= 0) close(gateway);
+  } else {
+    for (int i = 0; i < last - first; i++) {
+      if (cars[i].fd >= 0) close(cars[i].fd);
+    }
+  }
+  free(buf);
+  free(cars);
+  return NULL;
+}
+
+struct caller {
+  unsigned int seed;
+  unsigned long done;
+};
+
+static void *call_thread(void *p)
+{
+  struct caller *c = p;
+  char buf[256];
+  while (running) {
+    int src = 1 + rand_r(&c->seed) % FLOORS;
+    int dst = 1 + rand_r(&c->seed) % FLOORS;
+    if (src == dst) continue;
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK f%d", src, dst,
+             rand_r(&c->seed) % ((fleet + CARS_PER_BANK - 1) / CARS_PER_BANK));
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0) c->done++;
+    close(fd);
+  }
+  return NULL;
+}
+
+static int thread_count(pid_t pid)
+{
+  char path[64], line[256];
+  int threads = 0;
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE *f = fopen(path, "r");
+  while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "Threads: %d", &threads) == 1) break;
+  }
+  if (f != NULL) fclose(f);
+  return threads;
+}
+
+static void run(const char *label, int gateway, int seconds)
+{
+  pid_t ctrl = bench_start_controller_log(NULL, LOG_FILE);
+  pthread_t workers[WORKERS], callers[CALLERS];
+  int ids[WORKERS];
+  struct caller calls[CALLERS];
+
+  use_gateway = gateway;
+  running = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    ids[i] = i;
+    pthread_create(&workers[i], NULL, worker, &ids[i]);
+  }
+  for (int i = 0; i < CALLERS; i++) {
+    calls[i].seed = 7919 * (i + 1);
+    calls[i].done = 0;
+    pthread_create(&callers[i], NULL, call_thread, &calls[i]);
+  }
+  sleep(1); //Registration is not what is measured
+  double start = bench_now(), cpu_start = bench_cpu_seconds(ctrl);
+  sleep(seconds);
+  double elapsed = bench_now() - start, cpu = bench_cpu_seconds(ctrl) - cpu_start;
+  int threads = thread_count(ctrl);
+  running = 0;
+  for (int i = 0; i < CALLERS; i++) pthread_join(callers[i], NULL);
+  //Stopping the controller releases any car still blocked in write
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < WORKERS; i++) pthread_join(workers[i], NULL);
+
+  unsigned long updates = 0, cars = 0, call_total = 0;
+  double per_read = 0;
+  for (int i = 0; i < CALLERS; i++) call_total += calls[i].done;
+  FILE *log = fopen(LOG_FILE, "r");
+  char line[512];
+  while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+    //"Bank <name>: <n> cars, <calls> calls (...), <u> status updates (<l> locked), ..."
+    unsigned long u, l;
+    char *q = strstr(line, "), ");
+    if (strncmp(line, "Car ", 4) == 0 && strstr(line, " registered ") != NULL) cars++;
+    if (strncmp(line, "Gateways: ", 10) == 0 && (q = strchr(line, '(')) != NULL) {
+      sscanf(q, "(%lf per read)", &per_read);
+    }
+    if (strncmp(line, "Bank ", 5) != 0 || q == NULL) continue;
+    if (sscanf(q, "), %lu status updates (%lu locked)", &u, &l) == 2) updates += u;
+  }
+  if (log != NULL) fclose(log);
+  unlink(LOG_FILE);
+
+  //Frames are counted over the whole run, CPU over the measured part only
+  double rate = updates / (elapsed + 1);
+  printf("%-9s  %5lu  %9.0f  %11.3f  %7d  %14.1f  %8.0f\n", label, cars, rate,
+         rate > 0 ? cpu / (rate * elapsed) * 100000 : 0.0, threads, per_read, call_total / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+  fleet = argc > 1 ? atoi(argv[1]) : 1000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+
+  //The controller has 128 banks of ten
+  if (fleet > 1280) fleet = 1280;
+  if (fleet < WORKERS) fleet = WORKERS;
+  if (seconds < 1) seconds = 1;
+
+  //One socket per car in the first run
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars (%d per bank), %d workers, %d callers, %ds per run, %ld cpus\n", fleet, CARS_PER_BANK,
+         WORKERS, CALLERS, seconds, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("channel    cars   status/s  cpu s/100k  threads  frames/read    calls/s\n");
+  run("sockets", 0, seconds);
+  run("gateways", 1, seconds);
+  return 0;
+}
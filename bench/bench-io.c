@@ -0,0 +1,149 @@
+/*
+ * bench-io: compares the controller's handler-thread path with its io_uring
+ * backend (--io-uring) under the same load.
+ *
+ * For each backend a fresh controller is started. A set of emulated cars
+ * flood it with STATUS frames, many frames per write as a busy car gateway
+ * would, while call threads issue CALL requests back to back, each on its own
+ * connection. STATUS frames/sec, calls/sec and call round-trip percentiles
+ * are reported per backend. The cars' writes block once the controller falls
+ * behind, so the STATUS rate is what the controller actually absorbed (give
+ * or take what the socket buffers hold).
+ *
+ * Usage: ./bench-io [cars] [callers] [seconds]
+ */
+
+#include "bench.h"
+
+#define FLOORS 20
+#define FRAMES_PER_WRITE 64
+#define MAX_SAMPLES 200000 //Call latencies kept per caller
+
+static volatile int running;
+static unsigned long status_frames;
+
+static void *car_thread(void *p)
+{
+  int idx = *(int *)p;
+  char buf[FRAMES_PER_WRITE * 32];
+  int fd = bench_connect(bench_port());
+  if (fd < 0) return NULL;
+  snprintf(buf, sizeof(buf), "CAR io%d 1 %d", idx, FLOORS);
+  bench_send(fd, buf);
+
+  //One batch of frames, reused for every write
+  size_t len = 0;
+  for (int i = 0; i < FRAMES_PER_WRITE; i++) {
+    char frame[32];
+    int n = snprintf(frame, sizeof(frame), "STATUS Between %d %d", 1 + i % FLOORS, 1 + (i + 1) % FLOORS);
+    uint16_t nlen = htons(n);
+    memcpy(buf + len, &nlen, 2);
+    memcpy(buf + len + 2, frame, n);
+    len += n + 2;
+  }
+
+  unsigned long sent = 0;
+  char discard[4096];
+  while (running) {
+    if (write(fd, buf, len) != (ssize_t)len) break;
+    sent += FRAMES_PER_WRITE;
+    //FLOOR replies are not needed, just keep them from filling the socket
+    while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+  }
+  __atomic_add_fetch(&status_frames, sent, __ATOMIC_RELAXED);
+  close(fd);
+  return NULL;
+}
+
+struct caller {
+  unsigned int seed;
+  unsigned long done;
+  double *samples;
+};
+
+static void *call_thread(void *p)
+{
+  struct caller *c = p;
+  char buf[256];
+  while (running) {
+    int src = 1 + rand_r(&c->seed) % FLOORS;
+    int dst = 1 + rand_r(&c->seed) % FLOORS;
+    if (src == dst) continue;
+    double start = bench_now();
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d", src, dst);
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0) {
+      if (c->done < MAX_SAMPLES) c->samples[c->done] = bench_now() - start;
+      c->done++;
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+static void run(const char *label, const char *flag, int cars, int callers, int seconds)
+{
+  pid_t ctrl = bench_start_controller(flag);
+  pthread_t car_tids[cars];
+  pthread_t call_tids[callers];
+  int car_ids[cars];
+  struct caller call_args[callers];
+
+  status_frames = 0;
+  running = 1;
+  double start = bench_now();
+  for (int i = 0; i < cars; i++) {
+    car_ids[i] = i;
+    pthread_create(&car_tids[i], NULL, car_thread, &car_ids[i]);
+  }
+  for (int i = 0; i < callers; i++) {
+    call_args[i].seed = 7919 * (i + 1);
+    call_args[i].done = 0;
+    call_args[i].samples = malloc(MAX_SAMPLES * sizeof(double));
+    pthread_create(&call_tids[i], NULL, call_thread, &call_args[i]);
+  }
+  sleep(seconds);
+  running = 0;
+  for (int i = 0; i < callers; i++) pthread_join(call_tids[i], NULL);
+  double elapsed = bench_now() - start;
+
+  //Stopping the controller releases any car still blocked in write
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < cars; i++) pthread_join(car_tids[i], NULL);
+
+  unsigned long calls = 0, kept = 0;
+  for (int i = 0; i < callers; i++) calls += call_args[i].done;
+  double *all = malloc((calls ? calls : 1) * sizeof(double));
+  for (int i = 0; i < callers; i++) {
+    unsigned long n = call_args[i].done < MAX_SAMPLES ? call_args[i].done : MAX_SAMPLES;
+    memcpy(all + kept, call_args[i].samples, n * sizeof(double));
+    kept += n;
+    free(call_args[i].samples);
+  }
+  qsort(all, kept, sizeof(double), bench_cmp_double);
+  double p50 = kept ? all[kept / 2] * 1e6 : 0;
+  double p99 = kept ? all[kept * 99 / 100] * 1e6 : 0;
+  printf("%-9s  %12.0f  %9.0f  %8.0f  %8.0f\n", label, status_frames / elapsed, calls / elapsed,
+         p50, p99);
+  free(all);
+}
+
+int main(int argc, char **argv)
+{
+  int cars = argc > 1 ? atoi(argv[1]) : 8;
+  int callers = argc > 2 ? atoi(argv[2]) : 4;
+  int seconds = argc > 3 ? atoi(argv[3]) : 2;
+
+  //The default bank holds at most 10 cars
+  if (cars > 10) cars = 10;
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars flooding STATUS, %d callers, %ds per run, %ld cpus\n", cars, callers, seconds,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("backend        status/s    calls/s   p50 us    p99 us\n");
+  run("threads", NULL, cars, callers, seconds);
+  run("io_uring", "--io-uring", cars, callers, seconds);
+  return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * bench-reopt: a small building simulator that measures how long riders wait
+ * for a car under each of the controller's dispatch modes: greedy, greedy with
+ * the background re-optimizer (--reoptimize), rollout dispatch (--rollout) and
+ * a learned policy (--policy) that ../train-policy trains for the same load.
+ *
+ * One bank of emulated cars serves FLOORS floors. Each car drives like the
+ * real one at a faster clock: one floor per FLOOR_MS, doors Opening/Open for
+ * DOOR_MS and then Closing/Closed, always heading for the last FLOOR it was
+ * sent, and advertises that timing when it registers. Callers arrive as a
+ * Poisson stream with random source and destination floors, and each call
+ * asks to be kept informed (NOTIFY 1). The controller closes that connection
+ * when the car picks the rider up, so the rider's wait is the time from the
+ * call to the close; a "CAR" received in between means the call was moved to
+ * another car.
+ *
+ * Every run uses the same seed, so the same calls arrive at the same times.
+ * The controller's own report gives rollout decision latency.
+ *
+ * Usage: ./bench-reopt [calls] [calls per second]
+ */
+
+#include "bench.h"
+#include <poll.h>
+#include <math.h>
+
+#define FLOORS 20
+#define CARS 6
+#define FLOOR_MS 50
+#define DOOR_MS 150 //Opening, open and closing each take a floor-time, as in car.c
+#define DRAIN_S 10 //How long riders still waiting after the last call are given
+#define LOG_FILE "bench-reopt.log"
+#define TRAINER "../train-policy"
+#define POLICY_FILE "bench-reopt.policy"
+
+static volatile int running;
+
+enum car_state { IDLE, MOVING, DOORS };
+
+static void status(int fd, const char *state, int floor, int dest)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "STATUS %s %d %d", state, floor, dest);
+  bench_send(fd, buf);
+}
+
+static void *car_thread(void *p)
+{
+  int id = *(int *)p;
+  int floor = 1 + id * (FLOORS - 1) / CARS;
+  int target = floor;
+  enum car_state state = IDLE;
+  int door_step = 0;
+  int reopen = 0; //Sent this floor again after the doors opened here
+  double next = 0;
+  char buf[128];
+
+  int fd = bench_connect(bench_port());
+  if (fd < 0) return NULL;
+  snprintf(buf, sizeof(buf), "CAR s%d 1 %d TIMING %d,%d,%d,%d", id, FLOORS, FLOOR_MS, DOOR_MS / 4, DOOR_MS / 2, DOOR_MS / 4);
+  bench_send(fd, buf);
+  status(fd, "Closed", floor, floor);
+
+  while (running) {
+    double now = bench_now();
+    int wait_ms = state == IDLE ? 50 : (int)((next - now) * 1000);
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (wait_ms > 0 && poll(&pfd, 1, wait_ms) > 0) {
+      if (bench_recv(fd, buf, sizeof(buf)) != 0) break;
+      if (sscanf(buf, "FLOOR %d", &target) != 1) continue;
+      if (state == DOORS && target == floor && door_step > 0) reopen = 1;
+      if (state == IDLE) {
+        state = target == floor ? DOORS : MOVING;
+        door_step = 0;
+        next = bench_now();
+      }
+      continue;
+    }
+    if (state == IDLE) continue;
+
+    if (state == MOVING) {
+      if (floor == target) {
+        state = DOORS;
+        door_step = 0;
+        continue;
+      }
+      int to = floor + (target > floor ? 1 : -1);
+      status(fd, "Between", floor, to);
+      floor = to;
+      next += FLOOR_MS / 1000.0;
+      continue;
+    }
+
+    //Doors: Opening, Open, Closing, Closed, then on to the next target
+    static const char *steps[] = {"Opening", "Open", "Closing", "Closed"};
+    static const int step_ms[] = {DOOR_MS / 4, DOOR_MS / 2, DOOR_MS / 4, 0};
+    if (door_step < 4) {
+      status(fd, steps[door_step], floor, floor);
+      next += step_ms[door_step] / 1000.0;
+      door_step++;
+    } else if (reopen && target == floor) {
+      reopen = 0;
+      door_step = 0;
+    } else {
+      reopen = 0;
+      state = target == floor ? IDLE : MOVING;
+      next = bench_now();
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+struct rider {
+  int fd;
+  double called;
+};
+
+static void run(const char *label, const char *flag, int calls, double rate)
+{
+  pid_t ctrl = bench_start_controller_log(flag, LOG_FILE);
+  pthread_t cars[CARS];
+  int ids[CARS];
+  running = 1;
+  for (int i = 0; i < CARS; i++) {
+    ids[i] = i;
+    pthread_create(&cars[i], NULL, car_thread, &ids[i]);
+  }
+  usleep(300000); //Let every car register
+
+  struct rider *riders = calloc(calls, sizeof(*riders));
+  struct pollfd *pfds = calloc(calls, sizeof(*pfds));
+  int *slot = calloc(calls, sizeof(*slot));
+  double *waits = calloc(calls, sizeof(*waits));
+  int placed = 0, refused = 0, boarded = 0, moved = 0, waiting = 0;
+  unsigned int seed = 2718;
+  char buf[128];
+
+  double start = bench_now(), arrival = start;
+  while (placed + refused < calls || waiting > 0) {
+    double now = bench_now();
+    if (placed + refused < calls && now >= arrival) {
+      int src = 1 + rand_r(&seed) % FLOORS, dst;
+      do {
+        dst = 1 + rand_r(&seed) % FLOORS;
+      } while (dst == src);
+      arrival += -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / rate;
+      int fd = bench_connect(bench_port());
+      snprintf(buf, sizeof(buf), "CALL %d %d NOTIFY 1", src, dst);
+      if (fd < 0 || bench_send(fd, buf) != 0 || bench_recv(fd, buf, sizeof(buf)) != 0 ||
+          strncmp(buf, "CAR ", 4) != 0) {
+        if (fd >= 0) close(fd);
+        refused++;
+        continue;
+      }
+      riders[placed].fd = fd;
+      riders[placed].called = now;
+      placed++;
+      waiting++;
+      continue;
+    }
+    if (placed + refused >= calls && now > arrival + DRAIN_S) break;
+
+    int n = 0;
+    for (int i = 0; i < placed; i++) {
+      if (riders[i].fd < 0) continue;
+      pfds[n].fd = riders[i].fd;
+      pfds[n].events = POLLIN;
+      slot[n++] = i;
+    }
+    int timeout = placed + refused < calls ? (int)((arrival - now) * 1000) + 1 : 100;
+    if (poll(pfds, n, timeout) <= 0) continue;
+    for (int k = 0; k < n; k++) {
+      if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      struct rider *r = &riders[slot[k]];
+      if (bench_recv(r->fd, buf, sizeof(buf)) == 0) {
+        if (strncmp(buf, "CAR ", 4) == 0) moved++;
+        continue;
+      }
+      waits[boarded++] = bench_now() - r->called;
+      close(r->fd);
+      r->fd = -1;
+      waiting--;
+    }
+  }
+
+  running = 0;
+  for (int i = 0; i < placed; i++) {
+    if (riders[i].fd >= 0) close(riders[i].fd);
+  }
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < CARS; i++) pthread_join(cars[i], NULL);
+
+  //"Bank default: ..., avg dispatch <ns> ns" covers the whole decision, rollouts included
+  double dispatch_us = 0;
+  FILE *log = fopen(LOG_FILE, "r");
+  char line[512];
+  while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+    char *at = strstr(line, "avg dispatch ");
+    if (strncmp(line, "Bank ", 5) == 0 && at != NULL) dispatch_us = atof(at + 13) / 1000;
+  }
+  if (log != NULL) fclose(log);
+  unlink(LOG_FILE);
+
+  double total = 0;
+  for (int i = 0; i < boarded; i++) total += waits[i];
+  qsort(waits, boarded, sizeof(double), bench_cmp_double);
+  printf("%-12s  %6d  %7d  %8d  %9.0f  %7.0f  %9d  %10.1f\n", label, boarded, refused, waiting,
+         boarded ? total / boarded * 1000 : 0.0, boarded ? waits[(int)(boarded * 0.95)] * 1000 : 0.0,
+         moved, dispatch_us);
+  free(riders);
+  free(pfds);
+  free(slot);
+  free(waits);
+}
+
+int main(int argc, char **argv)
+{
+  int calls = argc > 1 ? atoi(argv[1]) : 300;
+  double rate = argc > 2 ? atof(argv[2]) : 15;
+  if (calls < 1) calls = 1;
+  if (rate <= 0) rate = 15;
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars, %d floors (%d ms a floor, %d ms at a stop), %d calls at %.1f/s\n", CARS, FLOORS,
+         FLOOR_MS, DOOR_MS, calls, rate);
+  printf("dispatch      boarded  refused  stranded  avg wait ms  p95 ms  reassigned  decide us\n");
+  run("greedy", NULL, calls, rate);
+  run("reoptimized", "--reoptimize", calls, rate);
+  run("rollout", "--rollout", calls, rate);
+
+  //The trainer counts in floor-times
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), "%s %s %.3f > /dev/null", TRAINER, POLICY_FILE, rate * FLOOR_MS / 1000.0);
+  if (system(cmd) == 0) {
+    run("learned", "--policy " POLICY_FILE, calls, rate);
+    unlink(POLICY_FILE);
+  } else {
+    printf("learned       (%s failed)\n", TRAINER);
+  }
+  return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * bench-router: aggregate dispatch throughput as controllers are added behind
+ * the router.
+ *
+ * For each count (1, 2, 4, ... up to the limit) that many controllers are
+ * started on the ports after the public one, with a router (ROUTER, default
+ * ../router) on the public port in front of them sharing the banks out by
+ * hashing. Every bank gets emulated cars that arrive instantly at whatever
+ * floor they are sent to, and one call thread per bank issues CALL requests
+ * back to back, all through the router, as in bench-banks. A first run with
+ * one controller on the public port and no router shows what the extra hop
+ * costs.
+ *
+ * Reported per run: calls/s in all, calls/s per controller and how many
+ * banks the busiest controller was given.
+ *
+ * Usage: ./bench-router [max controllers] [banks] [cars per bank] [seconds]
+ */
+
+#include "bench.h"
+
+#define FLOORS 20
+#define MAX_CONTROLLERS 8
+#define LOG_FILE "bench-router.log"
+
+static volatile int running;
+static int bank_count;
+static unsigned long *bank_calls;
+
+struct car_arg {
+  int bank;
+  int idx;
+};
+
+static void *car_thread(void *p)
+{
+  struct car_arg *a = p;
+  char buf[256];
+  int fd = bench_connect(bench_port());
+  if (fd < 0) return NULL;
+  snprintf(buf, sizeof(buf), "CAR b%dc%d 1 %d BANK bank%d", a->bank, a->idx, FLOORS, a->bank);
+  bench_send(fd, buf);
+  bench_send(fd, "STATUS Closed 1 1");
+  while (running && bench_recv(fd, buf, sizeof(buf)) == 0) {
+    int floor;
+    if (sscanf(buf, "FLOOR %d", &floor) == 1) {
+      snprintf(buf, sizeof(buf), "STATUS Opening %d %d", floor, floor);
+      bench_send(fd, buf);
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+static void *call_thread(void *p)
+{
+  int bank = *(int *)p;
+  unsigned int seed = bank * 7919 + 17;
+  char buf[256];
+  unsigned long done = 0;
+  while (running) {
+    int src = 1 + rand_r(&seed) % FLOORS;
+    int dst = 1 + rand_r(&seed) % FLOORS;
+    if (src == dst) continue;
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK bank%d", src, dst, bank);
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0 && strncmp(buf, "CAR ", 4) == 0) {
+      done++;
+    }
+    close(fd);
+  }
+  __atomic_add_fetch(&bank_calls[bank], done, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+//Starts a controller on port, its output in a log of its own
+static pid_t start_controller_on(int port, char *log, size_t size)
+{
+  char value[16];
+  const char *public_port = getenv("ELEVATOR_CONTROLLER_PORT");
+  char *saved = public_port ? strdup(public_port) : NULL;
+  snprintf(value, sizeof(value), "%d", port);
+  snprintf(log, size, "%s.%d", LOG_FILE, port);
+  setenv("ELEVATOR_CONTROLLER_PORT", value, 1);
+  pid_t pid = bench_start_controller_log(NULL, log);
+  if (saved) {
+    setenv("ELEVATOR_CONTROLLER_PORT", saved, 1);
+    free(saved);
+  } else {
+    unsetenv("ELEVATOR_CONTROLLER_PORT");
+  }
+  return pid;
+}
+
+static pid_t start_router(int controllers)
+{
+  const char *bin = getenv("ROUTER");
+  if (bin == NULL) bin = "../router";
+  pid_t pid = fork();
+  if (pid == 0) {
+    char ports[MAX_CONTROLLERS][16];
+    char *args[MAX_CONTROLLERS + 2] = {(char *)bin};
+    for (int i = 0; i < controllers; i++) {
+      snprintf(ports[i], sizeof(ports[i]), "%d", bench_port() + 1 + i);
+      args[i + 1] = ports[i];
+    }
+    int out = open(LOG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    execv(bin, args);
+    perror("exec router");
+    _exit(1);
+  }
+  for (int i = 0; i < 200; i++) {
+    int fd = bench_connect(bench_port());
+    if (fd >= 0) {
+      close(fd);
+      break;
+    }
+    usleep(10000);
+  }
+  return pid;
+}
+
+//Banks the busiest controller holds, from the controllers' logs
+static int busiest(char logs[][64], int controllers)
+{
+  int most = 0;
+  for (int i = 0; i < controllers; i++) {
+    FILE *log = fopen(logs[i], "r");
+    char line[512];
+    int banks = 0;
+    while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+      if (strncmp(line, "Bank bank", 9) == 0 && strstr(line, " created") != NULL) banks++;
+    }
+    if (log != NULL) fclose(log);
+    unlink(logs[i]);
+    if (banks > most) most = banks;
+  }
+  return most;
+}
+
+static void run(const char *label, int controllers, int routed, int cars, int seconds)
+{
+  pid_t pids[MAX_CONTROLLERS], router = -1;
+  char logs[MAX_CONTROLLERS][64];
+  if (routed) {
+    for (int i = 0; i < controllers; i++) {
+      pids[i] = start_controller_on(bench_port() + 1 + i, logs[i], sizeof(logs[i]));
+    }
+    router = start_router(controllers);
+  } else {
+    pids[0] = start_controller_on(bench_port(), logs[0], sizeof(logs[0]));
+  }
+
+  pthread_t car_tids[bank_count * cars];
+  pthread_t call_tids[bank_count];
+  struct car_arg car_args[bank_count * cars];
+  int bank_ids[bank_count];
+  bank_calls = calloc(bank_count, sizeof(*bank_calls));
+  running = 1;
+  for (int b = 0; b < bank_count; b++) {
+    bank_ids[b] = b;
+    for (int c = 0; c < cars; c++) {
+      car_args[b * cars + c].bank = b;
+      car_args[b * cars + c].idx = c;
+      pthread_create(&car_tids[b * cars + c], NULL, car_thread, &car_args[b * cars + c]);
+    }
+  }
+  usleep(300000);
+
+  double start = bench_now();
+  for (int b = 0; b < bank_count; b++) pthread_create(&call_tids[b], NULL, call_thread, &bank_ids[b]);
+  sleep(seconds);
+  running = 0;
+  for (int b = 0; b < bank_count; b++) pthread_join(call_tids[b], NULL);
+  double elapsed = bench_now() - start;
+
+  //Stopping the controllers closes the car sockets and releases their threads
+  for (int i = 0; i < controllers; i++) bench_stop_controller(pids[i]);
+  if (router > 0) bench_stop_controller(router);
+  for (int i = 0; i < bank_count * cars; i++) pthread_join(car_tids[i], NULL);
+  unlink(LOG_FILE);
+
+  unsigned long total = 0;
+  for (int b = 0; b < bank_count; b++) total += bank_calls[b];
+  printf("%-8s  %11d  %9.0f  %14.0f  %12d\n", label, controllers, total / elapsed,
+         total / elapsed / controllers, busiest(logs, controllers));
+  free(bank_calls);
+}
+
+int main(int argc, char **argv)
+{
+  int max_controllers = argc > 1 ? atoi(argv[1]) : 4;
+  bank_count = argc > 2 ? atoi(argv[2]) : 16;
+  int cars = argc > 3 ? atoi(argv[3]) : 2;
+  int seconds = argc > 4 ? atoi(argv[4]) : 2;
+  if (max_controllers < 1) max_controllers = 1;
+  if (max_controllers > MAX_CONTROLLERS) max_controllers = MAX_CONTROLLERS;
+  if (bank_count < 1) bank_count = 1;
+  if (cars < 1) cars = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d banks, %d cars and one caller per bank, %ds per run, %ld cpus\n", bank_count, cars, seconds,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("path      controllers    calls/s  per controller  busiest banks\n");
+  run("direct", 1, 0, cars, seconds);
+  for (int n = 1; n <= max_controllers; n *= 2) {
+    run("router", n, 1, cars, seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * bench-status: shows how much bank-mutex traffic a large fleet's STATUS
+ * stream causes now that movement updates go through the per-car mailbox.
+ *
+ * A fresh controller is started per backend and a fleet of emulated cars
+ * (1,000 by default, ten to a bank) registers with it. Each car drives trips
+ * between random floors, reporting several "Between" updates per floor as a
+ * car with fine-grained position telemetry would, then Opening/Open/Closing/
+ * Closed at the stop. A few call threads keep dispatch running meanwhile.
+ *
+ * The controller's own counters (printed on shutdown) give the STATUS frames
+ * it took and how many of them took a bank mutex; before the mailbox every
+ * frame did. Only arrivals need the lock, so frames per lock is the
+ * coalescing factor.
+ *
+ * Usage: ./bench-status [cars] [seconds]
+ */
+
+#include "bench.h"
+#include <sys/resource.h>
+
+#define FLOORS 20
+#define CARS_PER_BANK 10
+#define WORKERS 8
+#define CALLERS 2
+#define UPDATES_PER_FLOOR 4 //Between frames per floor travelled
+#define LOG_FILE "bench-status.log"
+
+static volatile int running;
+static int fleet;
+
+struct car {
+  int fd;
+  int floor;
+  int target;
+};
+
+static void add_frame(char *buf, size_t *len, const char *fmt, int a, int b)
+{
+  char frame[64];
+  int n = snprintf(frame, sizeof(frame), fmt, a, b);
+  uint16_t nlen = htons(n);
+  memcpy(buf + *len, &nlen, 2);
+  memcpy(buf + *len + 2, frame, n);
+  *len += n + 2;
+}
+
+static void *worker(void *p)
+{
+  int id = *(int *)p;
+  int first = fleet * id / WORKERS, last = fleet * (id + 1) / WORKERS;
+  struct car *cars = calloc(last - first, sizeof(*cars));
+  unsigned int seed = 104729 * (id + 1);
+  char buf[1024];
+
+  for (int i = first; i < last; i++) {
+    struct car *c = &cars[i - first];
+    c->fd = bench_connect(bench_port());
+    if (c->fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CAR c%d 1 %d BANK f%d", i, FLOORS, i / CARS_PER_BANK);
+    bench_send(c->fd, buf);
+    bench_send(c->fd, "STATUS Closed 1 1");
+    c->floor = c->target = 1;
+  }
+
+  while (running) {
+    //Each pass moves every car one floor, or through its stop
+    for (int i = 0; i < last - first && running; i++) {
+      struct car *c = &cars[i];
+      size_t len = 0;
+      if (c->fd < 0) continue;
+      if (c->floor == c->target) {
+        add_frame(buf, &len, "STATUS Opening %d %d", c->floor, c->floor);
+        add_frame(buf, &len, "STATUS Open %d %d", c->floor, c->floor);
+        add_frame(buf, &len, "STATUS Closing %d %d", c->floor, c->floor);
+        add_frame(buf, &len, "STATUS Closed %d %d", c->floor, c->floor);
+        do {
+          c->target = 1 + rand_r(&seed) % FLOORS;
+        } while (c->target == c->floor);
+      } else {
+        int next = c->floor + (c->target > c->floor ? 1 : -1);
+        for (int u = 0; u < UPDATES_PER_FLOOR; u++) {
+          add_frame(buf, &len, "STATUS Between %d %d", c->floor, next);
+        }
+        c->floor = next;
+      }
+      if (write(c->fd, buf, len) != (ssize_t)len) {
+        close(c->fd);
+        c->fd = -1;
+        continue;
+      }
+      //FLOOR replies are not needed, just keep them from filling the socket
+      char discard[512];
+      while (recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+      }
+    }
+  }
+  for (int i = 0; i < last - first; i++) {
+    if (cars[i].fd >= 0) close(cars[i].fd);
+  }
+  free(cars);
+  return NULL;
+}
+
+struct caller {
+  unsigned int seed;
+  unsigned long done;
+};
+
+static void *call_thread(void *p)
+{
+  struct caller *c = p;
+  char buf[256];
+  while (running) {
+    int src = 1 + rand_r(&c->seed) % FLOORS;
+    int dst = 1 + rand_r(&c->seed) % FLOORS;
+    if (src == dst) continue;
+    int fd = bench_connect(bench_port());
+    if (fd < 0) continue;
+    snprintf(buf, sizeof(buf), "CALL %d %d BANK f%d", src, dst,
+             rand_r(&c->seed) % ((fleet + CARS_PER_BANK - 1) / CARS_PER_BANK));
+    if (bench_send(fd, buf) == 0 && bench_recv(fd, buf, sizeof(buf)) == 0) c->done++;
+    close(fd);
+  }
+  return NULL;
+}
+
+static void run(const char *label, const char *flag, int seconds)
+{
+  pid_t ctrl = bench_start_controller_log(flag, LOG_FILE);
+  pthread_t workers[WORKERS], callers[CALLERS];
+  int ids[WORKERS];
+  struct caller calls[CALLERS];
+
+  running = 1;
+  for (int i = 0; i < WORKERS; i++) {
+    ids[i] = i;
+    pthread_create(&workers[i], NULL, worker, &ids[i]);
+  }
+  for (int i = 0; i < CALLERS; i++) {
+    calls[i].seed = 7919 * (i + 1);
+    calls[i].done = 0;
+    pthread_create(&callers[i], NULL, call_thread, &calls[i]);
+  }
+  double start = bench_now();
+  sleep(seconds);
+  running = 0;
+  for (int i = 0; i < CALLERS; i++) pthread_join(callers[i], NULL);
+  double elapsed = bench_now() - start;
+  //Stopping the controller releases any car still blocked in write
+  bench_stop_controller(ctrl);
+  for (int i = 0; i < WORKERS; i++) pthread_join(workers[i], NULL);
+
+  unsigned long updates = 0, locked = 0, cars = 0, call_total = 0;
+  for (int i = 0; i < CALLERS; i++) call_total += calls[i].done;
+  FILE *log = fopen(LOG_FILE, "r");
+  char line[512];
+  while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+    //"Bank <name>: <n> cars, <calls> calls (...), <u> status updates (<l> locked), ..."
+    unsigned long u, l;
+    char *q = strstr(line, "), ");
+    if (strncmp(line, "Car ", 4) == 0 && strstr(line, " registered ") != NULL) cars++;
+    if (strncmp(line, "Bank ", 5) != 0 || q == NULL) continue;
+    if (sscanf(q, "), %lu status updates (%lu locked)", &u, &l) == 2) {
+      updates += u;
+      locked += l;
+    }
+  }
+  if (log != NULL) fclose(log);
+  unlink(LOG_FILE);
+
+  printf("%-9s  %5lu  %12.0f  %10.0f  %13.1f  %8.0f\n", label, cars, updates / elapsed,
+         locked / elapsed, locked ? (double)updates / locked : 0.0, call_total / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+  fleet = argc > 1 ? atoi(argv[1]) : 1000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+
+  //The controller has 128 banks of ten
+  if (fleet > 1280) fleet = 1280;
+  if (fleet < WORKERS) fleet = WORKERS;
+
+  //One socket per car
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d cars (%d per bank), %d callers, %ds per run, %ld cpus\n", fleet, CARS_PER_BANK,
+         CALLERS, seconds, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("backend     cars      status/s    locked/s  frames/lock    calls/s\n");
+  run("threads", NULL, seconds);
+  run("io_uring", "--io-uring", seconds);
+  return 0;
+}
@@ -0,0 +1,180 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Helpers shared by the benchmarks. Like the testers in test/, each benchmark
+ * starts its own controller (CONTROLLER, default ../controller) and talks to
+ * it over the normal length-prefixed protocol.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//Same override as the programs, so a benchmark can run beside another fleet
+static inline int bench_port(void)
+{
+  const char *env = getenv("ELEVATOR_CONTROLLER_PORT");
+  int port = env ? atoi(env) : 0;
+  return (port > 0 && port < 65536) ? port : 3000;
+}
+
+static inline double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int bench_recv_all(int fd, void *buf, size_t sz)
+{
+  char *p = buf;
+  while (sz > 0) {
+    ssize_t n = read(fd, p, sz);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    sz -= n;
+  }
+  return 0;
+}
+
+static inline int bench_send(int fd, const char *msg)
+{
+  char buf[1024];
+  uint16_t len = htons(strlen(msg));
+  memcpy(buf, &len, 2);
+  memcpy(buf + 2, msg, strlen(msg));
+  //One write per frame so the controller never sees a split header
+  return write(fd, buf, strlen(msg) + 2) == (ssize_t)(strlen(msg) + 2) ? 0 : -1;
+}
+
+//Writes all of buf, for senders that batch several frames into one write
+static inline int bench_write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0) return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+//Receives one frame into buf (NUL terminated). Returns -1 on EOF
+static inline int bench_recv(int fd, char *buf, size_t size)
+{
+  uint16_t nlen;
+  if (bench_recv_all(fd, &nlen, 2) != 0) return -1;
+  size_t len = ntohs(nlen);
+  if (len >= size) return -1;
+  if (bench_recv_all(fd, buf, len) != 0) return -1;
+  buf[len] = '\0';
+  return 0;
+}
+
+//CPU seconds the process has used, from /proc/<pid>/stat
+static inline double bench_cpu_seconds(pid_t pid)
+{
+  char path[64], line[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) return 0;
+  unsigned long utime = 0, stime = 0;
+  if (fgets(line, sizeof(line), f) != NULL) {
+    //Fields after the command name, which is in parentheses: state is field 3, utime 14, stime 15
+    char *p = strrchr(line, ')');
+    if (p != NULL) sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+  }
+  fclose(f);
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+//qsort comparator for the latency samples
+static inline int bench_cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static inline int bench_connect(int port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  int one = 1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+//Starts a controller with its output written to log (truncated). extra may be NULL
+//or hold several arguments separated by spaces
+static inline pid_t bench_start_controller_log(const char *extra, const char *log)
+{
+  const char *bin = getenv("CONTROLLER");
+  if (bin == NULL) bin = "../controller";
+  pid_t pid = fork();
+  if (pid == 0) {
+    int out = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    //extra may hold several space-separated arguments
+    char *args[16] = {(char *)bin};
+    char *copy = extra ? strdup(extra) : NULL;
+    int n = 1;
+    for (char *tok = copy ? strtok(copy, " ") : NULL; tok != NULL && n < 15; tok = strtok(NULL, " ")) {
+      args[n++] = tok;
+    }
+    execv(bin, args);
+    perror("exec controller");
+    _exit(1);
+  }
+  //Wait until it accepts connections
+  for (int i = 0; i < 200; i++) {
+    int fd = bench_connect(bench_port());
+    if (fd >= 0) {
+      close(fd);
+      break;
+    }
+    usleep(10000);
+  }
+  return pid;
+}
+
+//Starts a controller with its output discarded. extra may be NULL
+static inline pid_t bench_start_controller(const char *extra)
+{
+  return bench_start_controller_log(extra, "/dev/null");
+}
+
+static inline void bench_stop_controller(pid_t pid)
+{
+  kill(pid, SIGINT);
+  waitpid(pid, NULL, 0);
+}
+
+#endif
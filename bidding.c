@@ -0,0 +1,284 @@
+/**
+ * Contract-net dispatch (--bidding <deadline ms>).
+ *
+ * Normally schedule_request weighs every car's insertion cost itself, under
+ * the bank mutex, from the timing the cars advertised. With --bidding a call
+ * is put out to tender instead: every car that could take it is sent
+ *
+ *   "BID <seq> <source> <dest> <stops...>"
+ *
+ * with its queue as the controller holds it, and each car works out what
+ * taking the call would cost from where it is right now, its own floor times
+ * and the dwell it would give each stop (see answer_bid in car.c). It answers
+ *
+ *   "BID <seq> <cost> <pickup index> <dropoff index>"  or  "BID <seq> NONE"
+ *
+ * and the call goes to the cheapest bid in by the deadline, its stops placed
+ * where that car said: the dropoff inserted at its index first, then the
+ * pickup. The controller keeps owning the queues (failover, the re-optimizer
+ * and reconnects all need them), which is why they are sent with the offer.
+ *
+ * Cars opt in with "CAR ... BIDS 1" (car --bid). A call goes out to tender
+ * only if every car that could take it bids; otherwise, and whenever no usable
+ * bid comes back, the greedy rule decides as usual. The bank mutex is released
+ * while the bids come in, so the winner's queue is checked again on award: if
+ * it has only lost stops from its head (the car arrived somewhere) the indices
+ * are shifted to match, if it changed in any other way the next bid is tried.
+ *
+ * Waiting blocks the call's handler thread, so bidding needs handler threads
+ * (not --io-uring).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <time.h>
+
+#define BID_SLOTS 64 //Auctions open at once; a call finding none free is decided centrally
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int open;
+    unsigned long seq; //Of the auction running in this slot, 0 if none
+    const Car *cars[MAX_CARS]; //Bidders, by the bank's car index
+    int awaited;
+    long cost[MAX_CARS]; //-1 until a bid arrives, -2 for NONE
+    int pickup[MAX_CARS];
+    int dropoff[MAX_CARS];
+} auction_t;
+
+static auction_t auctions[BID_SLOTS];
+static unsigned long next_round = 0;
+int bidding_deadline_ms = 0;
+
+static struct {
+    unsigned long auctions;
+    unsigned long bids;
+    unsigned long timeouts; //Deadline passed with bids still out
+    unsigned long shifted; //Awards whose indices were moved because the car had arrived somewhere
+    unsigned long stale; //Bids passed over because the car's queue changed while waiting
+    unsigned long central; //Calls decided centrally: a car that does not bid, no free slot, or no usable bid
+    unsigned long long decide_ns; //Offer to award, over the auctions
+    unsigned long long decide_max_ns;
+} bid_metrics;
+
+/// @brief Sets up the auction slots; waits are measured on the monotonic clock
+int bidding_start(int deadline_ms) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (int i = 0; i < BID_SLOTS; i++) {
+        pthread_mutex_init(&auctions[i].mutex, NULL);
+        pthread_cond_init(&auctions[i].cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+    bidding_deadline_ms = deadline_ms;
+    return 0;
+}
+
+/**
+ * @brief The queue a bid asks for: dest inserted at dropoff, then source at pickup.
+ * @return 0 if the rider is carried (a stop at dest after the first stop at source), else -1
+ */
+static int bid_queue(const Car *car, int source, int dest, int pickup, int dropoff, int *queue, int *size) {
+    if (pickup < 0 || pickup > dropoff || dropoff > car->queue_size || car->queue_size + 2 > MAX_QUEUE_DEPTH) return -1;
+    memcpy(queue, car->queue, sizeof(int) * car->queue_size);
+    *size = car->queue_size;
+    insert_into_queue(queue, size, dropoff, dest);
+    insert_into_queue(queue, size, pickup, source);
+    int board = -1;
+    for (int k = 0; k < *size; k++) {
+        if (board < 0 && queue[k] == source) board = k;
+        else if (board >= 0 && queue[k] == dest) return 0;
+    }
+    return -1;
+}
+
+/// @brief Records a car's "BID ..." reply. Taken on the car's handler (or gateway) thread, no bank mutex needed
+void bid_received(const Car *car, const char *message) {
+    unsigned long seq;
+    long cost;
+    int pickup, dropoff, used = 0;
+    if (sscanf(message, "BID %lu%n", &seq, &used) != 1) return;
+    auction_t *a = &auctions[seq % BID_SLOTS];
+    pthread_mutex_lock(&a->mutex);
+    for (int i = 0; a->open && a->seq == seq && i < MAX_CARS; i++) {
+        if (a->cars[i] != car || a->cost[i] != -1) continue;
+        if (sscanf(message + used, "%ld %d %d", &cost, &pickup, &dropoff) == 3 && cost >= 0) {
+            a->cost[i] = cost;
+            a->pickup[i] = pickup;
+            a->dropoff[i] = dropoff;
+        } else {
+            a->cost[i] = -2;
+        }
+        if (--a->awaited == 0) pthread_cond_signal(&a->cond);
+        break;
+    }
+    pthread_mutex_unlock(&a->mutex);
+    __atomic_add_fetch(&bid_metrics.bids, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief Claims a free slot and gives it a new sequence number. Returns NULL if all are in use
+static auction_t *open_auction(void) {
+    for (int i = 0; i < BID_SLOTS; i++) {
+        auction_t *a = &auctions[i];
+        pthread_mutex_lock(&a->mutex);
+        if (!a->open) {
+            unsigned long round = __atomic_add_fetch(&next_round, 1, __ATOMIC_RELAXED);
+            a->open = 1;
+            a->seq = round * BID_SLOTS + (unsigned long)i;
+            a->awaited = 0;
+            for (int c = 0; c < MAX_CARS; c++) {
+                a->cars[c] = NULL;
+                a->cost[c] = -1;
+            }
+            pthread_mutex_unlock(&a->mutex);
+            return a;
+        }
+        pthread_mutex_unlock(&a->mutex);
+    }
+    return NULL;
+}
+
+static void close_auction(auction_t *a) {
+    pthread_mutex_lock(&a->mutex);
+    a->open = 0;
+    a->seq = 0;
+    pthread_mutex_unlock(&a->mutex);
+}
+
+/**
+ * @brief Puts a call out to tender among the bank's cars and picks the winner.
+ * Called with the bank mutex held; it is released while the bids come in and
+ * held again on return.
+ * @param pickup, dropoff where the winner's bid places the stops in its queue as it is now
+ * @param waited_ns set to how long the bank mutex was released
+ * @return the winning car's index, or -1 to decide centrally
+ */
+int bidding_award(Bank *bank, int source, int dest, int *pickup, int *dropoff, long long *waited_ns) {
+    Car *cars = bank->cars;
+    int bidders[MAX_CARS], count = 0;
+    int snapshot[MAX_CARS][MAX_QUEUE_DEPTH], snapshot_size[MAX_CARS];
+    *waited_ns = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (!cars[i].in_use || source < cars[i].floor_min || source > cars[i].floor_max ||
+            dest < cars[i].floor_min || dest > cars[i].floor_max || cars[i].queue_size + 2 > MAX_QUEUE_DEPTH) {
+            continue;
+        }
+        if (!cars[i].bids) {
+            __atomic_add_fetch(&bid_metrics.central, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        bidders[count++] = i;
+    }
+    if (count == 0) return -1;
+    auction_t *a = open_auction();
+    if (a == NULL) {
+        __atomic_add_fetch(&bid_metrics.central, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int64_t offered = monotonic_ns();
+    pthread_mutex_lock(&a->mutex);
+    unsigned long seq = a->seq;
+    for (int k = 0; k < count; k++) {
+        a->cars[bidders[k]] = &cars[bidders[k]];
+    }
+    a->awaited = count;
+    pthread_mutex_unlock(&a->mutex);
+
+    //The offers go out under the bank mutex, so each queue sent is the one snapshotted
+    for (int k = 0; k < count; k++) {
+        Car *car = &cars[bidders[k]];
+        char offer[BUFFER_SIZE];
+        int len = snprintf(offer, sizeof(offer), "BID %lu %d %d", seq, source, dest);
+        for (int q = 0; q < car->queue_size && len < (int)sizeof(offer); q++) {
+            len += snprintf(offer + len, sizeof(offer) - len, " %d", car->queue[q]);
+        }
+        memcpy(snapshot[bidders[k]], car->queue, sizeof(int) * car->queue_size);
+        snapshot_size[bidders[k]] = car->queue_size;
+        car_send(car, offer);
+    }
+    pthread_mutex_unlock(&bank->mutex);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += bidding_deadline_ms / 1000;
+    deadline.tv_nsec += (long)(bidding_deadline_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    long cost[MAX_CARS];
+    int at[MAX_CARS], to[MAX_CARS];
+    pthread_mutex_lock(&a->mutex);
+    while (a->awaited > 0 && pthread_cond_timedwait(&a->cond, &a->mutex, &deadline) == 0) {
+    }
+    if (a->awaited > 0) __atomic_add_fetch(&bid_metrics.timeouts, 1, __ATOMIC_RELAXED);
+    memcpy(cost, a->cost, sizeof(cost));
+    memcpy(at, a->pickup, sizeof(at));
+    memcpy(to, a->dropoff, sizeof(to));
+    pthread_mutex_unlock(&a->mutex);
+    close_auction(a);
+
+    pthread_mutex_lock(&bank->mutex);
+    *waited_ns = monotonic_ns() - offered;
+    __atomic_add_fetch(&bid_metrics.auctions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bid_metrics.decide_ns, (unsigned long long)*waited_ns, __ATOMIC_RELAXED);
+    unsigned long long prev = __atomic_load_n(&bid_metrics.decide_max_ns, __ATOMIC_RELAXED);
+    while ((unsigned long long)*waited_ns > prev &&
+           !__atomic_compare_exchange_n(&bid_metrics.decide_max_ns, &prev, (unsigned long long)*waited_ns, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    //Cheapest bid first; one whose car's queue changed meanwhile gives way to the next
+    while (1) {
+        int best = -1;
+        for (int k = 0; k < count; k++) {
+            int i = bidders[k];
+            if (cost[i] >= 0 && (best < 0 || cost[i] < cost[best])) best = i;
+        }
+        if (best < 0) break;
+        cost[best] = -1;
+        Car *car = &cars[best];
+        //Stops the car reached meanwhile are gone from the head; anything else makes the bid stale
+        int gone = snapshot_size[best] - car->queue_size;
+        int queue[MAX_QUEUE_DEPTH], size;
+        if (!car->in_use || gone < 0 || at[best] < gone ||
+            memcmp(car->queue, snapshot[best] + gone, sizeof(int) * car->queue_size) != 0 ||
+            bid_queue(car, source, dest, at[best] - gone, to[best] - gone, queue, &size) != 0) {
+            __atomic_add_fetch(&bid_metrics.stale, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (gone > 0) __atomic_add_fetch(&bid_metrics.shifted, 1, __ATOMIC_RELAXED);
+        *pickup = at[best] - gone;
+        *dropoff = to[best] - gone;
+        return best;
+    }
+    __atomic_add_fetch(&bid_metrics.central, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/// @brief Places a call's stops in the winner's queue where its bid said (see bidding_award)
+void bidding_apply(Car *car, int source, int dest, int pickup, int dropoff) {
+    int queue[MAX_QUEUE_DEPTH], size;
+    if (bid_queue(car, source, dest, pickup, dropoff, queue, &size) != 0) {
+        plan_insertion(car, source, dest);
+        return;
+    }
+    memcpy(car->queue, queue, sizeof(int) * size);
+    car->queue_size = size;
+}
+
+void print_bidding_metrics(void) {
+    if (bidding_deadline_ms == 0) return;
+    unsigned long auctions_run = __atomic_load_n(&bid_metrics.auctions, __ATOMIC_RELAXED);
+    unsigned long long decide_ns = __atomic_load_n(&bid_metrics.decide_ns, __ATOMIC_RELAXED);
+    printf("Bidding: %lu auctions, %lu bids, %lu past the deadline, %lu shifted, %lu stale bids, %lu central, "
+           "decided in %.3f ms on average (%.3f ms at most)\n",
+        auctions_run, __atomic_load_n(&bid_metrics.bids, __ATOMIC_RELAXED),
+        __atomic_load_n(&bid_metrics.timeouts, __ATOMIC_RELAXED), __atomic_load_n(&bid_metrics.shifted, __ATOMIC_RELAXED),
+        __atomic_load_n(&bid_metrics.stale, __ATOMIC_RELAXED), __atomic_load_n(&bid_metrics.central, __ATOMIC_RELAXED),
+        auctions_run ? decide_ns / 1e6 / auctions_run : 0.0,
+        __atomic_load_n(&bid_metrics.decide_max_ns, __ATOMIC_RELAXED) / 1e6);
+}
@@ -1,79 +1,176 @@
-#include "shared.h"
-
-
-
-int main(int argc, char **argv) {
-    if(argc != 3) {
-        fprintf(stderr, "Invalid format");
-        exit(1);
-    }
-
-    const char* source_floor = argv[1];
-    const char* destination_floor = argv[2];
-    //Check if floors are the same
-    if(strcmp(source_floor, destination_floor) == 0) {
-        printf("You are already on that floor!\n");
-        exit(1);
-    }
-
-    //Validate teh floors
-    if(!validate_floor(source_floor) || !validate_floor(destination_floor)) {
-        printf("Invalid floor(s) specified.\n");
-        exit(1);
-    }
-    //Create a socket
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd == -1) {
-        printf("Unable to connect to elevator system.\n");
-        exit(1);
-    }
-    //setup the server address
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET; //IPV4 not IPV6 as 127.0.0.1
-    addr.sin_port = htons(CONTROLLER_PORT);
-    const char *ip_address = CONTROLLER_IP;
-    if (inet_pton(AF_INET, ip_address, &addr.sin_addr) == -1) {
-        printf("Unable to connect to elevator system.\n");
-        close (sockfd);
-        exit(1);
-    }
-
-    //Connect to the controller
-    if (connect(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
-        printf("Unable to connect to elevator system.\n");
-        close(sockfd);
-        exit(1);
-    }
-
-    //prepare to send CALL message
-    char call_message[256];
-    snprintf(call_message, sizeof(call_message), "CALL %s %s", source_floor, destination_floor);
-    send_message(sockfd, call_message);
-    
-    //Receive the response
-    char *response = receive_msg(sockfd);
-
-    // receive_msg returns NULL on error
-    if (response == NULL) {
-        printf("Unable to connect to elevator system.\n");
-        close(sockfd);
-        exit(1);
-    }
-
-    //Process the response
-    if (strncmp(response, "CAR ", 4) == 0) {
-        //print the server response
-        printf("Car %s is arriving.\n", response + 4);
-    } else if (strcmp(response, "UNAVAILABLE") == 0) {
-        printf("Sorry, no car is available to take this request.\n");
-    } else {
-        printf("Unable to connect to elevator system.\n");
-    }
-    free(response); //free the memory up
-    if(close(sockfd) == -1) {
-        perror("close()");
-        exit(1);
-    }
-    return 0;
+#define _POSIX_C_SOURCE 200809L //nanosleep, rand_r
+#include "shared.h"
+#include <time.h>
+#include <signal.h>
+
+#define CALL_MAX_ATTEMPTS 5 //Tries in total while the controller keeps answering BUSY
+#define CALL_DEFAULT_RETRY_MS 100
+#define CALL_MAX_RETRY_MS 5000
+#define CALL_LOST_RETRY_MS 100 //Back-off before resending a keyed call whose answer was lost
+
+char *place_call(const char *call_message, int *reached, int *follow_fd);
+
+int main(int argc, char **argv) {
+    argc = parse_common_flags(argc, argv);
+    //Optional bank, for buildings where one controller runs several banks, an
+    //optional idempotency key which makes it safe to resend a call whose answer was lost,
+    //and --follow to stay on until the rider boards in case the call moves to another car
+    const char* bank = NULL;
+    const char* key = NULL;
+    int follow = 0;
+    int valid = (argc >= 3);
+    for (int i = 3; valid && i < argc; i++) {
+        if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else if (i + 1 >= argc) {
+            valid = 0;
+        } else if (strcmp(argv[i], "--bank") == 0) {
+            bank = argv[++i];
+            if (bank[0] == '\0' || strlen(bank) >= MAX_BANK_NAME_LEN || strchr(bank, ' ') != NULL) valid = 0;
+        } else if (strcmp(argv[i], "--key") == 0) {
+            key = argv[++i];
+            //The controller keeps keys in fixed slots, so a longer one could not be matched
+            if (key[0] == '\0' || strlen(key) >= DEDUPE_KEY_LEN || strchr(key, ' ') != NULL) valid = 0;
+        } else {
+            valid = 0;
+        }
+    }
+    if(!valid) {
+        fprintf(stderr, "Invalid format");
+        exit(1);
+    }
+
+    const char* source_floor = argv[1];
+    const char* destination_floor = argv[2];
+    //Check if floors are the same
+    if(strcmp(source_floor, destination_floor) == 0) {
+        printf("You are already on that floor!\n");
+        exit(1);
+    }
+
+    //Validate teh floors
+    if(!validate_floor(source_floor) || !validate_floor(destination_floor)) {
+        printf("Invalid floor(s) specified.\n");
+        exit(1);
+    }
+    //prepare to send CALL message
+    char call_message[256];
+    int len = snprintf(call_message, sizeof(call_message), "CALL %s %s", source_floor, destination_floor);
+    if (bank != NULL && len < (int)sizeof(call_message)) {
+        len += snprintf(call_message + len, sizeof(call_message) - len, " BANK %s", bank);
+    }
+    if (key != NULL && len < (int)sizeof(call_message)) {
+        len += snprintf(call_message + len, sizeof(call_message) - len, " KEY %s", key);
+    }
+    if (follow && len < (int)sizeof(call_message)) {
+        len += snprintf(call_message + len, sizeof(call_message) - len, " NOTIFY 1");
+    }
+    //A truncated call would reach the controller without its bank or key
+    if (len >= (int)sizeof(call_message)) {
+        fprintf(stderr, "Invalid format");
+        exit(1);
+    }
+
+    //A controller out of handler slots answers BUSY and hangs up without reading the
+    //CALL, so sending it may fail; the answer is still there to read
+    signal(SIGPIPE, SIG_IGN);
+
+    //An overloaded controller answers BUSY with how long to back off before trying again
+    unsigned int seed = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+    char *response = NULL;
+    int follow_fd = -1;
+    for (int attempt = 1; ; attempt++) {
+        int reached = 0;
+        response = place_call(call_message, &reached, follow ? &follow_fd : NULL);
+        long retry_ms;
+        if (response == NULL) {
+            //The controller already has a keyed call it got, so sending it again is harmless
+            if (key == NULL || !reached || attempt == CALL_MAX_ATTEMPTS) {
+                printf("Unable to connect to elevator system.\n");
+                exit(1);
+            }
+            retry_ms = CALL_LOST_RETRY_MS;
+        } else {
+            if (strncmp(response, "BUSY", 4) != 0 || attempt == CALL_MAX_ATTEMPTS) break;
+            retry_ms = strtol(response + 4, NULL, 10);
+            free(response);
+            response = NULL;
+        }
+        if (retry_ms <= 0) retry_ms = CALL_DEFAULT_RETRY_MS;
+        if (retry_ms > CALL_MAX_RETRY_MS) retry_ms = CALL_MAX_RETRY_MS;
+        //Spread the retries so pads turned away together do not come back together
+        long wait_ms = retry_ms / 2 + rand_r(&seed) % (retry_ms + 1);
+        struct timespec pause = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+
+    //Process the response
+    if (strncmp(response, "CAR ", 4) == 0) {
+        //print the server response
+        printf("Car %s is arriving.\n", response + 4);
+        fflush(stdout);
+        //The controller re-sends CAR if the call is moved, and hangs up once the rider boards
+        char *update;
+        while (follow_fd >= 0 && (update = receive_msg(follow_fd)) != NULL) {
+            if (strncmp(update, "CAR ", 4) == 0) {
+                printf("Car %s is arriving instead.\n", update + 4);
+                fflush(stdout);
+            }
+            free(update);
+        }
+    } else if (strcmp(response, "UNAVAILABLE") == 0) {
+        printf("Sorry, no car is available to take this request.\n");
+    } else if (strncmp(response, "BUSY", 4) == 0) {
+        printf("The elevator system is busy, please try again shortly.\n");
+    } else {
+        printf("Unable to connect to elevator system.\n");
+    }
+    if (follow_fd >= 0) {
+        close(follow_fd);
+    }
+    free(response); //free the memory up
+    return 0;
+}
+
+/**
+ * @brief Connects to the controller, sends one CALL and waits for the answer
+ * @param reached set once the CALL has been sent, so a NULL return means the answer was lost
+ * @param follow_fd if not NULL and a car was assigned, receives the still open connection
+ * @return the response (to be freed), or NULL if the controller could not be reached
+ */
+char *place_call(const char *call_message, int *reached, int *follow_fd) {
+    //Create a socket
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        return NULL;
+    }
+    //setup the server address
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET; //IPV4 not IPV6 as 127.0.0.1
+    addr.sin_port = htons(call_port()); //The controller may give call pads their own port
+    const char *ip_address = controller_ip();
+    if (inet_pton(AF_INET, ip_address, &addr.sin_addr) != 1) {
+        close (sockfd);
+        return NULL;
+    }
+
+    //Connect to the controller
+    if (connect(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(sockfd);
+        return NULL;
+    }
+    *reached = (send_message(sockfd, call_message) == 0);
+
+    //Receive the response, receive_msg returns NULL on error
+    char *response = receive_msg(sockfd);
+    if (follow_fd != NULL && response != NULL && strncmp(response, "CAR ", 4) == 0) {
+        *follow_fd = sockfd;
+        return response;
+    }
+    if(close(sockfd) == -1) {
+        perror("close()");
+        exit(1);
+    }
+    return response;
 }
\ No newline at end of file
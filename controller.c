@@ -1,599 +1,1826 @@
-/**
- * Elevator System Controller
- *
- * The controller module accepts connections from elevator cars and
- * call pads. A Static pool of car state entries and a static pool for 
- * client handler arguments  are used to avoid unbounded resources or issues 
- * with race conditions. This design is not fully MISRA C Compliant but is designed
- * to be robust.
- */
-
-#include "shared.h"
-#include <signal.h>
-#include <pthread.h>
-
-#define MAX_CARS 10
-#define MAX_CLIENTS (MAX_CARS + 20) // Cars + some call pads
-#define MAX_QUEUE_DEPTH 20
-#define BUFFER_SIZE 256
-#define MAX_FLOOR_STR_LEN 8 // "B99" + null
-#define MAX_CAR_NAME_LEN 128 //half of max buffer size to ensure no memory overflow
-
-
-typedef enum {
-    DIR_UP,
-    DIR_DOWN,
-    DIR_IDLE
-} Direction;
-
-
-//Represent the state of a single elevator car
-
-typedef struct {
-    int in_use;
-    int socket_fd;
-    char car_name[MAX_CAR_NAME_LEN];
-    int floor_min;
-    int floor_max;
-
-    //A real-time status
-    int current_floor;
-    char status[BUFFER_SIZE];
-
-    //scheduling queue
-    int queue[MAX_QUEUE_DEPTH];
-    int queue_size;
-} Car;
-
-//Global status for all cars
-static Car cars[MAX_CARS];
-static pthread_mutex_t cars_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-typedef struct {
-    int in_use;
-    int client_fd;
-} thread_arg_t;
-static thread_arg_t thread_args[MAX_CLIENTS];
-static pthread_mutex_t thread_args_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-//status flag for graceful shutdown
-static volatile sig_atomic_t shutdown_requested = 0;
-
-//Function prototypes
-void *client_handler_thread(void *arg);
-void handle_car_connection(int client_fd, const char* initial_message);
-void handle_call_connection(int client_fd, const char* initial_message);
-void sigint_handler(int signum);
-void setup_signal_handlers(void);
-
-//Scheduling Algorithm
-void schedule_request(int source_floor, int dest_floor, int client_fd);
-int calculate_insertion_cost(const Car *car, int source, int dest, int *pickup_idx, int *final_len);
-
-//Queue Management
-void insert_into_queue(int *queue, int *size, int index, int value);
-void remove_from_queue(int *queue, int *size, int index);
-void send_next_destination(Car *car);
-
-//Utility
-int parse_car_info(const char *buffer, char *name, int *min_floor, int *max_floor);
-int parse_call_info(const char *buffer, int *source, int *dest);
-int parse_status_info(const char *buffer, int *floor, char *status_buf);
-void safe_write(int fd, const char *message);
-
-//The main function 
-int main() {
-    int listen_fd = -1;
-    int client_fd = -1;
-    struct sockaddr_in serv_addr;
-    pthread_t threads[MAX_CLIENTS];
-    int opt_enable = 1;
-
-    setup_signal_handlers();
-
-    //Create a listening socket 
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("Socket() failed!");
-        return EXIT_FAILURE;
-    }
-
-    //Set address reuse option
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable)) < 0) {
-        perror("setsocketopt(SO_REUSEADDR) failed");
-        close(listen_fd);
-        return EXIT_FAILURE;
-    }
-
-    //Bind a socket to a port 
-    memset(&serv_addr, 0 , sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET; // Keep in mind ipv4 not ipv6
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(CONTROLLER_PORT);
-
-    //Bind the socket now
-    if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 ) { //would return -1 if bad
-        perror("bind() failed");
-        close(listen_fd); //close the file descriptor
-        return EXIT_FAILURE;
-    }
-
-    //Listen for the connections
-    if (listen(listen_fd, 10) < 0) { // 10 requests
-        perror("listen() failed.");
-        return EXIT_FAILURE;
-    }
-
-    printf("Controller listening on port %d\n", CONTROLLER_PORT);
-
-    //the actual main accept loop, where we check if CTRL+C
-    while (!shutdown_requested){
-        client_fd = accept(listen_fd, NULL, NULL);
-        if(client_fd < 0) {
-            if(errno == EINTR) continue; //Was interrupted by signal handler
-            perror("accept() failed");
-            break; //Exit the loop on other errors
-        }
-        int arg_idx = -1;
-        pthread_mutex_lock(&thread_args_mutex);
-        for(int i = 0; i < MAX_CLIENTS; i++) {
-            if(!thread_args[i].in_use) {
-                thread_args[i].in_use = 1;
-                thread_args[i].client_fd = client_fd;
-                arg_idx = i;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&thread_args_mutex);
-
-        if (arg_idx!= -1) {
-            //Pass the index into static pool as arg
-            if (pthread_create(&threads[arg_idx], NULL, client_handler_thread, 
-            (void *)(intptr_t)arg_idx) != 0) {
-                perror("pthread_create() failed");
-                //If thread creation fails mark the arg struct as free
-                pthread_mutex_lock(&thread_args_mutex);
-                thread_args[arg_idx].in_use = 0;
-                pthread_mutex_unlock(&thread_args_mutex);
-                close(client_fd);
-            } else {
-                pthread_detach(threads[arg_idx]);
-            }
-        } else {
-            printf("Max clients reached. rejecting new connection.\n");
-            close(client_fd);
-        }
-    }
-    //Requested to be shutdown from terminal being CTRL+C
-    printf("\nShutdown signal received. Closing the listening socket.\n");
-    if(listen_fd >= 0) {
-        close(listen_fd);
-    }    
-    return EXIT_SUCCESS;
-}
-
-/**
- * @brief handler for a single client connection. This is designed to run in own thread
- */
-void *client_handler_thread(void *arg) {
-    int arg_idx = (intptr_t)arg;
-    //get the client file descriptor from the static pool
-    int client_fd = thread_args[arg_idx].client_fd;
-    char *buffer = receive_msg(client_fd);
-
-    if (buffer == NULL) {
-        //Client has disconnected before sending anything
-        close(client_fd);
-    } else if (strncmp(buffer, "CAR", 3) == 0) {
-        handle_car_connection(client_fd, buffer);
-    } else if (strncmp(buffer, "CALL", 4) == 0) {
-        handle_call_connection(client_fd, buffer);
-        close(client_fd);
-    }
-    //Free the initial buffer once handler done
-    if(buffer != NULL) {
-        free(buffer);
-    }
-    pthread_mutex_lock(&thread_args_mutex);
-    thread_args[arg_idx].in_use = 0;
-    pthread_mutex_unlock(&thread_args_mutex);
-    return NULL;
-}
-
-void handle_car_connection(int client_fd, const char* initial_message) {
-    char car_name[BUFFER_SIZE];
-    int min_floor, max_floor;
-
-    //The initial "CAR.." line is consumed, get the next line
-
-    if(parse_car_info(initial_message, car_name, &min_floor, &max_floor) != 0) {
-        printf("Failed to parse car info.\n");
-        close(client_fd);
-        return;
-    }
-
-    pthread_mutex_lock(&cars_mutex);
-    int car_idx = -1;
-    for (int i = 0; i < MAX_CARS; i++) {
-        if(!cars[i].in_use) {
-            car_idx = i;
-            break;
-        }
-    }
-    if (car_idx == -1){
-        pthread_mutex_unlock(&cars_mutex);
-        printf("Max cars reached. Rejecting car %s.\n", car_name);
-        close(client_fd);
-        return;
-    }
-    //car is good to go. Let's register the new car
-    Car *car  = &cars[car_idx];
-    car->in_use = 1;
-    car->socket_fd = client_fd;
-    strncpy(car->car_name, car_name, sizeof(car->car_name) -1);
-    car->floor_min = min_floor;
-    car->floor_max = max_floor;
-    car-> queue_size = 0;
-    //Initial status is unknown until the first update
-    strcpy(car->status, "Unknown");
-    car->current_floor = min_floor;
-
-    //Finished handling the data; unlock the mutex
-    pthread_mutex_unlock(&cars_mutex);
-    printf("Car %s registered (Floors %d to %d).\n", car_name, min_floor, max_floor);
-
-    //Loop for status updates
-    while(1) {
-        char* msg_buffer = receive_msg(client_fd);
-        if (msg_buffer == NULL) break;
-        
-        // Check for INDIVIDUAL SERVICE or EMERGENCY mode
-        if (strcmp(msg_buffer, "INDIVIDUAL SERVICE") == 0 || strcmp(msg_buffer, "EMERGENCY") == 0) {
-            printf("Car %s entered %s mode.\n", car_name, msg_buffer);
-            free(msg_buffer);
-            break; // Car will disconnect and reconnect later
-        }
-        
-        int floor;
-        char status_buf[BUFFER_SIZE];
-        if(parse_status_info(msg_buffer, &floor, status_buf) == 0) {
-            //Altering the car state; lock the cars mutex
-            pthread_mutex_lock(&cars_mutex);
-            car->current_floor = floor;
-            strncpy(car->status, status_buf, sizeof(car->status) -1);
-            car->status[sizeof(car->status) - 1] = '\0';
-
-            //If the car has arrived open the doors and service the queue
-            if(car->queue_size > 0 && car->current_floor == car->queue[0] &&
-                (strcmp(car->status, "Open") == 0 || strcmp(car->status, "Opening") == 0)) {
-                remove_from_queue(car->queue, &car->queue_size, 0);
-                send_next_destination(car);
-            }
-            pthread_mutex_unlock(&cars_mutex);
-        }
-        free(msg_buffer);
-    }
-    
-    //The car has disconnected 
-    printf("Car %s disconnected.\n", car_name);
-    pthread_mutex_lock(&cars_mutex);
-    car->in_use = 0;
-    pthread_mutex_unlock(&cars_mutex);
-    close(client_fd);
-}
-
-/**
- * @brief Handler for connection from a call pad to receive a floor from and to
- */
-void handle_call_connection(int client_fd, const char* call_message){
-    int source_floor, dest_floor;
-
-    if(call_message == NULL || parse_call_info(call_message, &source_floor, &dest_floor) != 0) {
-        printf("Failed to parse call info.\n");
-        return;
-    }
-
-    printf("Received call from floor %d to %d.\n", source_floor, dest_floor);
-    schedule_request(source_floor, dest_floor, client_fd);
-}
-
-/**
- * @brief Sets up the signal handlers for shutdown. This is designed to be a graceful shutodnw as outlined by the task (SIGINT).  */
-
- void setup_signal_handlers(void) {
-    //Ignore the SIGPIPE to prevent crashing on write to closed socket
-    signal(SIGPIPE, SIG_IGN);
-
-    //Setup SIGINT (CTRL+C) handler
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = sigint_handler;
-    sigaction(SIGINT, &sa, NULL);
-
- }
-
-
- /**
-  * @brief A safe handler for SIGINT that is async safe
-  */
-void sigint_handler(int signum) {
-    (void)signum;
-    shutdown_requested = 1;
-}
-
-
-/**
- * SCHEDULING LOGIC 
- */
-
- /// @brief Schedules a request by finding the best car for a request and then updating thh queue
- /// @param source_floor The floor the request came from
- /// @param dest_floor  The floor that the ekevator will need to go to after they go to the source floor
- /// @param client_fd Client file descriptor 
- void schedule_request(int source_floor, int dest_floor, int client_fd) {
-    int best_car_idx = -1;
-    int min_cost = 1000;
-    int best_final_len = 1000;
-    //Lock the mutex as we find the best, so no one can change it 
-    pthread_mutex_lock(&cars_mutex);
-    for (int i = 0; i < MAX_CARS; i++) {
-        if (!cars[i].in_use) continue; 
-        //Elevator car must be able to service both floors as a rule
-        if (source_floor < cars[i].floor_min || source_floor > cars[i].floor_max
-            || dest_floor < cars[i].floor_min || dest_floor > cars[i].floor_max) {
-                continue;
-            }
-        int pickup_idx, final_len;
-        int cost = calculate_insertion_cost(&cars[i], source_floor, dest_floor,
-        &pickup_idx, &final_len);
-
-        if (cost < 0) continue; //An invalid insertion, do not consider
-
-        /*
-        Using the lowest cost by finding the earliest pickup index. If two
-        have the same it is the shorter final queue length as a tiebreaker.
-        */
-
-        if (cost < min_cost || (cost == min_cost && final_len < best_final_len)) {
-            min_cost = cost;
-            best_final_len = final_len;
-            best_car_idx = i;
-        }
-    }
-    if (best_car_idx != -1) {
-        //No error 
-        Car *chosen_car = &cars[best_car_idx];
-        int old_head = (chosen_car->queue_size > 0) ? chosen_car->queue[0] : -1000;
-
-        //Recompute the best insertion to get final queue state
-        int pickup_idx, final_len;
-        calculate_insertion_cost(chosen_car, source_floor, dest_floor, &pickup_idx, &final_len);
-        int temp_queue[MAX_QUEUE_DEPTH];
-        int temp_size = chosen_car->queue_size;
-        memcpy(temp_queue, chosen_car->queue, sizeof(int) *temp_size);
-
-        insert_into_queue(temp_queue, &temp_size, pickup_idx, source_floor);
-
-        //Find where to insert dest - first check if it already exists in queue
-        int dest_already_exists = 0;
-        for (int i = 0; i < temp_size; i++) {
-            if (temp_queue[i] == dest_floor) {
-                dest_already_exists = 1;
-                break;
-            }
-        }
-        
-        if (!dest_already_exists) {
-            int dest_idx = -1;
-            Direction travel_dir = (dest_floor > source_floor) ? DIR_UP : DIR_DOWN;
-
-            for (int i = pickup_idx + 1; i < temp_size; i++) {
-                if (travel_dir == DIR_UP){
-                    if(dest_floor < temp_queue[i]) {
-                        dest_idx = i;
-                        break;
-                    }
-                } else { // direction down
-                    if (dest_floor > temp_queue[i]) {
-                        dest_idx = i;
-                        break;
-                    }
-
-                }
-            }
-            if (dest_idx == -1) dest_idx = temp_size;
-
-            insert_into_queue(temp_queue, &temp_size, dest_idx, dest_floor);
-        }
-
-        //Commit the change by memcpy
-        memcpy(chosen_car->queue, temp_queue, sizeof(int) *temp_size);
-        chosen_car->queue_size = temp_size;
-        char response[BUFFER_SIZE];
-        snprintf(response, sizeof(response), "CAR %s", chosen_car->car_name);
-        send_message(client_fd, response);
-
-        printf("Assigned call (%d->%d) to Car %s. New queue size: %d\n",
-        source_floor, dest_floor, chosen_car->car_name, chosen_car->queue_size);
-
-        //If the head of the queue has changed send a new destination
-        if (chosen_car->queue[0] != old_head) {
-            send_next_destination(chosen_car);
-        }
-    } else {
-        send_message(client_fd, "UNAVAILABLE");
-        printf("Call (%d->%d) is unavailable.\n", source_floor, dest_floor);
-    }
-    //We are done so unlock the mutex
-    pthread_mutex_unlock(&cars_mutex);
- }
-
-
-
- /**
-  * @brief Calculates the cost of inserting a new request into a car's queue.
-  * @return the index of the pickup floor (cost) or -1 if impossible
-  */
- int calculate_insertion_cost(const Car *car, int source, int dest, int *pickup_idx, int *final_len) {
-    int effective_floor = car->current_floor;
-    if (car-> queue_size > 0) {
-        //If closing / between we are effectively at the next floor
-        if (strcmp(car->status, "Closing") == 0 || strcmp(car->status, "Between") == 0) {
-            effective_floor = car->queue[0];
-        }
-    }
-    Direction request_dir = (dest > source) ? DIR_UP : DIR_DOWN; // is it up or down
-    //Insert as early as possible
-    int current = effective_floor;
-    for(int i = 0; i <= car->queue_size; i++) {
-        int next = (i < car->queue_size) ? car->queue[i] : current;// if at end stay
-
-        Direction segment_dir = (next > current) ? DIR_UP : ((next < current) ? DIR_DOWN : DIR_IDLE);
-        //Can we pick up on this segment? We are moving in same direction as request
-        // the source floor is between our current and next stop
-
-        if (segment_dir == request_dir) {
-            if((request_dir == DIR_UP && source >= current && source < next) ||
-            (request_dir == DIR_DOWN && source <= current && source > next)) {
-                //found a valid pickup point. now can we drop off without reversing
-                for(int j = i; j <= car->queue_size; j++) {
-                    int check_next = (j < car->queue_size) ? car->queue[j] : dest;
-                    // Check for direction reversal before drop-off
-                    if ((request_dir == DIR_UP && check_next < source) ||
-                        (request_dir == DIR_DOWN && check_next > source)) {
-                        goto next_segment; // Fails direction rule, break inner loop
-                    }
-
-                    // Check if we can drop off at or before the next stop
-                    if (j == car->queue_size ||
-                       (request_dir == DIR_UP && dest <= check_next) ||
-                       (request_dir == DIR_DOWN && dest >= check_next)) {
-                        
-                        // Valid insertion found
-                        *pickup_idx = i;
-                        *final_len = car->queue_size + 2;
-                        return *pickup_idx;
-                    }
-                }
-            }
-        }
-        
-        // Check if we can extend the current direction run
-        // For example, queue is [6,7,4] going UP then DOWN, and source=8 is beyond 7 in UP direction
-        if (segment_dir != DIR_IDLE && i < car->queue_size) {
-            int next_segment_floor = (i + 1 < car->queue_size) ? car->queue[i + 1] : -1;
-            Direction next_segment_dir = DIR_IDLE;
-            if (next_segment_floor != -1) {
-                next_segment_dir = (next_segment_floor > next) ? DIR_UP : ((next_segment_floor < next) ? DIR_DOWN : DIR_IDLE);
-            }
-            
-            // If direction changes after this segment, check if source extends current direction
-            if (next_segment_dir != segment_dir && next_segment_dir != DIR_IDLE) {
-                if ((segment_dir == DIR_UP && source > next) ||
-                    (segment_dir == DIR_DOWN && source < next)) {
-                    // Source extends the current direction run, insert after current segment
-                    // Check if dest can be reached without extra direction changes
-                    if ((segment_dir == DIR_UP && dest < source) ||
-                        (segment_dir == DIR_DOWN && dest > source)) {
-                        // Dest is in opposite direction, which is fine (we'll turn around)
-                        // Check if dest can be inserted in the remaining queue
-                        int can_insert_dest = 0;
-                        for (int j = i + 1; j <= car->queue_size; j++) {
-                            int check_floor = (j < car->queue_size) ? car->queue[j] : dest;
-                            Direction check_dir = (dest > source) ? DIR_UP : DIR_DOWN;
-                            if (check_dir == next_segment_dir) {
-                                if ((check_dir == DIR_DOWN && dest >= check_floor) ||
-                                    (check_dir == DIR_UP && dest <= check_floor)) {
-                                    can_insert_dest = 1;
-                                    break;
-                                }
-                            }
-                            if (j == car->queue_size) {
-                                can_insert_dest = 1;
-                                break;
-                            }
-                        }
-                        if (can_insert_dest) {
-                            *pickup_idx = i;
-                            *final_len = car->queue_size + 2;
-                            return *pickup_idx;
-                        }
-                    }
-                }
-            }
-        }
-        
-        next_segment:
-            current = next;
-    }    
-    //The cost is higher, which means it is waiting for jobs to finish
-    *pickup_idx = car->queue_size;
-    *final_len = car->queue_size +2;
-    return *pickup_idx;
- }
-
- /**
-  * Queue management
-  */
-
-  void insert_into_queue(int *queue, int *size, int index, int value) {
-    if (*size >= MAX_QUEUE_DEPTH || index > *size) return;
-    //Don't add duplicates: if value equals the previous entry, skip
-    if (index > 0 && queue[index-1] == value) return;
-
-    memmove(&queue[index + 1 ], & queue[index], (*size - index) * sizeof(int));
-    queue[index] = value;
-    (*size)++;
-  }
-
-  void remove_from_queue(int *queue, int *size, int index) {
-    if (*size == 0 || index >= *size) return;
-    memmove(&queue[index], &queue[index +1], (*size - 1 - index) *sizeof(int));
-    (*size)--;
-  }
-
-  void send_next_destination(Car *car) {
-    if (car->queue_size > 0) {
-        char msg[BUFFER_SIZE];
-        snprintf(msg, sizeof(msg), "FLOOR %d", car->queue[0]);
-        send_message(car->socket_fd, msg);
-    }
-  }
-
-
-int parse_car_info(const char *buffer, char *name, int *min_floor, int *max_floor) {
-    char min_str[MAX_FLOOR_STR_LEN], max_str[MAX_FLOOR_STR_LEN];
-    if (sscanf(buffer, "CAR %s %s %s", name, min_str, max_str) != 3) {
-        return -1;
-    }
-    *min_floor = floor_to_int(min_str);
-    *max_floor = floor_to_int(max_str);
-    return 0;
-}
-int parse_call_info(const char *buffer, int *source, int *dest){
-    char source_str[MAX_FLOOR_STR_LEN], dest_str[MAX_FLOOR_STR_LEN];
-    if (sscanf(buffer, "CALL %s %s", source_str, dest_str) != 2) {
-        return -1;
-    }
-    *source = floor_to_int(source_str);
-    *dest = floor_to_int(dest_str);
-    return 0;
-}
-int parse_status_info(const char *buffer, int *floor, char *status_buf) {
-    char floor_str[MAX_FLOOR_STR_LEN];
-    char dest_str [MAX_FLOOR_STR_LEN];
-    // The format is: STATUS <status> <current_floor> <dest_floor>
-    // But we only care about status and current_floor
-    int result = sscanf(buffer, "STATUS %s %s %s", status_buf, floor_str, dest_str);
-    if (result < 2) {
-        return -1;
-    }
-    *floor = floor_to_int(floor_str);
-    return 0;
-}
-
- void safe_write(int fd, const char *message) {
-    if (write(fd, message, strlen(message)) < 0) {
-        perror("write failed");
-    }
+/**
+ * Elevator System Controller
+ *
+ * The controller module accepts connections from elevator cars and
+ * call pads. A Static pool of car state entries and a static pool for 
+ * client handler arguments  are used to avoid unbounded resources or issues 
+ * with race conditions. This design is not fully MISRA C Compliant but is designed
+ * to be robust.
+ *
+ * Live upgrade: a running controller listens on a local control socket. A new
+ * build started with --takeover connects to it, and the running controller
+ * parks every handler thread at a frame boundary, then passes the listening
+ * socket, every established connection (SCM_RIGHTS) and an image of the car
+ * table to the new process before exiting. Nothing is closed, so cars and
+ * call pads never see a disconnect.
+ *
+ * Hot standby: with --replicate the controller streams every car table change
+ * to a standby started with --standby (see replication.c). When the primary
+ * dies the standby claims the port and cars resume their entries with the
+ * SESSION token they were given at registration.
+ *
+ * Banks: cars and calls may name a bank ("CAR Alpha 1 10 BANK east",
+ * "CALL 1 5 BANK east"); those without one use the default bank. Each bank
+ * has its own car table, lock and metrics, so calls in different banks are
+ * scheduled in parallel on their handler threads with no shared lock. Beyond
+ * one process, the router (router.c) spreads banks over several controllers.
+ *
+ * io_uring: with --io-uring one thread serves every connection from a ring
+ * instead of a thread per connection (see uring.c). If the kernel cannot
+ * provide the ring the controller falls back to handler threads.
+ *
+ * Re-optimization: with --reoptimize a background thread revisits the
+ * pending calls of every bank and re-plans them when that shortens waits
+ * (see reopt.c). A call pad that sends NOTIFY 1 stays connected until its
+ * rider boards and is told if its call moves to another car.
+ *
+ * Rollout dispatch: with --rollout a call that several cars could take goes
+ * to the car whose simulated futures cost least (see rollout.c).
+ *
+ * Learned policy: --policy <file> replaces the greedy rule with a cost table
+ * trained offline by train-policy (see policy.c). Rollouts, if on, start from
+ * the policy's choice.
+ *
+ * Car timing: a car may advertise how fast it is ("CAR ... TIMING
+ * floor,opening,open,closing" in ms, or a later "TIMING ..." frame; car
+ * --timing does so, car --dwell sends a new one as its door dwell shifts and
+ * any car sends one when its delay is changed live: internal <car> delay <ms>).
+ * Re-optimizer ETAs and rollout simulations use each car's own timing, and a
+ * guess (TIMING_GUESS_MS) for cars that do not say.
+ *
+ * Express service: with --express <floors> a trip at least that many floors
+ * long only goes to a car carrying no shorter trips, and the reverse, so long
+ * trips ride temporary expresses that skip local stops (see express_choice in
+ * schedule.c). A call no car of its kind can take goes to any car.
+ *
+ * Gateways: an emulator or a host running many cars may carry them all over
+ * one connection that opens with "GATEWAY", each frame led by a small car id
+ * ("3 STATUS Open 4 4", answered "3 FLOOR 7"). One handler thread serves the
+ * whole gateway and applies every frame from a read in one batch (see
+ * gateway.c). Live upgrade is refused while a gateway is connected.
+ *
+ * Bidding: with --bidding <deadline ms> a call is offered to the cars that
+ * could take it, each car prices it from its own position and timing, and the
+ * cheapest bid in by the deadline wins (see bidding.c). Cars bid if they
+ * register with BIDS 1 (car --bid); calls they cannot all bid on are decided
+ * by the greedy rule.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE //syscall(), to renice call handler threads
+#include "controller.h"
+#include <poll.h>
+#include <time.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <stddef.h>
+
+//Live upgrade (handoff) settings
+#define HANDOFF_MAGIC 0x454c4556u // "ELEV"
+#define HANDOFF_VERSION 6
+#define HANDOFF_QUIESCE_TIMEOUT_MS 2000 //Give up if handlers cannot be parked in time
+#define HANDOFF_ACK_TIMEOUT_MS 5000 //Give up if the new process never confirms
+#define HANDOFF_BIND_RETRY_MS 1000 //How long the new process waits to claim the control socket
+#define STANDBY_TAKEOVER_BOUND_MS 2000 //How long a standby keeps trying to claim the port
+#define CALL_THREAD_NICE 10 //Call handlers yield the CPU to car sessions
+
+//STATUS values that only move a car between stops. The newest one is kept in the car's
+//mailbox without locking; MAILBOX_FULL marks the word as set (floor in the low 32 bits)
+static const char *mailbox_statuses[] = {"Between", "Closing", "Closed"};
+#define MAILBOX_STATUS_COUNT 3
+#define MAILBOX_FULL (1ULL << 63)
+
+//Admission control: calls beyond these are answered BUSY <retry_ms> instead of queueing
+#define ADMIT_MAX_IN_FLIGHT 8 //Calls waiting for or inside dispatch
+#define ADMIT_LATENCY_TARGET_NS 20000000LL //Smoothed admit-to-answer time that counts as overload
+#define ADMIT_RETRY_MIN_MS 50
+#define ADMIT_RETRY_MAX_MS 2000
+
+
+//Global status for all cars, grouped by bank
+Bank banks[MAX_BANKS];
+int express_floors = 0;
+int bank_count = 0;
+static pthread_mutex_t bank_registry_mutex = PTHREAD_MUTEX_INITIALIZER; //Only taken to add a bank
+
+typedef struct {
+    int in_use;
+    int client_fd;
+    int car_ref; //Set when the thread is serving an adopted car session (see car_ref()), otherwise -1
+    ConnClass klass;
+    int64_t accepted_ns;
+} thread_arg_t;
+static thread_arg_t thread_args[MAX_CLIENTS];
+static pthread_mutex_t thread_args_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ClassMetrics class_metrics[CONN_CLASS_COUNT];
+static pthread_mutex_t class_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    int in_flight;
+    long long latency_ns; //Moving average of admit-to-answer time
+    unsigned long admitted;
+    unsigned long shed;
+} admission;
+static pthread_mutex_t admission_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//status flag for graceful shutdown
+volatile sig_atomic_t shutdown_requested = 0;
+
+/*
+ * Handoff state. Every handler thread is counted in live_handlers. While a
+ * handoff is quiescing, car and not-yet-identified connections park themselves
+ * before reading their next frame and call handlers simply run to completion.
+ * The handoff proceeds once parked_handlers == live_handlers.
+ */
+typedef enum {
+    HANDOFF_IDLE,
+    HANDOFF_QUIESCING,
+    HANDOFF_DONE
+} handoff_state_t;
+
+typedef enum {
+    HANDOFF_REC_HEADER,
+    HANDOFF_REC_LISTENER,
+    HANDOFF_REC_CAR,
+    HANDOFF_REC_PENDING,
+    HANDOFF_REC_END,
+    HANDOFF_REC_ACK,
+    HANDOFF_REC_STANDBY_LISTENER,
+    HANDOFF_REC_STANDBY,
+    HANDOFF_REC_CALL_LISTENER
+} handoff_rec_type_t;
+
+//Wire image of a car. Kept separate from Car so the in-memory layout can change between builds
+typedef struct {
+    char car_name[MAX_CAR_NAME_LEN];
+    int32_t floor_min;
+    int32_t floor_max;
+    int32_t current_floor;
+    char status[BUFFER_SIZE];
+    int32_t queue[MAX_QUEUE_DEPTH];
+    int32_t queue_size;
+    char session[SESSION_TOKEN_LEN];
+    int32_t detached; //Sent without a descriptor; the car has yet to resume after a failover
+    char bank[MAX_BANK_NAME_LEN];
+    int32_t timing[4]; //CarTiming: floor, opening, open, closing (ms); 0 if never advertised
+    int32_t bids; //Registered with BIDS 1
+} handoff_car_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    uint32_t count;           //Header: number of car records that follow
+    int64_t pause_start_ns;   //Header: CLOCK_MONOTONIC time the old controller stopped accepting
+    uint32_t conn_class;      //Pending records: the listener the connection came in on
+    handoff_car_t car;        //Car records only
+} handoff_record_t;
+
+static handoff_state_t handoff_state = HANDOFF_IDLE;
+static int live_handlers = 0;
+static int parked_handlers = 0;
+static int handoff_wake[2] = {-1, -1}; //Readable while a handoff is quiescing
+static pthread_mutex_t handoff_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handoff_cond = PTHREAD_COND_INITIALIZER;
+
+typedef enum {
+    FRAME_READY,
+    FRAME_CLOSED,
+    FRAME_HANDED_OFF
+} frame_wait_t;
+
+//Function prototypes
+void *client_handler_thread(void *arg);
+int handle_car_connection(int client_fd, const char* initial_message);
+int run_car_session(Car *car);
+void sigint_handler(int signum);
+void setup_signal_handlers(void);
+int start_handler_thread(int client_fd, int car_ref, ConnClass klass);
+frame_wait_t wait_for_frame(int fd);
+
+//Live upgrade
+void handoff_address(struct sockaddr_un *addr, socklen_t *len);
+int open_handoff_listener(int retry_ms);
+int serve_handoff(int control_fd, int listen_fd, int call_listen_fd, int standby_listen_fd);
+int takeover_from_running(int *listen_fd, int *call_listen_fd, int *standby_listen_fd);
+int open_listener(int port, int quiet_if_in_use);
+int accept_loop(int listen_fd, int call_listen_fd, int control_fd, int standby_listen_fd);
+void print_bank_metrics(void);
+void print_class_metrics(void);
+
+//Scheduling Algorithm
+int schedule_request(Bank *bank, int source_floor, int dest_floor, int client_fd, int notify, char *answer, size_t answer_size);
+
+//Utility
+int parse_car_info(const char *buffer, char *name, int *min_floor, int *max_floor);
+int parse_call_info(const char *buffer, int *source, int *dest);
+int parse_status_info(const char *buffer, int *floor, char *status_buf);
+int parse_timing(const char *value, CarTiming *timing);
+void safe_write(int fd, const char *message);
+
+//The main function 
+int main(int argc, char **argv) {
+    int listen_fd = -1;
+    int call_listen_fd = -1;
+    int control_fd = -1;
+    int standby_listen_fd = -1;
+    int takeover = 0;
+    int replicate = 0;
+    int standby = 0;
+    int use_uring = 0;
+    int reoptimize = 0;
+    int rollout = 0;
+    int bid_deadline_ms = 0;
+    const char *policy = NULL;
+    int handed_off = 0;
+
+    //Only the port matters here; the controller still listens on every address
+    argc = parse_common_flags(argc, argv);
+    if (argc < 0) return EXIT_FAILURE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = 1;
+        } else if (strcmp(argv[i], "--replicate") == 0) {
+            replicate = 1;
+        } else if (strcmp(argv[i], "--standby") == 0) {
+            standby = 1;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            use_uring = 1;
+        } else if (strcmp(argv[i], "--reoptimize") == 0) {
+            reoptimize = 1;
+        } else if (strcmp(argv[i], "--rollout") == 0) {
+            rollout = 1;
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            policy = argv[++i];
+        } else if (strcmp(argv[i], "--express") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            express_floors = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bidding") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            bid_deadline_ms = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--takeover] [--replicate | --standby] [--io-uring] [--reoptimize] [--rollout] [--policy <file> | --express <floors>] [--bidding <deadline ms>] [--controller-port <port>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    //A standby becomes a replicating primary once it takes over
+    repl_init(replicate || standby);
+
+    //A full fleet needs more descriptors than the usual soft limit of 1024
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    if (policy != NULL && express_floors > 0) {
+        fprintf(stderr, "--policy and --express cannot be combined.\n");
+        return EXIT_FAILURE;
+    }
+    if (bid_deadline_ms > 0 && (policy != NULL || express_floors > 0 || rollout)) {
+        fprintf(stderr, "--bidding cannot be combined with --policy, --express or --rollout.\n");
+        return EXIT_FAILURE;
+    }
+    find_bank(DEFAULT_BANK, 1);
+    if (express_floors > 0) {
+        printf("Express service for trips of %d floors or more\n", express_floors);
+    }
+    if (policy != NULL) {
+        if (policy_load(policy) != 0) return EXIT_FAILURE;
+        printf("Dispatching by learned policy %s\n", policy);
+    }
+
+    setup_signal_handlers();
+
+    if (pipe(handoff_wake) != 0) {
+        perror("pipe() failed");
+        return EXIT_FAILURE;
+    }
+
+    if (takeover) {
+        //Adopt the listening socket and every connection from the running controller
+        if (takeover_from_running(&listen_fd, &call_listen_fd, &standby_listen_fd) != 0) {
+            fprintf(stderr, "Takeover failed, the running controller keeps serving.\n");
+            return EXIT_FAILURE;
+        }
+    } else if (standby) {
+        //Mirror the primary until it dies, then claim its port within a bounded time
+        if (repl_run_standby() != 0) {
+            return EXIT_SUCCESS;
+        }
+        struct timespec started;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        long waited_ms = 0;
+        while ((listen_fd = open_listener(controller_port(), 1)) < 0 && errno == EADDRINUSE &&
+               waited_ms < STANDBY_TAKEOVER_BOUND_MS && !shutdown_requested) {
+            struct timespec pause = {0, 5000000L}; //5ms
+            nanosleep(&pause, NULL);
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            waited_ms = (now.tv_sec - started.tv_sec) * 1000 + (now.tv_nsec - started.tv_nsec) / 1000000;
+        }
+        if (listen_fd < 0) {
+            fprintf(stderr, "Standby could not claim port %d.\n", controller_port());
+            return EXIT_FAILURE;
+        }
+        printf("Standby is now primary, listening on port %d (claimed in %ld ms)\n", controller_port(), waited_ms);
+    } else {
+        listen_fd = open_listener(controller_port(), 0);
+        if (listen_fd < 0) {
+            return EXIT_FAILURE;
+        }
+        printf("Controller listening on port %d\n", controller_port());
+    }
+
+    //Call pads get their own listener when a separate port is configured
+    if (!takeover && call_port() != controller_port()) {
+        call_listen_fd = open_listener(call_port(), 0);
+        if (call_listen_fd < 0) {
+            printf("Call port %d unavailable, call pads share port %d with the cars.\n", call_port(), controller_port());
+        } else {
+            printf("Call pads connect on port %d\n", call_port());
+        }
+    }
+
+    if (repl_issues_tokens() && standby_listen_fd < 0) {
+        standby_listen_fd = repl_open_listener();
+        if (standby_listen_fd < 0) {
+            printf("Standby socket unavailable, running without a standby.\n");
+        }
+    }
+
+    //Adopted sessions already run on handler threads, which the ring cannot serve
+    if (use_uring && takeover) {
+        printf("io_uring backend is not available with --takeover, using handler threads.\n");
+    } else if (use_uring && uring_init() != 0) {
+        printf("Falling back to handler threads.\n");
+    }
+
+    if (rollout) {
+        printf("Dispatching by rollout on %d worker threads.\n", rollout_start());
+    }
+
+    //Moving a call to another car writes to its call pad, which only the ring's thread may do
+    if (reoptimize && uring_active) {
+        printf("Re-optimizer needs handler threads, running without it.\n");
+    } else if (reoptimize && reopt_start() == 0) {
+        printf("Re-optimizing pending calls every %d ms.\n", REOPT_PERIOD_MS);
+    }
+
+    //Waiting for bids blocks the call's thread, which under the ring would be the only one
+    if (bid_deadline_ms > 0 && uring_active) {
+        printf("Bidding needs handler threads, dispatching centrally.\n");
+    } else if (bid_deadline_ms > 0 && bidding_start(bid_deadline_ms) == 0) {
+        printf("Dispatching by car bids, %d ms deadline.\n", bid_deadline_ms);
+    }
+
+    if (uring_active) {
+        //Live upgrade parks handler threads, so it only works with them
+        printf("Controller running on io_uring (live upgrade unavailable).\n");
+        uring_run(listen_fd, call_listen_fd, standby_listen_fd);
+    } else {
+        //The control socket is optional, the controller still works without live upgrade
+        control_fd = open_handoff_listener(takeover ? HANDOFF_BIND_RETRY_MS : 0);
+        if (control_fd < 0) {
+            printf("Live upgrade unavailable (control socket in use).\n");
+        }
+        handed_off = accept_loop(listen_fd, call_listen_fd, control_fd, standby_listen_fd);
+    }
+    if (handed_off) {
+        //The new process owns every socket now; exiting only drops our references
+        return EXIT_SUCCESS;
+    }
+    //Requested to be shutdown from terminal being CTRL+C
+    printf("\nShutdown signal received. Closing the listening socket.\n");
+    if(listen_fd >= 0) {
+        close(listen_fd);
+    }    
+    if (call_listen_fd >= 0) {
+        close(call_listen_fd);
+    }
+    if (control_fd >= 0) {
+        close(control_fd);
+    }
+    if (standby_listen_fd >= 0) {
+        close(standby_listen_fd);
+    }
+    print_bank_metrics();
+    print_class_metrics();
+    print_reopt_metrics();
+    print_rollout_metrics();
+    print_gateway_metrics();
+    print_bidding_metrics();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Accepts connections and starts a handler thread for each, until shutdown
+ * or until the process hands everything over to a new controller. With a
+ * separate call listener, waiting cars are always accepted before call pads.
+ * @return 1 if handed off, otherwise 0
+ */
+int accept_loop(int listen_fd, int call_listen_fd, int control_fd, int standby_listen_fd) {
+    //Without a call listener the one port serves both, and the pool is shared
+    ConnClass listen_class = (call_listen_fd >= 0) ? CONN_CAR : CONN_SHARED;
+
+    //the actual main accept loop, where we check if CTRL+C
+    while (!shutdown_requested){
+        struct pollfd pfds[4];
+        pfds[0].fd = listen_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = control_fd; //Negative fds are ignored by poll()
+        pfds[1].events = POLLIN;
+        pfds[2].fd = standby_listen_fd;
+        pfds[2].events = POLLIN;
+        pfds[3].fd = call_listen_fd;
+        pfds[3].events = POLLIN;
+        if (poll(pfds, 4, -1) < 0) {
+            if(errno == EINTR) continue; //Was interrupted by signal handler
+            perror("poll() failed");
+            break;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            //A new controller wants to take over. Nothing is accepted while this runs
+            int peer_fd = accept(control_fd, NULL, NULL);
+            if (peer_fd >= 0) {
+                if (serve_handoff(peer_fd, listen_fd, call_listen_fd, standby_listen_fd) == 0) {
+                    close(peer_fd);
+                    return 1;
+                }
+                close(peer_fd);
+            }
+            continue;
+        }
+
+        if (pfds[2].revents & POLLIN) {
+            repl_accept_standby(standby_listen_fd);
+        }
+
+        int listener = -1;
+        ConnClass klass = listen_class;
+        if (pfds[0].revents & POLLIN) {
+            listener = listen_fd;
+        } else if (pfds[3].revents & POLLIN) {
+            //Only reached once no car is waiting to be accepted
+            listener = call_listen_fd;
+            klass = CONN_CALL;
+        }
+        if (listener < 0) continue;
+        int client_fd = accept(listener, NULL, NULL);
+        if(client_fd < 0) {
+            if(errno == EINTR) continue; //Was interrupted by signal handler
+            perror("accept() failed");
+            break; //Exit the loop on other errors
+        }
+        if (start_handler_thread(client_fd, -1, klass) != 0) {
+            close(client_fd);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Looks a bank up by name. Lookups take no lock: entries below bank_count
+ * are fully initialised before bank_count is published and are never removed.
+ * @param create add the bank if it does not exist yet
+ * @return the bank, or NULL if it does not exist (or the table is full)
+ */
+Bank *find_bank(const char *name, int create) {
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(banks[i].name, name) == 0) return &banks[i];
+    }
+    if (!create || strlen(name) >= MAX_BANK_NAME_LEN) return NULL;
+
+    Bank *bank = NULL;
+    pthread_mutex_lock(&bank_registry_mutex);
+    count = bank_count;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(banks[i].name, name) == 0) bank = &banks[i];
+    }
+    if (bank == NULL && count < MAX_BANKS) {
+        bank = &banks[count];
+        memset(bank, 0, sizeof(*bank));
+        strcpy(bank->name, name);
+        pthread_mutex_init(&bank->mutex, NULL);
+        for (int c = 0; c < MAX_CARS; c++) {
+            bank->cars[c].bank_idx = count;
+        }
+        __atomic_store_n(&bank_count, count + 1, __ATOMIC_RELEASE);
+        if (strcmp(name, DEFAULT_BANK) != 0) {
+            printf("Bank %s created.\n", name);
+        }
+    }
+    pthread_mutex_unlock(&bank_registry_mutex);
+    return bank;
+}
+
+/// @brief Identifies a car entry by one int (bank and slot), for the thread argument pool
+int car_ref(const Car *car) {
+    return car->bank_idx * MAX_CARS + (int)(car - banks[car->bank_idx].cars);
+}
+
+Car *car_from_ref(int ref) {
+    return &banks[ref / MAX_CARS].cars[ref % MAX_CARS];
+}
+
+/// @brief Picks the bank a CAR or CALL message names, defaulting to DEFAULT_BANK.
+/// Only cars create banks; a call naming a bank nobody has registered in gets NULL.
+static Bank *bank_for_message(const char *message, int create) {
+    char name[MAX_BANK_NAME_LEN];
+    if (!get_msg_option(message, "BANK", name, sizeof(name))) {
+        strcpy(name, DEFAULT_BANK);
+    }
+    return find_bank(name, create);
+}
+
+/// @brief Prints per-bank counters, used on shutdown
+void print_bank_metrics(void) {
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        Bank *bank = &banks[i];
+        int car_total = 0;
+        pthread_mutex_lock(&bank->mutex);
+        for (int c = 0; c < MAX_CARS; c++) {
+            if (bank->cars[c].in_use) car_total++;
+        }
+        BankMetrics m = bank->metrics;
+        pthread_mutex_unlock(&bank->mutex);
+        printf("Bank %s: %d cars, %lu calls (%lu assigned, %lu unavailable), %lu status updates (%lu locked), avg dispatch %llu ns (%llu choosing), %lu of %lu candidates pruned\n",
+            bank->name, car_total, m.calls, m.assigned, m.unavailable, m.status_updates, m.status_locked,
+            m.calls ? m.dispatch_ns / m.calls : 0ULL, m.calls ? m.choose_ns / m.calls : 0ULL, m.pruned, m.candidates);
+    }
+}
+
+int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void note_accepted(ConnClass klass) {
+    pthread_mutex_lock(&class_metrics_mutex);
+    ClassMetrics *m = &class_metrics[klass];
+    m->accepted++;
+    m->active++;
+    if (m->active > m->peak_active) m->peak_active = m->active;
+    pthread_mutex_unlock(&class_metrics_mutex);
+}
+
+void note_rejected(ConnClass klass) {
+    pthread_mutex_lock(&class_metrics_mutex);
+    class_metrics[klass].rejected++;
+    pthread_mutex_unlock(&class_metrics_mutex);
+}
+
+/// @brief Records how long a connection waited between accept and its first frame being read
+void note_first_frame(ConnClass klass, long long waited_ns) {
+    pthread_mutex_lock(&class_metrics_mutex);
+    class_metrics[klass].wait_ns += (unsigned long long)waited_ns;
+    class_metrics[klass].waited++;
+    pthread_mutex_unlock(&class_metrics_mutex);
+}
+
+void note_closed(ConnClass klass) {
+    pthread_mutex_lock(&class_metrics_mutex);
+    class_metrics[klass].active--;
+    pthread_mutex_unlock(&class_metrics_mutex);
+}
+
+/// @brief How long a turned-away caller should wait: longer the deeper and slower the queue
+static int retry_after_ms(void) {
+    long long ms = ADMIT_RETRY_MIN_MS + admission.latency_ns / 1000000 * (admission.in_flight + 1);
+    return (int)(ms > ADMIT_RETRY_MAX_MS ? ADMIT_RETRY_MAX_MS : ms);
+}
+
+/**
+ * @brief Decides whether a call may go on to dispatch. Calls are shed once
+ * ADMIT_MAX_IN_FLIGHT are queued, or while answers are running slower than
+ * ADMIT_LATENCY_TARGET_NS and any call is still queued.
+ * @param retry_ms set to the back-off to advertise when the call is shed
+ * @return 1 if admitted (call_answered must follow), 0 if shed
+ */
+int admit_call(int *retry_ms) {
+    pthread_mutex_lock(&admission_mutex);
+    int overloaded = admission.in_flight >= ADMIT_MAX_IN_FLIGHT ||
+        (admission.latency_ns > ADMIT_LATENCY_TARGET_NS && admission.in_flight > 0);
+    if (overloaded) {
+        admission.shed++;
+        *retry_ms = retry_after_ms();
+    } else {
+        admission.admitted++;
+        admission.in_flight++;
+    }
+    pthread_mutex_unlock(&admission_mutex);
+    return !overloaded;
+}
+
+/// @brief Ends an admitted call and folds its latency into the average (weight 1/8)
+void call_answered(int64_t admitted_ns) {
+    long long took = monotonic_ns() - admitted_ns;
+    pthread_mutex_lock(&admission_mutex);
+    admission.latency_ns += (took - admission.latency_ns) / 8;
+    admission.in_flight--;
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+/// @brief Tells a call pad turned away before its CALL was read when to come back
+void send_busy(int fd) {
+    char busy[32];
+    pthread_mutex_lock(&admission_mutex);
+    admission.shed++;
+    snprintf(busy, sizeof(busy), "BUSY %d", retry_after_ms());
+    pthread_mutex_unlock(&admission_mutex);
+    send_message(fd, busy); //A fresh socket has room, this does not block
+}
+
+/// @brief Prints per-connection-class counters, used on shutdown
+void print_class_metrics(void) {
+    static const char *names[CONN_CLASS_COUNT] = {"car", "call", "shared"};
+    pthread_mutex_lock(&class_metrics_mutex);
+    for (int i = 0; i < CONN_CLASS_COUNT; i++) {
+        ClassMetrics m = class_metrics[i];
+        if (m.accepted == 0 && m.rejected == 0) continue;
+        printf("Connections %s: %lu accepted, %lu rejected, peak %d active, avg first-frame wait %llu ns\n",
+            names[i], m.accepted, m.rejected, m.peak_active,
+            m.waited ? m.wait_ns / m.waited : 0ULL);
+    }
+    pthread_mutex_unlock(&class_metrics_mutex);
+    pthread_mutex_lock(&admission_mutex);
+    if (admission.shed > 0) {
+        printf("Admission: %lu calls admitted, %lu shed with BUSY, avg answer %lld us\n",
+            admission.admitted, admission.shed, admission.latency_ns / 1000);
+    }
+    pthread_mutex_unlock(&admission_mutex);
+    if (dedupe_replayed() > 0) {
+        printf("Idempotency: %lu repeated calls answered from the dedupe table\n", dedupe_replayed());
+    }
+}
+
+/**
+ * @brief Creates the TCP socket cars and call pads connect to
+ * @return listening fd, or -1 with errno set
+ */
+int open_listener(int port, int quiet_if_in_use) {
+    struct sockaddr_in serv_addr;
+    int opt_enable = 1;
+
+    //Create a listening socket 
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("Socket() failed!");
+        return -1;
+    }
+
+    //Set address reuse option
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable)) < 0) {
+        perror("setsocketopt(SO_REUSEADDR) failed");
+        close(listen_fd);
+        return -1;
+    }
+
+    //Bind a socket to a port 
+    memset(&serv_addr, 0 , sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET; // Keep in mind ipv4 not ipv6
+    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv_addr.sin_port = htons(port);
+
+    //Bind the socket now
+    if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0 ) { //would return -1 if bad
+        int saved = errno;
+        if (saved != EADDRINUSE || !quiet_if_in_use) perror("bind() failed");
+        close(listen_fd); //close the file descriptor
+        errno = saved;
+        return -1;
+    }
+
+    //Listen for the connections
+    if (listen(listen_fd, SOMAXCONN) < 0) { //Several banks can register their cars at once
+        perror("listen() failed.");
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+/**
+ * @brief Claims a slot in the static pool and starts a detached handler thread for it.
+ * Car and call connections each draw from their own part of the pool; shared
+ * connections may take any slot.
+ * @param car_ref reference to an adopted car session, or -1 for a fresh connection
+ * @return 0 on success, -1 if the pool is full or the thread could not start
+ */
+int start_handler_thread(int client_fd, int car_ref, ConnClass klass) {
+    pthread_t thread;
+    int arg_idx = -1;
+    int first = (klass == CONN_CALL) ? CAR_CLIENT_SLOTS : 0;
+    int last = (klass == CONN_CAR) ? CAR_CLIENT_SLOTS : MAX_CLIENTS;
+    pthread_mutex_lock(&thread_args_mutex);
+    for(int i = first; i < last; i++) {
+        if(!thread_args[i].in_use) {
+            thread_args[i].in_use = 1;
+            thread_args[i].client_fd = client_fd;
+            thread_args[i].car_ref = car_ref;
+            thread_args[i].klass = klass;
+            thread_args[i].accepted_ns = monotonic_ns();
+            arg_idx = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&thread_args_mutex);
+
+    if (arg_idx == -1) {
+        printf("Max clients reached. rejecting new connection.\n");
+        note_rejected(klass);
+        //Anything but a car port may be a call pad, which can come back later
+        if (klass != CONN_CAR && car_ref < 0) send_busy(client_fd);
+        return -1;
+    }
+    note_accepted(klass);
+
+    pthread_mutex_lock(&handoff_mutex);
+    live_handlers++;
+    pthread_mutex_unlock(&handoff_mutex);
+
+    //Pass the index into static pool as arg
+    if (pthread_create(&thread, NULL, client_handler_thread, (void *)(intptr_t)arg_idx) != 0) {
+        perror("pthread_create() failed");
+        //If thread creation fails mark the arg struct as free
+        pthread_mutex_lock(&handoff_mutex);
+        live_handlers--;
+        pthread_cond_broadcast(&handoff_cond);
+        pthread_mutex_unlock(&handoff_mutex);
+        pthread_mutex_lock(&thread_args_mutex);
+        thread_args[arg_idx].in_use = 0;
+        pthread_mutex_unlock(&thread_args_mutex);
+        note_closed(klass);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/**
+ * @brief Waits until a frame can be read from fd. If a handoff starts first the
+ * calling thread parks until it either completes (FRAME_HANDED_OFF) or is aborted.
+ */
+frame_wait_t wait_for_frame(int fd) {
+    while (1) {
+        struct pollfd pfds[2];
+        pfds[0].fd = fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = handoff_wake[0];
+        pfds[1].events = POLLIN;
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return FRAME_CLOSED;
+        }
+        if (pfds[1].revents & POLLIN) {
+            pthread_mutex_lock(&handoff_mutex);
+            if (handoff_state == HANDOFF_QUIESCING) {
+                parked_handlers++;
+                pthread_cond_broadcast(&handoff_cond);
+                while (handoff_state == HANDOFF_QUIESCING) {
+                    pthread_cond_wait(&handoff_cond, &handoff_mutex);
+                }
+                parked_handlers--;
+            }
+            handoff_state_t state = handoff_state;
+            pthread_mutex_unlock(&handoff_mutex);
+            if (state == HANDOFF_DONE) return FRAME_HANDED_OFF;
+            continue;
+        }
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) return FRAME_READY;
+    }
+}
+
+/**
+ * @brief handler for a single client connection. This is designed to run in own thread
+ */
+void *client_handler_thread(void *arg) {
+    int arg_idx = (intptr_t)arg;
+    //get the client file descriptor from the static pool
+    int client_fd = thread_args[arg_idx].client_fd;
+    int adopted_ref = thread_args[arg_idx].car_ref;
+    ConnClass klass = thread_args[arg_idx].klass;
+    int64_t accepted_ns = thread_args[arg_idx].accepted_ns;
+    int handed_off = 0;
+
+    if (klass == CONN_CALL) {
+        //Car sessions win any contention for the CPU against call intake
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), CALL_THREAD_NICE);
+    }
+
+    if (adopted_ref >= 0) {
+        //Session adopted from a previous controller, registration already happened
+        handed_off = run_car_session(car_from_ref(adopted_ref));
+    } else {
+        frame_wait_t ready = wait_for_frame(client_fd);
+        char *buffer = (ready == FRAME_READY) ? receive_msg(client_fd) : NULL;
+        if (buffer != NULL) {
+            note_first_frame(klass, monotonic_ns() - accepted_ns);
+        }
+
+        if (ready == FRAME_HANDED_OFF) {
+            handed_off = 1;
+        } else if (buffer == NULL) {
+            //Client has disconnected before sending anything
+            close(client_fd);
+        } else if (strncmp(buffer, "CAR", 3) == 0) {
+            handed_off = handle_car_connection(client_fd, buffer);
+        } else if (strncmp(buffer, "CALL", 4) == 0) {
+            if (!handle_call_connection(client_fd, buffer)) {
+                close(client_fd);
+            }
+        } else if (strncmp(buffer, "GATEWAY", 7) == 0 && (buffer[7] == '\0' || buffer[7] == ' ')) {
+            handle_gateway_connection(client_fd);
+        } else {
+            close(client_fd);
+        }
+        //Free the initial buffer once handler done
+        if(buffer != NULL) {
+            free(buffer);
+        }
+    }
+    if (handed_off) {
+        //The slot stays claimed; this process is about to exit
+        return NULL;
+    }
+    pthread_mutex_lock(&thread_args_mutex);
+    thread_args[arg_idx].in_use = 0;
+    pthread_mutex_unlock(&thread_args_mutex);
+    note_closed(klass);
+    pthread_mutex_lock(&handoff_mutex);
+    live_handlers--;
+    pthread_cond_broadcast(&handoff_cond);
+    pthread_mutex_unlock(&handoff_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Registers a car from its "CAR" message and then serves its session
+ * @return 1 if the session was handed off to a new controller, otherwise 0
+ */
+int handle_car_connection(int client_fd, const char* initial_message) {
+    Car *car = register_car(client_fd, initial_message);
+    if (car == NULL) return 0;
+    return run_car_session(car);
+}
+
+/**
+ * @brief Claims (or resumes) a car table entry for a "CAR" message. Shared by the
+ * handler threads and the io_uring backend
+ * @return the car, or NULL if it was rejected (the connection is closed)
+ */
+Car *register_car(int client_fd, const char* initial_message) {
+    return register_car_via(client_fd, NULL, -1, initial_message);
+}
+
+/// @brief Turns a car away: its own connection is closed, a gateway is told "<id> REJECTED"
+static void reject_car(int client_fd, Gateway *gateway, int channel_id) {
+    if (gateway != NULL) {
+        gateway_send(gateway, channel_id, "REJECTED");
+    } else {
+        conn_close(client_fd);
+    }
+}
+
+/**
+ * @brief register_car for a car that may sit behind a gateway, which then carries
+ * its frames tagged with channel_id. gateway is NULL for a car on its own connection
+ */
+Car *register_car_via(int client_fd, Gateway *gateway, int channel_id, const char* initial_message) {
+    char car_name[BUFFER_SIZE];
+    int min_floor, max_floor;
+
+    //The initial "CAR.." line is consumed, get the next line
+
+    if(parse_car_info(initial_message, car_name, &min_floor, &max_floor) != 0) {
+        printf("Failed to parse car info.\n");
+        reject_car(client_fd, gateway, channel_id);
+        return NULL;
+    }
+
+    char token[SESSION_TOKEN_LEN];
+    int has_token = get_msg_option(initial_message, "SESSION", token, sizeof(token));
+    char timing_str[BUFFER_SIZE];
+    CarTiming timing = {0, 0, 0, 0};
+    if (get_msg_option(initial_message, "TIMING", timing_str, sizeof(timing_str)) &&
+        parse_timing(timing_str, &timing) != 0) {
+        printf("Ignoring bad timing from car %s.\n", car_name);
+    }
+    char bids_str[8];
+    int bids = get_msg_option(initial_message, "BIDS", bids_str, sizeof(bids_str)) && strcmp(bids_str, "1") == 0;
+    Bank *bank = bank_for_message(initial_message, 1);
+    if (bank == NULL) {
+        printf("Max banks reached. Rejecting car %s.\n", car_name);
+        reject_car(client_fd, gateway, channel_id);
+        return NULL;
+    }
+    Car *cars = bank->cars;
+
+    pthread_mutex_lock(&bank->mutex);
+    int car_idx = -1;
+    int resumed = 0;
+    //A car coming back after a failover picks up its replicated entry and queue
+    for (int i = 0; has_token && i < MAX_CARS; i++) {
+        if (cars[i].detached && strcmp(cars[i].session, token) == 0 &&
+            strcmp(cars[i].car_name, car_name) == 0) {
+            car_idx = i;
+            resumed = 1;
+            break;
+        }
+    }
+    for (int i = 0; car_idx == -1 && i < MAX_CARS; i++) {
+        if(!cars[i].in_use && !cars[i].detached) {
+            car_idx = i;
+            break;
+        }
+    }
+    //Entries whose car never came back are reclaimed only when the table is full
+    for (int i = 0; car_idx == -1 && i < MAX_CARS; i++) {
+        if(!cars[i].in_use) {
+            car_idx = i;
+            break;
+        }
+    }
+    if (car_idx == -1){
+        pthread_mutex_unlock(&bank->mutex);
+        printf("Max cars reached. Rejecting car %s.\n", car_name);
+        reject_car(client_fd, gateway, channel_id);
+        return NULL;
+    }
+    Car *car  = &cars[car_idx];
+    if (resumed) {
+        car->in_use = 1;
+        car->detached = 0;
+        car->socket_fd = client_fd;
+        car->gateway = gateway;
+        car->channel_id = channel_id;
+    } else {
+        //car is good to go. Let's register the new car
+        memset(car, 0, sizeof(*car));
+        car->bank_idx = (int)(bank - banks);
+        car->in_use = 1;
+        car->socket_fd = client_fd;
+        car->gateway = gateway;
+        car->channel_id = channel_id;
+        strncpy(car->car_name, car_name, sizeof(car->car_name) -1);
+        car->car_name[sizeof(car->car_name) - 1] = '\0';
+        car->floor_min = min_floor;
+        car->floor_max = max_floor;
+        car-> queue_size = 0;
+        //Initial status is unknown until the first update
+        strcpy(car->status, "Unknown");
+        car->current_floor = min_floor;
+        if (repl_issues_tokens()) {
+            repl_new_token(car->session);
+        }
+    }
+    if (timing.floor_ms > 0) {
+        car->timing = timing;
+    }
+    car->bids = bids;
+    if (repl_issues_tokens()) {
+        char session_msg[BUFFER_SIZE];
+        snprintf(session_msg, sizeof(session_msg), "SESSION %s", car->session);
+        car_send(car, session_msg);
+        repl_car_registered(car);
+        repl_car_queue(car);
+    }
+    if (resumed) {
+        //Put the car back on course for whatever it was doing before the failover
+        send_next_destination(car);
+    }
+
+    //Finished handling the data; unlock the mutex
+    pthread_mutex_unlock(&bank->mutex);
+    if (resumed) {
+        printf("Car %s resumed its session (queue size %d).\n", car_name, car->queue_size);
+    } else if (bank == &banks[0]) {
+        printf("Car %s registered (Floors %d to %d).\n", car_name, min_floor, max_floor);
+    } else {
+        printf("Car %s registered in bank %s (Floors %d to %d).\n", car_name, bank->name, min_floor, max_floor);
+    }
+    return car;
+}
+
+/**
+ * @brief Status loop for a registered car. Shared by fresh and adopted sessions
+ * @return 1 if the session was handed off to a new controller, otherwise 0
+ */
+int run_car_session(Car *car) {
+    int client_fd = car->socket_fd;
+
+    //Loop for status updates
+    while(1) {
+        frame_wait_t ready = wait_for_frame(client_fd);
+        if (ready == FRAME_HANDED_OFF) return 1;
+        if (ready == FRAME_CLOSED) break;
+        char* msg_buffer = receive_msg(client_fd);
+        if (msg_buffer == NULL) break;
+        int leaving = car_frame(car, msg_buffer);
+        free(msg_buffer);
+        if (leaving) break; // Car will disconnect and reconnect later
+    }
+    car_disconnected(car);
+    return 0;
+}
+
+/**
+ * @brief Applies one frame from a registered car
+ * @return 1 if the car is leaving (INDIVIDUAL SERVICE or EMERGENCY), otherwise 0
+ */
+int car_frame(Car *car, const char *msg_buffer) {
+    return car_frame_batched(car, msg_buffer, NULL);
+}
+
+/// @brief Takes the bank mutex, or keeps it across a batch: *held is the bank the caller already holds
+static void lock_bank(Bank *bank, Bank **held) {
+    if (held == NULL) {
+        pthread_mutex_lock(&bank->mutex);
+        return;
+    }
+    if (*held == bank) return;
+    if (*held != NULL) pthread_mutex_unlock(&(*held)->mutex);
+    pthread_mutex_lock(&bank->mutex);
+    *held = bank;
+}
+
+static void unlock_bank(Bank *bank, Bank **held) {
+    if (held == NULL) pthread_mutex_unlock(&bank->mutex);
+}
+
+/**
+ * @brief car_frame for a batch of frames (a gateway's read). With held set the bank
+ * mutex is kept from one frame to the next while they are for the same bank, and the
+ * caller releases *held once the batch is done
+ */
+int car_frame_batched(Car *car, const char *msg_buffer, Bank **held) {
+    Bank *bank = &banks[car->bank_idx];
+
+    // Check for INDIVIDUAL SERVICE or EMERGENCY mode
+    if (strcmp(msg_buffer, "INDIVIDUAL SERVICE") == 0 || strcmp(msg_buffer, "EMERGENCY") == 0) {
+        printf("Car %s entered %s mode.\n", car->car_name, msg_buffer);
+        return 1;
+    }
+
+    //An answer to a call offered to it (--bidding)
+    if (strncmp(msg_buffer, "BID ", 4) == 0) {
+        bid_received(car, msg_buffer);
+        return 0;
+    }
+
+    //A new timing profile, e.g. after the car's speed was changed
+    CarTiming timing;
+    if (strncmp(msg_buffer, "TIMING ", 7) == 0) {
+        if (parse_timing(msg_buffer + 7, &timing) != 0) {
+            printf("Ignoring bad timing from car %s.\n", car->car_name);
+            return 0;
+        }
+        lock_bank(bank, held);
+        car->timing = timing;
+        bank->version++;
+        unlock_bank(bank, held);
+        printf("Car %s timing: %d ms a floor, doors %d/%d/%d ms.\n", car->car_name,
+            timing.floor_ms, timing.opening_ms, timing.open_ms, timing.closing_ms);
+        return 0;
+    }
+
+    int floor;
+    char status_buf[BUFFER_SIZE];
+    if(parse_status_info(msg_buffer, &floor, status_buf) == 0) {
+        __atomic_add_fetch(&bank->metrics.status_updates, 1, __ATOMIC_RELAXED);
+        //Movement between stops only matters to the next dispatch, which reads the newest
+        for (int code = 0; code < MAILBOX_STATUS_COUNT; code++) {
+            if (strcmp(status_buf, mailbox_statuses[code]) == 0) {
+                uint64_t word = MAILBOX_FULL | ((uint64_t)code << 32) | (uint32_t)floor;
+                __atomic_store_n(&car->status_mailbox, word, __ATOMIC_RELEASE);
+                return 0;
+            }
+        }
+
+        //Arrivals (and anything unusual) must be seen in order; lock the bank mutex
+        lock_bank(bank, held);
+        bank->metrics.status_locked++;
+        car_sync_status(car);
+        car->current_floor = floor;
+        strncpy(car->status, status_buf, sizeof(car->status) -1);
+        car->status[sizeof(car->status) - 1] = '\0';
+        repl_car_status(car);
+
+        //If the car has arrived open the doors and service the queue
+        if(car->queue_size > 0 && car->current_floor == car->queue[0] &&
+            (strcmp(car->status, "Open") == 0 || strcmp(car->status, "Opening") == 0)) {
+            remove_from_queue(car->queue, &car->queue_size, 0);
+            pickups_arrived(car, floor);
+            bank->version++;
+            repl_car_queue(car);
+            send_next_destination(car);
+        }
+        unlock_bank(bank, held);
+    }
+    return 0;
+}
+
+/**
+ * @brief Folds the car's newest mailbox status into current_floor and status.
+ * Called with the bank mutex held by anything about to read those fields.
+ */
+void car_sync_status(Car *car) {
+    uint64_t word = __atomic_exchange_n(&car->status_mailbox, 0, __ATOMIC_ACQUIRE);
+    if (word == 0) return;
+    car->current_floor = (int32_t)(uint32_t)word;
+    strcpy(car->status, mailbox_statuses[(word >> 32) & 0xff]);
+    repl_car_status(car);
+}
+
+/// @brief Releases a car's entry once its connection is gone, and closes the connection
+/// unless a gateway shares it
+void car_disconnected(Car *car) {
+    Bank *bank = &banks[car->bank_idx];
+    int client_fd = car->socket_fd;
+
+    //The car has disconnected 
+    printf("Car %s disconnected.\n", car->car_name);
+    pthread_mutex_lock(&bank->mutex);
+    car->in_use = 0;
+    pickups_dropped(car);
+    bank->version++;
+    repl_car_dropped(car);
+    pthread_mutex_unlock(&bank->mutex);
+    if (car->gateway == NULL) conn_close(client_fd);
+}
+
+/**
+ * @brief Handler for connection from a call pad to receive a floor from and to
+ * @return 1 if the connection now belongs to the pickup (NOTIFY), otherwise 0 and the caller closes it
+ */
+int handle_call_connection(int client_fd, const char* call_message){
+    int source_floor, dest_floor;
+
+    if(call_message == NULL || parse_call_info(call_message, &source_floor, &dest_floor) != 0) {
+        printf("Failed to parse call info.\n");
+        return 0;
+    }
+
+    Bank *bank = bank_for_message(call_message, 0);
+    if (bank == NULL) {
+        conn_send(client_fd, "UNAVAILABLE");
+        printf("Call (%d->%d) names an unknown bank.\n", source_floor, dest_floor);
+        return 0;
+    }
+    printf("Received call from floor %d to %d.\n", source_floor, dest_floor);
+
+    //A repeated idempotency key gets the first call's answer and changes nothing
+    char key[DEDUPE_KEY_LEN];
+    char answer[BUFFER_SIZE];
+    int keyed = get_msg_option(call_message, "KEY", key, sizeof(key));
+    char long_key[BUFFER_SIZE];
+    if (!keyed && get_msg_option(call_message, "KEY", long_key, sizeof(long_key))) {
+        //Ignoring a key we cannot store would turn a resend into a second call
+        conn_send(client_fd, "UNAVAILABLE");
+        printf("Call (%d->%d) has a key longer than %d characters.\n", source_floor, dest_floor, DEDUPE_KEY_LEN - 1);
+        return 0;
+    }
+    int slot = -1;
+    if (keyed && dedupe_begin(key, answer, sizeof(answer), &slot)) {
+        conn_send(client_fd, answer);
+        printf("Call (%d->%d) repeats key %s, answered again: %s\n", source_floor, dest_floor, key, answer);
+        return 0;
+    }
+
+    int retry_ms;
+    if (!admit_call(&retry_ms)) {
+        char busy[32];
+        snprintf(busy, sizeof(busy), "BUSY %d", retry_ms);
+        conn_send(client_fd, busy);
+        printf("Call (%d->%d) shed, retry in %d ms.\n", source_floor, dest_floor, retry_ms);
+        if (keyed) dedupe_abandon(slot, key);
+        return 0;
+    }
+    //A pad that asks to be notified stays connected until its car picks it up
+    char notify[8];
+    int wants_notify = get_msg_option(call_message, "NOTIFY", notify, sizeof(notify)) && strcmp(notify, "1") == 0;
+    int64_t admitted_ns = monotonic_ns();
+    int kept = schedule_request(bank, source_floor, dest_floor, client_fd, wants_notify, answer, sizeof(answer));
+    call_answered(admitted_ns);
+    if (keyed) dedupe_finish(slot, key, answer);
+    return kept;
+}
+
+/**
+ * @brief Sets up the signal handlers for shutdown. This is designed to be a graceful shutodnw as outlined by the task (SIGINT).  */
+
+ void setup_signal_handlers(void) {
+    //Ignore the SIGPIPE to prevent crashing on write to closed socket
+    signal(SIGPIPE, SIG_IGN);
+
+    //Setup SIGINT (CTRL+C) handler
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigaction(SIGINT, &sa, NULL);
+
+ }
+
+
+ /**
+  * @brief A safe handler for SIGINT that is async safe
+  */
+void sigint_handler(int signum) {
+    (void)signum;
+    shutdown_requested = 1;
+}
+
+/**
+ * @brief Sends one frame to a car or call pad. Handler threads write it straight
+ * away; under the io_uring backend it is queued on the connection instead
+ */
+int conn_send(int fd, const char *message) {
+    if (uring_active) return uring_send(fd, message);
+    return send_message(fd, message);
+}
+
+/// @brief Sends one frame to a car, on its own connection or tagged with its id through its gateway
+int car_send(Car *car, const char *message) {
+    if (car->gateway != NULL) return gateway_send(car->gateway, car->channel_id, message);
+    return conn_send(car->socket_fd, message);
+}
+
+/// @brief Closes a connection once everything sent on it has gone out
+void conn_close(int fd) {
+    if (uring_active) {
+        uring_close(fd);
+    } else {
+        close(fd);
+    }
+}
+
+
+/**
+ * LIVE UPGRADE (HANDOFF)
+ */
+
+/// @brief Builds the control socket address. An abstract UNIX socket keyed on the port, so no file is left behind
+void handoff_address(struct sockaddr_un *addr, socklen_t *len) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    //sun_path[0] stays '\0' which places the name in the abstract namespace
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "elevator-controller-%d", controller_port());
+    *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+/// @brief Opens the control socket, retrying for up to retry_ms while a previous owner releases it
+/// @return listening fd or -1
+int open_handoff_listener(int retry_ms) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    handoff_address(&addr, &len);
+    int64_t deadline = monotonic_ns() + (int64_t)retry_ms * 1000000LL;
+
+    while (1) {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr *)&addr, len) == 0 && listen(fd, 1) == 0) {
+            return fd;
+        }
+        close(fd);
+        if (errno != EADDRINUSE || monotonic_ns() >= deadline) return -1;
+        struct timespec pause = {0, 1000000L}; //1ms
+        nanosleep(&pause, NULL);
+    }
+}
+
+/// @brief Sends one record, optionally carrying a file descriptor as SCM_RIGHTS ancillary data
+static int send_record(int sock, const handoff_record_t *rec, int fd) {
+    struct iovec iov;
+    struct msghdr mh;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+
+    iov.iov_base = (void *)rec;
+    iov.iov_len = sizeof(*rec);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        mh.msg_control = ctrl.buf;
+        mh.msg_controllen = sizeof(ctrl.buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    return (sendmsg(sock, &mh, 0) == (ssize_t)sizeof(*rec)) ? 0 : -1;
+}
+
+/// @brief Receives one record and the descriptor attached to it (-1 if none)
+static int recv_record(int sock, handoff_record_t *rec, int *fd) {
+    struct iovec iov;
+    struct msghdr mh;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+
+    *fd = -1;
+    iov.iov_base = rec;
+    iov.iov_len = sizeof(*rec);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl.buf;
+    mh.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n = recvmsg(sock, &mh, 0);
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); n > 0 && cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+    if (n != (ssize_t)sizeof(*rec) || rec->magic != HANDOFF_MAGIC || rec->version != HANDOFF_VERSION) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void init_record(handoff_record_t *rec, handoff_rec_type_t type) {
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = HANDOFF_MAGIC;
+    rec->version = HANDOFF_VERSION;
+    rec->type = type;
+}
+
+/// @brief Whether no live upgrade is under way; read under a bank mutex, a true answer
+/// holds until that mutex is released because the handoff locks every bank first
+int handoff_idle(void) {
+    pthread_mutex_lock(&handoff_mutex);
+    int idle = (handoff_state == HANDOFF_IDLE);
+    pthread_mutex_unlock(&handoff_mutex);
+    return idle;
+}
+
+/// @brief Releases parked handlers so they go back to serving their connections
+static void release_parked_handlers(void) {
+    char drain;
+    pthread_mutex_lock(&handoff_mutex);
+    handoff_state = HANDOFF_IDLE;
+    pthread_cond_broadcast(&handoff_cond);
+    pthread_mutex_unlock(&handoff_mutex);
+    while (read(handoff_wake[0], &drain, 1) == 1) {
+        //A single byte is ever written; this loop just empties the pipe
+        break;
+    }
+}
+
+/// @brief Releases parked handlers after a failed handoff so service continues in this process
+static void abort_handoff(void) {
+    release_parked_handlers();
+    printf("Handoff aborted, resuming service.\n");
+}
+
+/**
+ * @brief Old-process side of a live upgrade. Parks every handler, then streams the
+ * listener, the car table and all connections to the new process.
+ * @return 0 once the new process has confirmed it owns everything, -1 if aborted
+ */
+int serve_handoff(int control_fd, int listen_fd, int call_listen_fd, int standby_listen_fd) {
+    handoff_record_t rec;
+    int64_t pause_start = monotonic_ns();
+    int car_count = 0, pending_count = 0;
+
+    //A gateway's cars share one connection, which the car records cannot describe
+    if (gateways_connected() > 0) {
+        printf("Live upgrade refused while a gateway is connected.\n");
+        return -1;
+    }
+    printf("Live upgrade requested. Quiescing handlers.\n");
+    pthread_mutex_lock(&handoff_mutex);
+    handoff_state = HANDOFF_QUIESCING;
+    if (write(handoff_wake[1], "x", 1) != 1) {
+        pthread_mutex_unlock(&handoff_mutex);
+        abort_handoff();
+        return -1;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += HANDOFF_QUIESCE_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (HANDOFF_QUIESCE_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int timed_out = 0;
+    while (parked_handlers < live_handlers && !timed_out) {
+        timed_out = (pthread_cond_timedwait(&handoff_cond, &handoff_mutex, &deadline) == ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&handoff_mutex);
+    if (timed_out) {
+        abort_handoff();
+        return -1;
+    }
+
+    //Everyone is parked at a frame boundary, so the tables and sockets are stable
+    int banks_in_use = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int b = 0; b < banks_in_use; b++) {
+        pthread_mutex_lock(&banks[b].mutex);
+        for (int i = 0; i < MAX_CARS; i++) {
+            if (banks[b].cars[i].in_use || banks[b].cars[i].detached) car_count++;
+        }
+    }
+    init_record(&rec, HANDOFF_REC_HEADER);
+    rec.count = (uint32_t)car_count;
+    rec.pause_start_ns = pause_start;
+    int ok = (send_record(control_fd, &rec, -1) == 0);
+
+    init_record(&rec, HANDOFF_REC_LISTENER);
+    ok = ok && (send_record(control_fd, &rec, listen_fd) == 0);
+    if (call_listen_fd >= 0) {
+        init_record(&rec, HANDOFF_REC_CALL_LISTENER);
+        ok = ok && (send_record(control_fd, &rec, call_listen_fd) == 0);
+    }
+
+    //The standby keeps replicating from the new process instead of failing over
+    if (standby_listen_fd >= 0) {
+        init_record(&rec, HANDOFF_REC_STANDBY_LISTENER);
+        ok = ok && (send_record(control_fd, &rec, standby_listen_fd) == 0);
+    }
+    int standby_fd = repl_detach_standby();
+    if (standby_fd >= 0) {
+        init_record(&rec, HANDOFF_REC_STANDBY);
+        ok = ok && (send_record(control_fd, &rec, standby_fd) == 0);
+    }
+
+    for (int i = 0; i < banks_in_use * MAX_CARS && ok; i++) {
+        Car *car = car_from_ref(i);
+        if (!car->in_use && !car->detached) continue;
+        car_sync_status(car);
+        init_record(&rec, HANDOFF_REC_CAR);
+        memcpy(rec.car.bank, banks[car->bank_idx].name, sizeof(rec.car.bank));
+        memcpy(rec.car.car_name, car->car_name, sizeof(rec.car.car_name));
+        rec.car.floor_min = car->floor_min;
+        rec.car.floor_max = car->floor_max;
+        rec.car.current_floor = car->current_floor;
+        memcpy(rec.car.status, car->status, sizeof(rec.car.status));
+        for (int q = 0; q < car->queue_size; q++) {
+            rec.car.queue[q] = car->queue[q];
+        }
+        rec.car.queue_size = car->queue_size;
+        memcpy(rec.car.session, car->session, sizeof(rec.car.session));
+        rec.car.detached = car->detached;
+        rec.car.timing[0] = car->timing.floor_ms;
+        rec.car.timing[1] = car->timing.opening_ms;
+        rec.car.timing[2] = car->timing.open_ms;
+        rec.car.timing[3] = car->timing.closing_ms;
+        rec.car.bids = car->bids;
+        ok = (send_record(control_fd, &rec, car->detached ? -1 : car->socket_fd) == 0);
+    }
+
+    //Connections that have not identified themselves yet
+    pthread_mutex_lock(&thread_args_mutex);
+    for (int i = 0; i < MAX_CLIENTS && ok; i++) {
+        if (!thread_args[i].in_use || thread_args[i].car_ref >= 0) continue;
+        int is_car = 0;
+        for (int c = 0; c < banks_in_use * MAX_CARS; c++) {
+            const Car *car = car_from_ref(c);
+            if (car->in_use && car->socket_fd == thread_args[i].client_fd) is_car = 1;
+        }
+        if (is_car) continue;
+        init_record(&rec, HANDOFF_REC_PENDING);
+        rec.conn_class = thread_args[i].klass;
+        ok = (send_record(control_fd, &rec, thread_args[i].client_fd) == 0);
+        pending_count++;
+    }
+    pthread_mutex_unlock(&thread_args_mutex);
+    for (int b = banks_in_use - 1; b >= 0; b--) {
+        pthread_mutex_unlock(&banks[b].mutex);
+    }
+
+    init_record(&rec, HANDOFF_REC_END);
+    ok = ok && (send_record(control_fd, &rec, -1) == 0);
+
+    //Wait for the new process to confirm it is serving
+    struct pollfd pfd;
+    pfd.fd = control_fd;
+    pfd.events = POLLIN;
+    int fd;
+    if (!ok || poll(&pfd, 1, HANDOFF_ACK_TIMEOUT_MS) <= 0 ||
+        recv_record(control_fd, &rec, &fd) != 0 || rec.type != HANDOFF_REC_ACK) {
+        abort_handoff();
+        if (standby_fd >= 0) {
+            repl_adopt_standby(standby_fd);
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(&handoff_mutex);
+    handoff_state = HANDOFF_DONE;
+    pthread_cond_broadcast(&handoff_cond);
+    pthread_mutex_unlock(&handoff_mutex);
+    printf("Handed off %d cars and %d pending connections. Pause %ld us.\n",
+        car_count, pending_count, (long)((monotonic_ns() - pause_start) / 1000));
+    return 0;
+}
+
+/**
+ * @brief New-process side of a live upgrade. Receives the listener and the car
+ * table, restarts a handler for every connection and then confirms.
+ * @return 0 on success with *listen_fd set, -1 if nothing was adopted
+ */
+int takeover_from_running(int *listen_fd, int *call_listen_fd, int *standby_listen_fd) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    handoff_record_t rec;
+    int fd;
+    int adopted_cars = 0, adopted_pending = 0;
+
+    handoff_address(&addr, &len);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, len) != 0) {
+        perror("connect() to running controller failed");
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+
+    if (recv_record(sock, &rec, &fd) != 0 || rec.type != HANDOFF_REC_HEADER) {
+        fprintf(stderr, "Running controller sent no handoff header (version mismatch?).\n");
+        close(sock);
+        return -1;
+    }
+    int64_t pause_start = rec.pause_start_ns;
+
+    //Adopted handlers stay parked until the old process has let go (see the ACK below)
+    pthread_mutex_lock(&handoff_mutex);
+    handoff_state = HANDOFF_QUIESCING;
+    int woke = (write(handoff_wake[1], "x", 1) == 1);
+    pthread_mutex_unlock(&handoff_mutex);
+
+    *listen_fd = -1;
+    *call_listen_fd = -1;
+    *standby_listen_fd = -1;
+    int standby_fd = -1;
+    int ok = woke;
+    while (ok) {
+        if (recv_record(sock, &rec, &fd) != 0) {
+            ok = 0;
+            break;
+        }
+        if (rec.type == HANDOFF_REC_END) break;
+        if (rec.type == HANDOFF_REC_LISTENER) {
+            *listen_fd = fd;
+        } else if (rec.type == HANDOFF_REC_CALL_LISTENER) {
+            *call_listen_fd = fd;
+        } else if (rec.type == HANDOFF_REC_STANDBY_LISTENER) {
+            *standby_listen_fd = fd;
+        } else if (rec.type == HANDOFF_REC_STANDBY) {
+            standby_fd = fd;
+        } else if (rec.type == HANDOFF_REC_CAR && (fd >= 0 || rec.car.detached) &&
+                   rec.car.queue_size >= 0 && rec.car.queue_size <= MAX_QUEUE_DEPTH) {
+            rec.car.bank[sizeof(rec.car.bank) - 1] = '\0';
+            Bank *bank = find_bank(rec.car.bank, 1);
+            Car *car = NULL;
+            if (bank != NULL) {
+                pthread_mutex_lock(&bank->mutex);
+                for (int i = 0; i < MAX_CARS && car == NULL; i++) {
+                    if (!bank->cars[i].in_use && !bank->cars[i].detached) car = &bank->cars[i];
+                }
+            }
+            if (car != NULL) {
+                memset(car, 0, sizeof(*car));
+                car->bank_idx = (int)(bank - banks);
+                car->in_use = 1;
+                car->socket_fd = fd;
+                memcpy(car->car_name, rec.car.car_name, sizeof(car->car_name));
+                car->car_name[sizeof(car->car_name) - 1] = '\0';
+                car->floor_min = rec.car.floor_min;
+                car->floor_max = rec.car.floor_max;
+                car->current_floor = rec.car.current_floor;
+                memcpy(car->status, rec.car.status, sizeof(car->status));
+                car->status[sizeof(car->status) - 1] = '\0';
+                for (int q = 0; q < rec.car.queue_size; q++) {
+                    car->queue[q] = rec.car.queue[q];
+                }
+                car->queue_size = rec.car.queue_size;
+                car->untracked = car->queue_size > 0; //Pickups are not handed over
+                car->timing.floor_ms = rec.car.timing[0];
+                car->timing.opening_ms = rec.car.timing[1];
+                car->timing.open_ms = rec.car.timing[2];
+                car->timing.closing_ms = rec.car.timing[3];
+                car->bids = rec.car.bids;
+                memcpy(car->session, rec.car.session, sizeof(car->session));
+                car->session[sizeof(car->session) - 1] = '\0';
+                if (rec.car.detached) {
+                    //Still waiting for its car to come back after a failover
+                    car->in_use = 0;
+                    car->detached = 1;
+                    car->socket_fd = -1;
+                }
+            }
+            if (bank != NULL) {
+                pthread_mutex_unlock(&bank->mutex);
+            }
+            //The listeners come first in the stream, so the pool split is already known
+            ConnClass klass = (*call_listen_fd >= 0) ? CONN_CAR : CONN_SHARED;
+            if (car == NULL || (fd >= 0 && start_handler_thread(fd, car_ref(car), klass) != 0)) {
+                ok = 0;
+            } else {
+                adopted_cars++;
+            }
+        } else if (rec.type == HANDOFF_REC_PENDING && fd >= 0 && rec.conn_class < CONN_CLASS_COUNT) {
+            if (start_handler_thread(fd, -1, (ConnClass)rec.conn_class) != 0) {
+                ok = 0;
+            } else {
+                adopted_pending++;
+            }
+        } else {
+            ok = 0;
+        }
+    }
+
+    if (!ok || *listen_fd < 0) {
+        //Nothing has been acknowledged, so the old controller rolls back and keeps serving
+        fprintf(stderr, "Handoff stream was incomplete.\n");
+        close(sock);
+        return -1;
+    }
+
+    init_record(&rec, HANDOFF_REC_ACK);
+    if (send_record(sock, &rec, -1) != 0) {
+        close(sock);
+        return -1;
+    }
+    close(sock);
+    release_parked_handlers();
+    if (standby_fd >= 0) {
+        //Resync the standby from this process's table
+        repl_adopt_standby(standby_fd);
+    }
+    printf("Controller took over on port %d: %d cars, %d pending connections. Pause %ld us.\n",
+        controller_port(), adopted_cars, adopted_pending, (long)((monotonic_ns() - pause_start) / 1000));
+    return 0;
+}
+
+
+/**
+ * SCHEDULING LOGIC 
+ */
+
+ /// @brief Schedules a request by finding the best car for a request and then updating thh queue
+ /// @param source_floor The floor the request came from
+ /// @param dest_floor  The floor that the ekevator will need to go to after they go to the source floor
+ /// @param client_fd Client file descriptor 
+ /// @param notify the call pad asked to hear about reassignments (NOTIFY)
+ /// @param answer receives the reply sent to the client, for replaying a repeated call
+ /// @return 1 if the pickup keeps client_fd open for reassignment notices, otherwise 0
+ int schedule_request(Bank *bank, int source_floor, int dest_floor, int client_fd, int notify, char *answer, size_t answer_size) {
+    int kept = 0, queue_size = 0;
+    char car_name[MAX_CAR_NAME_LEN];
+    Car *cars = bank->cars;
+    struct timespec started, chosen, finished;
+    //Lock the mutex as we find the best, so no one can change it 
+    pthread_mutex_lock(&bank->mutex);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    bank->metrics.calls++;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (cars[i].in_use) car_sync_status(&cars[i]);
+    }
+    rollout_observe(bank, source_floor, dest_floor);
+    //With --bidding the cars price the call first; the bank mutex is released while they do
+    int pickup_idx = 0, dropoff_idx = 0;
+    long long waited_ns = 0;
+    int best_car_idx = -1, awarded = 0;
+    if (bidding_deadline_ms > 0) {
+        best_car_idx = bidding_award(bank, source_floor, dest_floor, &pickup_idx, &dropoff_idx, &waited_ns);
+        awarded = (best_car_idx != -1);
+    }
+    if (!awarded) {
+        for (int i = 0; waited_ns > 0 && i < MAX_CARS; i++) {
+            if (cars[i].in_use) car_sync_status(&cars[i]);
+        }
+        ChoiceStats choice = {0, 0};
+        best_car_idx = (express_floors > 0) ? express_choice(cars, source_floor, dest_floor, express_floors, &choice)
+            : policy_choice(cars, source_floor, dest_floor, &choice);
+        bank->metrics.candidates += choice.candidates;
+        bank->metrics.pruned += choice.pruned;
+        if (best_car_idx != -1) {
+            best_car_idx = rollout_choose(bank, source_floor, dest_floor, best_car_idx);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &chosen);
+    if (best_car_idx != -1) {
+        //No error 
+        Car *chosen_car = &cars[best_car_idx];
+        int old_head = (chosen_car->queue_size > 0) ? chosen_car->queue[0] : -1000;
+
+        if (awarded) {
+            bidding_apply(chosen_car, source_floor, dest_floor, pickup_idx, dropoff_idx);
+        } else {
+            plan_insertion(chosen_car, source_floor, dest_floor);
+        }
+        kept = pickup_add(chosen_car, source_floor, dest_floor, notify ? client_fd : -1);
+        bank->version++;
+        repl_car_queue(chosen_car);
+        snprintf(answer, answer_size, "CAR %s", chosen_car->car_name);
+        conn_send(client_fd, answer);
+        strcpy(car_name, chosen_car->car_name);
+        queue_size = chosen_car->queue_size;
+
+        //If the head of the queue has changed send a new destination
+        if (chosen_car->queue[0] != old_head) {
+            send_next_destination(chosen_car);
+        }
+        bank->metrics.assigned++;
+    } else {
+        snprintf(answer, answer_size, "UNAVAILABLE");
+        conn_send(client_fd, answer);
+        bank->metrics.unavailable++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    //Time waiting for bids was spent without the lock (see print_bidding_metrics)
+    bank->metrics.choose_ns += (unsigned long long)((chosen.tv_sec - started.tv_sec) * 1000000000LL +
+        (chosen.tv_nsec - started.tv_nsec) - waited_ns);
+    bank->metrics.dispatch_ns += (unsigned long long)((finished.tv_sec - started.tv_sec) * 1000000000LL +
+        (finished.tv_nsec - started.tv_nsec) - waited_ns);
+    //We are done so unlock the mutex
+    pthread_mutex_unlock(&bank->mutex);
+
+    //Logged after unlocking: stdout is shared by every bank's handlers
+    if (best_car_idx != -1) {
+        printf("Assigned call (%d->%d) to Car %s. New queue size: %d\n",
+        source_floor, dest_floor, car_name, queue_size);
+    } else {
+        printf("Call (%d->%d) is unavailable.\n", source_floor, dest_floor);
+    }
+    return kept;
+ }
+
+
+
+ /**
+  * Queue management
+  */
+
+  void send_next_destination(Car *car) {
+    if (car->queue_size > 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "FLOOR %d", car->queue[0]);
+        car_send(car, msg);
+    }
+  }
+
+
+int parse_car_info(const char *buffer, char *name, int *min_floor, int *max_floor) {
+    char min_str[MAX_FLOOR_STR_LEN], max_str[MAX_FLOOR_STR_LEN];
+    if (sscanf(buffer, "CAR %s %s %s", name, min_str, max_str) != 3) {
+        return -1;
+    }
+    *min_floor = floor_to_int(min_str);
+    *max_floor = floor_to_int(max_str);
+    return 0;
+}
+int parse_call_info(const char *buffer, int *source, int *dest){
+    char source_str[MAX_FLOOR_STR_LEN], dest_str[MAX_FLOOR_STR_LEN];
+    if (sscanf(buffer, "CALL %s %s", source_str, dest_str) != 2) {
+        return -1;
+    }
+    *source = floor_to_int(source_str);
+    *dest = floor_to_int(dest_str);
+    return 0;
+}
+/// @brief Parses a TIMING value, "floor,opening,open,closing" in ms
+int parse_timing(const char *value, CarTiming *timing) {
+    CarTiming t;
+    if (sscanf(value, "%d,%d,%d,%d", &t.floor_ms, &t.opening_ms, &t.open_ms, &t.closing_ms) != 4) {
+        return -1;
+    }
+    if (t.floor_ms <= 0 || t.floor_ms > TIMING_MAX_MS || t.opening_ms < 0 || t.opening_ms > TIMING_MAX_MS ||
+        t.open_ms < 0 || t.open_ms > TIMING_MAX_MS || t.closing_ms < 0 || t.closing_ms > TIMING_MAX_MS) {
+        return -1;
+    }
+    *timing = t;
+    return 0;
+}
+int parse_status_info(const char *buffer, int *floor, char *status_buf) {
+    char floor_str[MAX_FLOOR_STR_LEN];
+    char dest_str [MAX_FLOOR_STR_LEN];
+    // The format is: STATUS <status> <current_floor> <dest_floor>
+    // But we only care about status and current_floor
+    int result = sscanf(buffer, "STATUS %s %s %s", status_buf, floor_str, dest_str);
+    if (result < 2) {
+        return -1;
+    }
+    *floor = floor_to_int(floor_str);
+    return 0;
+}
+
+ void safe_write(int fd, const char *message) {
+    if (write(fd, message, strlen(message)) < 0) {
+        perror("write failed");
+    }
 }
\ No newline at end of file
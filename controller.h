@@ -0,0 +1,275 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+/**
+ * Definitions shared between the controller's modules (controller.c, the
+ * replication code, the io_uring backend and the call dedupe table). Cars are grouped into banks;
+ * each bank owns its car table, its mutex and its metrics, so work in one bank
+ * never waits on another. The bank table lives in controller.c; other modules only touch a
+ * bank's cars while holding that bank's mutex.
+ */
+
+#include "shared.h"
+#include <pthread.h>
+#include <signal.h>
+
+#define MAX_CARS 10 //Per bank
+#define MAX_BANKS 128 //Enough for a 1,000-car fleet
+#define CAR_CLIENT_SLOTS (MAX_BANKS * MAX_CARS)
+#define CALL_CLIENT_SLOTS 20
+#define MAX_CLIENTS (CAR_CLIENT_SLOTS + CALL_CLIENT_SLOTS) // Cars + some call pads
+#define MAX_QUEUE_DEPTH 20
+#define BUFFER_SIZE 256
+#define MAX_FLOOR_STR_LEN 8 // "B99" + null
+#define MAX_CAR_NAME_LEN 128 //half of max buffer size to ensure no memory overflow
+#define SESSION_TOKEN_LEN 17 //16 hex digits + null
+#define DEFAULT_BANK "default" //Cars and calls that do not name a bank
+
+
+typedef enum {
+    DIR_UP,
+    DIR_DOWN,
+    DIR_IDLE
+} Direction;
+
+
+//A call assigned to a car, kept until the rider gets off so the re-optimizer can move it
+#define MAX_PICKUPS MAX_QUEUE_DEPTH
+typedef struct {
+    int source;
+    int dest;
+    int boarded; //The car has opened at the source floor
+    int notify_fd; //Call pad (NOTIFY 1) told about reassignments, or -1
+} Pickup;
+
+//How long a car takes to travel and to stop, from its TIMING advertisement
+//("TIMING floor,opening,open,closing" in ms, on registration or on its own).
+//All 0 until the car advertises; car_floor_ms and car_stop_ms then guess
+#define TIMING_GUESS_MS 50 //Per floor, and per door phase
+#define TIMING_MAX_MS 60000
+typedef struct {
+    int floor_ms;
+    int opening_ms;
+    int open_ms; //Dwell with the doors open
+    int closing_ms;
+} CarTiming;
+
+//A connection carrying many cars' frames, see gateway.c
+typedef struct Gateway Gateway;
+
+//Represent the state of a single elevator car
+
+typedef struct {
+    int in_use;
+    int socket_fd;
+    char car_name[MAX_CAR_NAME_LEN];
+    int floor_min;
+    int floor_max;
+
+    //A real-time status
+    int current_floor;
+    char status[BUFFER_SIZE];
+    //Newest STATUS not yet folded into the two fields above (see car_sync_status), 0 if none
+    uint64_t status_mailbox;
+    CarTiming timing;
+
+    //scheduling queue
+    int queue[MAX_QUEUE_DEPTH];
+    int queue_size;
+    //The calls behind the queue. untracked is set while the queue holds stops no
+    //pickup accounts for (adopted or restored queues); such stops are never moved
+    Pickup pickups[MAX_PICKUPS];
+    int pickup_count;
+    int untracked;
+
+    //Failover: the token a car presents to resume this entry, and whether the
+    //entry is waiting for its car to reconnect (no socket, not schedulable)
+    char session[SESSION_TOKEN_LEN];
+    int detached;
+
+    int bank_idx; //Which bank's table this entry belongs to
+
+    //Set when the car talks through a gateway (socket_fd is then the gateway's),
+    //whose frames for it carry channel_id
+    Gateway *gateway;
+    int channel_id;
+
+    int bids; //Answers BID offers with its own cost ("CAR ... BIDS 1"), see bidding.c
+} Car;
+
+//What the greedy rule did with one call's candidate cars (greedy_choice)
+typedef struct {
+    int candidates;
+    int pruned; //Ruled out by their lower bound, queue never walked
+} ChoiceStats;
+
+//Counters kept per bank, updated under the bank's mutex
+typedef struct {
+    unsigned long calls;
+    unsigned long assigned;
+    unsigned long unavailable;
+    unsigned long status_updates; //Every STATUS frame, counted without the lock
+    unsigned long status_locked; //STATUS frames that took the bank mutex
+    unsigned long long dispatch_ns; //Time spent placing calls, bank lock held
+    unsigned long long choose_ns; //...of which weighing the candidate cars
+    unsigned long candidates; //Cars the greedy rule could have given calls to
+    unsigned long pruned; //...that it ruled out without walking their queues
+    unsigned long reopt_passes;
+    unsigned long reopt_moved; //Pickups re-planned by the optimizer
+    unsigned long reopt_reassigned; //...of which went to another car
+    unsigned long reopt_stale; //Plans dropped because the bank changed meanwhile
+} BankMetrics;
+
+//One scheduling shard: a named group of cars with its own lock
+typedef struct {
+    char name[MAX_BANK_NAME_LEN];
+    Car cars[MAX_CARS];
+    pthread_mutex_t mutex;
+    unsigned long version; //Bumped on every queue change, so the re-optimizer can tell its snapshot is current
+    BankMetrics metrics;
+} Bank;
+
+//Which listener a connection came in on. With a separate call port each class has
+//its own share of the handler pool and call handling yields to car traffic; on a
+//single shared port every connection is CONN_SHARED and takes any free slot
+typedef enum {
+    CONN_CAR,
+    CONN_CALL,
+    CONN_SHARED,
+    CONN_CLASS_COUNT
+} ConnClass;
+
+//Per listener counters, see note_* in controller.c
+typedef struct {
+    unsigned long accepted;
+    unsigned long rejected; //No capacity left for this class
+    int active;
+    int peak_active;
+    unsigned long long wait_ns; //Accept to first frame handled, summed
+    unsigned long waited; //Connections included in wait_ns
+} ClassMetrics;
+
+//Banks are appended (never removed) so readers only need bank_count
+extern Bank banks[MAX_BANKS];
+extern int bank_count;
+extern volatile sig_atomic_t shutdown_requested;
+
+Bank *find_bank(const char *name, int create);
+Car *car_from_ref(int car_ref);
+void car_sync_status(Car *car);
+int car_ref(const Car *car);
+
+//Connection I/O for replies, so the same code runs under either backend
+int conn_send(int fd, const char *message);
+int car_send(Car *car, const char *message);
+void conn_close(int fd);
+
+//Per-class queueing metrics, shared by both backends
+void note_accepted(ConnClass klass);
+void note_rejected(ConnClass klass);
+void note_first_frame(ConnClass klass, long long waited_ns);
+void note_closed(ConnClass klass);
+int64_t monotonic_ns(void);
+
+//Idempotency keys for calls (dedupe.c), at most DEDUPE_KEY_LEN - 1 characters
+int dedupe_begin(const char *key, char *answer, size_t size, int *slot);
+void dedupe_finish(int slot, const char *key, const char *answer);
+void dedupe_abandon(int slot, const char *key);
+unsigned long dedupe_replayed(void);
+
+//Admission control for calls, see admit_call in controller.c
+int admit_call(int *retry_ms);
+void call_answered(int64_t admitted_ns);
+void send_busy(int fd);
+
+//Car and call handling, shared by the handler threads and the io_uring backend
+Car *register_car(int client_fd, const char *initial_message);
+Car *register_car_via(int client_fd, Gateway *gateway, int channel_id, const char *initial_message);
+int car_frame(Car *car, const char *message);
+int car_frame_batched(Car *car, const char *message, Bank **held);
+void car_disconnected(Car *car);
+int handle_call_connection(int client_fd, const char *call_message);
+
+//Multiplexed car channel (gateway.c). Served on handler threads only
+#define GATEWAY_MAX_CARS CAR_CLIENT_SLOTS //Car ids run from 0 to one less
+void handle_gateway_connection(int client_fd);
+int gateway_send(Gateway *gateway, int channel_id, const char *message);
+int gateways_connected(void);
+void print_gateway_metrics(void);
+
+//io_uring backend (uring.c). uring_init returns -1 (and leaves uring_active 0) when
+//the kernel lacks a feature it needs, so the caller can fall back to handler threads
+extern int uring_active;
+int uring_init(void);
+void uring_run(int listen_fd, int call_listen_fd, int standby_listen_fd);
+int uring_send(int fd, const char *message);
+void uring_close(int fd);
+
+//Queue management and the greedy rule (schedule.c)
+void insert_into_queue(int *queue, int *size, int index, int value);
+void remove_from_queue(int *queue, int *size, int index);
+void send_next_destination(Car *car);
+int calculate_insertion_cost(const Car *car, int source, int dest, int *pickup_idx, int *final_len);
+void plan_insertion(Car *car, int source_floor, int dest_floor);
+int greedy_choice(const Car *cars, int source_floor, int dest_floor, ChoiceStats *stats);
+int car_effective_floor(const Car *car);
+//Greedy ranking, lower is better: pickup index, final queue length, floors
+//from the pickup (at most 1098, B99 to 999) and car index, packed into one int
+#define GREEDY_RANK(pickup, len, dist, idx) ((((pickup) * 32 + (len)) * 2048 + (dist)) * 16 + (idx))
+int car_floor_ms(const Car *car);
+int car_stop_ms(const Car *car);
+
+//Express service (--express <floors>): trips at least express_floors long are
+//grouped onto cars that take no shorter ones. 0 when off
+extern int express_floors;
+int express_accepts(const Car *car, int source_floor, int dest_floor, int floors);
+int express_choice(const Car *cars, int source_floor, int dest_floor, int floors, ChoiceStats *stats);
+
+//Learned dispatch policy (policy.c), trained offline by train-policy
+#define POLICY_VERSION 1
+#define POLICY_BUCKETS 5
+#define POLICY_CELLS (POLICY_BUCKETS * POLICY_BUCKETS * POLICY_BUCKETS * 3)
+int policy_cell(const Car *car, int source, int dest, int pickup_idx);
+int policy_pick(const int16_t *costs, const Car *cars, int source, int dest);
+int policy_write(const char *path, const int16_t *costs, uint32_t trained_calls);
+int policy_load(const char *path);
+int policy_choice(const Car *cars, int source, int dest, ChoiceStats *stats);
+
+//Monte Carlo rollout dispatch (rollout.c). Both calls expect the bank mutex held
+void rollout_observe(Bank *bank, int source, int dest);
+int rollout_choose(Bank *bank, int source, int dest, int greedy);
+int rollout_start(void);
+void print_rollout_metrics(void);
+
+//Contract-net dispatch (bidding.c). bidding_award and bidding_apply expect the bank mutex held
+extern int bidding_deadline_ms; //0 when off
+int bidding_start(int deadline_ms);
+int bidding_award(Bank *bank, int source, int dest, int *pickup, int *dropoff, long long *waited_ns);
+void bidding_apply(Car *car, int source, int dest, int pickup, int dropoff);
+void bid_received(const Car *car, const char *message);
+void print_bidding_metrics(void);
+
+//Pickup tracking and the background re-optimizer (reopt.c). The pickup_* calls expect the bank mutex held
+int pickup_add(Car *car, int source, int dest, int notify_fd);
+void pickups_arrived(Car *car, int floor);
+void pickups_dropped(Car *car);
+#define REOPT_PERIOD_MS 100
+int reopt_start(void);
+int handoff_idle(void);
+void print_reopt_metrics(void);
+
+//Hot standby replication (replication.c). The repl_car_* calls expect the car's bank mutex held
+void repl_init(int issue_tokens);
+int repl_issues_tokens(void);
+void repl_new_token(char *out);
+int repl_open_listener(void);
+void repl_accept_standby(int listen_fd);
+void repl_adopt_standby(int fd);
+int repl_detach_standby(void);
+void repl_car_registered(const Car *car);
+void repl_car_status(const Car *car);
+void repl_car_queue(const Car *car);
+void repl_car_dropped(const Car *car);
+int repl_run_standby(void);
+
+#endif
@@ -0,0 +1,179 @@
+/**
+ * Idempotency keys for CALL requests.
+ *
+ * A call pad may add " KEY <token>" to its CALL. The first call with a key is
+ * scheduled as usual and its answer ("CAR x" or "UNAVAILABLE") is kept here for
+ * DEDUPE_TTL_MS; a repeat of the key within that time gets the same answer
+ * without touching any queue, so a pad can safely retry a call whose answer was
+ * lost, or send the same call twice at once.
+ *
+ * The table is a fixed array probed linearly from the key's hash, at most
+ * DEDUPE_MAX_PROBE slots. Lookups take no lock: each slot is guarded by a
+ * sequence counter that writers make odd while they change the slot, and a
+ * reader that sees it change simply reads again. Writers (claiming a new key,
+ * storing its answer) are serialised by one mutex. Slots are never emptied, so
+ * probe chains stay intact; an expired or abandoned slot is reused in place and
+ * when a whole probe window is live the oldest entry in it is evicted.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <time.h>
+
+#define DEDUPE_SLOTS 4096 //Power of two
+#define DEDUPE_MAX_PROBE 16
+#define DEDUPE_TTL_MS 30000 //How long an answer is replayed for
+#define DEDUPE_PENDING_MS 2000 //A claim not answered by then is treated as abandoned
+#define DEDUPE_ANSWER_LEN (MAX_CAR_NAME_LEN + 8) //"CAR <name>" or UNAVAILABLE
+
+typedef enum {
+    SLOT_FREE, //Never used, or abandoned (hash still set so probing continues past it)
+    SLOT_PENDING, //Claimed, the call is being scheduled
+    SLOT_DONE
+} slot_state_t;
+
+typedef struct {
+    uint32_t seq; //Odd while a writer is changing the slot
+    uint64_t hash; //0 until the slot is first used
+    slot_state_t state;
+    int64_t stamp_ns; //When it was claimed, or answered
+    char key[DEDUPE_KEY_LEN];
+    char answer[DEDUPE_ANSWER_LEN];
+} dedupe_slot_t;
+
+static dedupe_slot_t slots[DEDUPE_SLOTS];
+static pthread_mutex_t dedupe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long replayed;
+
+static uint64_t key_hash(const char *key) {
+    uint64_t h = 14695981039346656037ULL; //FNV-1a
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/// @brief Copies a slot without locking, retrying while a writer is in it
+static void read_slot(int idx, dedupe_slot_t *out) {
+    dedupe_slot_t *slot = &slots[idx];
+    for (;;) {
+        uint32_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        memcpy(out, slot, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == before) return;
+    }
+}
+
+/// @brief Rewrites a slot. Caller holds dedupe_mutex
+static void write_slot(int idx, uint64_t hash, slot_state_t state, const char *key, const char *answer) {
+    dedupe_slot_t *slot = &slots[idx];
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->hash = hash;
+    slot->state = state;
+    slot->stamp_ns = monotonic_ns();
+    if (key != NULL) snprintf(slot->key, sizeof(slot->key), "%s", key);
+    if (answer != NULL) snprintf(slot->answer, sizeof(slot->answer), "%s", answer);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int slot_live(const dedupe_slot_t *slot, int64_t now) {
+    if (slot->state == SLOT_DONE) return now - slot->stamp_ns < DEDUPE_TTL_MS * 1000000LL;
+    if (slot->state == SLOT_PENDING) return now - slot->stamp_ns < DEDUPE_PENDING_MS * 1000000LL;
+    return 0;
+}
+
+/**
+ * @brief Finds the live slot holding key
+ * @return slot index with a copy in *out, or -1
+ */
+static int find_key(const char *key, uint64_t hash, dedupe_slot_t *out) {
+    int64_t now = monotonic_ns();
+    for (int i = 0; i < DEDUPE_MAX_PROBE; i++) {
+        int idx = (int)((hash + i) & (DEDUPE_SLOTS - 1));
+        read_slot(idx, out);
+        if (out->hash == 0) return -1; //End of the chain
+        if (out->hash == hash && slot_live(out, now) && strcmp(out->key, key) == 0) return idx;
+    }
+    return -1;
+}
+
+/**
+ * @brief Starts a keyed call. If the key has been answered already the answer is
+ * copied out; if another connection is still scheduling it, waits for that.
+ * Otherwise the key is claimed for the caller, who must follow with
+ * dedupe_finish or dedupe_abandon.
+ * @param slot set to the claimed slot
+ * @return 1 if answer holds the earlier answer, 0 if the key was claimed
+ */
+int dedupe_begin(const char *key, char *answer, size_t size, int *slot) {
+    uint64_t hash = key_hash(key);
+    dedupe_slot_t copy;
+    for (;;) {
+        //Repeats normally end here without taking the lock
+        int idx = find_key(key, hash, &copy);
+        if (idx >= 0 && copy.state == SLOT_DONE) {
+            snprintf(answer, size, "%s", copy.answer);
+            __atomic_add_fetch(&replayed, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (idx >= 0) {
+            //A twin is being scheduled right now; its answer is ours too
+            struct timespec pause = {0, 1000000L};
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        pthread_mutex_lock(&dedupe_mutex);
+        if (find_key(key, hash, &copy) >= 0) {
+            pthread_mutex_unlock(&dedupe_mutex);
+            continue; //Claimed while we were getting the lock
+        }
+        int64_t now = monotonic_ns();
+        int chosen = -1;
+        int oldest = -1;
+        for (int i = 0; i < DEDUPE_MAX_PROBE; i++) {
+            int idx = (int)((hash + i) & (DEDUPE_SLOTS - 1));
+            dedupe_slot_t *s = &slots[idx];
+            if (s->hash == 0 || !slot_live(s, now)) {
+                chosen = idx;
+                break;
+            }
+            //Evict answers before claims still being scheduled
+            if (oldest < 0 || (s->state == SLOT_DONE && slots[oldest].state != SLOT_DONE) ||
+                (s->state == slots[oldest].state && s->stamp_ns < slots[oldest].stamp_ns)) {
+                oldest = idx;
+            }
+        }
+        if (chosen < 0) chosen = oldest; //Window full: the oldest answer goes
+        write_slot(chosen, hash, SLOT_PENDING, key, "");
+        pthread_mutex_unlock(&dedupe_mutex);
+        *slot = chosen;
+        return 0;
+    }
+}
+
+/// @brief Whether the claim is still ours: a slow claim may have been evicted or expired
+static int still_claimed(int slot, const char *key) {
+    return slots[slot].state == SLOT_PENDING && strcmp(slots[slot].key, key) == 0;
+}
+
+/// @brief Stores the answer for a key claimed with dedupe_begin
+void dedupe_finish(int slot, const char *key, const char *answer) {
+    pthread_mutex_lock(&dedupe_mutex);
+    if (still_claimed(slot, key)) write_slot(slot, slots[slot].hash, SLOT_DONE, NULL, answer);
+    pthread_mutex_unlock(&dedupe_mutex);
+}
+
+/// @brief Releases a claimed key without an answer (the call was turned away)
+void dedupe_abandon(int slot, const char *key) {
+    pthread_mutex_lock(&dedupe_mutex);
+    if (still_claimed(slot, key)) write_slot(slot, slots[slot].hash, SLOT_FREE, NULL, NULL);
+    pthread_mutex_unlock(&dedupe_mutex);
+}
+
+unsigned long dedupe_replayed(void) {
+    return __atomic_load_n(&replayed, __ATOMIC_RELAXED);
+}
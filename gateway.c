@@ -0,0 +1,230 @@
+/**
+ * Multiplexed car channel (gateways).
+ *
+ * A car normally holds its own connection and handler thread. A gateway (an
+ * emulator, a host running many cars, a bridge for a whole bank) instead
+ * opens one connection, sends "GATEWAY" and then carries frames for any
+ * number of cars, each led by a car id it picks from 0 to GATEWAY_MAX_CARS - 1:
+ *
+ *   "<id> CAR <name> <lowest> <highest> [options]"  registers the car
+ *   "<id> STATUS ...", "<id> TIMING ..."             as on a car's own connection
+ *   "<id> INDIVIDUAL SERVICE", "<id> EMERGENCY"      the car leaves, as it would
+ *   "<id> GONE"                                      the car leaves
+ *
+ * The controller answers in the same form: "<id> FLOOR <floor>", "<id> SESSION
+ * <token>", and "<id> REJECTED" for a registration it turns away. An id may be
+ * used again once its car has left. Closing the connection takes every car on
+ * it away. "GATEWAY" may carry options, which the controller ignores; a router
+ * places a gateway by its BANK (see router.c).
+ *
+ * One handler thread serves the gateway. It takes whatever has arrived in one
+ * recv and applies every complete frame in it before reading again. Movement
+ * statuses go to the car's mailbox as usual; frames that need a bank mutex keep
+ * it from one frame to the next while they are for the same bank. Replies
+ * queued meanwhile, by this thread or by a call handler dispatching to one of
+ * the gateway's cars, go out in one write once the batch is done.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+
+#define GATEWAY_IN_SIZE 65536 //Frames taken in by one read
+#define GATEWAY_OUT_SIZE 16384 //Replies held back until the batch is done
+#define GATEWAY_FRAME_MAX 1024 //Largest frame taken from a gateway, without its prefix
+
+struct Gateway {
+    int fd;
+    pthread_mutex_t send_mutex; //Taken after any bank mutex, never before one
+    int batching; //Replies wait in out until the batch is done
+    char out[GATEWAY_OUT_SIZE];
+    size_t out_len;
+    Car *cars[GATEWAY_MAX_CARS]; //By car id, NULL if none. Only the gateway's thread touches it
+};
+
+//Counted without a lock, once per read
+static struct {
+    int connected;
+    unsigned long gateways;
+    unsigned long frames;
+    unsigned long reads;
+    unsigned long writes;
+} gateway_metrics;
+
+/// @brief Writes out the queued replies. Called with send_mutex held
+static int flush_replies(Gateway *gateway) {
+    if (gateway->out_len == 0) return 0;
+    int rc = send_looped(gateway->fd, gateway->out, gateway->out_len);
+    gateway->out_len = 0;
+    __atomic_add_fetch(&gateway_metrics.writes, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+/// @brief Sends "<channel_id> <message>" to a gateway, or queues it while a batch is being applied
+int gateway_send(Gateway *gateway, int channel_id, const char *message) {
+    char frame[sizeof(uint16_t) + BUFFER_SIZE + 16];
+    int n = snprintf(frame + sizeof(uint16_t), sizeof(frame) - sizeof(uint16_t), "%d %s", channel_id, message);
+    if (n < 0 || (size_t)n >= sizeof(frame) - sizeof(uint16_t)) return -1;
+    uint16_t nlen = htons((uint16_t)n);
+    memcpy(frame, &nlen, sizeof(nlen));
+    size_t len = sizeof(nlen) + (size_t)n;
+
+    int rc = 0;
+    pthread_mutex_lock(&gateway->send_mutex);
+    if (gateway->out_len + len > sizeof(gateway->out)) {
+        rc = flush_replies(gateway);
+    }
+    memcpy(gateway->out + gateway->out_len, frame, len);
+    gateway->out_len += len;
+    if (!gateway->batching) {
+        rc = flush_replies(gateway);
+    }
+    pthread_mutex_unlock(&gateway->send_mutex);
+    return rc;
+}
+
+static void release_held(Bank **held) {
+    if (*held != NULL) {
+        pthread_mutex_unlock(&(*held)->mutex);
+        *held = NULL;
+    }
+}
+
+/// @brief Applies one "<id> ..." frame. *held is the bank mutex kept across the batch, if any
+static void gateway_frame(Gateway *gateway, const char *frame, Bank **held) {
+    char *rest;
+    long id = strtol(frame, &rest, 10);
+    if (rest == frame || *rest != ' ' || id < 0 || id >= GATEWAY_MAX_CARS) {
+        printf("Gateway frame without a valid car id ignored.\n");
+        return;
+    }
+    rest++;
+    Car *car = gateway->cars[id];
+
+    if (strncmp(rest, "CAR ", 4) == 0) {
+        //Registering takes the bank mutex itself
+        release_held(held);
+        if (car != NULL) {
+            //The gateway reused the id without saying the old car had gone
+            car_disconnected(car);
+        }
+        gateway->cars[id] = register_car_via(gateway->fd, gateway, (int)id, rest);
+        return;
+    }
+    if (car == NULL) return; //Never registered, rejected or already gone
+
+    if (strcmp(rest, "GONE") == 0 || car_frame_batched(car, rest, held)) {
+        release_held(held);
+        car_disconnected(car);
+        gateway->cars[id] = NULL;
+    }
+}
+
+/**
+ * @brief Applies every complete frame in in[0..len)
+ * @return bytes used (a partial frame at the end is left for the next read), or -1
+ * if a frame is too large to be one of ours
+ */
+static long apply_batch(Gateway *gateway, char *in, size_t len) {
+    Bank *held = NULL;
+    size_t off = 0;
+    unsigned long frames = 0;
+    int bad = 0;
+
+    pthread_mutex_lock(&gateway->send_mutex);
+    gateway->batching = 1;
+    pthread_mutex_unlock(&gateway->send_mutex);
+
+    while (len - off >= sizeof(uint16_t)) {
+        uint16_t nlen;
+        memcpy(&nlen, in + off, sizeof(nlen));
+        size_t frame_len = ntohs(nlen);
+        if (frame_len > GATEWAY_FRAME_MAX) {
+            bad = 1;
+            break;
+        }
+        if (len - off - sizeof(nlen) < frame_len) break;
+        //Terminate the frame in place; the byte after it is put back afterwards
+        char *frame = in + off + sizeof(nlen);
+        char saved = frame[frame_len];
+        frame[frame_len] = '\0';
+        gateway_frame(gateway, frame, &held);
+        frame[frame_len] = saved;
+        off += sizeof(nlen) + frame_len;
+        frames++;
+    }
+    release_held(&held);
+
+    pthread_mutex_lock(&gateway->send_mutex);
+    gateway->batching = 0;
+    flush_replies(gateway);
+    pthread_mutex_unlock(&gateway->send_mutex);
+
+    __atomic_add_fetch(&gateway_metrics.frames, frames, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gateway_metrics.reads, 1, __ATOMIC_RELAXED);
+    return bad ? -1 : (long)off;
+}
+
+/**
+ * @brief Serves a gateway connection (its "GATEWAY" frame has been read) until it
+ * closes, then drops its cars and closes it
+ */
+void handle_gateway_connection(int client_fd) {
+    Gateway *gateway = calloc(1, sizeof(*gateway));
+    char *in = malloc(GATEWAY_IN_SIZE + 1); //One spare byte to terminate the last frame
+    if (gateway == NULL || in == NULL) {
+        perror("malloc()");
+        free(gateway);
+        free(in);
+        close(client_fd);
+        return;
+    }
+    gateway->fd = client_fd;
+    pthread_mutex_init(&gateway->send_mutex, NULL);
+    __atomic_add_fetch(&gateway_metrics.connected, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gateway_metrics.gateways, 1, __ATOMIC_RELAXED);
+    printf("Gateway connected.\n");
+
+    size_t in_len = 0;
+    while (1) {
+        ssize_t n = recv(client_fd, in + in_len, GATEWAY_IN_SIZE - in_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        in_len += (size_t)n;
+        long used = apply_batch(gateway, in, in_len);
+        if (used < 0) {
+            printf("Gateway sent an oversized frame, closing it.\n");
+            break;
+        }
+        memmove(in, in + used, in_len - (size_t)used);
+        in_len -= (size_t)used;
+    }
+
+    int cars = 0;
+    for (int id = 0; id < GATEWAY_MAX_CARS; id++) {
+        if (gateway->cars[id] != NULL) {
+            car_disconnected(gateway->cars[id]);
+            cars++;
+        }
+    }
+    printf("Gateway disconnected (%d cars still on it).\n", cars);
+    __atomic_sub_fetch(&gateway_metrics.connected, 1, __ATOMIC_RELAXED);
+    close(client_fd);
+    pthread_mutex_destroy(&gateway->send_mutex);
+    free(gateway);
+    free(in);
+}
+
+/// @brief Gateways connected right now. Live upgrade is refused while there are any
+int gateways_connected(void) {
+    return __atomic_load_n(&gateway_metrics.connected, __ATOMIC_RELAXED);
+}
+
+void print_gateway_metrics(void) {
+    unsigned long gateways = __atomic_load_n(&gateway_metrics.gateways, __ATOMIC_RELAXED);
+    unsigned long frames = __atomic_load_n(&gateway_metrics.frames, __ATOMIC_RELAXED);
+    unsigned long reads = __atomic_load_n(&gateway_metrics.reads, __ATOMIC_RELAXED);
+    unsigned long writes = __atomic_load_n(&gateway_metrics.writes, __ATOMIC_RELAXED);
+    if (gateways == 0) return;
+    printf("Gateways: %lu connections, %lu frames in %lu reads (%.1f per read), %lu writes\n",
+        gateways, frames, reads, reads ? (double)frames / reads : 0.0, writes);
+}
@@ -1,207 +1,272 @@
-
-/*
-Open sets the open_button in shared memory to 1
-Close sets close_button to 1
-stop sets emergency_stop to 1
-service_on sets individual_service_mode in shared memory segment to 1 and emergency_mode to 0
-service_off sets individual_service_mode in the sharede memory segment to 0
-up sets the destination floor to the enxt floor up from current floor. useabl when individyyal service node, elevator not moving and door closed
-down sets the dest floor to the next down from current. Usable in service mode, elevtor not nmoving and door closed
-*/
-
-#include "shared.h"
-
-//Check to see if it is a basement or normal floor
-int is_basement_floor(const char* floor) {
-    return floor[0] == 'B';
-}
-
-int get_floor_number(const char* floor) {
-    if (floor == NULL) return 0;
-    char *endptr = NULL;
-    long v = 0;
-    errno = 0;
-    if (is_basement_floor(floor)) {
-        v = strtol(floor + 1, &endptr, 10);
-    } else {
-        v = strtol(floor, &endptr, 10);
-    }
-    if (endptr == NULL || *endptr != '\0' || errno == ERANGE) {
-        /* Fall back to 0 on parse error*/
-        return 0;
-    }
-    return (int)v;
-}
-
-
-
-/// @brief Gets the mext floor up in the floors. The system must skip 0 as this is not a floor in both directions
-/// @param current The current floor on
-/// @param next  The desired floor
-/// @param n size of next buffer as was getting warnings
-void get_next_floor_up(const char* current, char* next, size_t n) {
-    //Basemenet logic is that the number decreases. But no 0 so would go to 1
-    if (is_basement_floor(current)) {
-        int basement_num = get_floor_number(current);
-        if (basement_num == 1) {
-            snprintf(next , n, "1");
-        } else {
-            snprintf(next, n, "B%d", basement_num - 1);
-        }
-    } else {
-        //Is a regular floor
-        int floor_num = get_floor_number(current);
-        snprintf(next, n, "%d", floor_num + 1);
-    }
-}
-
-
-/// @brief Gets the mext floor down in the floors. The system must skip 0 as this is not a floor in both directions
-/// @param current The current floor
-/// @param next  The desired floor
-void get_next_floor_down(const char* current, char* next, size_t n) {
-    //Basemenet logic is that the number decreases. down to 99
-    if (is_basement_floor(current)) {
-        int basement_num = get_floor_number(current);
-        snprintf(next, n, "B%d", basement_num + 1);
-    } else {
-        //Is a regular floor
-        int floor_num = get_floor_number(current);
-        if (floor_num == 1) {
-            snprintf(next, n, "B1");
-        }
-        else {
-            snprintf(next, n, "%d", floor_num - 1);
-        }
-    }
-}
-
-
-
-int main(int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Not correct number of arguments");
-        exit(1);
-    }
-
-    const char* car_name = argv[1];
-    const char* operation = argv[2];
-
-    //Build the shared memory object name
-    char shm_name[256];
-    snprintf(shm_name, sizeof(shm_name), "/car%s", car_name);
-
-    //Open the shared memory segment 
-    int fd = shm_open(shm_name, O_RDWR, 0666);
-    if (fd == -1) {
-        //Shared memory failed, print debugging
-        printf("Unable to access car %s.\n", car_name);
-        exit(1);
-    }
-
-    //Now that we have opened it, lets map the shared mem
-    car_shared_mem *shm = mmap(NULL, sizeof(car_shared_mem), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (shm == MAP_FAILED) {
-        printf("Unable to access car %s.\n", car_name);
-        close(fd); //Close the file descript up as it failed
-        exit(1);
-    }
-
-    //We don't need the file descriptor anymore as the shared mem is mapped, lets close it up
-    close(fd);
-
-    //Lock the mutext before accessiog shread memory
-    pthread_mutex_lock(&shm->mutex);
-
-    //Procdess the operation
-    if(strcmp(operation, "open") == 0) {
-        shm->open_button = 1;
-    }
-    else if (strcmp(operation, "close") == 0) {
-        shm->close_button = 1;
-    }
-    else if (strcmp(operation, "stop") == 0) {
-        shm->emergency_stop = 1;
-    }
-     else if (strcmp(operation, "service_on") == 0) {
-        shm->individual_service_mode = 1;
-        shm->emergency_mode = 0;
-     }
-     else if (strcmp(operation, "service_off") == 0) {
-        shm->individual_service_mode = 0;
-     } else if (strcmp(operation, "up") == 0) {
-        //We want to go up. Lets see if we are even allowed to go up./
-        if(!shm -> individual_service_mode) {
-            pthread_mutex_unlock(&shm->mutex); //We open the mutex before exiting so other processes don't deadlock
-            //operation is only allowed in service mode
-            printf("Operation only allowed in service mode.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        //Ensure not in a place where it is open in any means
-        if (strcmp(shm->status, "Open") == 0 || strcmp(shm->status, "Opening") ==0 || strcmp(shm->status, "Closing") == 0) {
-            pthread_mutex_unlock(&shm->mutex);
-            printf("Operation not allowed while doors are open.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        if (strcmp(shm->status, "Between") == 0)  {
-            pthread_mutex_unlock(&shm->mutex);
-            printf("Operation not allowed while elevator is moving.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        //We have passed all our checks
-        //Set the desitation to next floor up
-    char next_floor[12];
-    get_next_floor_up(shm->current_floor, next_floor, sizeof(next_floor));
-    /* bounded copy ensuring null-termination to avoid overflow */
-    (void)strncpy(shm->destination_floor, next_floor, sizeof(shm->destination_floor) - 1);
-    shm->destination_floor[sizeof(shm->destination_floor) - 1] = '\0';
-
-     } else if (strcmp(operation, "down") == 0) {
-        //We want to go up. Lets see if we are even allowed to go up.
-        if(!shm -> individual_service_mode) {
-            pthread_mutex_unlock(&shm->mutex); //We open the mutex before exiting so other processes don't deadlock
-            //operation is only allowed in service mode
-            printf("Operation only allowed in service mode.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        //Ensure not in a place where it is open in any means
-        if (strcmp(shm->status, "Open") == 0 || strcmp(shm->status, "Opening") ==0 || strcmp(shm->status, "Closing") == 0) {
-            pthread_mutex_unlock(&shm->mutex);
-            printf("Operation not allowed while doors are open.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        if (strcmp(shm->status, "Between") == 0)  {
-            pthread_mutex_unlock(&shm->mutex);
-            printf("Operation not allowed while elevator is moving.\n");
-            munmap(shm, sizeof(car_shared_mem));
-            exit(1);
-        }
-        //We have passed all our checks
-        //Set the desitation to next floor up
-    char next_floor[12];
-    get_next_floor_down(shm->current_floor, next_floor, sizeof(next_floor));
-    (void)strncpy(shm->destination_floor, next_floor, sizeof(shm->destination_floor) - 1);
-    shm->destination_floor[sizeof(shm->destination_floor) - 1] = '\0';
-        
-     } else {
-        //Something else that we are not considering was inputted into the terminal
-        pthread_mutex_unlock(&shm->mutex);
-        printf("Invalid operation.\n");
-        munmap(shm, sizeof(car_shared_mem));
-        exit(1);
-     }
-     
-     //Send a signal out
-     pthread_cond_broadcast(&shm->cond);
-     //Unlock the mutex as data does not need to be locekd down aynmore
-     pthread_mutex_unlock(&shm->mutex);
-
-     //Clean uo the memory 
-     munmap(shm, sizeof(car_shared_mem));
-     return 0;
+
+/*
+Open sets the open_button in shared memory to 1
+Close sets close_button to 1
+stop sets emergency_stop to 1
+service_on sets individual_service_mode in shared memory segment to 1 and emergency_mode to 0
+service_off sets individual_service_mode in the sharede memory segment to 0
+up sets the destination floor to the enxt floor up from current floor. useabl when individyyal service node, elevator not moving and door closed
+down sets the dest floor to the next down from current. Usable in service mode, elevtor not nmoving and door closed
+delay <ms> changes the car's delay while it runs. It takes effect at the car's next step and the car tells the controller
+telemetry prints the car's lifetime counters and recent state transitions. It reads them without locking the car
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "shared.h"
+#include <time.h>
+
+#define MAX_DELAY_MS 60000
+
+//Check to see if it is a basement or normal floor
+int is_basement_floor(const char* floor) {
+    return floor[0] == 'B';
+}
+
+int get_floor_number(const char* floor) {
+    if (floor == NULL) return 0;
+    char *endptr = NULL;
+    long v = 0;
+    errno = 0;
+    if (is_basement_floor(floor)) {
+        v = strtol(floor + 1, &endptr, 10);
+    } else {
+        v = strtol(floor, &endptr, 10);
+    }
+    if (endptr == NULL || *endptr != '\0' || errno == ERANGE) {
+        /* Fall back to 0 on parse error*/
+        return 0;
+    }
+    return (int)v;
+}
+
+
+
+/// @brief Gets the mext floor up in the floors. The system must skip 0 as this is not a floor in both directions
+/// @param current The current floor on
+/// @param next  The desired floor
+/// @param n size of next buffer as was getting warnings
+void get_next_floor_up(const char* current, char* next, size_t n) {
+    //Basemenet logic is that the number decreases. But no 0 so would go to 1
+    if (is_basement_floor(current)) {
+        int basement_num = get_floor_number(current);
+        if (basement_num == 1) {
+            snprintf(next , n, "1");
+        } else {
+            snprintf(next, n, "B%d", basement_num - 1);
+        }
+    } else {
+        //Is a regular floor
+        int floor_num = get_floor_number(current);
+        snprintf(next, n, "%d", floor_num + 1);
+    }
+}
+
+
+/// @brief Gets the mext floor down in the floors. The system must skip 0 as this is not a floor in both directions
+/// @param current The current floor
+/// @param next  The desired floor
+void get_next_floor_down(const char* current, char* next, size_t n) {
+    //Basemenet logic is that the number decreases. down to 99
+    if (is_basement_floor(current)) {
+        int basement_num = get_floor_number(current);
+        snprintf(next, n, "B%d", basement_num + 1);
+    } else {
+        //Is a regular floor
+        int floor_num = get_floor_number(current);
+        if (floor_num == 1) {
+            snprintf(next, n, "B1");
+        }
+        else {
+            snprintf(next, n, "%d", floor_num - 1);
+        }
+    }
+}
+
+
+
+/// @brief Prints a car's counters and its recent transitions, oldest first, without taking its mutex
+void print_telemetry(const car_telemetry *t) {
+    static const char *causes[] = {"start", "controller", "travel", "doors", "button", "service", "emergency", "external"};
+    uint64_t n = __atomic_load_n(&t->transitions, __ATOMIC_ACQUIRE);
+    printf("%llu transitions, %llu door cycles, %llu floors travelled, %llu emergencies\n", (unsigned long long)n,
+        (unsigned long long)__atomic_load_n(&t->door_cycles, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&t->floors_travelled, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&t->emergencies, __ATOMIC_RELAXED));
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    for (uint64_t i = n > TELEMETRY_SLOTS ? n - TELEMETRY_SLOTS : 0; i < n; i++) {
+        const car_telemetry_entry *slot = &t->ring[i % TELEMETRY_SLOTS];
+        car_telemetry_entry e;
+        uint32_t before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(&e, slot, sizeof(e));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        //The car has lapped us and rewritten this slot
+        if (before != (uint32_t)(i + 1) || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != before) continue;
+        printf("%10.3f s ago  %-8.8s %4.4s -> %-4.4s  %s%s%s\n", (now_ns - e.at_ns) / 1e9, e.status, e.floor, e.destination,
+            e.cause < sizeof(causes) / sizeof(causes[0]) ? causes[e.cause] : "?",
+            (e.modes & TELEMETRY_SERVICE_MODE) ? " [service]" : "", (e.modes & TELEMETRY_EMERGENCY_MODE) ? " [emergency]" : "");
+    }
+}
+
+int main(int argc, char **argv) {
+    argc = parse_common_flags(argc, argv);
+    int is_delay = argc > 2 && strcmp(argv[2], "delay") == 0;
+    if (argc != (is_delay ? 4 : 3)) {
+        fprintf(stderr, "Not correct number of arguments");
+        exit(1);
+    }
+
+    const char* car_name = argv[1];
+    const char* operation = argv[2];
+    long delay_ms = 0;
+    if (is_delay) {
+        char *end = NULL;
+        delay_ms = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || delay_ms < 1 || delay_ms > MAX_DELAY_MS) {
+            printf("Invalid delay.\n");
+            exit(1);
+        }
+    }
+
+    //Build the shared memory object name
+    char shm_name[256];
+    snprintf(shm_name, sizeof(shm_name), "%s%s", shm_prefix(), car_name);
+
+    //Open the shared memory segment 
+    int fd = shm_open(shm_name, O_RDWR, 0666);
+    if (fd == -1) {
+        //Shared memory failed, print debugging
+        printf("Unable to access car %s.\n", car_name);
+        exit(1);
+    }
+
+    //A segment made by an older car ends before the delay and telemetry fields
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        printf("Unable to access car %s.\n", car_name);
+        close(fd);
+        exit(1);
+    }
+    if (st.st_size < (off_t)sizeof(car_shared_mem) && (is_delay || strcmp(operation, "telemetry") == 0)) {
+        printf("Car %s does not support %s.\n", car_name, operation);
+        close(fd);
+        exit(1);
+    }
+
+    //Now that we have opened it, lets map the shared mem
+    car_shared_mem *shm = mmap(NULL, sizeof(car_shared_mem), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        printf("Unable to access car %s.\n", car_name);
+        close(fd); //Close the file descript up as it failed
+        exit(1);
+    }
+
+    //We don't need the file descriptor anymore as the shared mem is mapped, lets close it up
+    close(fd);
+
+    //Telemetry is written so it can be read without the lock
+    if (strcmp(operation, "telemetry") == 0) {
+        print_telemetry(&shm->telemetry);
+        munmap(shm, sizeof(car_shared_mem));
+        return 0;
+    }
+
+    //Lock the mutext before accessiog shread memory
+    pthread_mutex_lock(&shm->mutex);
+
+    //Procdess the operation
+    if(strcmp(operation, "open") == 0) {
+        shm->open_button = 1;
+    }
+    else if (strcmp(operation, "close") == 0) {
+        shm->close_button = 1;
+    }
+    else if (strcmp(operation, "stop") == 0) {
+        shm->emergency_stop = 1;
+    }
+     else if (strcmp(operation, "service_on") == 0) {
+        shm->individual_service_mode = 1;
+        shm->emergency_mode = 0;
+     }
+     else if (strcmp(operation, "service_off") == 0) {
+        shm->individual_service_mode = 0;
+     } else if (strcmp(operation, "up") == 0) {
+        //We want to go up. Lets see if we are even allowed to go up./
+        if(!shm -> individual_service_mode) {
+            pthread_mutex_unlock(&shm->mutex); //We open the mutex before exiting so other processes don't deadlock
+            //operation is only allowed in service mode
+            printf("Operation only allowed in service mode.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        //Ensure not in a place where it is open in any means
+        if (strcmp(shm->status, "Open") == 0 || strcmp(shm->status, "Opening") ==0 || strcmp(shm->status, "Closing") == 0) {
+            pthread_mutex_unlock(&shm->mutex);
+            printf("Operation not allowed while doors are open.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        if (strcmp(shm->status, "Between") == 0)  {
+            pthread_mutex_unlock(&shm->mutex);
+            printf("Operation not allowed while elevator is moving.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        //We have passed all our checks
+        //Set the desitation to next floor up
+    char next_floor[12];
+    get_next_floor_up(shm->current_floor, next_floor, sizeof(next_floor));
+    /* bounded copy ensuring null-termination to avoid overflow */
+    (void)strncpy(shm->destination_floor, next_floor, sizeof(shm->destination_floor) - 1);
+    shm->destination_floor[sizeof(shm->destination_floor) - 1] = '\0';
+
+     } else if (strcmp(operation, "down") == 0) {
+        //We want to go up. Lets see if we are even allowed to go up.
+        if(!shm -> individual_service_mode) {
+            pthread_mutex_unlock(&shm->mutex); //We open the mutex before exiting so other processes don't deadlock
+            //operation is only allowed in service mode
+            printf("Operation only allowed in service mode.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        //Ensure not in a place where it is open in any means
+        if (strcmp(shm->status, "Open") == 0 || strcmp(shm->status, "Opening") ==0 || strcmp(shm->status, "Closing") == 0) {
+            pthread_mutex_unlock(&shm->mutex);
+            printf("Operation not allowed while doors are open.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        if (strcmp(shm->status, "Between") == 0)  {
+            pthread_mutex_unlock(&shm->mutex);
+            printf("Operation not allowed while elevator is moving.\n");
+            munmap(shm, sizeof(car_shared_mem));
+            exit(1);
+        }
+        //We have passed all our checks
+        //Set the desitation to next floor up
+    char next_floor[12];
+    get_next_floor_down(shm->current_floor, next_floor, sizeof(next_floor));
+    (void)strncpy(shm->destination_floor, next_floor, sizeof(shm->destination_floor) - 1);
+    shm->destination_floor[sizeof(shm->destination_floor) - 1] = '\0';
+        
+     } else if (is_delay) {
+        shm->delay_ms = (uint32_t)delay_ms;
+     } else {
+        //Something else that we are not considering was inputted into the terminal
+        pthread_mutex_unlock(&shm->mutex);
+        printf("Invalid operation.\n");
+        munmap(shm, sizeof(car_shared_mem));
+        exit(1);
+     }
+     
+     //Send a signal out
+     pthread_cond_broadcast(&shm->cond);
+     //Unlock the mutex as data does not need to be locekd down aynmore
+     pthread_mutex_unlock(&shm->mutex);
+
+     //Clean uo the memory 
+     munmap(shm, sizeof(car_shared_mem));
+     return 0;
 }
\ No newline at end of file
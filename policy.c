@@ -0,0 +1,142 @@
+/**
+ * Learned dispatch policy (--policy <file>).
+ *
+ * A policy is a table of costs trained offline by train-policy against a
+ * simulation of this scheduling model. Each car that could take a call is
+ * described by four small features, each cut into buckets:
+ *
+ *   - where the call's pickup would go in its queue (calculate_insertion_cost)
+ *   - how many floors it is from the pickup floor
+ *   - how many stops are already queued
+ *   - whether it is idle, heading toward the pickup floor or away from it
+ *
+ * and the bucket numbers index the table. The car with the lowest cost takes
+ * the call, with the greedy order (GREEDY_RANK) breaking ties, so choosing a car is one
+ * table read per candidate on top of the insertion cost greedy needs anyway.
+ *
+ * The file is a policy_header_t followed by POLICY_CELLS int16 costs, in host
+ * byte order. The controller maps it read-only at startup and refuses a file
+ * whose magic, version or size do not match the features it computes.
+ */
+
+#include "controller.h"
+#include <time.h>
+
+#define POLICY_MAGIC "ELEVPOL"
+
+typedef struct {
+    char magic[8];
+    uint32_t version; //POLICY_VERSION: the feature layout the costs are indexed by
+    uint32_t cells;
+    int64_t trained_at; //Unix time the trainer wrote it
+    uint32_t trained_calls; //Simulated calls the trainer scored policies on
+    uint32_t reserved;
+} policy_header_t;
+
+static const int16_t *policy_costs = NULL; //The mapped table, NULL without --policy
+
+static int bucket(int value) {
+    if (value <= 0) return 0;
+    if (value <= 2) return 1;
+    if (value <= 5) return 2;
+    if (value <= 10) return 3;
+    return 4;
+}
+
+/// @brief Table index for giving the call to car, with its pickup at pickup_idx
+int policy_cell(const Car *car, int source, int dest, int pickup_idx) {
+    (void)dest;
+    //Same notion of where the car is as calculate_insertion_cost
+    int floor = car_effective_floor(car);
+    int heading = 0; //Idle
+    if (car->queue_size > 0) {
+        int going = car->queue[0] - floor, wanted = source - floor;
+        heading = (wanted == 0 || (going > 0) == (wanted > 0)) ? 1 : 2;
+    }
+    return ((bucket(pickup_idx) * POLICY_BUCKETS + bucket(abs(source - floor))) * POLICY_BUCKETS +
+        bucket(car->queue_size)) * 3 + heading;
+}
+
+/**
+ * @brief Chooses a car by a cost table. Cars without room for both stops are
+ * passed over.
+ * @return index into cars, or -1 if no car can take the call
+ */
+int policy_pick(const int16_t *costs, const Car *cars, int source, int dest) {
+    int best = -1, best_cost = 0, best_rank = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        const Car *car = &cars[i];
+        if (!car->in_use || car->queue_size + 2 > MAX_QUEUE_DEPTH) continue;
+        if (source < car->floor_min || source > car->floor_max || dest < car->floor_min || dest > car->floor_max) continue;
+        int pickup_idx, final_len;
+        if (calculate_insertion_cost(car, source, dest, &pickup_idx, &final_len) < 0) continue;
+        int cost = costs[policy_cell(car, source, dest, pickup_idx)];
+        int rank = GREEDY_RANK(pickup_idx, final_len, abs(source - car_effective_floor(car)), i);
+        if (best < 0 || cost < best_cost || (cost == best_cost && rank < best_rank)) {
+            best = i;
+            best_cost = cost;
+            best_rank = rank;
+        }
+    }
+    return best;
+}
+
+/// @brief Writes a trained table. Used by train-policy
+int policy_write(const char *path, const int16_t *costs, uint32_t trained_calls) {
+    policy_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POLICY_MAGIC, sizeof(POLICY_MAGIC));
+    header.version = POLICY_VERSION;
+    header.cells = POLICY_CELLS;
+    header.trained_at = (int64_t)time(NULL);
+    header.trained_calls = trained_calls;
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        perror("fopen() failed");
+        return -1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(costs, sizeof(int16_t), POLICY_CELLS, out) == POLICY_CELLS;
+    if (fclose(out) != 0 || !ok) {
+        fprintf(stderr, "Could not write policy %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/// @brief Maps a policy file for policy_choice
+int policy_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open() policy failed");
+        return -1;
+    }
+    struct stat st;
+    size_t size = sizeof(policy_header_t) + POLICY_CELLS * sizeof(int16_t);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+        fprintf(stderr, "Policy %s is not a version %d policy (wrong size).\n", path, POLICY_VERSION);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap() policy failed");
+        return -1;
+    }
+    const policy_header_t *header = map;
+    if (memcmp(header->magic, POLICY_MAGIC, sizeof(POLICY_MAGIC)) != 0 ||
+        header->version != POLICY_VERSION || header->cells != POLICY_CELLS) {
+        fprintf(stderr, "Policy %s is not a version %d policy.\n", path, POLICY_VERSION);
+        munmap(map, size);
+        return -1;
+    }
+    policy_costs = (const int16_t *)(header + 1);
+    return 0;
+}
+
+/// @brief The car the loaded policy picks, or the greedy choice without one
+int policy_choice(const Car *cars, int source, int dest, ChoiceStats *stats) {
+    if (policy_costs == NULL) return greedy_choice(cars, source, dest, stats);
+    return policy_pick(policy_costs, cars, source, dest);
+}
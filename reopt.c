@@ -0,0 +1,328 @@
+/**
+ * Background re-optimizer for the controller (--reoptimize).
+ *
+ * schedule_request places each call greedily, and the placement used to be
+ * final. This module keeps the calls behind every car's queue as pickups and,
+ * every REOPT_PERIOD_MS, revisits each bank's plan. The bank is copied under
+ * its mutex and searched without it: each waiting pickup is taken out of its
+ * car's queue and put back wherever calculate_insertion_cost would place it in
+ * every car that can serve it, and the move that most lowers the bank's cost
+ * is kept. The cost counts each waiting rider's time to pickup (in ms, from
+ * the car's advertised timing) and, at a lower weight, time riding.
+ * Rounds of moves repeat until none helps or REOPT_BUDGET_NS runs out.
+ *
+ * The result is committed under the bank mutex only if the bank's version has
+ * not moved since the copy, so a plan never overwrites a newer call or arrival.
+ * A rider has already been told which car is coming, so a pickup may change
+ * cars only if its call pad asked to be kept informed (NOTIFY 1); it is sent
+ * "CAR <name>" again for the new car. Other pickups can only be re-sequenced
+ * within their own car. A pickup whose floor is the car's current destination
+ * stays where it is. With express service, a pickup only moves to a car that
+ * express_accepts it.
+ *
+ * Only the handler-thread backend runs the optimizer: io_uring connections
+ * may only be written from the ring's own thread.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <time.h>
+
+#define REOPT_BUDGET_NS 2000000LL //Search time per bank per pass
+#define REOPT_WAIT_WEIGHT 4 //Waiting counts this many times as much as riding
+#define REOPT_UNREACHED 3600000 //Cost (ms) of a stop missing from the route
+
+/// @brief Records a call just placed in car's queue
+/// @return 1 if the pickup now owns notify_fd, 0 if the caller should close it
+int pickup_add(Car *car, int source, int dest, int notify_fd) {
+    if (car->pickup_count >= MAX_PICKUPS) {
+        car->untracked = 1;
+        return 0;
+    }
+    Pickup *p = &car->pickups[car->pickup_count++];
+    p->source = source;
+    p->dest = dest;
+    p->boarded = 0;
+    p->notify_fd = notify_fd;
+    return notify_fd >= 0;
+}
+
+static void end_notify(Pickup *p) {
+    if (p->notify_fd >= 0) {
+        conn_close(p->notify_fd);
+        p->notify_fd = -1;
+    }
+}
+
+/// @brief Boards riders waiting at floor and lets off those riding to it
+void pickups_arrived(Car *car, int floor) {
+    for (int i = 0; i < car->pickup_count; i++) {
+        Pickup *p = &car->pickups[i];
+        if (!p->boarded && p->source == floor) {
+            p->boarded = 1;
+            end_notify(p); //Nothing more to tell the call pad
+        } else if (p->boarded && p->dest == floor) {
+            memmove(p, p + 1, (car->pickup_count - 1 - i) * sizeof(*p));
+            car->pickup_count--;
+            i--;
+        }
+    }
+    if (car->queue_size == 0) {
+        //Nothing left to serve, so nothing can be left to track
+        pickups_dropped(car);
+    }
+}
+
+/// @brief Forgets every pickup, e.g. when the car disconnects
+void pickups_dropped(Car *car) {
+    for (int i = 0; i < car->pickup_count; i++) {
+        end_notify(&car->pickups[i]);
+    }
+    car->pickup_count = 0;
+    car->untracked = 0;
+}
+
+/**
+ * SEARCH (on copies of the bank's cars)
+ */
+
+/// @brief Time (ms) until the car reaches floor at queue index from or later
+static int route_eta(const Car *car, int floor, int from, int *at) {
+    int pos = car->current_floor, t = 0;
+    int floor_ms = car_floor_ms(car), stop_ms = car_stop_ms(car);
+    for (int i = 0; i < car->queue_size; i++) {
+        t += abs(car->queue[i] - pos) * floor_ms;
+        pos = car->queue[i];
+        if (i >= from && car->queue[i] == floor) {
+            *at = i;
+            return t;
+        }
+        t += stop_ms;
+    }
+    return -1;
+}
+
+static long car_cost(const Car *car) {
+    long cost = 0;
+    for (int i = 0; i < car->pickup_count; i++) {
+        const Pickup *p = &car->pickups[i];
+        int at = -1, picked = 0, dropped;
+        if (!p->boarded) {
+            picked = route_eta(car, p->source, 0, &at);
+            if (picked < 0) picked = REOPT_UNREACHED;
+            cost += (long)picked * REOPT_WAIT_WEIGHT;
+        }
+        dropped = route_eta(car, p->dest, at + 1, &at);
+        cost += (dropped < 0) ? REOPT_UNREACHED : dropped - picked;
+    }
+    return cost;
+}
+
+static int queue_index(const Car *car, int floor, int from) {
+    for (int i = from; i < car->queue_size; i++) {
+        if (car->queue[i] == floor) return i;
+    }
+    return -1;
+}
+
+/// @brief Whether another pickup on the car still needs a stop at floor
+static int floor_needed(const Car *car, int skip, int floor) {
+    for (int i = 0; i < car->pickup_count; i++) {
+        const Pickup *q = &car->pickups[i];
+        if (i == skip) continue;
+        if ((!q->boarded && q->source == floor) || q->dest == floor) return 1;
+    }
+    return 0;
+}
+
+/// @brief Takes a waiting pickup and the stops only it needs out of a car copy
+/// @return 0 if it cannot be moved (the car is already heading for its floor)
+static int take_pickup(Car *car, int idx) {
+    Pickup p = car->pickups[idx];
+    int si = queue_index(car, p.source, 0);
+    if (si <= 0) return 0;
+    int di = queue_index(car, p.dest, si + 1);
+    if (di >= 0 && !floor_needed(car, idx, p.dest)) {
+        remove_from_queue(car->queue, &car->queue_size, di);
+    }
+    if (!floor_needed(car, idx, p.source)) {
+        remove_from_queue(car->queue, &car->queue_size, si);
+    }
+    memmove(&car->pickups[idx], &car->pickups[idx + 1], (car->pickup_count - 1 - idx) * sizeof(Pickup));
+    car->pickup_count--;
+    return 1;
+}
+
+static int put_pickup(Car *car, const Pickup *p) {
+    if (p->source < car->floor_min || p->source > car->floor_max ||
+        p->dest < car->floor_min || p->dest > car->floor_max) return 0;
+    if (car->queue_size + 2 > MAX_QUEUE_DEPTH || car->pickup_count >= MAX_PICKUPS) return 0;
+    plan_insertion(car, p->source, p->dest);
+    car->pickups[car->pickup_count++] = *p;
+    return 1;
+}
+
+static int usable(const Car *car) {
+    return car->in_use && !car->detached;
+}
+
+/**
+ * @brief One round of moves over the copy: each waiting pickup in turn goes to
+ * the placement (any car for NOTIFY pickups, else its own) that lowers cost most
+ * @return pickups moved
+ */
+static int improve(Car *cars, int64_t deadline, int *reassigned) {
+    int moved = 0;
+    static Car without, trial, best; //Only the optimizer thread searches
+    for (int a = 0; a < MAX_CARS; a++) {
+        if (!usable(&cars[a]) || cars[a].untracked) continue;
+        for (int pi = 0; pi < cars[a].pickup_count; pi++) {
+            if (monotonic_ns() > deadline) return moved;
+            Pickup p = cars[a].pickups[pi];
+            if (p.boarded) continue;
+            without = cars[a];
+            if (!take_pickup(&without, pi)) continue;
+            long base_a = car_cost(&cars[a]);
+            long best_delta = 0;
+            int best_b = -1;
+            for (int b = 0; b < MAX_CARS; b++) {
+                if (!usable(&cars[b]) || cars[b].untracked || (b != a && p.notify_fd < 0)) continue;
+                if (b != a && express_floors > 0 && !express_accepts(&cars[b], p.source, p.dest, express_floors)) continue;
+                trial = (b == a) ? without : cars[b];
+                if (!put_pickup(&trial, &p)) continue;
+                long delta = (b == a) ? car_cost(&trial) - base_a
+                           : car_cost(&without) + car_cost(&trial) - base_a - car_cost(&cars[b]);
+                if (delta < best_delta) {
+                    best_delta = delta;
+                    best_b = b;
+                    best = trial;
+                }
+            }
+            if (best_b < 0) continue;
+            if (best_b != a) {
+                cars[a] = without;
+                (*reassigned)++;
+            }
+            cars[best_b] = best;
+            moved++;
+            pi = -1; //The pickup list changed; start this car over
+        }
+    }
+    return moved;
+}
+
+/// @brief Which car (index) held the pickup notified on fd before the search
+static int original_car(const Car *before, int fd) {
+    for (int c = 0; c < MAX_CARS; c++) {
+        for (int i = 0; i < before[c].pickup_count; i++) {
+            if (before[c].pickups[i].notify_fd == fd) return c;
+        }
+    }
+    return -1;
+}
+
+static void reopt_bank(Bank *bank) {
+    static Car before[MAX_CARS], plan[MAX_CARS];
+    pthread_mutex_lock(&bank->mutex);
+    int waiting = 0;
+    for (int c = 0; c < MAX_CARS; c++) {
+        if (!usable(&bank->cars[c])) continue;
+        car_sync_status(&bank->cars[c]);
+        waiting += bank->cars[c].pickup_count;
+    }
+    bank->metrics.reopt_passes++;
+    if (waiting < 2) {
+        pthread_mutex_unlock(&bank->mutex);
+        return;
+    }
+    memcpy(before, bank->cars, sizeof(before));
+    unsigned long version = bank->version;
+    pthread_mutex_unlock(&bank->mutex);
+
+    memcpy(plan, before, sizeof(plan));
+    int64_t deadline = monotonic_ns() + REOPT_BUDGET_NS;
+    int moved = 0, reassigned = 0, round;
+    while ((round = improve(plan, deadline, &reassigned)) > 0) {
+        moved += round;
+    }
+    if (moved == 0) return;
+
+    pthread_mutex_lock(&bank->mutex);
+    if (bank->version != version || !handoff_idle()) {
+        bank->metrics.reopt_stale++;
+        pthread_mutex_unlock(&bank->mutex);
+        return;
+    }
+    for (int c = 0; c < MAX_CARS; c++) {
+        Car *car = &bank->cars[c];
+        //Compare the pickups themselves: a car can trade one call for an identical one
+        if (!usable(car) || (plan[c].queue_size == before[c].queue_size &&
+            memcmp(plan[c].queue, before[c].queue, sizeof(int) * plan[c].queue_size) == 0 &&
+            plan[c].pickup_count == before[c].pickup_count &&
+            memcmp(plan[c].pickups, before[c].pickups, sizeof(Pickup) * plan[c].pickup_count) == 0)) continue;
+        int old_head = (car->queue_size > 0) ? car->queue[0] : -1000;
+        memcpy(car->queue, plan[c].queue, sizeof(car->queue));
+        car->queue_size = plan[c].queue_size;
+        memcpy(car->pickups, plan[c].pickups, sizeof(car->pickups));
+        car->pickup_count = plan[c].pickup_count;
+        repl_car_queue(car);
+        if (car->queue_size > 0 && car->queue[0] != old_head) {
+            send_next_destination(car);
+        }
+        for (int i = 0; i < car->pickup_count; i++) {
+            Pickup *p = &car->pickups[i];
+            int from = (p->notify_fd >= 0) ? original_car(before, p->notify_fd) : c;
+            if (from == c || from < 0) continue;
+            char msg[BUFFER_SIZE];
+            snprintf(msg, sizeof(msg), "CAR %s", car->car_name);
+            conn_send(p->notify_fd, msg);
+            printf("Reassigned call (%d->%d) from Car %s to Car %s.\n", p->source, p->dest,
+                bank->cars[from].car_name, car->car_name);
+        }
+    }
+    bank->version++;
+    bank->metrics.reopt_moved += moved;
+    bank->metrics.reopt_reassigned += reassigned;
+    pthread_mutex_unlock(&bank->mutex);
+}
+
+static void *reopt_thread(void *arg) {
+    (void)arg;
+    while (!shutdown_requested) {
+        struct timespec pause = {0, REOPT_PERIOD_MS * 1000000L};
+        nanosleep(&pause, NULL);
+        int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+        for (int b = 0; b < count && !shutdown_requested; b++) {
+            reopt_bank(&banks[b]);
+        }
+    }
+    return NULL;
+}
+
+/// @brief Starts the optimizer thread
+int reopt_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reopt_thread, NULL) != 0) {
+        perror("pthread_create() failed");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/// @brief Prints the optimizer's counters across banks, used on shutdown
+void print_reopt_metrics(void) {
+    unsigned long passes = 0, moved = 0, reassigned = 0, stale = 0;
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int b = 0; b < count; b++) {
+        pthread_mutex_lock(&banks[b].mutex);
+        passes += banks[b].metrics.reopt_passes;
+        moved += banks[b].metrics.reopt_moved;
+        reassigned += banks[b].metrics.reopt_reassigned;
+        stale += banks[b].metrics.reopt_stale;
+        pthread_mutex_unlock(&banks[b].mutex);
+    }
+    if (passes == 0) return;
+    printf("Re-optimizer: %lu bank passes, %lu pickups re-planned (%lu to another car), %lu plans dropped as stale\n",
+        passes, moved, reassigned, stale);
+}
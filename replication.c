@@ -0,0 +1,434 @@
+/**
+ * Hot standby replication for the controller.
+ *
+ * A primary started with --replicate (or any standby once it has taken over)
+ * accepts one standby on a local abstract socket. Every change to the car
+ * table is written as a small text event into a bounded ring while the car's
+ * bank mutex is held, so each car's events are in the same order as its changes. A sender thread
+ * drains the ring onto the standby socket using the normal length-prefixed
+ * framing and sends a heartbeat when there is nothing else to say. A standby
+ * that falls behind far enough to fill the ring is dropped; it resyncs from a
+ * full snapshot when it reconnects.
+ *
+ * Events (each prefixed with the primary's CLOCK_MONOTONIC time in ns):
+ *   RESET                       - forget the mirror, a snapshot follows
+ *   REG <token> <bank> <name> <lo> <hi>
+ *   STAT <token> <floor> <status>
+ *   QUEUE <token> <n> <floor>...
+ *   DROP <token>
+ *   HB
+ *
+ * The standby applies events to its own car table as detached entries. When the
+ * primary's stream ends or goes quiet for REPL_DEAD_MS it claims the port; cars
+ * that reconnect with "CAR ... SESSION <token>" get their entry (and queue) back.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <poll.h>
+#include <time.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#define REPL_RING_SIZE 4096
+#define REPL_MSG_LEN 192
+#define REPL_HEARTBEAT_MS 50 //Primary heartbeat interval
+#define REPL_DEAD_MS 300 //Standby declares the primary dead after this much silence
+#define REPL_CONNECT_RETRY_MS 100
+
+static char repl_ring[REPL_RING_SIZE][REPL_MSG_LEN];
+static int repl_head = 0; //Next entry to send
+static int repl_count = 0;
+static int repl_fd = -1; //Connected standby, -1 if none
+static int repl_thread_started = 0;
+static int repl_sending = 0; //Sender is writing to repl_fd outside the lock
+static int repl_tokens = 0;
+static pthread_mutex_t repl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t repl_cond = PTHREAD_COND_INITIALIZER;
+
+static int64_t repl_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void repl_init(int issue_tokens) {
+    repl_tokens = issue_tokens;
+}
+
+/// @brief Whether cars should be given SESSION tokens (only useful when a standby can exist)
+int repl_issues_tokens(void) {
+    return repl_tokens;
+}
+
+/// @brief Creates a 16 hex digit session token
+void repl_new_token(char *out) {
+    static uint64_t counter = 0;
+    uint64_t value = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+        //Fall back to something unique enough for one host
+        value = (uint64_t)repl_now_ns() ^ ((uint64_t)getpid() << 32);
+    }
+    if (fd >= 0) close(fd);
+    value ^= __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    snprintf(out, SESSION_TOKEN_LEN, "%016llx", (unsigned long long)value);
+}
+
+static void repl_address(struct sockaddr_un *addr, socklen_t *len) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "elevator-standby-%d", controller_port());
+    *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+/// @brief Opens the socket a standby connects to. Only called when tokens are issued
+int repl_open_listener(void) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    repl_address(&addr, &len);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&addr, len) != 0 || listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//Must be called with repl_mutex held
+static void repl_push_locked(const char *fmt, va_list ap) {
+    if (repl_fd < 0) return;
+    if (repl_count == REPL_RING_SIZE) {
+        //The standby cannot keep up. Drop it rather than block the controller
+        printf("Standby fell behind, dropping it.\n");
+        close(repl_fd);
+        repl_fd = -1;
+        repl_count = 0;
+        return;
+    }
+    char *slot = repl_ring[(repl_head + repl_count) % REPL_RING_SIZE];
+    int n = snprintf(slot, REPL_MSG_LEN, "%lld ", (long long)repl_now_ns());
+    vsnprintf(slot + n, REPL_MSG_LEN - n, fmt, ap);
+    repl_count++;
+    pthread_cond_signal(&repl_cond);
+}
+
+static void repl_emit(const char *fmt, ...) {
+    va_list ap;
+    pthread_mutex_lock(&repl_mutex);
+    va_start(ap, fmt);
+    repl_push_locked(fmt, ap);
+    va_end(ap);
+    pthread_mutex_unlock(&repl_mutex);
+}
+
+void repl_car_registered(const Car *car) {
+    repl_emit("REG %s %s %s %d %d", car->session, banks[car->bank_idx].name, car->car_name,
+        car->floor_min, car->floor_max);
+}
+
+void repl_car_status(const Car *car) {
+    repl_emit("STAT %s %d %s", car->session, car->current_floor, car->status);
+}
+
+void repl_car_queue(const Car *car) {
+    char list[REPL_MSG_LEN];
+    int used = 0;
+    list[0] = '\0';
+    for (int i = 0; i < car->queue_size && used < (int)sizeof(list); i++) {
+        used += snprintf(list + used, sizeof(list) - used, " %d", car->queue[i]);
+    }
+    repl_emit("QUEUE %s %d%s", car->session, car->queue_size, list);
+}
+
+void repl_car_dropped(const Car *car) {
+    repl_emit("DROP %s", car->session);
+}
+
+static void *repl_sender_thread(void *arg) {
+    (void)arg;
+    char msg[REPL_MSG_LEN];
+    pthread_mutex_lock(&repl_mutex);
+    while (!shutdown_requested) {
+        if (repl_count == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += REPL_HEARTBEAT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&repl_cond, &repl_mutex, &deadline);
+        }
+        if (repl_fd < 0) {
+            repl_count = 0;
+            continue;
+        }
+        int fd = repl_fd;
+        if (repl_count > 0) {
+            memcpy(msg, repl_ring[repl_head], sizeof(msg));
+            repl_head = (repl_head + 1) % REPL_RING_SIZE;
+            repl_count--;
+        } else {
+            snprintf(msg, sizeof(msg), "%lld HB", (long long)repl_now_ns());
+        }
+        //Send without the lock so emitters never wait on the socket
+        repl_sending = 1;
+        pthread_mutex_unlock(&repl_mutex);
+        int rc = send_message(fd, msg);
+        pthread_mutex_lock(&repl_mutex);
+        repl_sending = 0;
+        pthread_cond_broadcast(&repl_cond);
+        if (rc != 0 && repl_fd == fd) {
+            printf("Standby disconnected.\n");
+            close(repl_fd);
+            repl_fd = -1;
+            repl_count = 0;
+        }
+    }
+    pthread_mutex_unlock(&repl_mutex);
+    return NULL;
+}
+
+/// @brief Starts streaming to fd: a RESET, a snapshot of every car, then live events
+void repl_adopt_standby(int fd) {
+    //Hold every bank so the snapshot is consistent with the events that follow it
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int b = 0; b < count; b++) {
+        pthread_mutex_lock(&banks[b].mutex);
+    }
+    pthread_mutex_lock(&repl_mutex);
+    if (repl_fd >= 0) {
+        //Only one standby at a time
+        pthread_mutex_unlock(&repl_mutex);
+        for (int b = count - 1; b >= 0; b--) {
+            pthread_mutex_unlock(&banks[b].mutex);
+        }
+        close(fd);
+        return;
+    }
+    repl_fd = fd;
+    repl_head = 0;
+    repl_count = 0;
+    if (!repl_thread_started) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, repl_sender_thread, NULL) == 0) {
+            pthread_detach(thread);
+            repl_thread_started = 1;
+        }
+    }
+    pthread_mutex_unlock(&repl_mutex);
+
+    repl_emit("RESET");
+    for (int i = 0; i < count * MAX_CARS; i++) {
+        Car *car = car_from_ref(i);
+        if (!car->in_use && !car->detached) continue;
+        repl_car_registered(car);
+        car_sync_status(car);
+        repl_car_status(car);
+        repl_car_queue(car);
+    }
+    for (int b = count - 1; b >= 0; b--) {
+        pthread_mutex_unlock(&banks[b].mutex);
+    }
+    printf("Standby attached.\n");
+}
+
+void repl_accept_standby(int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) repl_adopt_standby(fd);
+}
+
+/// @brief Stops streaming and hands back the standby socket (mid-frame writes are
+/// allowed to finish first) so a live upgrade can pass it on. -1 if none
+int repl_detach_standby(void) {
+    pthread_mutex_lock(&repl_mutex);
+    while (repl_sending) {
+        pthread_cond_wait(&repl_cond, &repl_mutex);
+    }
+    int fd = repl_fd;
+    repl_fd = -1;
+    repl_count = 0;
+    pthread_mutex_unlock(&repl_mutex);
+    return fd;
+}
+
+/**
+ * STANDBY SIDE
+ */
+
+//Finds a mirrored entry and locks its bank. Returns NULL (nothing locked) if unknown
+static Car *mirror_find_locked(const char *token) {
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int b = 0; b < count; b++) {
+        pthread_mutex_lock(&banks[b].mutex);
+        for (int i = 0; i < MAX_CARS; i++) {
+            Car *car = &banks[b].cars[i];
+            if (car->detached && strcmp(car->session, token) == 0) return car;
+        }
+        pthread_mutex_unlock(&banks[b].mutex);
+    }
+    return NULL;
+}
+
+static void mirror_apply(const char *event) {
+    char kind[16], token[SESSION_TOKEN_LEN];
+    Car *car;
+    if (sscanf(event, "%15s", kind) != 1) return;
+
+    if (strcmp(kind, "RESET") == 0) {
+        int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+        for (int b = 0; b < count; b++) {
+            pthread_mutex_lock(&banks[b].mutex);
+            for (int i = 0; i < MAX_CARS; i++) {
+                memset(&banks[b].cars[i], 0, sizeof(Car));
+                banks[b].cars[i].bank_idx = b;
+            }
+            pthread_mutex_unlock(&banks[b].mutex);
+        }
+    } else if (strcmp(kind, "REG") == 0) {
+        char bank_name[MAX_BANK_NAME_LEN], name[MAX_CAR_NAME_LEN];
+        int lo, hi;
+        if (sscanf(event, "REG %16s %31s %127s %d %d", token, bank_name, name, &lo, &hi) == 5) {
+            car = mirror_find_locked(token);
+            if (car != NULL) {
+                //Re-registration moves the entry; drop the old one first
+                int old_bank = car->bank_idx;
+                memset(car, 0, sizeof(*car));
+                car->bank_idx = old_bank;
+                pthread_mutex_unlock(&banks[old_bank].mutex);
+            }
+            Bank *bank = find_bank(bank_name, 1);
+            if (bank == NULL) return;
+            pthread_mutex_lock(&bank->mutex);
+            car = NULL;
+            for (int i = 0; car == NULL && i < MAX_CARS; i++) {
+                if (!bank->cars[i].detached) car = &bank->cars[i];
+            }
+            if (car != NULL) {
+                memset(car, 0, sizeof(*car));
+                car->bank_idx = (int)(bank - banks);
+                car->detached = 1;
+                car->socket_fd = -1;
+                snprintf(car->session, sizeof(car->session), "%s", token);
+                snprintf(car->car_name, sizeof(car->car_name), "%s", name);
+                car->floor_min = lo;
+                car->floor_max = hi;
+                car->current_floor = lo;
+                strcpy(car->status, "Unknown");
+            }
+            pthread_mutex_unlock(&bank->mutex);
+        }
+    } else if (strcmp(kind, "STAT") == 0) {
+        int floor;
+        char status[BUFFER_SIZE];
+        if (sscanf(event, "STAT %16s %d %255s", token, &floor, status) == 3 &&
+            (car = mirror_find_locked(token)) != NULL) {
+            car->current_floor = floor;
+            snprintf(car->status, sizeof(car->status), "%s", status);
+            pthread_mutex_unlock(&banks[car->bank_idx].mutex);
+        }
+    } else if (strcmp(kind, "QUEUE") == 0) {
+        int n, used;
+        if (sscanf(event, "QUEUE %16s %d%n", token, &n, &used) == 2 && n >= 0 && n <= MAX_QUEUE_DEPTH &&
+            (car = mirror_find_locked(token)) != NULL) {
+            const char *p = event + used;
+            int size = 0, step;
+            while (size < n && sscanf(p, "%d%n", &car->queue[size], &step) == 1) {
+                p += step;
+                size++;
+            }
+            car->queue_size = size;
+            car->untracked = size > 0; //Pickups are not replicated
+            pthread_mutex_unlock(&banks[car->bank_idx].mutex);
+        }
+    } else if (strcmp(kind, "DROP") == 0) {
+        if (sscanf(event, "DROP %16s", token) == 1 && (car = mirror_find_locked(token)) != NULL) {
+            int bank_idx = car->bank_idx;
+            memset(car, 0, sizeof(*car));
+            car->bank_idx = bank_idx;
+            pthread_mutex_unlock(&banks[bank_idx].mutex);
+        }
+    }
+}
+
+/**
+ * @brief Runs the standby: mirrors the primary's car table until the primary is lost.
+ * @return 0 when the primary has been lost and this process should take over,
+ *         -1 if shutdown was requested first
+ */
+int repl_run_standby(void) {
+    struct sockaddr_un addr;
+    socklen_t len;
+    int fd = -1;
+    int64_t events = 0, lag_total_ns = 0, lag_max_ns = 0;
+    int64_t last_contact = 0;
+    int announced_wait = 0;
+
+    repl_address(&addr, &len);
+    while (!shutdown_requested && fd < 0) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, len) == 0) break;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        if (!announced_wait) {
+            printf("Standby waiting for a primary on port %d.\n", controller_port());
+            announced_wait = 1;
+        }
+        struct timespec pause = {0, REPL_CONNECT_RETRY_MS * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    if (fd < 0) return -1;
+    printf("Standby replicating from primary on port %d.\n", controller_port());
+
+    const char *reason = "heartbeat timeout";
+    last_contact = repl_now_ns();
+    while (!shutdown_requested) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, REPL_DEAD_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            reason = "poll failure";
+            break;
+        }
+        if (ready == 0) break; //Primary went quiet
+        char *event = receive_msg(fd);
+        if (event == NULL) {
+            reason = "connection lost";
+            break;
+        }
+        int64_t now = repl_now_ns();
+        long long sent_ns = 0;
+        int used = 0;
+        if (sscanf(event, "%lld %n", &sent_ns, &used) == 1) {
+            int64_t lag = now - (int64_t)sent_ns;
+            lag_total_ns += lag;
+            if (lag > lag_max_ns) lag_max_ns = lag;
+            events++;
+            mirror_apply(event + used);
+        }
+        last_contact = now;
+        free(event);
+    }
+    close(fd);
+    if (shutdown_requested) return -1;
+
+    int mirrored = 0;
+    int count = __atomic_load_n(&bank_count, __ATOMIC_ACQUIRE);
+    for (int b = 0; b < count; b++) {
+        pthread_mutex_lock(&banks[b].mutex);
+        for (int i = 0; i < MAX_CARS; i++) {
+            if (banks[b].cars[i].detached) mirrored++;
+        }
+        pthread_mutex_unlock(&banks[b].mutex);
+    }
+    printf("Primary lost (%s) %ld ms after last contact. Taking over with %d cars awaiting resume.\n",
+        reason, (long)((repl_now_ns() - last_contact) / 1000000), mirrored);
+    printf("Replication lag over %lld events: avg %lld us, max %lld us.\n", (long long)events,
+        (long long)(events ? lag_total_ns / events / 1000 : 0), (long long)(lag_max_ns / 1000));
+    return 0;
+}
@@ -0,0 +1,385 @@
+/**
+ * Monte Carlo rollout dispatch (--rollout).
+ *
+ * The greedy rule in schedule_request only looks at the call in hand. With
+ * --rollout, every call that more than one car could take is decided by
+ * simulation instead: for each candidate car the bank is played forward
+ * ROLLOUT_HORIZON steps with the call given to that car and with future
+ * calls drawn from the bank's demand model, which are placed by the greedy
+ * rule as they would be today. The candidate whose futures cost least (riders'
+ * waits, plus a lighter weight for ride time) takes the call.
+ *
+ * The demand model is the bank's last ROLLOUT_HISTORY calls: their rate sets
+ * how often a sampled call arrives and each sampled call copies the floors of
+ * a random one of them. Sample s uses the same future calls for every
+ * candidate, so candidates are compared on equal terms.
+ *
+ * Rollouts run on a pool of worker threads, one per spare core, with the
+ * calling handler thread joining in. Tasks are handed out sample by sample
+ * across the candidates until ROLLOUT_SAMPLES have run or ROLLOUT_BUDGET_NS
+ * has passed; the bank mutex is held throughout, so the budget bounds how
+ * long the bank waits. One decision uses the pool at a time, and a call that
+ * finds it taken (another bank is deciding) keeps the greedy choice rather
+ * than wait, so no bank ever holds its mutex for more than one budget.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <time.h>
+#include <math.h>
+
+#define ROLLOUT_HISTORY 128 //Recent calls per bank the demand model samples
+#define ROLLOUT_MIN_HISTORY 8 //Fewer than this and no future calls are sampled
+#define ROLLOUT_HORIZON 40 //Steps simulated (see rollout_choose for how long a step is)
+#define ROLLOUT_SAMPLES 32 //Futures per candidate
+#define ROLLOUT_MIN_SAMPLES 4 //Sampled futures needed before they may overrule sample 0
+#define ROLLOUT_CONFIDENCE 2.0 //Standard errors a sampled gain must clear
+#define ROLLOUT_BUDGET_NS 2000000LL
+#define ROLLOUT_WAIT_WEIGHT 4 //Waiting counts this many times as much as riding
+#define ROLLOUT_CAR_RIDERS 64 //Riders a simulated car keeps track of
+#define ROLLOUT_MAX_WORKERS 8
+
+typedef struct {
+    int source;
+    int dest;
+    int64_t at_ns;
+} demand_call_t;
+
+typedef struct {
+    demand_call_t calls[ROLLOUT_HISTORY];
+    int next; //Ring position of the next call
+    int count;
+} demand_t;
+
+typedef struct {
+    int source;
+    int dest;
+    int riding; //Boarded at source
+    int since; //Floor-time it started waiting, or riding
+} rider_t;
+
+//Guarded by the bank's mutex
+static demand_t demand[MAX_BANKS];
+
+//The decision being evaluated. Set up by the caller while no task is running
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    Car cars[MAX_CARS];
+    int candidates[MAX_CARS];
+    int candidate_count;
+    int source, dest;
+    demand_call_t history[ROLLOUT_HISTORY];
+    int history_count;
+    double calls_per_step;
+    int step_ms;
+    int64_t deadline;
+    int next_task, total_tasks, running;
+    long cost[MAX_CARS][ROLLOUT_SAMPLES]; //By candidate slot and sample
+    int done[MAX_CARS][ROLLOUT_SAMPLES];
+} job = {.mutex = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER};
+
+//Serialises decisions on the pool
+static pthread_mutex_t decide_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int rollout_enabled = 0;
+static int worker_count = 0;
+
+//Counters for the shutdown report, guarded by decide_mutex
+static unsigned long decisions, overrides, rollouts;
+static unsigned long long decide_ns, decide_max_ns;
+static unsigned long contended; //Calls left greedy because the pool was busy; atomic
+
+/// @brief Records a call in its bank's demand model. Caller holds the bank mutex
+void rollout_observe(Bank *bank, int source, int dest) {
+    demand_t *d = &demand[bank - banks];
+    d->calls[d->next].source = source;
+    d->calls[d->next].dest = dest;
+    d->calls[d->next].at_ns = monotonic_ns();
+    d->next = (d->next + 1) % ROLLOUT_HISTORY;
+    if (d->count < ROLLOUT_HISTORY) d->count++;
+}
+
+typedef struct {
+    Car cars[MAX_CARS];
+    rider_t riders[MAX_CARS][ROLLOUT_CAR_RIDERS]; //Each car's riders, waiting or aboard
+    int rider_count[MAX_CARS];
+    int credit_ms[MAX_CARS]; //Time a car has left this step; negative while it is busy
+    long cost;
+} sim_t;
+
+/// @brief Gives a rider to a simulated car, or charges it the rest of the horizon if it cannot take it
+static void sim_assign(sim_t *sim, int car, int source, int dest, int now) {
+    Car *c = (car >= 0) ? &sim->cars[car] : NULL;
+    if (c == NULL || c->queue_size + 2 > MAX_QUEUE_DEPTH || sim->rider_count[car] >= ROLLOUT_CAR_RIDERS) {
+        sim->cost += (long)(ROLLOUT_HORIZON - now) * ROLLOUT_WAIT_WEIGHT;
+        return;
+    }
+    plan_insertion(c, source, dest);
+    sim->riders[car][sim->rider_count[car]++] = (rider_t){source, dest, 0, now};
+}
+
+/// @brief Moves every simulated car on by one step, at the speed it advertised
+static void sim_step(sim_t *sim, int t) {
+    for (int c = 0; c < MAX_CARS; c++) {
+        Car *car = &sim->cars[c];
+        if (!car->in_use) continue;
+        sim->credit_ms[c] += job.step_ms;
+        while (sim->credit_ms[c] > 0) {
+            if (car->queue_size == 0) {
+                strcpy(car->status, "Closed");
+                sim->credit_ms[c] = 0; //Idle time is not saved up
+                break;
+            }
+            if (car->current_floor != car->queue[0]) {
+                car->current_floor += (car->queue[0] > car->current_floor) ? 1 : -1;
+                strcpy(car->status, "Between");
+                sim->credit_ms[c] -= car_floor_ms(car);
+            }
+            if (car->current_floor != car->queue[0]) continue;
+
+            //A stop: board those waiting here and let off those riding to here
+            int floor = car->queue[0];
+            remove_from_queue(car->queue, &car->queue_size, 0);
+            strcpy(car->status, "Closed");
+            sim->credit_ms[c] -= car_stop_ms(car);
+            rider_t *riders = sim->riders[c];
+            for (int r = 0; r < sim->rider_count[c]; r++) {
+                if (!riders[r].riding && riders[r].source == floor) {
+                    sim->cost += (long)(t + 1 - riders[r].since) * ROLLOUT_WAIT_WEIGHT;
+                    riders[r].riding = 1;
+                    riders[r].since = t + 1;
+                } else if (riders[r].riding && riders[r].dest == floor) {
+                    sim->cost += t + 1 - riders[r].since;
+                    riders[r--] = riders[--sim->rider_count[c]];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Plays the job's bank forward with the call on one candidate
+ * @return the cost of the riders' time over the horizon
+ */
+static long simulate(int candidate, int sample) {
+    sim_t sim;
+    unsigned int seed = 0x9e3779b9u * (unsigned int)(sample + 1);
+
+    memcpy(sim.cars, job.cars, sizeof(sim.cars));
+    memset(sim.rider_count, 0, sizeof(sim.rider_count));
+    memset(sim.credit_ms, 0, sizeof(sim.credit_ms));
+    sim.cost = 0;
+    for (int c = 0; c < MAX_CARS; c++) {
+        for (int i = 0; i < sim.cars[c].pickup_count && i < ROLLOUT_CAR_RIDERS; i++) {
+            const Pickup *p = &sim.cars[c].pickups[i];
+            sim.riders[c][sim.rider_count[c]++] = (rider_t){p->source, p->dest, p->boarded, 0};
+        }
+    }
+    sim_assign(&sim, candidate, job.source, job.dest, 0);
+
+    //Future calls arrive as a Poisson stream at the observed rate (none in sample 0)
+    double next_call = ROLLOUT_HORIZON;
+    if (sample > 0 && job.history_count >= ROLLOUT_MIN_HISTORY && job.calls_per_step > 0) {
+        next_call = -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / job.calls_per_step;
+    }
+    for (int t = 0; t < ROLLOUT_HORIZON; t++) {
+        while (next_call < t + 1) {
+            const demand_call_t *like = &job.history[rand_r(&seed) % job.history_count];
+            sim_assign(&sim, greedy_choice(sim.cars, like->source, like->dest, NULL), like->source, like->dest, t);
+            next_call += -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / job.calls_per_step;
+        }
+        sim_step(&sim, t);
+    }
+
+    //Riders still waiting or riding at the horizon count up to it
+    for (int c = 0; c < MAX_CARS; c++) {
+        for (int r = 0; r < sim.rider_count[c]; r++) {
+            const rider_t *rider = &sim.riders[c][r];
+            sim.cost += (long)(ROLLOUT_HORIZON - rider->since) * (rider->riding ? 1 : ROLLOUT_WAIT_WEIGHT);
+        }
+    }
+    return sim.cost;
+}
+
+/// @brief Runs tasks of the current job until none are left. Caller holds job.mutex
+static void run_tasks(void) {
+    while (job.next_task < job.total_tasks) {
+        if (monotonic_ns() > job.deadline) {
+            job.next_task = job.total_tasks; //Out of time: what has run decides
+            break;
+        }
+        int task = job.next_task++;
+        int slot = task % job.candidate_count;
+        job.running++;
+        pthread_mutex_unlock(&job.mutex);
+        int sample = task / job.candidate_count;
+        long cost = simulate(job.candidates[slot], sample);
+        pthread_mutex_lock(&job.mutex);
+        job.cost[slot][sample] = cost;
+        job.done[slot][sample] = 1;
+        job.running--;
+    }
+    if (job.running == 0) pthread_cond_broadcast(&job.idle);
+}
+
+static void *rollout_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&job.mutex);
+    for (;;) {
+        while (job.next_task >= job.total_tasks) {
+            pthread_cond_wait(&job.work, &job.mutex);
+        }
+        run_tasks();
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads the verdict off a finished job. Sample 0 has no future calls, so
+ * it ranks the candidates by the riders already known; another candidate wins
+ * only if the sampled futures make it better by more than ROLLOUT_CONFIDENCE
+ * standard errors of the paired difference, since with few futures the lowest
+ * mean alone is mostly luck. Caller holds job.mutex.
+ * @return slot of the chosen candidate, or -1 to keep the greedy choice
+ */
+static int choose(int greedy, unsigned long *ran) {
+    int base = -1;
+    for (int i = 0; i < job.candidate_count; i++) {
+        for (int s = 0; s < ROLLOUT_SAMPLES; s++) *ran += job.done[i][s];
+        if (!job.done[i][0]) continue;
+        if (base < 0 || job.cost[i][0] < job.cost[base][0] ||
+            (job.cost[i][0] == job.cost[base][0] && job.candidates[i] == greedy)) {
+            base = i;
+        }
+    }
+    if (base < 0) return -1;
+
+    int chosen = base;
+    double best_gain = 0;
+    for (int i = 0; i < job.candidate_count; i++) {
+        if (i == base) continue;
+        double sum = 0, sum_sq = 0;
+        int n = 0;
+        for (int s = 1; s < ROLLOUT_SAMPLES; s++) {
+            if (!job.done[i][s] || !job.done[base][s]) continue;
+            double diff = (double)(job.cost[base][s] - job.cost[i][s]);
+            sum += diff;
+            sum_sq += diff * diff;
+            n++;
+        }
+        if (n < ROLLOUT_MIN_SAMPLES) continue;
+        double mean = sum / n;
+        double var = (sum_sq - n * mean * mean) / (n - 1);
+        double spread = sqrt(var > 0 ? var : 0) / sqrt(n);
+        if (mean > ROLLOUT_CONFIDENCE * spread && mean > best_gain) {
+            best_gain = mean;
+            chosen = i;
+        }
+    }
+    return chosen;
+}
+
+/**
+ * @brief Picks the car for a call by rollouts, when rollout dispatch is on and
+ * more than one car could take it. Caller holds the bank mutex.
+ * @param greedy the car the greedy rule chose
+ * @return index of the car to take the call
+ */
+int rollout_choose(Bank *bank, int source, int dest, int greedy) {
+    if (!rollout_enabled) return greedy;
+    int candidates[MAX_CARS], count = 0;
+    for (int c = 0; c < MAX_CARS; c++) {
+        const Car *car = &bank->cars[c];
+        int pickup_idx, final_len;
+        if (!car->in_use || car->queue_size + 2 > MAX_QUEUE_DEPTH) continue;
+        if (source < car->floor_min || source > car->floor_max || dest < car->floor_min || dest > car->floor_max) continue;
+        if (calculate_insertion_cost(car, source, dest, &pickup_idx, &final_len) < 0) continue;
+        if (express_floors > 0 && c != greedy && !express_accepts(car, source, dest, express_floors)) continue;
+        candidates[count++] = c;
+    }
+    if (count < 2) return greedy;
+
+    //Waiting here would hold this bank's mutex behind another bank's whole budget
+    if (pthread_mutex_trylock(&decide_mutex) != 0) {
+        __atomic_add_fetch(&contended, 1, __ATOMIC_RELAXED);
+        return greedy;
+    }
+    int64_t started = monotonic_ns();
+    const demand_t *d = &demand[bank - banks];
+
+    pthread_mutex_lock(&job.mutex);
+    memcpy(job.cars, bank->cars, sizeof(job.cars));
+    memcpy(job.candidates, candidates, sizeof(candidates));
+    job.candidate_count = count;
+    job.source = source;
+    job.dest = dest;
+    job.history_count = d->count;
+    memcpy(job.history, d->calls, sizeof(job.history));
+    //A step is a quarter of the bank's mean floor-plus-stop time (a floor, with the guessed timing)
+    int speeds = 0, cycle_ms = 0;
+    for (int c = 0; c < MAX_CARS; c++) {
+        if (!bank->cars[c].in_use) continue;
+        cycle_ms += car_floor_ms(&bank->cars[c]) + car_stop_ms(&bank->cars[c]);
+        speeds++;
+    }
+    job.step_ms = cycle_ms / (4 * speeds); //At least two candidates are in use
+    if (job.step_ms < 1) job.step_ms = 1;
+    //Rate over the span the history covers, in calls per step
+    int oldest = (d->count < ROLLOUT_HISTORY) ? 0 : d->next;
+    int64_t span_ns = started - d->calls[oldest].at_ns;
+    job.calls_per_step = (span_ns > 0) ? (d->count - 1) * (job.step_ms * 1e6) / span_ns : 0;
+    memset(job.done, 0, sizeof(job.done));
+    job.deadline = started + ROLLOUT_BUDGET_NS;
+    job.next_task = 0;
+    job.total_tasks = count * ROLLOUT_SAMPLES;
+    pthread_cond_broadcast(&job.work);
+    run_tasks();
+    while (job.running > 0) {
+        pthread_cond_wait(&job.idle, &job.mutex);
+    }
+
+    unsigned long ran = 0;
+    int base = choose(greedy, &ran);
+    int chosen = (base >= 0) ? candidates[base] : greedy;
+    pthread_mutex_unlock(&job.mutex);
+
+    unsigned long long took = (unsigned long long)(monotonic_ns() - started);
+    decisions++;
+    rollouts += ran;
+    decide_ns += took;
+    if (took > decide_max_ns) decide_max_ns = took;
+    if (chosen != greedy) overrides++;
+    pthread_mutex_unlock(&decide_mutex);
+    return chosen;
+}
+
+/// @brief Turns rollout dispatch on and starts a worker per spare core
+int rollout_start(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = (cores > 1) ? (int)cores - 1 : 0;
+    if (wanted > ROLLOUT_MAX_WORKERS) wanted = ROLLOUT_MAX_WORKERS;
+    for (int i = 0; i < wanted; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, rollout_worker, NULL) != 0) {
+            perror("pthread_create() failed");
+            break;
+        }
+        pthread_detach(thread);
+        worker_count++;
+    }
+    rollout_enabled = 1;
+    return worker_count;
+}
+
+/// @brief Prints decision counts and latency, used on shutdown
+void print_rollout_metrics(void) {
+    pthread_mutex_lock(&decide_mutex);
+    unsigned long busy = __atomic_load_n(&contended, __ATOMIC_RELAXED);
+    if (decisions > 0 || busy > 0) {
+        printf("Rollout dispatch: %lu decisions (%lu differ from greedy), avg %llu us (max %llu us), avg %lu rollouts each, %lu left greedy while busy\n",
+            decisions, overrides, decisions ? decide_ns / decisions / 1000 : 0, decide_max_ns / 1000,
+            decisions ? rollouts / decisions : 0, busy);
+    }
+    pthread_mutex_unlock(&decide_mutex);
+}
@@ -0,0 +1,523 @@
+/**
+ * Elevator router: one public port in front of several controller processes.
+ *
+ * Usage: ./router [--controller-port <port>] <controller>...
+ *
+ * Each <controller> is the port of a controller running on this host (or on
+ * --controller-ip), optionally followed by what it owns:
+ *
+ *   3001            a share of whatever no other controller owns
+ *   3002:east       bank east
+ *   3003:1-40       cars serving only floors 1 to 40, and calls from those floors
+ *
+ * The router reads the first frame of every connection, picks a controller
+ * from it and forwards that frame. From then on the connection's bytes go
+ * through untouched in both directions, spliced socket to pipe to socket so
+ * they never enter user space; the length-prefixed framing is the
+ * controller's business. A car goes by its bank ("CAR ... BANK east") and its
+ * lowest floor, a call by its bank and its source floor, and a gateway by the
+ * bank it names ("GATEWAY BANK east"). For a call to reach every car that could
+ * take it, all of a car's floors must have the same owner, so a car (in a bank
+ * nobody owns) whose floors cross the edge of a floor range is refused; it
+ * cannot be split, as one car cannot be in two controllers' queues. A call
+ * whose floors cross an edge is then one no car serves and is answered
+ * UNAVAILABLE by its source floor's controller. A connection that matches no
+ * owner goes to one of the controllers without one, chosen by hashing its
+ * bank name (rendezvous hashing), so a bank's cars and calls always meet on
+ * the same controller and only the banks that must move do when controllers
+ * come and go.
+ *
+ * Controllers join and leave by starting and stopping: every ROUTER_PROBE_MS
+ * the router tries each port. A controller that goes away takes its cars'
+ * connections with it and they reconnect through the router to the next
+ * choice. When one (re)joins, the car and gateway connections that now belong
+ * to it are closed so they reconnect to it; like any reconnecting car they
+ * start with an empty queue there. Calls are short lived and are not moved.
+ *
+ * One thread serves everything from an epoll loop. Counters per controller
+ * are printed on shutdown (SIGINT).
+ */
+
+#define _GNU_SOURCE //splice, pipe2, accept4
+#include "shared.h"
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+#define ROUTER_MAX_CONTROLLERS 16
+#define ROUTER_MAX_CONNS 4096
+#define ROUTER_PROBE_MS 500 //How often every controller's port is tried
+#define ROUTER_SPLICE_CHUNK 65536 //Bytes moved into a pipe at a time
+#define ROUTER_FRAME_MAX 512 //Largest first frame read to route a connection
+#define ROUTER_BANK_LEN 32
+#define ROUTER_EVENTS 256
+#define ROUTER_DEFAULT_BANK "default" //Same name the controller gives cars and calls without a bank
+#define NO_FLOOR INT_MIN
+
+typedef struct {
+    int port;
+    char bank[ROUTER_BANK_LEN]; //Bank it owns, "" if none
+    int floor_lo; //Floor range it owns; floor_lo > floor_hi if none
+    int floor_hi;
+    int up;
+    unsigned long routed; //Connections sent to it
+    unsigned long moved; //Connections closed so they could reconnect to it
+} controller_t;
+
+//One direction of a connection: bytes read from one socket wait in the pipe for the other
+typedef struct {
+    int pipe[2];
+    size_t pending;
+    int eof;
+} half_t;
+
+typedef struct {
+    int in_use;
+    int client_fd;
+    int controller_fd; //-1 while the first frame is being read
+    int controller; //Index into controllers, -1 while the first frame is being read
+    int movable; //A car or gateway, moved when its controller changes
+    char bank[ROUTER_BANK_LEN];
+    int floor; //Lowest floor of a car, source of a call, NO_FLOOR for a gateway
+    char first[sizeof(uint16_t) + ROUTER_FRAME_MAX + 1];
+    size_t first_len;
+    half_t up; //Client to controller
+    half_t down; //Controller to client
+} conn_t;
+
+static controller_t controllers[ROUTER_MAX_CONTROLLERS];
+static int controller_count = 0;
+static conn_t conns[ROUTER_MAX_CONNS];
+static int epoll_fd = -1;
+static unsigned long long forwarded_bytes = 0;
+static unsigned long refused = 0;
+static volatile sig_atomic_t shutdown_requested = 0;
+
+#define LISTENER_TAG UINT64_MAX
+//epoll data for a connection: its index, and which socket (0 client, 1 controller)
+#define CONN_TAG(idx, side) (((uint64_t)(idx) << 1) | (side))
+
+static void sigint_handler(int signum) {
+    (void)signum;
+    shutdown_requested = 1;
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/// @brief Parses "<port>", "<port>:<lo>-<hi>" or "<port>:<bank>"
+static int parse_controller(const char *arg, controller_t *c) {
+    char rule[ROUTER_BANK_LEN * 2] = "";
+    char *end;
+    long port = strtol(arg, &end, 10);
+    if (end == arg || port <= 0 || port > 65535 || (*end != '\0' && *end != ':')) return -1;
+    memset(c, 0, sizeof(*c));
+    c->port = (int)port;
+    c->floor_lo = 1;
+    c->floor_hi = 0;
+    if (*end == '\0') return 0;
+    if (strlen(end + 1) == 0 || strlen(end + 1) >= sizeof(rule)) return -1;
+    strcpy(rule, end + 1);
+
+    char *dash = strchr(rule, '-');
+    if (dash != NULL) {
+        *dash = '\0';
+        if (validate_floor(rule) && validate_floor(dash + 1)) {
+            c->floor_lo = floor_to_int(rule);
+            c->floor_hi = floor_to_int(dash + 1);
+            return c->floor_lo <= c->floor_hi ? 0 : -1;
+        }
+        *dash = '-';
+    }
+    if (strlen(rule) >= sizeof(c->bank)) return -1;
+    strcpy(c->bank, rule);
+    return 0;
+}
+
+static int owns_something(const controller_t *c) {
+    return c->bank[0] != '\0' || c->floor_lo <= c->floor_hi;
+}
+
+//FNV-1a of the bank name mixed with the port: each bank ranks the controllers differently
+static uint64_t rendezvous_weight(const char *bank, int port) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = bank; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+    h = (h ^ (uint64_t)port) * 1099511628211ULL;
+    h ^= h >> 29;
+    return h * 0xbf58476d1ce4e5b9ULL;
+}
+
+/**
+ * @brief The controller a connection belongs to: the owner of its bank, then the
+ * owner of its floor, then by hashing among controllers that own nothing (or
+ * among all of them if every one owns something)
+ * @return index into controllers, or -1 if none is up
+ */
+static int choose_controller(const char *bank, int floor) {
+    for (int i = 0; i < controller_count; i++) {
+        if (controllers[i].up && strcmp(controllers[i].bank, bank) == 0) return i;
+    }
+    for (int i = 0; floor != NO_FLOOR && i < controller_count; i++) {
+        if (controllers[i].up && floor >= controllers[i].floor_lo && floor <= controllers[i].floor_hi) return i;
+    }
+    int best = -1;
+    uint64_t best_weight = 0;
+    for (int pass = 0; pass < 2 && best < 0; pass++) {
+        for (int i = 0; i < controller_count; i++) {
+            if (!controllers[i].up || (pass == 0 && owns_something(&controllers[i]))) continue;
+            uint64_t weight = rendezvous_weight(bank, controllers[i].port);
+            if (best < 0 || weight > best_weight) {
+                best = i;
+                best_weight = weight;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Whether a car serving lo to hi would have floors routed to different
+ * controllers: some floor range covers part of it but not all. Ranges are
+ * checked whether or not their controller is up, so the answer does not change
+ * as controllers come and go
+ */
+static int spans_owners(const char *bank, int lo, int hi) {
+    for (int i = 0; i < controller_count; i++) {
+        if (strcmp(controllers[i].bank, bank) == 0) return 0; //Its bank's owner takes every floor
+    }
+    for (int i = 0; i < controller_count; i++) {
+        const controller_t *c = &controllers[i];
+        int overlaps = lo <= c->floor_hi && hi >= c->floor_lo;
+        if (overlaps && (lo < c->floor_lo || hi > c->floor_hi)) return 1;
+    }
+    return 0;
+}
+
+/// @brief Connects to a controller (blocking, it is expected to be close by)
+static int connect_controller(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, controller_ip(), &addr.sin_addr) != 1) {
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void close_conn(int idx) {
+    conn_t *c = &conns[idx];
+    close(c->client_fd);
+    if (c->controller_fd >= 0) {
+        close(c->controller_fd);
+        close(c->up.pipe[0]);
+        close(c->up.pipe[1]);
+        close(c->down.pipe[0]);
+        close(c->down.pipe[1]);
+    }
+    c->in_use = 0;
+}
+
+/**
+ * @brief Moves whatever can be moved from one socket to the other, until either
+ * side would block
+ * @return 0 to carry on, -1 once the connection is finished (closed or broken)
+ */
+static int pump(half_t *h, int from, int to) {
+    while (1) {
+        if (h->pending > 0) {
+            ssize_t n = splice(h->pipe[0], NULL, to, NULL, h->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) return (errno == EAGAIN) ? 0 : -1;
+            h->pending -= (size_t)n;
+            forwarded_bytes += (unsigned long long)n;
+            continue;
+        }
+        //Everything read before the peer closed has gone out
+        if (h->eof) return -1;
+        ssize_t n = splice(from, NULL, h->pipe[1], NULL, ROUTER_SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            h->eof = 1;
+        } else if (n < 0) {
+            return (errno == EAGAIN) ? 0 : -1;
+        } else {
+            h->pending += (size_t)n;
+        }
+    }
+}
+
+static void pump_conn(int idx) {
+    conn_t *c = &conns[idx];
+    if (pump(&c->up, c->client_fd, c->controller_fd) != 0 ||
+        pump(&c->down, c->controller_fd, c->client_fd) != 0) {
+        close_conn(idx);
+    }
+}
+
+/// @brief Opens the way to the chosen controller once the first frame is in, and forwards it
+static void route_conn(int idx) {
+    conn_t *c = &conns[idx];
+    char *frame = c->first + sizeof(uint16_t);
+    char floor_str[8], top_str[8];
+    c->first[c->first_len] = '\0';
+
+    //What the connection is, and where its bank and floor put it
+    if (!get_msg_option(frame, "BANK", c->bank, sizeof(c->bank))) {
+        strcpy(c->bank, ROUTER_DEFAULT_BANK);
+    }
+    c->floor = NO_FLOOR;
+    if (strncmp(frame, "CAR ", 4) == 0 && sscanf(frame, "CAR %*s %7s %7s", floor_str, top_str) == 2) {
+        c->movable = 1;
+        c->floor = floor_to_int(floor_str);
+        if (spans_owners(c->bank, c->floor, floor_to_int(top_str))) {
+            printf("Car from %s to %s crosses the floors of two controllers, refused.\n", floor_str, top_str);
+            refused++;
+            close_conn(idx);
+            return;
+        }
+    } else if (strncmp(frame, "CALL ", 5) == 0 && sscanf(frame, "CALL %7s", floor_str) == 1) {
+        c->floor = floor_to_int(floor_str);
+    } else if (strncmp(frame, "GATEWAY", 7) == 0 && (frame[7] == '\0' || frame[7] == ' ')) {
+        c->movable = 1;
+    } else {
+        close_conn(idx);
+        return;
+    }
+
+    //A controller that refuses the connection is taken as gone until the next probe says otherwise
+    int fd = -1, chosen = -1;
+    while (fd < 0 && (chosen = choose_controller(c->bank, c->floor)) >= 0) {
+        fd = connect_controller(controllers[chosen].port);
+        if (fd < 0) {
+            controllers[chosen].up = 0;
+            printf("Controller on port %d left.\n", controllers[chosen].port);
+        }
+    }
+    if (fd < 0) {
+        //Nobody to take it; call pads are told, cars retry on their own
+        if (!c->movable) send_message(c->client_fd, "UNAVAILABLE");
+        refused++;
+        close_conn(idx);
+        return;
+    }
+    if (send_looped(fd, c->first, c->first_len) != 0 || pipe2(c->up.pipe, O_NONBLOCK) != 0) {
+        close(fd);
+        close_conn(idx);
+        return;
+    }
+    if (pipe2(c->down.pipe, O_NONBLOCK) != 0) {
+        close(c->up.pipe[0]);
+        close(c->up.pipe[1]);
+        close(fd);
+        close_conn(idx);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    c->controller_fd = fd;
+    c->controller = chosen;
+    controllers[chosen].routed++;
+    struct epoll_event ev = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {.u64 = CONN_TAG(idx, 1)}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    //Anything the client sent after its first frame is already waiting
+    pump_conn(idx);
+}
+
+/// @brief Reads the first frame, exactly, so nothing after it is taken out of the socket
+static void read_first_frame(int idx) {
+    conn_t *c = &conns[idx];
+    while (1) {
+        size_t want = sizeof(uint16_t);
+        if (c->first_len >= sizeof(uint16_t)) {
+            uint16_t nlen;
+            memcpy(&nlen, c->first, sizeof(nlen));
+            size_t len = ntohs(nlen);
+            if (len > ROUTER_FRAME_MAX) {
+                close_conn(idx);
+                return;
+            }
+            want += len;
+        }
+        if (c->first_len == want && want > sizeof(uint16_t)) {
+            route_conn(idx);
+            return;
+        }
+        ssize_t n = recv(c->client_fd, c->first + c->first_len, want - c->first_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) {
+            close_conn(idx);
+            return;
+        }
+        c->first_len += (size_t)n;
+    }
+}
+
+static void accept_all(int listen_fd) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) return;
+        int idx = -1;
+        for (int i = 0; i < ROUTER_MAX_CONNS; i++) {
+            if (!conns[i].in_use) {
+                idx = i;
+                break;
+            }
+        }
+        if (idx < 0) {
+            printf("Max connections reached. Rejecting new connection.\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn_t *c = &conns[idx];
+        memset(c, 0, sizeof(*c));
+        c->in_use = 1;
+        c->client_fd = fd;
+        c->controller_fd = -1;
+        c->controller = -1;
+        struct epoll_event ev = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {.u64 = CONN_TAG(idx, 0)}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        read_first_frame(idx);
+    }
+}
+
+/// @brief Tries every controller's port; on a join, moves the cars that now belong to it
+static void probe_controllers(void) {
+    int joined = 0;
+    for (int i = 0; i < controller_count; i++) {
+        int fd = connect_controller(controllers[i].port);
+        int up = (fd >= 0);
+        if (fd >= 0) close(fd);
+        if (up != controllers[i].up) {
+            printf("Controller on port %d %s.\n", controllers[i].port, up ? "joined" : "left");
+            joined |= up;
+        }
+        controllers[i].up = up;
+    }
+    if (!joined) return;
+    for (int idx = 0; idx < ROUTER_MAX_CONNS; idx++) {
+        conn_t *c = &conns[idx];
+        if (!c->in_use || !c->movable || c->controller < 0) continue;
+        int now = choose_controller(c->bank, c->floor);
+        if (now >= 0 && now != c->controller) {
+            controllers[now].moved++;
+            close_conn(idx);
+        }
+    }
+}
+
+static int open_public_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket() failed");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror("bind() failed");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    argc = parse_common_flags(argc, argv);
+    if (argc < 2 || argc - 1 > ROUTER_MAX_CONTROLLERS) {
+        fprintf(stderr, "Usage: %s [--controller-port <port>] <port>[:<bank> | :<lowest>-<highest>]...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (parse_controller(argv[i], &controllers[controller_count]) != 0) {
+            fprintf(stderr, "Invalid controller %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (controllers[controller_count].port == controller_port()) {
+            fprintf(stderr, "Controller port %d is the router's own port.\n", controller_port());
+            return EXIT_FAILURE;
+        }
+        controller_count++;
+    }
+
+    //Two sockets and four pipe ends per connection
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigaction(SIGINT, &sa, NULL);
+
+    int listen_fd = open_public_listener(controller_port());
+    epoll_fd = epoll_create1(0);
+    if (listen_fd < 0 || epoll_fd < 0) return EXIT_FAILURE;
+    struct epoll_event ev = {EPOLLIN, {.u64 = LISTENER_TAG}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    printf("Router listening on port %d for %d controllers\n", controller_port(), controller_count);
+    probe_controllers();
+
+    int64_t next_probe = monotonic_ms() + ROUTER_PROBE_MS;
+    struct epoll_event events[ROUTER_EVENTS];
+    while (!shutdown_requested) {
+        int64_t wait_ms = next_probe - monotonic_ms();
+        int n = epoll_wait(epoll_fd, events, ROUTER_EVENTS, wait_ms > 0 ? (int)wait_ms : 0);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait() failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == LISTENER_TAG) {
+                accept_all(listen_fd);
+                continue;
+            }
+            int idx = (int)(tag >> 1);
+            //The connection may have been closed by an earlier event in this batch
+            if (!conns[idx].in_use) continue;
+            if (conns[idx].controller_fd < 0) {
+                if ((tag & 1) == 0) read_first_frame(idx);
+            } else {
+                pump_conn(idx);
+            }
+        }
+        if (monotonic_ms() >= next_probe) {
+            probe_controllers();
+            next_probe = monotonic_ms() + ROUTER_PROBE_MS;
+        }
+    }
+
+    printf("\nShutdown signal received. Closing the listening socket.\n");
+    close(listen_fd);
+    for (int i = 0; i < controller_count; i++) {
+        printf("Controller %d (%s): %lu connections routed, %lu moved to it\n", controllers[i].port,
+            controllers[i].up ? "up" : "down", controllers[i].routed, controllers[i].moved);
+    }
+    printf("Router: %llu bytes forwarded, %lu connections refused\n", forwarded_bytes, refused);
+    return EXIT_SUCCESS;
+}
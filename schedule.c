@@ -0,0 +1,315 @@
+/**
+ * The scheduling model: where a call's stops go in a car's queue and which
+ * car the greedy rule gives it to.
+ *
+ * These functions only read and write the Car copies they are given, so the
+ * controller (under the bank mutex), the rollout and re-optimizer searches (on
+ * private copies) and the offline policy trainer all run the same model.
+ */
+
+#include "controller.h"
+
+ /// @brief Where a car counts as being: the next stop once it has closed its doors to leave
+ int car_effective_floor(const Car *car) {
+    if (car->queue_size > 0 && (strcmp(car->status, "Closing") == 0 || strcmp(car->status, "Between") == 0)) {
+        return car->queue[0];
+    }
+    return car->current_floor;
+ }
+
+ /**
+  * @brief A lower bound on calculate_insertion_cost that only looks at the
+  * first leg of the queue: 0 if the pickup might go at its head, otherwise 1
+  */
+ static int insertion_bound(const Car *car, int source, int dest) {
+    if (car->queue_size == 0) return 0;
+    int current = car_effective_floor(car);
+    int next = car->queue[0];
+    if (next == current) return 1; //No first leg to join
+    Direction leg_dir = (next > current) ? DIR_UP : DIR_DOWN;
+    Direction request_dir = (dest > source) ? DIR_UP : DIR_DOWN;
+    if (leg_dir == request_dir && ((leg_dir == DIR_UP && source >= current && source < next) ||
+        (leg_dir == DIR_DOWN && source <= current && source > next))) {
+        return 0;
+    }
+    //...or the first leg's run might be extended past its stop
+    if ((leg_dir == DIR_UP && source > next) || (leg_dir == DIR_DOWN && source < next)) return 0;
+    return 1;
+ }
+
+ /**
+  * @brief The greedy rule: the car that can pick the call up earliest in its
+  * queue, with the shorter final queue, then the car nearest the pickup floor,
+  * then the lower index breaking ties
+  *
+  * The exact pickup index needs a walk of the car's queue; the other three are
+  * known up front. So the candidates are visited in order of a lower bound on
+  * their rank (insertion_bound standing in for the pickup index), and a car
+  * whose bound cannot beat the best exact rank so far is skipped.
+  * @param eligible bit i set if cars[i] may be considered at all
+  * @param stats if not NULL, counts the candidates and how many were skipped
+  * @return index into cars, or -1 if no car can take the call
+  */
+ static int greedy_among(const Car *cars, int source_floor, int dest_floor, unsigned eligible, ChoiceStats *stats) {
+    int bound[MAX_CARS], dist[MAX_CARS];
+    int order[MAX_CARS];
+    int count = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (!cars[i].in_use || !(eligible & (1u << i))) continue; 
+        //Elevator car must be able to service both floors as a rule
+        if (source_floor < cars[i].floor_min || source_floor > cars[i].floor_max
+            || dest_floor < cars[i].floor_min || dest_floor > cars[i].floor_max) {
+                continue;
+            }
+        dist[i] = abs(source_floor - car_effective_floor(&cars[i]));
+        bound[i] = GREEDY_RANK(insertion_bound(&cars[i], source_floor, dest_floor), cars[i].queue_size + 2, dist[i], i);
+        //Insertion sort by bound
+        int at = count++;
+        while (at > 0 && bound[order[at - 1]] > bound[i]) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = i;
+    }
+
+    int best_car_idx = -1;
+    int best = 0;
+    int pruned = 0;
+    for (int k = 0; k < count; k++) {
+        int i = order[k];
+        if (best_car_idx >= 0 && best < bound[i]) {
+            pruned++;
+            continue;
+        }
+        int pickup_idx, final_len;
+        int cost = calculate_insertion_cost(&cars[i], source_floor, dest_floor,
+        &pickup_idx, &final_len);
+
+        if (cost < 0) continue; //An invalid insertion, do not consider
+
+        int rank = GREEDY_RANK(cost, final_len, dist[i], i);
+        if (best_car_idx < 0 || rank < best) {
+            best = rank;
+            best_car_idx = i;
+        }
+    }
+    if (stats != NULL) {
+        stats->candidates += count;
+        stats->pruned += pruned;
+    }
+    return best_car_idx;
+ }
+
+ /// @brief The greedy rule over every car (see greedy_among)
+ int greedy_choice(const Car *cars, int source_floor, int dest_floor, ChoiceStats *stats) {
+    return greedy_among(cars, source_floor, dest_floor, ~0u, stats);
+ }
+
+ /**
+  * @brief Express service: whether a car may take a call without mixing long
+  * trips (floors apart or more) with short ones. A car carrying long trips is
+  * a temporary express until they are delivered; one with no calls may start
+  * either kind.
+  */
+ int express_accepts(const Car *car, int source_floor, int dest_floor, int floors) {
+    int is_long = abs(dest_floor - source_floor) >= floors;
+    if (car->untracked) return !is_long; //Stops of unknown calls: local service
+    for (int i = 0; i < car->pickup_count; i++) {
+        const Pickup *p = &car->pickups[i];
+        if ((abs(p->dest - p->source) >= floors) != is_long) return 0;
+    }
+    return 1;
+ }
+
+ /**
+  * @brief The greedy rule among the cars express_accepts, so long trips are
+  * grouped onto expresses that skip short hops. If none of those can take
+  * the call, any car may.
+  */
+ int express_choice(const Car *cars, int source_floor, int dest_floor, int floors, ChoiceStats *stats) {
+    unsigned eligible = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (cars[i].in_use && express_accepts(&cars[i], source_floor, dest_floor, floors)) eligible |= 1u << i;
+    }
+    int best = greedy_among(cars, source_floor, dest_floor, eligible, stats);
+    if (best < 0) best = greedy_among(cars, source_floor, dest_floor, ~eligible, stats);
+    return best;
+ }
+
+ /// @brief A car's time per floor of travel: as advertised, or TIMING_GUESS_MS
+ int car_floor_ms(const Car *car) {
+    return (car->timing.floor_ms > 0) ? car->timing.floor_ms : TIMING_GUESS_MS;
+ }
+
+ /// @brief A car's time for a stop: its doors opening, staying open and closing
+ int car_stop_ms(const Car *car) {
+    if (car->timing.floor_ms <= 0) return 3 * TIMING_GUESS_MS;
+    return car->timing.opening_ms + car->timing.open_ms + car->timing.closing_ms;
+ }
+
+ /// @brief Adds a pickup's stops to a car's queue at the positions calculate_insertion_cost picks
+ void plan_insertion(Car *car, int source_floor, int dest_floor) {
+    //Recompute the best insertion to get final queue state
+    int pickup_idx, final_len;
+    calculate_insertion_cost(car, source_floor, dest_floor, &pickup_idx, &final_len);
+    int temp_queue[MAX_QUEUE_DEPTH];
+    int temp_size = car->queue_size;
+    memcpy(temp_queue, car->queue, sizeof(int) *temp_size);
+
+    insert_into_queue(temp_queue, &temp_size, pickup_idx, source_floor);
+
+    //Find where to insert dest - first check if it already exists in queue
+    int dest_already_exists = 0;
+    for (int i = 0; i < temp_size; i++) {
+        if (temp_queue[i] == dest_floor) {
+            dest_already_exists = 1;
+            break;
+        }
+    }
+    
+    if (!dest_already_exists) {
+        int dest_idx = -1;
+        Direction travel_dir = (dest_floor > source_floor) ? DIR_UP : DIR_DOWN;
+
+        for (int i = pickup_idx + 1; i < temp_size; i++) {
+            if (travel_dir == DIR_UP){
+                if(dest_floor < temp_queue[i]) {
+                    dest_idx = i;
+                    break;
+                }
+            } else { // direction down
+                if (dest_floor > temp_queue[i]) {
+                    dest_idx = i;
+                    break;
+                }
+
+            }
+        }
+        if (dest_idx == -1) dest_idx = temp_size;
+
+        insert_into_queue(temp_queue, &temp_size, dest_idx, dest_floor);
+    }
+
+    //Commit the change by memcpy
+    memcpy(car->queue, temp_queue, sizeof(int) *temp_size);
+    car->queue_size = temp_size;
+ }
+
+ /**
+  * @brief Calculates the cost of inserting a new request into a car's queue.
+  * @return the index of the pickup floor (cost) or -1 if impossible
+  */
+ int calculate_insertion_cost(const Car *car, int source, int dest, int *pickup_idx, int *final_len) {
+    int effective_floor = car->current_floor;
+    if (car-> queue_size > 0) {
+        //If closing / between we are effectively at the next floor
+        if (strcmp(car->status, "Closing") == 0 || strcmp(car->status, "Between") == 0) {
+            effective_floor = car->queue[0];
+        }
+    }
+    Direction request_dir = (dest > source) ? DIR_UP : DIR_DOWN; // is it up or down
+    //Insert as early as possible
+    int current = effective_floor;
+    for(int i = 0; i <= car->queue_size; i++) {
+        int next = (i < car->queue_size) ? car->queue[i] : current;// if at end stay
+
+        Direction segment_dir = (next > current) ? DIR_UP : ((next < current) ? DIR_DOWN : DIR_IDLE);
+        //Can we pick up on this segment? We are moving in same direction as request
+        // the source floor is between our current and next stop
+
+        if (segment_dir == request_dir) {
+            if((request_dir == DIR_UP && source >= current && source < next) ||
+            (request_dir == DIR_DOWN && source <= current && source > next)) {
+                //found a valid pickup point. now can we drop off without reversing
+                for(int j = i; j <= car->queue_size; j++) {
+                    int check_next = (j < car->queue_size) ? car->queue[j] : dest;
+                    // Check for direction reversal before drop-off
+                    if ((request_dir == DIR_UP && check_next < source) ||
+                        (request_dir == DIR_DOWN && check_next > source)) {
+                        goto next_segment; // Fails direction rule, break inner loop
+                    }
+
+                    // Check if we can drop off at or before the next stop
+                    if (j == car->queue_size ||
+                       (request_dir == DIR_UP && dest <= check_next) ||
+                       (request_dir == DIR_DOWN && dest >= check_next)) {
+                        
+                        // Valid insertion found
+                        *pickup_idx = i;
+                        *final_len = car->queue_size + 2;
+                        return *pickup_idx;
+                    }
+                }
+            }
+        }
+        
+        // Check if we can extend the current direction run
+        // For example, queue is [6,7,4] going UP then DOWN, and source=8 is beyond 7 in UP direction
+        if (segment_dir != DIR_IDLE && i < car->queue_size) {
+            int next_segment_floor = (i + 1 < car->queue_size) ? car->queue[i + 1] : -1;
+            Direction next_segment_dir = DIR_IDLE;
+            if (next_segment_floor != -1) {
+                next_segment_dir = (next_segment_floor > next) ? DIR_UP : ((next_segment_floor < next) ? DIR_DOWN : DIR_IDLE);
+            }
+            
+            // If direction changes after this segment, check if source extends current direction
+            if (next_segment_dir != segment_dir && next_segment_dir != DIR_IDLE) {
+                if ((segment_dir == DIR_UP && source > next) ||
+                    (segment_dir == DIR_DOWN && source < next)) {
+                    // Source extends the current direction run, insert after current segment
+                    // Check if dest can be reached without extra direction changes
+                    if ((segment_dir == DIR_UP && dest < source) ||
+                        (segment_dir == DIR_DOWN && dest > source)) {
+                        // Dest is in opposite direction, which is fine (we'll turn around)
+                        // Check if dest can be inserted in the remaining queue
+                        int can_insert_dest = 0;
+                        for (int j = i + 1; j <= car->queue_size; j++) {
+                            int check_floor = (j < car->queue_size) ? car->queue[j] : dest;
+                            Direction check_dir = (dest > source) ? DIR_UP : DIR_DOWN;
+                            if (check_dir == next_segment_dir) {
+                                if ((check_dir == DIR_DOWN && dest >= check_floor) ||
+                                    (check_dir == DIR_UP && dest <= check_floor)) {
+                                    can_insert_dest = 1;
+                                    break;
+                                }
+                            }
+                            if (j == car->queue_size) {
+                                can_insert_dest = 1;
+                                break;
+                            }
+                        }
+                        if (can_insert_dest) {
+                            *pickup_idx = i;
+                            *final_len = car->queue_size + 2;
+                            return *pickup_idx;
+                        }
+                    }
+                }
+            }
+        }
+        
+        next_segment:
+            current = next;
+    }    
+    //The cost is higher, which means it is waiting for jobs to finish
+    *pickup_idx = car->queue_size;
+    *final_len = car->queue_size +2;
+    return *pickup_idx;
+ }
+
+
+  void insert_into_queue(int *queue, int *size, int index, int value) {
+    if (*size >= MAX_QUEUE_DEPTH || index > *size) return;
+    //Don't add duplicates: if value equals the previous entry, skip
+    if (index > 0 && queue[index-1] == value) return;
+
+    memmove(&queue[index + 1 ], & queue[index], (*size - index) * sizeof(int));
+    queue[index] = value;
+    (*size)++;
+  }
+
+  void remove_from_queue(int *queue, int *size, int index) {
+    if (*size == 0 || index >= *size) return;
+    memmove(&queue[index], &queue[index +1], (*size - 1 - index) *sizeof(int));
+    (*size)--;
+  }
@@ -1,45 +1,64 @@
-#ifndef SHARED_H
-#define SHARED_H
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <netinet/ip.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <stdint.h>
-#include <errno.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include "shared_mem.h"
-
-
-#define CONTROLLER_PORT 3000
-#define CONTROLLER_IP "127.0.0.1"
-
-#define MAX_FLOOR 999
-#define MIN_FLOOR 99 //Keep in mind it is B99 not 99
-#define MILLISECOND 1000
-#define DELAY 0
-
-
-// Network utility functions
-void recv_looped(int fd, void *buf, size_t sz);
-void send_looped(int fd, const void *buf, size_t sz);
-char *receive_msg(int fd);
-void send_message(int fd, const char *buf);
-
-// Floor utility functions
-int validate_floor(const char* floor);
-int floor_to_int(const char *floor_str);
-void int_to_floor(int floor_int, char *floor_str, size_t size);
-
-void msg(const char *string);
-void reset_shm(car_shared_mem *s);
-void init_shm(car_shared_mem *s);
-
+#ifndef SHARED_H
+#define SHARED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/ip.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "shared_mem.h"
+
+
+#define CONTROLLER_PORT 3000
+#define CONTROLLER_IP "127.0.0.1"
+#define SHM_PREFIX "/car"
+#define MAX_SHM_PREFIX_LEN 64
+
+//The defaults above can be overridden per process so several fleets share a host
+#define ENV_CONTROLLER_IP "ELEVATOR_CONTROLLER_IP"
+#define ENV_CONTROLLER_PORT "ELEVATOR_CONTROLLER_PORT"
+#define ENV_SHM_PREFIX "ELEVATOR_SHM_PREFIX"
+#define ENV_CALL_PORT "ELEVATOR_CALL_PORT" //Call pads only; defaults to the controller port
+
+#define MAX_FLOOR 999
+#define MIN_FLOOR 99 //Keep in mind it is B99 not 99
+#define MILLISECOND 1000
+#define DELAY 0
+#define DEDUPE_KEY_LEN 64 //Idempotency keys on CALL, including the terminator
+#define MAX_BANK_NAME_LEN 32 //Bank names on CAR and CALL, including the terminator
+
+
+// Network utility functions. These return -1 (or NULL) when the peer has gone away
+int recv_looped(int fd, void *buf, size_t sz);
+int send_looped(int fd, const void *buf, size_t sz);
+char *receive_msg(int fd);
+int send_message(int fd, const char *buf);
+int get_msg_option(const char *msg, const char *key, char *out, size_t size);
+
+// Endpoint and shm namespace, from --controller-ip/--controller-port/--call-port/
+// --shm-prefix, then the ELEVATOR_* environment, then the compile-time defaults
+int parse_common_flags(int argc, char **argv);
+const char *controller_ip(void);
+int controller_port(void);
+int call_port(void);
+const char *shm_prefix(void);
+
+// Floor utility functions
+int validate_floor(const char* floor);
+int floor_to_int(const char *floor_str);
+void int_to_floor(int floor_int, char *floor_str, size_t size);
+
+void msg(const char *string);
+void reset_shm(car_shared_mem *s);
+void init_shm(car_shared_mem *s);
+
 #endif
\ No newline at end of file
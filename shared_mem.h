@@ -3,6 +3,42 @@
 #include <stdint.h>
 #include <pthread.h>
 
+// One state transition of a car, as recorded in its telemetry ring
+typedef struct {
+  uint32_t seq;                    // Transition number + 1, 0 while the car rewrites the slot
+  uint8_t cause;                   // TELEMETRY_* below
+  uint8_t modes;                   // TELEMETRY_SERVICE_MODE | TELEMETRY_EMERGENCY_MODE as they were
+  char status[8];                  // As in car_shared_mem
+  char floor[4];
+  char destination[4];
+  int64_t at_ns;                   // CLOCK_MONOTONIC
+} car_telemetry_entry;
+
+#define TELEMETRY_SLOTS 256        // Power of two
+#define TELEMETRY_SERVICE_MODE 1
+#define TELEMETRY_EMERGENCY_MODE 2
+
+// Causes of a transition
+#define TELEMETRY_START 0          // The car started
+#define TELEMETRY_CONTROLLER 1     // A FLOOR from the controller
+#define TELEMETRY_TRAVEL 2         // Setting off, passing a floor, arriving
+#define TELEMETRY_DOORS 3          // The door sequence's own timing
+#define TELEMETRY_BUTTON 4         // Open or close button
+#define TELEMETRY_SERVICE 5        // Moving in individual service mode
+#define TELEMETRY_EMERGENCY 6      // The car lost its safety system
+#define TELEMETRY_EXTERNAL 7       // Changed by another process, seen by the car afterwards
+
+// Written only by the car, with the mutex held; read without it. A reader
+// takes transitions, then for each entry wanted checks that seq is the same
+// before and after copying it (a slot the car has moved on from no longer is)
+typedef struct {
+  uint64_t transitions;            // Entries ever appended; entry n is in ring[n % TELEMETRY_SLOTS]
+  uint64_t door_cycles;            // Lifetime counters, updated atomically
+  uint64_t floors_travelled;
+  uint64_t emergencies;
+  car_telemetry_entry ring[TELEMETRY_SLOTS];
+} car_telemetry;
+
 typedef struct {
   pthread_mutex_t mutex;           // Locked while accessing struct contents
   pthread_cond_t cond;             // Signalled when the contents change
@@ -17,6 +53,8 @@ typedef struct {
   uint8_t emergency_stop;          // 1 if stop button has been pressed, else 0
   uint8_t individual_service_mode; // 1 if in individual service mode, else 0
   uint8_t emergency_mode;          // 1 if in emergency mode, else 0
+  uint32_t delay_ms;               // The car's delay in ms; write a new one to change it live
+  car_telemetry telemetry;         // Transition history and counters, readable without the mutex
 } car_shared_mem;
 
 #endif
\ No newline at end of file
@@ -1,151 +1,265 @@
-#include "shared.h"
-#include <stddef.h>
-
-void recv_looped(int fd, void *buf, size_t sz) {
-    char *ptr = buf;
-    size_t remain = sz;
-    while (remain > 0) {
-        ssize_t received = read(fd, ptr, remain);
-        //error determined by -1
-        if (received == -1) {
-            perror("read()");
-            exit(1);
-        }
-        if (received == 0) { //The connection is closed by the other end
-            //fprintf(stderr, "Connection closed unexpectedly\n");
-            exit(1);
-        }
-        //We can move the pointer forwad and decrease remainng bytes needed 
-        ptr += received; 
-        remain -= received;
-    }
-}
-
-void send_looped(int fd, const void *buf, size_t sz) {
-    const char *ptr = buf;
-    size_t remain = sz;
-    while (remain > 0) {
-        ssize_t sent = write(fd, ptr, remain);
-        if (sent == -1) {
-            //Error when writing 
-            perror("write()");
-            exit(1);
-        }
-        ptr += sent;
-        remain -= sent;
-    }
-}
-
-char *receive_msg(int fd) {
-    uint16_t nlen;
-    recv_looped(fd, &nlen, sizeof(nlen));
-    uint16_t len = ntohs(nlen); // To work out how much mem we need
-    char *buf = malloc(len + 1); //Allocate the necessary memorey ( 1 is NT)
-    if (buf == NULL) {
-        perror("malloc()"); //We know it is malloc error because should be at least malloc(1)
-        exit(1);
-    }
-    buf[len] = '\0'; //End the string (null terminate)
-    recv_looped(fd, buf,len);
-    return buf;
-}
-
-void send_message(int fd, const char *buf) {
-    //Get length of string and convert big-endian (host to network)
-    uint16_t len = htons(strlen(buf));
-    //Lets send a 2-byte length prefix
-    send_looped(fd, &len, sizeof(len));
-    //sending the message
-    send_looped(fd, buf, strlen(buf));
-    
-}
-
-
-/*
-Considerations: 
-B1,2,3,4,5 (increase lower)
-Floor can go up to 999
-but as low as B99
-no ground floor ... B2, B1, 1, 2 ...
-*/
-int validate_floor(const char* floor) {
-    if (!floor || strlen(floor) == 0 || strlen(floor) > 3) {
-        return 0; 
-    }
-
-    //Handle basement floors
-    if (floor[0] == 'B') {
-        //Check if remaining cahracters are digits
-        for (int i = 1; floor[i] != '\0'; i++) {
-            if(floor[i] < '0' || floor[i] > '9'){
-                return 0; //Maybe we want to return something else
-            }
-        }
-
-        //Convert to num
-        int basement_num = atoi(floor + 1);
-        return basement_num >= 1 && basement_num <= MIN_FLOOR; //Basedment is 1 to 99
-    } else {
-        //regular floor
-        for(int i = 0; floor[i] != '\0'; i++) {
-            if(floor[i] < '0' || floor[i] > '9'){
-                //It is a character
-                return 0;
-            }
-        }
-        int floor_num = atoi(floor);
-        return floor_num >= 1 && floor_num <= MAX_FLOOR;
-    }
-}
-
-int floor_to_int(const char *floor_str) {
-    if(floor_str == NULL) return 0;
-    if (floor_str[0] == 'B') {
-        return -atoi(floor_str + 1);
-    }
-    return atoi(floor_str);
-}
-
-void int_to_floor(int floor_int, char *floor_str, size_t size) {
-    if (floor_int < 0) {
-        snprintf(floor_str, size, "B%d", -floor_int);
-    } else {
-        snprintf(floor_str, size, "%d", floor_int);
-    }
-}
-
-// Message and shared mem
-void msg(const char *string)
-{
-  printf("%s\n    ", string);
-  fflush(stdout);
-}
-
-void reset_shm(car_shared_mem *s)
-{
-  pthread_mutex_lock(&s->mutex);
-  size_t offset = offsetof(car_shared_mem, current_floor);
-  memset((char *)s + offset, 0, sizeof(*s) - offset);
-
-  strcpy(s->status, "Closed");
-  strcpy(s->current_floor, "1");
-  strcpy(s->destination_floor, "1");
-  pthread_mutex_unlock(&s->mutex);
-}
-
-void init_shm(car_shared_mem *s)
-{
-  pthread_mutexattr_t mutattr;
-  pthread_mutexattr_init(&mutattr);
-  pthread_mutexattr_setpshared(&mutattr, PTHREAD_PROCESS_SHARED);
-  pthread_mutex_init(&s->mutex, &mutattr);
-  pthread_mutexattr_destroy(&mutattr);
-
-  pthread_condattr_t condattr;
-  pthread_condattr_init(&condattr);
-  pthread_condattr_setpshared(&condattr, PTHREAD_PROCESS_SHARED);
-  pthread_cond_init(&s->cond, &condattr);
-  pthread_condattr_destroy(&condattr);
-
-  reset_shm(s);
+#include "shared.h"
+#include <stddef.h>
+
+int recv_looped(int fd, void *buf, size_t sz) {
+    char *ptr = buf;
+    size_t remain = sz;
+    while (remain > 0) {
+        ssize_t received = read(fd, ptr, remain);
+        //error determined by -1
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            perror("read()");
+            return -1;
+        }
+        if (received == 0) { //The connection is closed by the other end
+            //fprintf(stderr, "Connection closed unexpectedly\n");
+            return -1;
+        }
+        //We can move the pointer forwad and decrease remainng bytes needed 
+        ptr += received; 
+        remain -= received;
+    }
+    return 0;
+}
+
+int send_looped(int fd, const void *buf, size_t sz) {
+    const char *ptr = buf;
+    size_t remain = sz;
+    while (remain > 0) {
+        ssize_t sent = write(fd, ptr, remain);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            //Error when writing; a peer that has hung up is for the caller to handle
+            if (errno != EPIPE && errno != ECONNRESET) perror("write()");
+            return -1;
+        }
+        ptr += sent;
+        remain -= sent;
+    }
+    return 0;
+}
+
+char *receive_msg(int fd) {
+    uint16_t nlen;
+    //A closed or broken connection is reported as NULL so callers can clean up
+    if (recv_looped(fd, &nlen, sizeof(nlen)) != 0) return NULL;
+    uint16_t len = ntohs(nlen); // To work out how much mem we need
+    char *buf = malloc(len + 1); //Allocate the necessary memorey ( 1 is NT)
+    if (buf == NULL) {
+        perror("malloc()"); //We know it is malloc error because should be at least malloc(1)
+        exit(1);
+    }
+    buf[len] = '\0'; //End the string (null terminate)
+    if (recv_looped(fd, buf, len) != 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+int send_message(int fd, const char *buf) {
+    //Get length of string and convert big-endian (host to network)
+    uint16_t len = htons(strlen(buf));
+    //Lets send a 2-byte length prefix
+    if (send_looped(fd, &len, sizeof(len)) != 0) return -1;
+    //sending the message
+    return send_looped(fd, buf, strlen(buf));
+}
+
+/// @brief Finds an optional "KEY value" pair after the fixed fields of a message,
+/// e.g. the SESSION in "CAR Alpha 1 10 SESSION 3f2a..."
+/// @return 1 if found (value copied into out), 0 otherwise
+int get_msg_option(const char *msg, const char *key, char *out, size_t size) {
+    size_t key_len = strlen(key);
+    const char *p = msg;
+    while (p != NULL && *p != '\0') {
+        //Options are whole words, so only match at the start of a word
+        if ((p == msg || p[-1] == ' ') && strncmp(p, key, key_len) == 0 && p[key_len] == ' ') {
+            const char *value = p + key_len + 1;
+            size_t n = strcspn(value, " ");
+            if (n == 0 || n >= size) return 0;
+            memcpy(out, value, n);
+            out[n] = '\0';
+            return 1;
+        }
+        p = strchr(p, ' ');
+        if (p != NULL) p++;
+    }
+    return 0;
+}
+
+static const char *ip_override;
+static int port_override;
+static int call_port_override;
+static const char *prefix_override;
+
+static int parse_port(const char *s) {
+    char *end;
+    long port = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || port < 1 || port > 65535) return -1;
+    return (int)port;
+}
+
+//shm names must be "/name" with no further slashes, and the car name is appended
+static int valid_prefix(const char *s) {
+    return s[0] == '/' && strchr(s + 1, '/') == NULL && strlen(s) < MAX_SHM_PREFIX_LEN;
+}
+
+/// @brief Strips --controller-ip, --controller-port, --call-port and --shm-prefix (each
+/// followed by a value) out of argv so the caller can check its positional arguments as before.
+/// @return the new argc, or -1 if one of the values is invalid
+int parse_common_flags(int argc, char **argv) {
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        const char *flag = argv[i];
+        int known = strcmp(flag, "--controller-ip") == 0 || strcmp(flag, "--controller-port") == 0 ||
+                    strcmp(flag, "--call-port") == 0 || strcmp(flag, "--shm-prefix") == 0;
+        if (!known) {
+            argv[out++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs a value\n", flag);
+            return -1;
+        }
+        const char *value = argv[++i];
+        if (strcmp(flag, "--controller-ip") == 0) {
+            ip_override = value;
+        } else if (strcmp(flag, "--controller-port") == 0) {
+            if ((port_override = parse_port(value)) < 0) {
+                fprintf(stderr, "Invalid controller port %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(flag, "--call-port") == 0) {
+            if ((call_port_override = parse_port(value)) < 0) {
+                fprintf(stderr, "Invalid call port %s\n", value);
+                return -1;
+            }
+        } else {
+            if (!valid_prefix(value)) {
+                fprintf(stderr, "Invalid shm prefix %s\n", value);
+                return -1;
+            }
+            prefix_override = value;
+        }
+    }
+    argv[out] = NULL;
+    return out;
+}
+
+const char *controller_ip(void) {
+    if (ip_override != NULL) return ip_override;
+    const char *env = getenv(ENV_CONTROLLER_IP);
+    return (env != NULL && *env != '\0') ? env : CONTROLLER_IP;
+}
+
+int controller_port(void) {
+    if (port_override > 0) return port_override;
+    const char *env = getenv(ENV_CONTROLLER_PORT);
+    int port = (env != NULL) ? parse_port(env) : -1;
+    return port > 0 ? port : CONTROLLER_PORT;
+}
+
+//Where call pads connect. Unless set it is the controller port, shared with the cars
+int call_port(void) {
+    if (call_port_override > 0) return call_port_override;
+    const char *env = getenv(ENV_CALL_PORT);
+    int port = (env != NULL) ? parse_port(env) : -1;
+    return port > 0 ? port : controller_port();
+}
+
+const char *shm_prefix(void) {
+    if (prefix_override != NULL) return prefix_override;
+    const char *env = getenv(ENV_SHM_PREFIX);
+    return (env != NULL && valid_prefix(env)) ? env : SHM_PREFIX;
+}
+
+/*
+Considerations: 
+B1,2,3,4,5 (increase lower)
+Floor can go up to 999
+but as low as B99
+no ground floor ... B2, B1, 1, 2 ...
+*/
+int validate_floor(const char* floor) {
+    if (!floor || strlen(floor) == 0 || strlen(floor) > 3) {
+        return 0; 
+    }
+
+    //Handle basement floors
+    if (floor[0] == 'B') {
+        //Check if remaining cahracters are digits
+        for (int i = 1; floor[i] != '\0'; i++) {
+            if(floor[i] < '0' || floor[i] > '9'){
+                return 0; //Maybe we want to return something else
+            }
+        }
+
+        //Convert to num
+        int basement_num = atoi(floor + 1);
+        return basement_num >= 1 && basement_num <= MIN_FLOOR; //Basedment is 1 to 99
+    } else {
+        //regular floor
+        for(int i = 0; floor[i] != '\0'; i++) {
+            if(floor[i] < '0' || floor[i] > '9'){
+                //It is a character
+                return 0;
+            }
+        }
+        int floor_num = atoi(floor);
+        return floor_num >= 1 && floor_num <= MAX_FLOOR;
+    }
+}
+
+int floor_to_int(const char *floor_str) {
+    if(floor_str == NULL) return 0;
+    if (floor_str[0] == 'B') {
+        return -atoi(floor_str + 1);
+    }
+    return atoi(floor_str);
+}
+
+void int_to_floor(int floor_int, char *floor_str, size_t size) {
+    if (floor_int < 0) {
+        snprintf(floor_str, size, "B%d", -floor_int);
+    } else {
+        snprintf(floor_str, size, "%d", floor_int);
+    }
+}
+
+// Message and shared mem
+void msg(const char *string)
+{
+  printf("%s\n    ", string);
+  fflush(stdout);
+}
+
+void reset_shm(car_shared_mem *s)
+{
+  pthread_mutex_lock(&s->mutex);
+  size_t offset = offsetof(car_shared_mem, current_floor);
+  memset((char *)s + offset, 0, sizeof(*s) - offset);
+
+  strcpy(s->status, "Closed");
+  strcpy(s->current_floor, "1");
+  strcpy(s->destination_floor, "1");
+  pthread_mutex_unlock(&s->mutex);
+}
+
+void init_shm(car_shared_mem *s)
+{
+  pthread_mutexattr_t mutattr;
+  pthread_mutexattr_init(&mutattr);
+  pthread_mutexattr_setpshared(&mutattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&s->mutex, &mutattr);
+  pthread_mutexattr_destroy(&mutattr);
+
+  pthread_condattr_t condattr;
+  pthread_condattr_init(&condattr);
+  pthread_condattr_setpshared(&condattr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&s->cond, &condattr);
+  pthread_condattr_destroy(&condattr);
+
+  reset_shm(s);
 }
\ No newline at end of file
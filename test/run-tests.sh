@@ -0,0 +1,93 @@
+#!/bin/sh
+# Runs the testers side by side. Each one gets its own scratch directory,
+# controller port and shm prefix, so they never see each other's controller or
+# cars (and do not disturb a fleet already running on the default port).
+#
+# Usage: ./run-tests.sh [--virtual-time] [tester ...]
+# (default: every tester in the Makefile). Build the programs in .. and the
+# testers here first. BASE_PORT (default 3100) is the first port handed out.
+#
+# --virtual-time preloads libvtime.so (make vtime) so each tester and the
+# programs it starts share a virtual clock, and sleeps take no real time.
+# The clock only moves once every wake-up has been seen, so the outcome does
+# not depend on how busy the machine is.
+#
+# Each tester's output is printed in order once all of them finish. A tester is
+# flagged when one of its "### expected" lines never shows up in its output;
+# read the output itself for anything timing dependent.
+
+cd "$(dirname "$0")" || exit 1
+VTIME=
+if [ "$1" = "--virtual-time" ]; then
+  VTIME=$(pwd)/libvtime.so
+  [ -f "$VTIME" ] || { echo "libvtime.so missing, run make vtime" >&2; exit 1; }
+  shift
+fi
+HERE=$(pwd)
+BIN_DIR=$(cd .. && pwd)
+BASE_PORT=${BASE_PORT:-3100}
+TESTERS=${*:-$(sed -n 's/^TESTERS=//p' Makefile)}
+OUT=$(mktemp -d "${TMPDIR:-/tmp}/elevator-tests.XXXXXX") || exit 1
+PREFIX="/car$$x"
+
+start=$(date +%s%N)
+i=0
+for t in $TESTERS; do
+  dir="$OUT/$t"
+  mkdir "$dir"
+  for b in controller car call internal safety; do
+    ln -s "$BIN_DIR/$b" "$dir/$b"
+  done
+  ln -s "$HERE/$t" "$dir/$t"
+  (
+    cd "$dir" || exit 1
+    export ELEVATOR_CONTROLLER_PORT=$((BASE_PORT + i)) ELEVATOR_SHM_PREFIX="$PREFIX$i"
+    if [ -n "$VTIME" ]; then
+      timeout 120 env LD_PRELOAD="$VTIME" VTIME_NAME="/vtime$$x$i" "./$t" > "$OUT/$t.log" 2>&1
+    else
+      timeout 120 "./$t" > "$OUT/$t.log" 2>&1
+    fi
+  ) &
+  i=$((i + 1))
+done
+wait
+end=$(date +%s%N)
+
+failed=0
+for t in $TESTERS; do
+  echo "===== $t"
+  cat "$OUT/$t.log"
+  missing=$(awk '
+    { line = $0; gsub(/^[ \t]+|[ \t]+$/, "", line) }
+    /^### / { want[substr(line, 5)] = 1; next }
+    { seen[line] = 1 }
+    # "A B C (or D)" also accepts "A B D"; "A (X or Y)" accepts "A X" and "A Y"
+    function ok(w,    base, alt, nb, na, b, a, i, s) {
+      if (w in seen) return 1
+      if (match(w, / \(or [^()]*\)$/)) {
+        base = substr(w, 1, RSTART - 1); alt = substr(w, RSTART + 5, RLENGTH - 6)
+        nb = split(base, b, " "); na = split(alt, a, " ")
+        s = ""
+        for (i = 1; i <= nb - na; i++) s = s b[i] " "
+        for (i = 1; i <= na; i++) s = s a[i] (i < na ? " " : "")
+        return (base in seen) || (s in seen)
+      }
+      if (match(w, /\([^ ()]+ or [^ ()]+\)$/)) {
+        base = substr(w, 1, RSTART - 1); split(substr(w, RSTART + 1, RLENGTH - 2), a, " or ")
+        return ((base a[1]) in seen) || ((base a[2]) in seen)
+      }
+      return 0
+    }
+    END { for (w in want) if (!ok(w)) print "  not seen: " w }
+  ' "$OUT/$t.log")
+  if [ -n "$missing" ]; then
+    echo "----- $t: expected lines missing"
+    echo "$missing"
+    failed=$((failed + 1))
+  fi
+done
+
+rm -f /dev/shm/"${PREFIX#/}"* /dev/shm/vtime$$x*
+rm -rf "$OUT"
+echo "$i testers in $(((end - start) / 1000000)) ms, $failed with missing lines"
+[ "$failed" -eq 0 ]
@@ -118,3 +118,20 @@ void init_shm(car_shared_mem *s)
 
   reset_shm(s);
 }
+
+// The testers honour the same ELEVATOR_CONTROLLER_PORT and ELEVATOR_SHM_PREFIX
+// overrides as the programs they test, so several suites can run side by side
+int test_port(void)
+{
+  const char *env = getenv("ELEVATOR_CONTROLLER_PORT");
+  int port = env ? atoi(env) : 0;
+  return (port > 0 && port < 65536) ? port : 3000;
+}
+
+const char *test_shm(void)
+{
+  static char name[128];
+  const char *prefix = getenv("ELEVATOR_SHM_PREFIX");
+  snprintf(name, sizeof(name), "%sTest", prefix ? prefix : "/car");
+  return name;
+}
@@ -40,7 +40,7 @@ void *server(void *_)
   struct sockaddr_in a;
   memset(&a, 0, sizeof(a));
   a.sin_family = AF_INET;
-  a.sin_port = htons(3000);
+  a.sin_port = htons(test_port());
   a.sin_addr.s_addr = htonl(INADDR_ANY);
 
   int s = socket(AF_INET, SOCK_STREAM, 0);
@@ -14,7 +14,7 @@ static car_shared_mem *shm;
 
 int main()
 {
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
   pid_t p;
 
   p = car("Test", "B4", "4", "10");
@@ -98,7 +98,7 @@ void cleanup(pid_t p)
   close(shm_fd);
   kill(p, SIGINT);
   usleep(DELAY);
-  shm_unlink("/carTest");
+  shm_unlink(test_shm());
 }
 
 void displaycond(car_shared_mem *s)
@@ -126,7 +126,7 @@ pid_t car(const char *name, const char *lowest_floor, const char *highest_floor,
     execlp("./car", "./car", name, lowest_floor, highest_floor, delay, NULL);
   }
   usleep(DELAY);
-  shm_fd = shm_open("/carTest", O_RDWR, 0666);
+  shm_fd = shm_open(test_shm(), O_RDWR, 0666);
   shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
 
   return pid;
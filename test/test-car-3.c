@@ -20,7 +20,7 @@ int heartbeat_cancel = 0;
 
 int main()
 {
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
 
   pid_t p;
 
@@ -103,7 +103,7 @@ void cleanup(pid_t p)
   close(shm_fd);
   kill(p, SIGINT);
   usleep(DELAY);
-  shm_unlink("/carTest");
+  shm_unlink(test_shm());
 }
 
 pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
@@ -113,7 +113,7 @@ pid_t car(const char *name, const char *lowest_floor, const char *highest_floor,
     execlp("./car", "./car", name, lowest_floor, highest_floor, delay, NULL);
   }
   usleep(DELAY);
-  int shm_fd = shm_open("/carTest", O_RDWR, 0666);
+  int shm_fd = shm_open(test_shm(), O_RDWR, 0666);
   shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
   pthread_create(&heartbeat_tid, NULL, simulate_heartbeat, NULL);
 
@@ -125,7 +125,7 @@ void server_init()
   struct sockaddr_in a;
   memset(&a, 0, sizeof(a));
   a.sin_family = AF_INET;
-  a.sin_port = htons(3000);
+  a.sin_port = htons(test_port());
   a.sin_addr.s_addr = htonl(INADDR_ANY);
 
   server_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -18,7 +18,7 @@ static car_shared_mem *shm;
 
 int main()
 {
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
 
   pid_t p;
 
@@ -35,7 +35,7 @@ int main()
   usleep(DELAY);
 
   msg("shm_open(): No such file or directory");
-  int shm_fd = shm_open("/carTest", O_RDWR, 0666);
+  int shm_fd = shm_open(test_shm(), O_RDWR, 0666);
   if (shm_fd == -1) perror("shm_open()");
 
   cleanup(p);
@@ -49,7 +49,7 @@ void cleanup(pid_t p)
   close(shm_fd);
   kill(p, SIGINT);
   usleep(DELAY);
-  shm_unlink("/carTest");
+  shm_unlink(test_shm());
 }
 
 pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
@@ -0,0 +1,130 @@
+#include "shared.h"
+
+// Tester for car (answering the controller's BID offers, car --bid)
+
+/*
+  The tester plays the controller. The car is idle at 1 with a 10ms delay, so
+  every floor takes 10ms and every stop 30ms (opening, open, closing). A bid
+  costs twice the rider's wait plus their ride, plus whatever the new stops
+  add to the stops already queued:
+
+    BID 7 3 5     [3 5]: wait 20, ride 50                         -> 90 at 0 0
+    BID 8 2 4 8   [2 4 8]: wait 10, ride 50, 8 is 60 later        -> 130 at 0 0
+    BID 9 3 9 5   [3 5 9]: wait 20, ride 120, 5 is 30 later        -> 190 at 0 1
+                  ([3 9 5] would be 270 and [5 3 9] 270 too)
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t car(const char *, const char *, const char *, const char *);
+void cleanup(pid_t);
+void server_init();
+void test_recv(int, const char *);
+void *simulate_heartbeat(void *);
+
+int server_fd;
+int shm_fd;
+static car_shared_mem *shm;
+
+pthread_t heartbeat_tid;
+int heartbeat_cancel = 0;
+
+int main()
+{
+  shm_unlink(test_shm()); // Remove shm object if it exists
+
+  server_init();
+  pid_t p = car("Test", "1", "10", "10");
+
+  int fd = accept(server_fd, NULL, NULL);
+  test_recv(fd, "RECV: CAR Test 1 10 BIDS 1");
+  test_recv(fd, "RECV: STATUS Closed 1 1");
+
+  // An empty queue leaves only one place for the stops
+  send_message(fd, "BID 7 3 5");
+  test_recv(fd, "RECV: BID 7 90 0 0");
+
+  // Picking up on the way costs the queued stop less than going there first
+  send_message(fd, "BID 8 2 4 8");
+  test_recv(fd, "RECV: BID 8 130 0 0");
+
+  // The rider rides past a queued stop rather than making it wait
+  send_message(fd, "BID 9 3 9 5");
+  test_recv(fd, "RECV: BID 9 190 0 1");
+
+  heartbeat_cancel = 1;
+  pthread_cond_broadcast(&shm->cond);
+  pthread_join(heartbeat_tid, NULL);
+  cleanup(p);
+  close(fd);
+  close(server_fd);
+
+  printf("\nTests completed.\n");
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+void cleanup(pid_t p)
+{
+  munmap(shm, sizeof(car_shared_mem));
+  close(shm_fd);
+  kill(p, SIGINT);
+  usleep(DELAY);
+  shm_unlink(test_shm());
+}
+
+pid_t car(const char *name, const char *lowest_floor, const char *highest_floor, const char *delay)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./car", "./car", name, lowest_floor, highest_floor, delay, "--bid", NULL);
+  }
+  usleep(DELAY);
+  shm_fd = shm_open(test_shm(), O_RDWR, 0666);
+  shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  pthread_create(&heartbeat_tid, NULL, simulate_heartbeat, NULL);
+
+  return pid;
+}
+
+void server_init()
+{
+  struct sockaddr_in a;
+  memset(&a, 0, sizeof(a));
+  a.sin_family = AF_INET;
+  a.sin_port = htons(test_port());
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int opt_enable = 1;
+  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable));
+  if (bind(server_fd, (const struct sockaddr *)&a, sizeof(a)) == -1) {
+    perror("bind()");
+    exit(1);
+  }
+
+  listen(server_fd, 10);
+}
+
+void *simulate_heartbeat(void *_)
+{
+  pthread_mutex_lock(&shm->mutex);
+  for (;;) {
+
+    if (shm->safety_system != 1) {
+      shm->safety_system = 1;
+      pthread_cond_broadcast(&shm->cond);
+    }
+    pthread_cond_wait(&shm->cond, &shm->mutex);
+    if (heartbeat_cancel) break;
+  }
+  pthread_mutex_unlock(&shm->mutex);
+  return NULL;
+}
@@ -103,7 +103,7 @@ int connect_to_controller(void)
   struct sockaddr_in sockaddr;
   memset(&sockaddr, 0, sizeof(sockaddr));
   sockaddr.sin_family = AF_INET;
-  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_port = htons(test_port());
   sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
   if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
   {
@@ -0,0 +1,152 @@
+#include "shared.h"
+#include <poll.h>
+
+// Tester for controller (idempotent calls: CALL ... KEY <token>)
+
+/*
+  A call pad that lost its answer sends the same keyed call again. The
+  controller must give back the first answer and queue nothing new, even
+  once the car has moved on and the call on its own would go elsewhere.
+
+    Alpha  Beta
+ 10 -----  [   ]
+     | |    | |
+  1 [   ]  -----
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t controller(void);
+int connect_to_controller(void);
+void test_call(const char *, const char *);
+void test_recv(int, const char *);
+void test_quiet(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  // Two cars for floors 1 to 10, Alpha idle at 1 and Beta idle at 10
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 10");
+  send_message(alpha, "STATUS Closed 1 1");
+
+  int beta = connect_to_controller();
+  send_message(beta, "CAR Beta 1 10");
+  send_message(beta, "STATUS Closed 10 10");
+
+  usleep(DELAY);
+
+  // The first keyed call goes to Alpha, the nearer car
+  test_call("CALL 3 7 KEY ride1", "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 3");
+
+  // Alpha picks up at 3 and sets off for 7
+  send_message(alpha, "STATUS Between 1 3");
+  send_message(alpha, "STATUS Opening 3 3");
+  send_message(alpha, "STATUS Open 3 3");
+  send_message(alpha, "STATUS Closing 3 3");
+  send_message(alpha, "STATUS Closed 3 3");
+  test_recv(alpha, "RECV: FLOOR 7");
+  send_message(alpha, "STATUS Between 3 7");
+  send_message(alpha, "STATUS Between 4 7");
+  usleep(DELAY);
+
+  // The same call again gets the first answer and queues no stops anywhere
+  test_call("CALL 3 7 KEY ride1", "CAR Alpha");
+  test_quiet(alpha, "RECV: (nothing)");
+  test_quiet(beta, "RECV: (nothing)");
+
+  // Without the key it is a new call, and Alpha has passed 3, so Beta takes it
+  test_call("CALL 3 7", "CAR Beta");
+  test_recv(beta, "RECV: FLOOR 3");
+
+  // A key too long for the controller to keep is refused, not ignored
+  test_call("CALL 2 5 KEY 0123456789012345678901234567890123456789012345678901234567890123", "UNAVAILABLE");
+
+  // The call pad refuses such keys before sending, and keys with spaces
+  msg("Invalid format");
+  system("./call 2 5 --key 0123456789012345678901234567890123456789012345678901234567890123");
+  printf("\n"); // call prints no newline after it
+  fflush(stdout);
+  msg("Invalid format");
+  system("./call 2 5 --key 'ride 2'");
+  printf("\n");
+  fflush(stdout);
+
+  cleanup(p);
+
+  close(alpha);
+  close(beta);
+
+  printf("\nTests completed.\n");
+}
+
+void test_call(const char *sendmsg, const char *expectedreply)
+{
+  int fd = connect_to_controller();
+  send_message(fd, sendmsg);
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+// Checks that nothing arrives on fd for a while
+void test_quiet(int fd, const char *t)
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  msg(t);
+  if (poll(&pfd, 1, DELAY / MILLISECOND) > 0) {
+    char *m = receive_msg(fd);
+    printf("RECV: %s\n", m);
+    free(m);
+  } else {
+    printf("RECV: (nothing)\n");
+  }
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(test_port());
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./controller", "./controller", NULL);
+  }
+
+  return pid;
+}
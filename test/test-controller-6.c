@@ -0,0 +1,123 @@
+#include "shared.h"
+#include <sys/wait.h>
+
+// Tester for controller (admission control: BUSY <retry_ms> and call's retry)
+
+/*
+  Call pads get their own port here, so their 20 handler slots can be filled
+  with pads that never send a CALL. The next pad must be told BUSY with a
+  retry time, and a real call pad turned away like that must come back on its
+  own and get its car once the slots free up.
+
+    Alpha
+ 10 -----
+     | |
+  1 -----
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+#define CALL_SLOTS 20 // CALL_CLIENT_SLOTS in the controller
+#define CALL_PORT_OFFSET 1000 // Call port is the controller port plus this, clear of run-tests.sh's ports
+
+pid_t controller(void);
+int connect_to(int);
+void test_recv(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  // The controller and the call pads it starts both read the call port from here
+  char call_port[16];
+  snprintf(call_port, sizeof(call_port), "%d", test_port() + CALL_PORT_OFFSET);
+  setenv("ELEVATOR_CALL_PORT", call_port, 1);
+
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  // Register a car that can take floors 1 to 10
+  int alpha = connect_to(test_port());
+  send_message(alpha, "CAR Alpha 1 10");
+  send_message(alpha, "STATUS Closed 1 1");
+
+  // Fill every call slot with a pad that says nothing (kept out of the call pad started below)
+  int idle[CALL_SLOTS];
+  for (int i = 0; i < CALL_SLOTS; i++) {
+    idle[i] = connect_to(test_port() + CALL_PORT_OFFSET);
+    fcntl(idle[i], F_SETFD, FD_CLOEXEC);
+  }
+  usleep(DELAY);
+
+  // One more pad is turned away with a time to come back in
+  int fd = connect_to(test_port() + CALL_PORT_OFFSET);
+  char *reply = receive_msg(fd);
+  msg("BUSY <retry_ms>");
+  if (strncmp(reply, "BUSY ", 5) == 0 && atoi(reply + 5) > 0) {
+    printf("BUSY <retry_ms>\n");
+  } else {
+    printf("%s\n", reply);
+  }
+  free(reply);
+  close(fd);
+
+  // A call pad placed now is shed too, and retries after the time it is given
+  msg("Car Alpha is arriving.");
+  pid_t pad = fork();
+  if (pad == 0) {
+    execlp("./call", "./call", "2", "5", NULL);
+    exit(1);
+  }
+  usleep(DELAY);
+  for (int i = 0; i < CALL_SLOTS; i++) {
+    close(idle[i]);
+  }
+  waitpid(pad, NULL, 0);
+  test_recv(alpha, "RECV: FLOOR 2");
+
+  cleanup(p);
+
+  close(alpha);
+
+  printf("\nTests completed.\n");
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+int connect_to(int port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(port);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./controller", "./controller", NULL);
+  }
+
+  return pid;
+}
@@ -0,0 +1,184 @@
+#include "shared.h"
+#include <poll.h>
+
+// Tester for controller (contract-net dispatch, controller --bidding)
+
+/*
+  Two cars that bid ("CAR ... BIDS 1"). Each call is offered to both as
+  "BID <seq> <source> <dest> <stops...>" with the car's queue, and the tester
+  answers for them with made-up costs and indices.
+
+    Alpha  Beta
+ 10 -----  -----
+     | |    | |
+  5  | |   [   ]
+  1 [   ]  -----
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+#define DEADLINE_MS "100" // How long the controller waits for bids
+
+pid_t controller(void);
+int connect_to_controller(void);
+unsigned long test_offer(int, const char *);
+void test_reply(int, const char *);
+void test_recv(int, const char *);
+void test_quiet(int, const char *);
+void bid(int, unsigned long, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  // Alpha idle at 1, Beta idle at 5, both bidding
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 10 BIDS 1");
+  send_message(alpha, "STATUS Closed 1 1");
+
+  int beta = connect_to_controller();
+  send_message(beta, "CAR Beta 1 10 BIDS 1");
+  send_message(beta, "STATUS Closed 5 5");
+
+  usleep(DELAY);
+  unsigned long a, b;
+  int call;
+
+  // No bid in by the deadline: the greedy rule decides (Beta is closer), and a late bid is ignored
+  call = connect_to_controller();
+  send_message(call, "CALL 6 9");
+  a = test_offer(alpha, "RECV: BID <seq> 6 9");
+  test_offer(beta, "RECV: BID <seq> 6 9");
+  test_reply(call, "CAR Beta");
+  test_recv(beta, "RECV: FLOOR 6");
+  bid(alpha, a, "1 0 0");
+  test_quiet(alpha, "RECV: (nothing)");
+
+  // Both cars answer NONE: the greedy rule decides (Alpha is idle)
+  call = connect_to_controller();
+  send_message(call, "CALL 2 3");
+  a = test_offer(alpha, "RECV: BID <seq> 2 3");
+  b = test_offer(beta, "RECV: BID <seq> 2 3 6 9");
+  bid(alpha, a, "NONE");
+  bid(beta, b, "NONE");
+  test_reply(call, "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 2");
+
+  // The cheapest bid wins, though greedy would give Beta the call on its way up
+  call = connect_to_controller();
+  send_message(call, "CALL 7 8");
+  a = test_offer(alpha, "RECV: BID <seq> 7 8 2 3");
+  b = test_offer(beta, "RECV: BID <seq> 7 8 6 9");
+  bid(alpha, a, "100 2 2");
+  bid(beta, b, "900 1 1");
+  test_reply(call, "CAR Alpha");
+  test_quiet(alpha, "RECV: (nothing)");
+
+  // The stops go where the bid put them: ahead of Alpha's queue, so 4 becomes its next floor
+  call = connect_to_controller();
+  send_message(call, "CALL 4 5");
+  a = test_offer(alpha, "RECV: BID <seq> 4 5 2 3 7 8");
+  b = test_offer(beta, "RECV: BID <seq> 4 5 6 9");
+  bid(alpha, a, "10 0 0");
+  bid(beta, b, "NONE");
+  test_reply(call, "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 4");
+  test_quiet(beta, "RECV: (nothing)");
+
+  cleanup(p);
+
+  close(alpha);
+  close(beta);
+
+  printf("\nTests completed.\n");
+}
+
+// Receives a car's offer, prints it with the sequence number left out and returns that number
+unsigned long test_offer(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  unsigned long seq = 0;
+  int used = 0;
+  msg(t);
+  if (sscanf(m, "BID %lu%n", &seq, &used) == 1) {
+    printf("RECV: BID <seq>%s\n", m + used);
+  } else {
+    printf("RECV: %s\n", m);
+  }
+  free(m);
+  return seq;
+}
+
+// Answers an offer for a car: "<cost> <pickup index> <dropoff index>" or "NONE"
+void bid(int fd, unsigned long seq, const char *answer)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "BID %lu %s", seq, answer);
+  send_message(fd, buf);
+}
+
+void test_reply(int fd, const char *expectedreply)
+{
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+// Checks that nothing arrives on fd for a while
+void test_quiet(int fd, const char *t)
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  msg(t);
+  if (poll(&pfd, 1, DELAY / MILLISECOND) > 0) {
+    char *m = receive_msg(fd);
+    printf("RECV: %s\n", m);
+    free(m);
+  } else {
+    printf("RECV: (nothing)\n");
+  }
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(test_port());
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("./controller", "./controller", "--bidding", DEADLINE_MS, NULL);
+  }
+
+  return pid;
+}
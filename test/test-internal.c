@@ -10,12 +10,12 @@ void test_operation_floor(car_shared_mem *, const char *, const char *, const ch
 
 int main()
 {
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
 
   msg("Unable to access car Test.");
   system("./internal Test open"); // Valid operation but shm unavailable
 
-  int fd = shm_open("/carTest", O_CREAT | O_RDWR, 0666);
+  int fd = shm_open(test_shm(), O_CREAT | O_RDWR, 0666);
   ftruncate(fd, sizeof(car_shared_mem));
   car_shared_mem *shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   init_shm(shm);
@@ -67,7 +67,7 @@ int main()
   test_operation(shm, "Closed", "service_on", "Current state: {1, 1, Closed, 1, 1, 0, 0, 1, 1, 0}");
 
   printf("\nTests completed.\n");
-  shm_unlink("/carTest"); // Remove shm object
+  shm_unlink(test_shm()); // Remove shm object
 }
 
 void test_operation(car_shared_mem *s, const char *st, const char *op, const char *m)
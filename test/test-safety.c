@@ -13,12 +13,12 @@ int main()
   printf("# If the output produced by your program does not appear on Gradescope,\n");
   printf("# add fflush(stdout); after your printfs in the safety component\n");
   printf("# (Alternatively, use write() instead as stdio is discouraged in MISRA C)\n\n");
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
 
   msg("Unable to access car Test.");
   system("./safety Test"); // Attempt to launch safety system with shm missing
 
-  int fd = shm_open("/carTest", O_CREAT | O_RDWR, 0666);
+  int fd = shm_open(test_shm(), O_CREAT | O_RDWR, 0666);
   ftruncate(fd, sizeof(car_shared_mem));
   car_shared_mem *shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   init_shm(shm);
@@ -219,7 +219,7 @@ int main()
 
   cleanup(p);
   printf("\nTests completed.\n");
-  shm_unlink("/carTest"); // Remove shm object if it exists
+  shm_unlink(test_shm()); // Remove shm object if it exists
 }
 
 void displaycond(car_shared_mem *s)
@@ -0,0 +1,1440 @@
+/*
+ * libvtime: virtual time for a test run, loaded with LD_PRELOAD.
+ *
+ * Every process started with VTIME_NAME=/<name> in its environment shares one
+ * virtual clock kept in that shm object. clock_gettime, gettimeofday and time
+ * read the virtual clock, and sleeps (nanosleep, clock_nanosleep, usleep,
+ * sleep, and the timed forms of select, poll and pthread_cond_timedwait) wait
+ * for it instead of the wall clock.
+ *
+ * The clock only moves when every registered thread is either sleeping or
+ * blocked (read, accept, waitpid, pthread_cond_wait, ...). It then jumps
+ * straight to the earliest wake-up. Threads are registered from the moment
+ * their process or thread is created, so a new car cannot be overtaken by its
+ * tester before it has started.
+ *
+ * A blocked thread looks idle until it is scheduled again, even when whatever
+ * it waits for has already happened. Every wake-up it could have missed holds
+ * the clock until the thread has looked again:
+ * - bytes written to a socket or pipe are counted until they are read (and
+ *   connections until accepted), and hold the clock while a thread waits on
+ *   that socket (a reader busy elsewhere picks them up in its own time);
+ * - a condvar signal, a close or a process exit "pokes" the threads waiting on
+ *   that condvar, on a socket or for a child. Blocking calls wait in short
+ *   real slices (VTIME_SLICE_US, default 1000), and a poked thread counts as
+ *   running until its next check finds nothing;
+ * - a kill() holds the clock until the target's handler has run (or, for a
+ *   signal that kills, until the target is gone).
+ * Data or a signal nobody picks up within STALE_NS of real time is given up
+ * on, so a lost one slows the run down instead of hanging it.
+ *
+ * A loop that polls the clock without ever sleeping would hold it still
+ * forever, so every SPIN_READS reads in a row count as a short sleep.
+ *
+ * Without VTIME_NAME every call passes straight through.
+ *
+ * Build: make vtime   Use: ./run-tests.sh --virtual-time
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VT_MAX_SLOTS 512
+#define VT_MAX_SIGNALS 64
+#define VT_MAX_MAPS 64
+#define VT_MAX_CONNS 1024
+#define VT_MAX_FDS 1024
+//Channels one waiting thread is tracked on; more count as "any"
+#define VT_WAIT_FDS 4
+#define NSEC 1000000000LL
+//Unread data or an unhandled signal this old is assumed to be lost
+#define STALE_NS 250000000LL
+//A thread that reads the clock this often without sleeping is busy-waiting on it
+#define SPIN_READS 100
+#define SPIN_STEP_NS 1000000LL
+
+enum { VT_FREE, VT_RUNNING, VT_BLOCKED, VT_SLEEPING, VT_EXITING };
+//What an idle thread is waiting for, so wakers can poke the right ones
+enum { W_NONE = 0, W_FD = 1, W_COND = 2, W_CHILD = 4 };
+
+typedef struct {
+  int pid;
+  int tid;
+  int state;
+  int wait;         // W_* while VT_BLOCKED or in a timed wait
+  int poked;        // A wake-up may have reached this thread since it last checked
+  uint64_t key[3];  // Condvar identity while wait == W_COND
+  int nfds;         // Channels waited on while wait == W_FD, -1 for any
+  uint64_t fds[VT_WAIT_FDS][2];
+  int64_t deadline; // Virtual CLOCK_MONOTONIC ns, while VT_SLEEPING
+} vt_slot;
+
+//Data sent on a socket or pipe and not read yet, keyed by the end it is read from
+typedef struct {
+  int state; // 0 free, 1 being claimed, 2 in use
+  uint64_t key[2];
+  int64_t bytes;
+  int64_t changed; // Real CLOCK_MONOTONIC ns of the last change
+} vt_conn;
+
+//Signals sent with kill() whose handler has not run yet
+typedef struct {
+  int pid;
+  int count;
+  int64_t since; // Real CLOCK_MONOTONIC ns of the last kill()
+} vt_signal;
+
+typedef struct {
+  int ready;
+  pthread_mutex_t lock;
+  pthread_cond_t tick;    // Broadcast whenever the clock moves
+  int64_t now;            // Virtual CLOCK_MONOTONIC ns
+  int64_t mono_base;      // Real CLOCK_MONOTONIC when the clock was created
+  int64_t rt_base;        // Real CLOCK_REALTIME at the same moment
+  vt_conn conns[VT_MAX_CONNS];
+  vt_signal signals[VT_MAX_SIGNALS];
+  vt_slot slots[VT_MAX_SLOTS];
+} vt_clock;
+
+//Shared file mappings of this process, so a condvar in shm has the same key everywhere
+typedef struct {
+  uintptr_t start; // 0 when unused
+  uintptr_t end;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t offset;
+} vt_map;
+
+//The two ends of a channel fd, as last seen for that inode
+typedef struct {
+  uint64_t ino;
+  uint64_t local, peer;
+} vt_fd;
+
+static vt_clock *vt;
+static int64_t slice_ns = 1000000;
+static __thread int my_slot = -1;
+static __thread int clock_reads; //Since this thread last slept or blocked
+static __thread int sig_restart; //SA_RESTART of the last handler this thread ran
+static pthread_key_t slot_key;
+static vt_map maps[VT_MAX_MAPS];
+static vt_fd fd_ends[VT_MAX_FDS];
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction handlers[NSIG]; //What the program installed; run by trampoline()
+
+static int (*real_clock_gettime)(clockid_t, struct timespec *);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+static int (*real_cond_signal)(pthread_cond_t *);
+static int (*real_cond_broadcast)(pthread_cond_t *);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_recv)(int, void *, size_t, int);
+static ssize_t (*real_recvfrom)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
+static ssize_t (*real_recvmsg)(int, struct msghdr *, int);
+static ssize_t (*real_send)(int, const void *, size_t, int);
+static ssize_t (*real_sendto)(int, const void *, size_t, int, const struct sockaddr *, socklen_t);
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+static int (*real_accept)(int, struct sockaddr *, socklen_t *);
+static int (*real_accept4)(int, struct sockaddr *, socklen_t *, int);
+static int (*real_close)(int);
+static int (*real_shutdown)(int, int);
+static int (*real_connect)(int, const struct sockaddr *, socklen_t);
+static int (*real_kill)(pid_t, int);
+static int (*real_sigaction)(int, const struct sigaction *, struct sigaction *);
+static sighandler_t (*real_signal)(int, sighandler_t);
+static sighandler_t (*real_sysv_signal)(int, sighandler_t);
+static pid_t (*real_fork)(void);
+static pid_t (*real_waitpid)(pid_t, int *, int);
+static int (*real_pthread_create)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+static int (*real_pthread_join)(pthread_t, void **);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_munmap)(void *, size_t);
+
+static void *next_sym(const char *name)
+{
+  return dlsym(RTLD_NEXT, name);
+}
+
+//The condvar functions have a compat version too; make sure we get the current one
+static void *next_cond_sym(const char *name)
+{
+  void *sym = dlvsym(RTLD_NEXT, name, "GLIBC_2.3.2");
+  return sym ? sym : dlsym(RTLD_NEXT, name);
+}
+
+static void resolve(void)
+{
+  real_clock_gettime = next_sym("clock_gettime");
+  real_nanosleep = next_sym("nanosleep");
+  real_select = next_sym("select");
+  real_poll = next_sym("poll");
+  real_cond_wait = next_cond_sym("pthread_cond_wait");
+  real_cond_timedwait = next_cond_sym("pthread_cond_timedwait");
+  real_cond_signal = next_cond_sym("pthread_cond_signal");
+  real_cond_broadcast = next_cond_sym("pthread_cond_broadcast");
+  real_read = next_sym("read");
+  real_write = next_sym("write");
+  real_recv = next_sym("recv");
+  real_recvfrom = next_sym("recvfrom");
+  real_recvmsg = next_sym("recvmsg");
+  real_send = next_sym("send");
+  real_sendto = next_sym("sendto");
+  real_sendmsg = next_sym("sendmsg");
+  real_accept = next_sym("accept");
+  real_accept4 = next_sym("accept4");
+  real_close = next_sym("close");
+  real_shutdown = next_sym("shutdown");
+  real_connect = next_sym("connect");
+  real_kill = next_sym("kill");
+  real_sigaction = next_sym("sigaction");
+  real_signal = next_sym("signal");
+  real_sysv_signal = next_sym("__sysv_signal");
+  real_fork = next_sym("fork");
+  real_waitpid = next_sym("waitpid");
+  real_pthread_create = next_sym("pthread_create");
+  real_pthread_join = next_sym("pthread_join");
+  real_mmap = next_sym("mmap");
+  real_munmap = next_sym("munmap");
+}
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+  return ts->tv_sec * NSEC + ts->tv_nsec;
+}
+
+static struct timespec ns_ts(int64_t ns)
+{
+  struct timespec ts = {ns / NSEC, ns % NSEC};
+  return ts;
+}
+
+static int64_t real_ns(clockid_t clk)
+{
+  struct timespec ts;
+  real_clock_gettime(clk, &ts);
+  return ts_ns(&ts);
+}
+
+static int slice_ms(void)
+{
+  return slice_ns >= 1000000 ? (int)(slice_ns / 1000000) : 1;
+}
+
+static void real_pause(int ms)
+{
+  struct timespec ts = ns_ts(ms * 1000000LL);
+  real_nanosleep(&ts, NULL);
+}
+
+static int my_tid(void)
+{
+  return (int)syscall(SYS_gettid);
+}
+
+static void vt_lock(void)
+{
+  if (pthread_mutex_lock(&vt->lock) == EOWNERDEAD) {
+    //A participant died holding the lock; the state it guards is still usable
+    pthread_mutex_consistent(&vt->lock);
+  }
+}
+
+static void vt_unlock(void)
+{
+  pthread_mutex_unlock(&vt->lock);
+}
+
+//Caller holds the lock
+static int alloc_slot(int pid, int tid)
+{
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    if (vt->slots[i].state == VT_FREE) {
+      vt->slots[i].pid = pid;
+      vt->slots[i].tid = tid;
+      vt->slots[i].wait = W_NONE;
+      vt->slots[i].deadline = 0;
+      __atomic_store_n(&vt->slots[i].state, VT_RUNNING, __ATOMIC_SEQ_CST);
+      return i;
+    }
+  }
+  fprintf(stderr, "vtime: more than %d threads\n", VT_MAX_SLOTS);
+  abort();
+}
+
+static void free_slot(int i)
+{
+  if (i < 0) return;
+  vt_lock();
+  __atomic_store_n(&vt->slots[i].state, VT_FREE, __ATOMIC_SEQ_CST);
+  vt_unlock();
+}
+
+//The thread is on its way out; it holds the clock until it is gone, so its joiner is poked
+static void slot_destructor(void *p)
+{
+  int i = (int)(intptr_t)p - 1;
+  vt_lock();
+  vt->slots[i].tid = my_tid();
+  __atomic_store_n(&vt->slots[i].state, VT_EXITING, __ATOMIC_SEQ_CST);
+  vt_unlock();
+}
+
+static void set_my_slot(int i)
+{
+  my_slot = i;
+  pthread_setspecific(slot_key, (void *)(intptr_t)(i + 1));
+}
+
+//A thread that reached here without going through our pthread_create (there should be none)
+static int current_slot(void)
+{
+  if (my_slot < 0) {
+    vt_lock();
+    set_my_slot(alloc_slot(getpid(), my_tid()));
+    vt_unlock();
+  }
+  return my_slot;
+}
+
+//Dead or zombie processes never wake up, so their threads must not hold the clock
+static int process_gone(int pid)
+{
+  if (pid == getpid()) return 0;
+  if (real_kill(pid, 0) != 0 && errno == ESRCH) return 1;
+  char path[64], buf[256];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 1;
+  ssize_t n = real_read(fd, buf, sizeof(buf) - 1);
+  real_close(fd);
+  if (n <= 0) return 1;
+  buf[n] = '\0';
+  char *state = strrchr(buf, ')');
+  return state != NULL && (state[2] == 'Z' || state[2] == 'X');
+}
+
+static int thread_gone(const vt_slot *s)
+{
+  if (syscall(SYS_tgkill, s->pid, s->tid, 0) != 0 && errno == ESRCH) return 1;
+  return process_gone(s->pid);
+}
+
+/* ---- data in flight on sockets and pipes ---- */
+
+#define END_INET (1ULL << 63)
+#define END_LISTEN (1ULL << 62)
+#define END_PIPE (1ULL << 61)
+
+static uint64_t inet_end(const struct sockaddr_in *a)
+{
+  return END_INET | (uint64_t)ntohl(a->sin_addr.s_addr) << 16 | ntohs(a->sin_port);
+}
+
+//Key of the data read from fd (or written to it, if sending). Returns 0 for anything but
+//a socket or pipe; a socket we cannot follow gets the key {0, 0}. stdout/stderr usually
+//go to the log, so they do not count
+static int chan_key(int fd, int sending, uint64_t key[2])
+{
+  struct stat st;
+  if (fd <= STDERR_FILENO || fstat(fd, &st) != 0) return 0;
+  if (S_ISFIFO(st.st_mode)) {
+    key[0] = END_PIPE | st.st_ino;
+    key[1] = st.st_dev;
+    return 1;
+  }
+  if (!S_ISSOCK(st.st_mode)) return 0;
+  vt_fd *f = fd < VT_MAX_FDS ? &fd_ends[fd] : NULL;
+  uint64_t local = 0, peer = 0;
+  if (f != NULL && f->ino == st.st_ino && f->local != 0) {
+    local = f->local;
+    peer = f->peer;
+  } else {
+    struct sockaddr_in a;
+    socklen_t len = sizeof(a);
+    if (getsockname(fd, (struct sockaddr *)&a, &len) == 0 && a.sin_family == AF_INET) {
+      local = inet_end(&a);
+      len = sizeof(a);
+      if (getpeername(fd, (struct sockaddr *)&a, &len) == 0) {
+        peer = inet_end(&a);
+      } else {
+        local = END_LISTEN | ntohs(a.sin_port); //Bound to any address; connectors only know the port
+      }
+    }
+    //Only connected sockets keep their ends; a listener is cheap to look up again
+    if (f != NULL && peer != 0) {
+      f->ino = st.st_ino;
+      f->local = local;
+      f->peer = peer;
+    }
+  }
+  key[0] = sending ? peer : local;
+  key[1] = sending ? local : peer;
+  if (local == 0) key[0] = key[1] = 0;
+  return 1;
+}
+
+//Lock-free, as a signal handler may write. Entries are never given back, so the first
+//free one means the key is not there yet
+static vt_conn *conn_find(const uint64_t key[2], int create)
+{
+  for (int i = 0; i < VT_MAX_CONNS; i++) {
+    vt_conn *c = &vt->conns[i];
+    int state = __atomic_load_n(&c->state, __ATOMIC_ACQUIRE);
+    if (state == 0) {
+      if (!create) return NULL;
+      if (__atomic_compare_exchange_n(&c->state, &state, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        c->key[0] = key[0];
+        c->key[1] = key[1];
+        __atomic_store_n(&c->state, 2, __ATOMIC_RELEASE);
+        return c;
+      }
+    }
+    while (state == 1) state = __atomic_load_n(&c->state, __ATOMIC_ACQUIRE);
+    if (c->key[0] == key[0] && c->key[1] == key[1]) return c;
+  }
+  return NULL;
+}
+
+static void count_data(const uint64_t key[2], int64_t delta)
+{
+  vt_conn *c = delta != 0 ? conn_find(key, delta > 0) : NULL;
+  if (c == NULL) return;
+  __atomic_add_fetch(&c->bytes, delta, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&c->changed, real_ns(CLOCK_MONOTONIC), __ATOMIC_RELAXED);
+}
+
+//Counted before it is sent (sending) or after it was read
+static void count_fd(int fd, int sending, int64_t delta)
+{
+  uint64_t key[2];
+  if (chan_key(fd, sending, key)) count_data(key, delta);
+}
+
+//Caller holds the lock. Whether data sits unread on a channel the idle thread in s waits on
+static int data_waiting(const vt_slot *s, int64_t real_now)
+{
+  for (int i = 0; i < VT_MAX_CONNS; i++) {
+    vt_conn *c = &vt->conns[i];
+    int state = __atomic_load_n(&c->state, __ATOMIC_ACQUIRE);
+    if (state == 0) break;
+    if (state != 2 || __atomic_load_n(&c->bytes, __ATOMIC_SEQ_CST) <= 0) continue;
+    if (real_now - __atomic_load_n(&c->changed, __ATOMIC_RELAXED) >= STALE_NS) continue;
+    if (s->nfds < 0) return 1;
+    for (int j = 0; j < s->nfds; j++) {
+      if (s->fds[j][0] == c->key[0] && s->fds[j][1] == c->key[1]) return 1;
+    }
+  }
+  return 0;
+}
+
+/* ---- pokes: a wake-up an idle thread may not have seen yet ---- */
+
+//Lock-free, so a signal handler can poke. The slot counts as running until its
+//thread has checked again (wait_idle), which keeps the clock still meanwhile
+static void poke_slot(vt_slot *s)
+{
+  if (__atomic_load_n(&s->wait, __ATOMIC_SEQ_CST) == W_NONE) return;
+  __atomic_store_n(&s->poked, 1, __ATOMIC_SEQ_CST);
+  int state = VT_BLOCKED;
+  if (!__atomic_compare_exchange_n(&s->state, &state, VT_RUNNING, 0, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_SEQ_CST)) {
+    state = VT_SLEEPING;
+    __atomic_compare_exchange_n(&s->state, &state, VT_RUNNING, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+  }
+}
+
+//Pokes the threads waiting for one of kinds (of process pid, on condvar key; 0/NULL for any)
+static void poke(int kinds, int pid, const uint64_t *key)
+{
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    vt_slot *s = &vt->slots[i];
+    int state = __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+    if (state != VT_BLOCKED && state != VT_SLEEPING) continue;
+    if (!(__atomic_load_n(&s->wait, __ATOMIC_SEQ_CST) & kinds)) continue;
+    if (pid != 0 && s->pid != pid) continue;
+    if (key != NULL && memcmp(s->key, key, sizeof(s->key)) != 0) continue;
+    poke_slot(s);
+  }
+}
+
+//Caller holds the lock. pid has exited: its threads and pending signals go, and whoever
+//waits for a child or on a socket (which may have been its peer) must look again
+static void reap(int pid)
+{
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    if (vt->slots[i].state != VT_FREE && vt->slots[i].pid == pid) {
+      __atomic_store_n(&vt->slots[i].state, VT_FREE, __ATOMIC_SEQ_CST);
+    }
+  }
+  for (int i = 0; i < VT_MAX_SIGNALS; i++) {
+    if (vt->signals[i].pid == pid) __atomic_store_n(&vt->signals[i].count, 0, __ATOMIC_SEQ_CST);
+  }
+  poke(W_FD | W_CHILD, 0, NULL);
+}
+
+//Caller holds the lock. Moves the clock to the earliest wake-up once nothing can still
+//happen before it: nobody running or exiting, no handler still due, and no data unread
+//that a waiting thread is about to get
+static void try_advance(void)
+{
+  int64_t real_now = real_ns(CLOCK_MONOTONIC);
+  for (int i = 0; i < VT_MAX_SIGNALS; i++) {
+    vt_signal *p = &vt->signals[i];
+    if (__atomic_load_n(&p->count, __ATOMIC_SEQ_CST) <= 0) continue;
+    if (process_gone(p->pid)) {
+      reap(p->pid);
+      return;
+    }
+    if (real_now - p->since < STALE_NS) return;
+    __atomic_store_n(&p->count, 0, __ATOMIC_SEQ_CST);
+  }
+  int64_t next = INT64_MAX;
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    vt_slot *s = &vt->slots[i];
+    int state = __atomic_load_n(&s->state, __ATOMIC_SEQ_CST);
+    if (state == VT_FREE) continue;
+    if (state == VT_RUNNING) {
+      if (!process_gone(s->pid)) return;
+      reap(s->pid);
+      return;
+    }
+    if (state == VT_EXITING) {
+      if (!thread_gone(s)) return;
+      if (process_gone(s->pid)) {
+        reap(s->pid);
+      } else {
+        __atomic_store_n(&s->state, VT_FREE, __ATOMIC_SEQ_CST);
+        poke(W_CHILD, s->pid, NULL);
+      }
+      return;
+    }
+    if ((s->wait & W_FD) && data_waiting(s, real_now)) return;
+    if (state == VT_SLEEPING && s->deadline < next) next = s->deadline;
+  }
+  if (next == INT64_MAX) return;
+  if (next > vt->now) __atomic_store_n(&vt->now, next, __ATOMIC_RELEASE);
+  real_cond_broadcast(&vt->tick);
+}
+
+static int64_t vnow(void)
+{
+  return __atomic_load_n(&vt->now, __ATOMIC_ACQUIRE);
+}
+
+//Waits on the tick with a real timeout of one slice, so holds that ran out are rechecked
+static void wait_tick(void)
+{
+  struct timespec until = ns_ts(real_ns(CLOCK_REALTIME) + slice_ns);
+  real_cond_timedwait(&vt->tick, &vt->lock, &until);
+}
+
+static void sleep_until(int64_t deadline)
+{
+  vt_slot *s = &vt->slots[current_slot()];
+  clock_reads = 0;
+  vt_lock();
+  s->wait = W_NONE;
+  s->deadline = deadline;
+  while (vnow() < deadline) {
+    __atomic_store_n(&s->state, VT_SLEEPING, __ATOMIC_SEQ_CST);
+    try_advance();
+    if (vnow() >= deadline) break;
+    wait_tick();
+  }
+  __atomic_store_n(&s->state, VT_RUNNING, __ATOMIC_SEQ_CST);
+  vt_unlock();
+}
+
+static void set_running(void)
+{
+  int saved = errno;
+  __atomic_store_n(&vt->slots[current_slot()].state, VT_RUNNING, __ATOMIC_SEQ_CST);
+  errno = saved;
+}
+
+//Starts a check: a poke from here on makes wait_idle refuse
+static void wait_arm(void)
+{
+  __atomic_store_n(&vt->slots[current_slot()].poked, 0, __ATOMIC_SEQ_CST);
+}
+
+//The channels this thread is about to wait on, so data sent on them holds the clock
+static void waits_reset(void)
+{
+  vt->slots[current_slot()].nfds = 0;
+}
+
+static void waits_add(int fd)
+{
+  vt_slot *s = &vt->slots[current_slot()];
+  uint64_t key[2];
+  if (s->nfds < 0 || !chan_key(fd, 0, key)) return;
+  if (s->nfds == VT_WAIT_FDS || (key[0] == 0 && key[1] == 0)) {
+    s->nfds = -1;
+    return;
+  }
+  memcpy(s->fds[s->nfds++], key, sizeof(key));
+}
+
+//After a check found nothing: go idle until deadline (0 for none) and let the clock move.
+//Returns 0 instead if a poke came in since wait_arm; the caller has to check again
+static int wait_idle(int kind, const uint64_t *key, int64_t deadline)
+{
+  vt_slot *s = &vt->slots[current_slot()];
+  clock_reads = 0;
+  vt_lock();
+  s->deadline = deadline;
+  if (key != NULL) memcpy(s->key, key, sizeof(s->key));
+  __atomic_store_n(&s->wait, kind, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&s->state, deadline != 0 ? VT_SLEEPING : VT_BLOCKED, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&s->poked, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&s->state, VT_RUNNING, __ATOMIC_SEQ_CST);
+    vt_unlock();
+    return 0;
+  }
+  try_advance();
+  vt_unlock();
+  return 1;
+}
+
+//Waits for check(arg, ms) to return non-zero, which is returned, or for the virtual
+//deadline (0 for none) to pass, which returns 0. check(arg, 0) must not block; check(arg,
+//ms) waits up to ms of real time. The thread is idle only between a check that found
+//nothing and the next one, and a poke in that window means it checks again
+static int wait_until(int kind, int64_t deadline, int (*check)(void *, int), void *arg)
+{
+  while (1) {
+    wait_arm();
+    int rc = check(arg, 0);
+    if (rc == 0 && (deadline == 0 || vnow() < deadline)) {
+      if (!wait_idle(kind, NULL, deadline)) continue;
+      rc = check(arg, slice_ms());
+      if (rc == 0 && (deadline == 0 || vnow() < deadline)) continue;
+    }
+    set_running();
+    return rc;
+  }
+}
+
+/* ---- condvar identity ---- */
+
+//A condvar in a shared mapping is keyed by file and offset, anything else by pid and address
+static void cond_key(const void *addr, uint64_t key[3])
+{
+  uintptr_t a = (uintptr_t)addr;
+  for (int i = 0; i < VT_MAX_MAPS; i++) {
+    uintptr_t start = __atomic_load_n(&maps[i].start, __ATOMIC_ACQUIRE);
+    if (start != 0 && a >= start && a < maps[i].end) {
+      key[0] = maps[i].dev | (1ULL << 63);
+      key[1] = maps[i].ino;
+      key[2] = (uint64_t)(maps[i].offset + (int64_t)(a - start));
+      return;
+    }
+  }
+  key[0] = (uint64_t)getpid();
+  key[1] = 0;
+  key[2] = a;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+  if (real_mmap == NULL) resolve();
+  void *p = real_mmap(addr, len, prot, flags, fd, offset);
+  struct stat st;
+  if (vt == NULL || p == MAP_FAILED || !(flags & MAP_SHARED) || fd < 0 || fstat(fd, &st) != 0) {
+    return p;
+  }
+  pthread_mutex_lock(&maps_lock);
+  for (int i = 0; i < VT_MAX_MAPS; i++) {
+    if (maps[i].start == 0) {
+      maps[i].end = (uintptr_t)p + len;
+      maps[i].dev = st.st_dev;
+      maps[i].ino = st.st_ino;
+      maps[i].offset = offset;
+      __atomic_store_n(&maps[i].start, (uintptr_t)p, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&maps_lock);
+  return p;
+}
+
+int munmap(void *addr, size_t len)
+{
+  if (real_munmap == NULL) resolve();
+  if (vt != NULL) {
+    uintptr_t a = (uintptr_t)addr;
+    pthread_mutex_lock(&maps_lock);
+    for (int i = 0; i < VT_MAX_MAPS; i++) {
+      if (maps[i].start >= a && maps[i].start < a + len) {
+        __atomic_store_n(&maps[i].start, 0, __ATOMIC_RELEASE);
+      }
+    }
+    pthread_mutex_unlock(&maps_lock);
+  }
+  return real_munmap(addr, len);
+}
+
+static void attach(void)
+{
+  const char *name = getenv("VTIME_NAME");
+  const char *slice = getenv("VTIME_SLICE_US");
+  if (slice != NULL && atoi(slice) > 0) slice_ns = atoi(slice) * 1000LL;
+
+  int created = 1;
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd < 0 && errno == EEXIST) {
+    created = 0;
+    fd = shm_open(name, O_RDWR, 0666);
+  }
+  if (fd < 0 || (created && ftruncate(fd, sizeof(vt_clock)) != 0)) {
+    perror("vtime: shm");
+    return;
+  }
+  struct stat st;
+  while (!created && fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(vt_clock)) {
+    struct timespec pause = {0, 100000};
+    real_nanosleep(&pause, NULL);
+  }
+  vt_clock *clk = real_mmap(NULL, sizeof(vt_clock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  real_close(fd);
+  if (clk == MAP_FAILED) {
+    perror("vtime: mmap");
+    return;
+  }
+  if (created) {
+    pthread_mutexattr_t ma;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&clk->lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&clk->tick, &ca);
+    pthread_condattr_destroy(&ca);
+    clk->mono_base = real_ns(CLOCK_MONOTONIC);
+    clk->rt_base = real_ns(CLOCK_REALTIME);
+    clk->now = clk->mono_base;
+    __atomic_store_n(&clk->ready, 1, __ATOMIC_RELEASE);
+  }
+  while (!__atomic_load_n(&clk->ready, __ATOMIC_ACQUIRE)) {
+    struct timespec pause = {0, 100000};
+    real_nanosleep(&pause, NULL);
+  }
+  vt = clk;
+}
+
+__attribute__((constructor)) static void vtime_init(void)
+{
+  resolve();
+  if (getenv("VTIME_NAME") == NULL) return;
+  attach();
+  if (vt == NULL) return;
+  pthread_key_create(&slot_key, slot_destructor);
+
+  //After an exec the slots of the old image (same pid) are stale; take one over
+  int pid = getpid();
+  vt_lock();
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    if (vt->slots[i].state != VT_FREE && vt->slots[i].pid == pid) {
+      __atomic_store_n(&vt->slots[i].state, VT_FREE, __ATOMIC_SEQ_CST);
+    }
+  }
+  set_my_slot(alloc_slot(pid, my_tid()));
+  vt_unlock();
+}
+
+//The process holds the clock until it is gone, so that its exit (closed sockets, a
+//child to reap) is seen before anyone else's sleep runs out
+__attribute__((destructor)) static void vtime_fini(void)
+{
+  if (vt == NULL) return;
+  int pid = getpid();
+  vt_lock();
+  for (int i = 0; i < VT_MAX_SLOTS; i++) {
+    if (vt->slots[i].state != VT_FREE && vt->slots[i].pid == pid) {
+      __atomic_store_n(&vt->slots[i].state, VT_EXITING, __ATOMIC_SEQ_CST);
+    }
+  }
+  vt_unlock();
+}
+
+/* ---- clocks ---- */
+
+static int virtual_clock(clockid_t clk)
+{
+  return clk == CLOCK_MONOTONIC || clk == CLOCK_MONOTONIC_RAW || clk == CLOCK_MONOTONIC_COARSE ||
+         clk == CLOCK_BOOTTIME || clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE;
+}
+
+static int64_t virtual_ns(clockid_t clk)
+{
+  int64_t now = vnow();
+  if (clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE) return vt->rt_base + (now - vt->mono_base);
+  return now;
+}
+
+//Converts an absolute time on clk to virtual monotonic ns
+static int64_t to_mono(clockid_t clk, int64_t abs_ns)
+{
+  if (clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE) return abs_ns - vt->rt_base + vt->mono_base;
+  return abs_ns;
+}
+
+int clock_gettime(clockid_t clk, struct timespec *ts)
+{
+  if (real_clock_gettime == NULL) resolve();
+  if (vt == NULL || !virtual_clock(clk)) return real_clock_gettime(clk, ts);
+  //A spinning thread never looks idle, so let its polling move the clock instead
+  if (++clock_reads >= SPIN_READS) sleep_until(vnow() + SPIN_STEP_NS);
+  *ts = ns_ts(virtual_ns(clk));
+  return 0;
+}
+
+int gettimeofday(struct timeval *tv, void *tz)
+{
+  (void)tz;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  tv->tv_sec = ts.tv_sec;
+  tv->tv_usec = ts.tv_nsec / 1000;
+  return 0;
+}
+
+time_t time(time_t *out)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if (out != NULL) *out = ts.tv_sec;
+  return ts.tv_sec;
+}
+
+/* ---- sleeps ---- */
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+  if (vt == NULL) return real_nanosleep(req, rem);
+  sleep_until(vnow() + ts_ns(req));
+  if (rem != NULL) rem->tv_sec = rem->tv_nsec = 0;
+  return 0;
+}
+
+int clock_nanosleep(clockid_t clk, int flags, const struct timespec *req, struct timespec *rem)
+{
+  if (vt == NULL || !virtual_clock(clk)) {
+    return syscall(SYS_clock_nanosleep, clk, flags, req, rem) == 0 ? 0 : errno;
+  }
+  if (flags & TIMER_ABSTIME) {
+    sleep_until(to_mono(clk, ts_ns(req)));
+  } else {
+    sleep_until(vnow() + ts_ns(req));
+    if (rem != NULL) rem->tv_sec = rem->tv_nsec = 0;
+  }
+  return 0;
+}
+
+int usleep(useconds_t usec)
+{
+  struct timespec ts = ns_ts(usec * 1000LL);
+  return nanosleep(&ts, NULL);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+  struct timespec ts = {seconds, 0};
+  nanosleep(&ts, NULL);
+  return 0;
+}
+
+/* ---- waits on file descriptors ---- */
+
+struct poll_args {
+  struct pollfd *fds;
+  nfds_t n;
+};
+
+static int poll_check(void *p, int ms)
+{
+  struct poll_args *a = p;
+  return real_poll(a->fds, a->n, ms);
+}
+
+int poll(struct pollfd *fds, nfds_t n, int timeout_ms)
+{
+  if (vt == NULL || timeout_ms == 0) return real_poll(fds, n, timeout_ms);
+  struct poll_args a = {fds, n};
+  waits_reset();
+  for (nfds_t i = 0; i < n; i++) {
+    if (fds[i].events & POLLIN) waits_add(fds[i].fd);
+  }
+  int64_t deadline = timeout_ms < 0 ? 0 : vnow() + timeout_ms * 1000000LL;
+  int rc = wait_until(W_FD, deadline, poll_check, &a);
+  if (rc == 0) {
+    for (nfds_t i = 0; i < n; i++) fds[i].revents = 0;
+  }
+  return rc;
+}
+
+struct select_args {
+  int nfds;
+  fd_set *r, *w, *e; // Results go here
+  fd_set r0, w0, e0; // What was asked for
+};
+
+static int select_check(void *p, int ms)
+{
+  struct select_args *a = p;
+  fd_set rs = a->r0, ws = a->w0, es = a->e0;
+  struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+  int rc = real_select(a->nfds, a->r ? &rs : NULL, a->w ? &ws : NULL, a->e ? &es : NULL, &tv);
+  if (rc > 0) {
+    if (a->r) *a->r = rs;
+    if (a->w) *a->w = ws;
+    if (a->e) *a->e = es;
+  }
+  return rc;
+}
+
+int select(int nfds, fd_set *r, fd_set *w, fd_set *e, struct timeval *timeout)
+{
+  if (vt == NULL || (timeout != NULL && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+    return real_select(nfds, r, w, e, timeout);
+  }
+  struct select_args a = {.nfds = nfds, .r = r, .w = w, .e = e};
+  if (r) a.r0 = *r;
+  if (w) a.w0 = *w;
+  if (e) a.e0 = *e;
+  waits_reset();
+  for (int fd = 0; r != NULL && fd < nfds; fd++) {
+    if (FD_ISSET(fd, r)) waits_add(fd);
+  }
+  int64_t deadline = timeout == NULL ? 0 : vnow() + timeout->tv_sec * NSEC + timeout->tv_usec * 1000LL;
+  int rc = wait_until(W_FD, deadline, select_check, &a);
+  if (rc == 0) {
+    if (r) FD_ZERO(r);
+    if (w) FD_ZERO(w);
+    if (e) FD_ZERO(e);
+    timeout->tv_sec = timeout->tv_usec = 0;
+  }
+  return rc;
+}
+
+//A blocking read or accept first waits in poll, so that it can be poked. Returns -1 when
+//interrupted by a handler without SA_RESTART, as the call itself would
+static int wait_readable(int fd, int flags)
+{
+  uint64_t key[2];
+  if ((flags & MSG_DONTWAIT) || !chan_key(fd, 0, key) || (fcntl(fd, F_GETFL) & O_NONBLOCK)) return 0;
+  struct pollfd p = {fd, POLLIN, 0};
+  struct poll_args a = {&p, 1};
+  waits_reset();
+  waits_add(fd);
+  while (wait_until(W_FD, 0, poll_check, &a) < 0) {
+    if (errno != EINTR || !sig_restart) return -1;
+  }
+  return 0;
+}
+
+ssize_t read(int fd, void *buf, size_t n)
+{
+  if (vt == NULL) return real_read(fd, buf, n);
+  if (wait_readable(fd, 0) != 0) return -1;
+  ssize_t rc = real_read(fd, buf, n);
+  if (rc > 0) count_fd(fd, 0, -rc);
+  return rc;
+}
+
+ssize_t recv(int fd, void *buf, size_t n, int flags)
+{
+  if (vt == NULL) return real_recv(fd, buf, n, flags);
+  if (wait_readable(fd, flags) != 0) return -1;
+  ssize_t rc = real_recv(fd, buf, n, flags);
+  if (rc > 0 && !(flags & MSG_PEEK)) count_fd(fd, 0, -rc);
+  return rc;
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t n, int flags, struct sockaddr *addr, socklen_t *len)
+{
+  if (vt == NULL) return real_recvfrom(fd, buf, n, flags, addr, len);
+  if (wait_readable(fd, flags) != 0) return -1;
+  ssize_t rc = real_recvfrom(fd, buf, n, flags, addr, len);
+  if (rc > 0 && !(flags & MSG_PEEK)) count_fd(fd, 0, -rc);
+  return rc;
+}
+
+ssize_t recvmsg(int fd, struct msghdr *m, int flags)
+{
+  if (vt == NULL) return real_recvmsg(fd, m, flags);
+  if (wait_readable(fd, flags) != 0) return -1;
+  ssize_t rc = real_recvmsg(fd, m, flags);
+  if (rc > 0 && !(flags & MSG_PEEK)) count_fd(fd, 0, -rc);
+  return rc;
+}
+
+//Nagle would hold a frame's body back until the header is acked (up to 40ms
+//of real time with delayed acks), long enough to look like nobody will read it
+static void no_delay(int fd)
+{
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); //Fails harmlessly off TCP
+}
+
+//A connection waiting to be accepted counts as one byte in flight
+int accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  if (vt == NULL) return real_accept(fd, addr, len);
+  if (wait_readable(fd, 0) != 0) return -1;
+  int rc = real_accept(fd, addr, len);
+  if (rc >= 0) {
+    count_fd(fd, 0, -1);
+    no_delay(rc);
+  }
+  return rc;
+}
+
+int accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags)
+{
+  if (vt == NULL) return real_accept4(fd, addr, len, flags);
+  if (wait_readable(fd, 0) != 0) return -1;
+  int rc = real_accept4(fd, addr, len, flags);
+  if (rc >= 0) {
+    count_fd(fd, 0, -1);
+    no_delay(rc);
+  }
+  return rc;
+}
+
+/* ---- waits for children and threads ---- */
+
+struct waitpid_args {
+  pid_t pid;
+  int *status;
+  int options;
+  pid_t rc;
+};
+
+static int waitpid_check(void *p, int ms)
+{
+  struct waitpid_args *a = p;
+  if (ms > 0) real_pause(ms);
+  a->rc = real_waitpid(a->pid, a->status, a->options | WNOHANG);
+  return a->rc != 0;
+}
+
+pid_t waitpid(pid_t pid, int *status, int options)
+{
+  if (vt == NULL || (options & WNOHANG)) return real_waitpid(pid, status, options);
+  struct waitpid_args a = {pid, status, options, 0};
+  wait_until(W_CHILD, 0, waitpid_check, &a);
+  return a.rc;
+}
+
+pid_t wait(int *status)
+{
+  return waitpid(-1, status, 0);
+}
+
+struct join_args {
+  pthread_t t;
+  void **ret;
+  int rc;
+};
+
+static int join_check(void *p, int ms)
+{
+  struct join_args *a = p;
+  if (ms > 0) real_pause(ms);
+  a->rc = pthread_tryjoin_np(a->t, a->ret);
+  return a->rc != EBUSY;
+}
+
+int pthread_join(pthread_t t, void **ret)
+{
+  if (vt == NULL) return real_pthread_join(t, ret);
+  struct join_args a = {t, ret, 0};
+  wait_until(W_CHILD, 0, join_check, &a);
+  return a.rc;
+}
+
+/* ---- condition variables ---- */
+
+//The clock a condvar's timeouts are on (glibc keeps it in bit 1 of __wrefs)
+static clockid_t cond_clock(const pthread_cond_t *cond)
+{
+  return (cond->__data.__wrefs & 2) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+}
+
+//Waits in real slices; a signal for this condvar pokes us before it is sent, so one
+//that lands between two slices still ends the wait (as a spurious wake-up)
+static int cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t deadline)
+{
+  uint64_t key[3];
+  cond_key(cond, key);
+  clockid_t clk = cond_clock(cond);
+  wait_arm();
+  while (1) {
+    if (deadline != 0 && vnow() >= deadline) {
+      set_running();
+      return ETIMEDOUT;
+    }
+    if (!wait_idle(W_COND, key, deadline)) return 0;
+    struct timespec slice = ns_ts(real_ns(clk) + slice_ns);
+    int rc = real_cond_timedwait(cond, mutex, &slice);
+    if (rc != ETIMEDOUT) {
+      set_running();
+      return rc;
+    }
+  }
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+  if (real_cond_timedwait == NULL) resolve();
+  if (vt == NULL) return real_cond_timedwait(cond, mutex, abstime);
+  int64_t deadline = to_mono(cond_clock(cond), ts_ns(abstime));
+  return cond_wait_until(cond, mutex, deadline > 0 ? deadline : 1);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+  if (real_cond_wait == NULL) resolve();
+  if (vt == NULL) return real_cond_wait(cond, mutex);
+  return cond_wait_until(cond, mutex, 0);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+  if (real_cond_signal == NULL) resolve();
+  if (vt != NULL) {
+    uint64_t key[3];
+    cond_key(cond, key);
+    poke(W_COND, 0, key);
+  }
+  return real_cond_signal(cond);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+  if (real_cond_broadcast == NULL) resolve();
+  if (vt != NULL) {
+    uint64_t key[3];
+    cond_key(cond, key);
+    poke(W_COND, 0, key);
+  }
+  return real_cond_broadcast(cond);
+}
+
+/* ---- calls that hand data or a wake-up to another participant ---- */
+
+//Counted before it is sent, so a reader waiting on it never looks idle with the data
+//already there
+static int will_send(int fd, size_t n, uint64_t key[2])
+{
+  if (!chan_key(fd, 1, key)) return 0;
+  count_data(key, n);
+  return 1;
+}
+
+static ssize_t sent(int counted, const uint64_t key[2], size_t n, ssize_t rc)
+{
+  if (counted && rc < (ssize_t)n) count_data(key, -(int64_t)(n - (rc > 0 ? (size_t)rc : 0)));
+  return rc;
+}
+
+ssize_t write(int fd, const void *buf, size_t n)
+{
+  if (vt == NULL) return real_write(fd, buf, n);
+  uint64_t key[2];
+  int counted = will_send(fd, n, key);
+  return sent(counted, key, n, real_write(fd, buf, n));
+}
+
+ssize_t send(int fd, const void *buf, size_t n, int flags)
+{
+  if (vt == NULL) return real_send(fd, buf, n, flags);
+  uint64_t key[2];
+  int counted = will_send(fd, n, key);
+  return sent(counted, key, n, real_send(fd, buf, n, flags));
+}
+
+ssize_t sendto(int fd, const void *buf, size_t n, int flags, const struct sockaddr *addr, socklen_t len)
+{
+  if (vt == NULL) return real_sendto(fd, buf, n, flags, addr, len);
+  uint64_t key[2];
+  int counted = will_send(fd, n, key);
+  return sent(counted, key, n, real_sendto(fd, buf, n, flags, addr, len));
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *m, int flags)
+{
+  if (vt == NULL) return real_sendmsg(fd, m, flags);
+  size_t n = 0;
+  for (size_t i = 0; i < m->msg_iovlen; i++) n += m->msg_iov[i].iov_len;
+  uint64_t key[2];
+  int counted = will_send(fd, n, key);
+  return sent(counted, key, n, real_sendmsg(fd, m, flags));
+}
+
+//A connection waiting to be accepted counts as one byte for the listener on that port
+int connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  if (vt == NULL || addr == NULL || addr->sa_family != AF_INET) return real_connect(fd, addr, len);
+  uint64_t key[2] = {END_LISTEN | ntohs(((const struct sockaddr_in *)addr)->sin_port), 0};
+  count_data(key, 1);
+  int rc = real_connect(fd, addr, len);
+  if (rc == 0 || errno == EINPROGRESS) {
+    no_delay(fd);
+  } else {
+    int saved = errno;
+    count_data(key, -1);
+    errno = saved;
+  }
+  return rc;
+}
+
+//Whatever is still queued on a socket we close will never be read, and a reader at the
+//other end (or another thread here) wakes up to EOF
+int close(int fd)
+{
+  if (vt == NULL) return real_close(fd);
+  uint64_t key[2];
+  int unread = 0, channel = chan_key(fd, 0, key);
+  if (channel && ioctl(fd, FIONREAD, &unread) == 0) count_data(key, -unread);
+  if (fd >= 0 && fd < VT_MAX_FDS) fd_ends[fd].local = 0;
+  int rc = real_close(fd);
+  if (channel) poke(W_FD, 0, NULL);
+  return rc;
+}
+
+int shutdown(int fd, int how)
+{
+  int rc = real_shutdown(fd, how);
+  if (vt != NULL) poke(W_FD, 0, NULL);
+  return rc;
+}
+
+/* ---- signals: kill() holds the clock until the target's handler has run ---- */
+
+//Runs the program's handler, then lets the wait it interrupted (if any) check again
+static void trampoline(int sig, siginfo_t *info, void *ctx)
+{
+  int saved = errno;
+  struct sigaction *a = &handlers[sig];
+  if (a->sa_flags & SA_SIGINFO) {
+    a->sa_sigaction(sig, info, ctx);
+  } else {
+    a->sa_handler(sig);
+  }
+  sig_restart = (a->sa_flags & SA_RESTART) != 0;
+  if (my_slot >= 0) poke_slot(&vt->slots[my_slot]);
+  int pid = getpid();
+  for (int i = 0; i < VT_MAX_SIGNALS; i++) {
+    vt_signal *p = &vt->signals[i];
+    int count = __atomic_load_n(&p->count, __ATOMIC_SEQ_CST);
+    while (p->pid == pid && count > 0 &&
+           !__atomic_compare_exchange_n(&p->count, &count, count - 1, 0, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST)) {
+    }
+    if (p->pid == pid && count > 0) break;
+  }
+  errno = saved;
+}
+
+int sigaction(int sig, const struct sigaction *act, struct sigaction *old)
+{
+  if (real_sigaction == NULL) resolve();
+  if (vt == NULL || sig <= 0 || sig >= NSIG) return real_sigaction(sig, act, old);
+  struct sigaction prev = handlers[sig], mine;
+  if (act != NULL && act->sa_handler != SIG_DFL && act->sa_handler != SIG_IGN) {
+    handlers[sig] = *act;
+    mine = *act;
+    mine.sa_sigaction = trampoline;
+    mine.sa_flags |= SA_SIGINFO;
+    act = &mine;
+  }
+  int rc = real_sigaction(sig, act, old);
+  if (rc != 0) {
+    handlers[sig] = prev;
+  } else if (old != NULL && old->sa_sigaction == trampoline) {
+    *old = prev;
+  }
+  return rc;
+}
+
+static sighandler_t install(int sig, sighandler_t handler, int flags)
+{
+  struct sigaction act, old;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = handler;
+  sigemptyset(&act.sa_mask);
+  if (!(flags & SA_NODEFER) && sig > 0 && sig < NSIG) sigaddset(&act.sa_mask, sig);
+  act.sa_flags = flags;
+  return sigaction(sig, &act, &old) == 0 ? old.sa_handler : SIG_ERR;
+}
+
+//BSD semantics, as glibc's own signal()
+sighandler_t signal(int sig, sighandler_t handler)
+{
+  if (real_signal == NULL) resolve();
+  if (vt == NULL) return real_signal(sig, handler);
+  return install(sig, handler, SA_RESTART);
+}
+
+//What signal() is under -std=c99, which the programs are built with: System V semantics
+sighandler_t __sysv_signal(int sig, sighandler_t handler)
+{
+  if (real_sysv_signal == NULL) resolve();
+  if (vt == NULL) return real_sysv_signal(sig, handler);
+  return install(sig, handler, SA_RESETHAND | SA_NODEFER);
+}
+
+//Whether sig's bit is set in the "<field>:\t<hex mask>" line of /proc/<pid>/status
+static int sig_in_mask(const char *status, const char *field, int sig)
+{
+  const char *line = strstr(status, field);
+  if (line == NULL) return 0;
+  unsigned long long mask = strtoull(line + strlen(field), NULL, 16);
+  return (mask >> (sig - 1)) & 1;
+}
+
+//Caller holds the lock. Whether the target has anything to do on sig: run a handler, or
+//die. Signals that are ignored, or do nothing by default, do not hold the clock
+static int signal_matters(int pid, int sig)
+{
+  char path[64], buf[2048];
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  ssize_t n = real_read(fd, buf, sizeof(buf) - 1);
+  real_close(fd);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+  if (sig_in_mask(buf, "SigCgt:", sig)) return 1;
+  if (sig_in_mask(buf, "SigIgn:", sig)) return 0;
+  return sig != SIGCHLD && sig != SIGCONT && sig != SIGURG && sig != SIGWINCH && sig != SIGSTOP &&
+         sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU;
+}
+
+//Caller holds the lock. Returns the entry now holding the clock for it, or NULL
+static vt_signal *expect_signal(int pid, int sig)
+{
+  int participant = 0;
+  for (int i = 0; i < VT_MAX_SLOTS && !participant; i++) {
+    participant = vt->slots[i].state != VT_FREE && vt->slots[i].pid == pid;
+  }
+  if (!participant || !signal_matters(pid, sig)) return NULL;
+  vt_signal *spare = NULL;
+  for (int i = 0; i < VT_MAX_SIGNALS; i++) {
+    vt_signal *p = &vt->signals[i];
+    int count = __atomic_load_n(&p->count, __ATOMIC_SEQ_CST);
+    if (count > 0 && p->pid == pid) {
+      spare = p;
+      break;
+    }
+    if (count <= 0 && spare == NULL) spare = p;
+  }
+  if (spare == NULL) return NULL;
+  if (spare->pid != pid || __atomic_load_n(&spare->count, __ATOMIC_SEQ_CST) <= 0) {
+    spare->pid = pid;
+    __atomic_store_n(&spare->count, 0, __ATOMIC_SEQ_CST);
+  }
+  spare->since = real_ns(CLOCK_MONOTONIC);
+  __atomic_add_fetch(&spare->count, 1, __ATOMIC_SEQ_CST);
+  return spare;
+}
+
+int kill(pid_t pid, int sig)
+{
+  if (vt == NULL || pid <= 0 || sig <= 0 || sig >= NSIG) return real_kill(pid, sig);
+  vt_lock();
+  vt_signal *held = expect_signal(pid, sig);
+  vt_unlock();
+  int rc = real_kill(pid, sig);
+  if (rc != 0 && held != NULL) {
+    int saved = errno;
+    __atomic_sub_fetch(&held->count, 1, __ATOMIC_SEQ_CST);
+    errno = saved;
+  }
+  return rc;
+}
+
+/* ---- new participants are registered before they can be overtaken ---- */
+
+pid_t fork(void)
+{
+  if (vt == NULL) return real_fork();
+  vt_lock();
+  int reserved = alloc_slot(getpid(), 0);
+  vt_unlock();
+  pid_t pid = real_fork();
+  if (pid == 0) {
+    vt->slots[reserved].pid = getpid();
+    vt->slots[reserved].tid = my_tid();
+    set_my_slot(reserved);
+  } else if (pid < 0) {
+    free_slot(reserved);
+  }
+  return pid;
+}
+
+struct start_arg {
+  void *(*fn)(void *);
+  void *arg;
+  int slot;
+};
+
+static void *thread_start(void *p)
+{
+  struct start_arg a = *(struct start_arg *)p;
+  free(p);
+  vt->slots[a.slot].tid = my_tid();
+  set_my_slot(a.slot);
+  return a.fn(a.arg);
+}
+
+int pthread_create(pthread_t *t, const pthread_attr_t *attr, void *(*fn)(void *), void *arg)
+{
+  if (real_pthread_create == NULL) resolve();
+  if (vt == NULL) return real_pthread_create(t, attr, fn, arg);
+  struct start_arg *a = malloc(sizeof(*a));
+  if (a == NULL) return EAGAIN;
+  vt_lock();
+  a->slot = alloc_slot(getpid(), 0);
+  vt_unlock();
+  a->fn = fn;
+  a->arg = arg;
+  int rc = real_pthread_create(t, attr, thread_start, a);
+  if (rc != 0) {
+    free_slot(a->slot);
+    free(a);
+  }
+  return rc;
+}
@@ -0,0 +1,233 @@
+/**
+ * Offline trainer for the controller's learned dispatch policy (see policy.c).
+ *
+ * Usage: ./train-policy <output file> [calls per floor-time] [iterations]
+ *
+ * A building of TRAIN_CARS cars over TRAIN_FLOORS floors is simulated in
+ * floor-times (one floor of travel; a stop takes TRAIN_STOP), with calls
+ * arriving as a Poisson stream between uniformly random floors. Queues are
+ * planned by the controller's own schedule.c, so only the choice of car
+ * differs from the real thing.
+ *
+ * The table is not trained cell by cell: each feature bucket gets a weight
+ * and a cell's cost is the sum of its buckets' weights, 18 numbers in all.
+ * The weights are searched by the cross-entropy method: each iteration draws
+ * TRAIN_POPULATION weight vectors around the current mean, scores each by
+ * the riders' average wait over the same TRAIN_SEEDS simulated runs, and
+ * moves the mean and spread to the best TRAIN_ELITE. The search starts from
+ * weights that reproduce the greedy rule.
+ *
+ * The final table is compared with the greedy rule on fresh seeds before it
+ * is written.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "controller.h"
+#include <math.h>
+
+#define TRAIN_CARS 6
+#define TRAIN_FLOORS 20
+#define TRAIN_STOP 3
+#define TRAIN_STEPS 1500 //Floor-times per simulated run
+#define TRAIN_SEEDS 4 //Runs per score during training
+#define TRAIN_CHECK_SEEDS 16 //Fresh runs for the final comparison
+#define TRAIN_POPULATION 32
+#define TRAIN_ELITE 8
+#define TRAIN_MAX_RIDERS 64 //Per car; a call beyond that is refused
+#define TRAIN_REFUSED_WAIT 200 //Floor-times charged for a refused call
+#define TRAIN_SCALE 16 //Table units per floor-time of weight
+#define WEIGHTS (3 * POLICY_BUCKETS + 3)
+
+typedef struct {
+    int source;
+    int dest;
+    int riding;
+    int since;
+} rider_t;
+
+typedef struct {
+    long calls;
+    long waited; //Floor-times, including charges for refused calls
+} outcome_t;
+
+/// @brief Cell costs from per-bucket weights: pickup index, distance, queue length, heading
+static void weights_to_table(const double *w, int16_t *costs) {
+    for (int p = 0; p < POLICY_BUCKETS; p++) {
+        for (int d = 0; d < POLICY_BUCKETS; d++) {
+            for (int q = 0; q < POLICY_BUCKETS; q++) {
+                for (int h = 0; h < 3; h++) {
+                    double cost = w[p] + w[POLICY_BUCKETS + d] + w[2 * POLICY_BUCKETS + q] + w[3 * POLICY_BUCKETS + h];
+                    long scaled = lround(cost * TRAIN_SCALE);
+                    if (scaled > INT16_MAX) scaled = INT16_MAX;
+                    if (scaled < INT16_MIN) scaled = INT16_MIN;
+                    costs[((p * POLICY_BUCKETS + d) * POLICY_BUCKETS + q) * 3 + h] = (int16_t)scaled;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs the building for TRAIN_STEPS floor-times
+ * @param costs the policy, or NULL for the greedy rule
+ */
+static outcome_t run(const int16_t *costs, double rate, unsigned int seed) {
+    static Car cars[MAX_CARS];
+    static rider_t riders[MAX_CARS][TRAIN_MAX_RIDERS];
+    int rider_count[MAX_CARS] = {0};
+    int stop_left[MAX_CARS] = {0};
+    outcome_t out = {0, 0};
+
+    memset(cars, 0, sizeof(cars));
+    for (int c = 0; c < TRAIN_CARS; c++) {
+        cars[c].in_use = 1;
+        cars[c].floor_min = 1;
+        cars[c].floor_max = TRAIN_FLOORS;
+        cars[c].current_floor = 1 + c * (TRAIN_FLOORS - 1) / TRAIN_CARS;
+        strcpy(cars[c].status, "Closed");
+    }
+
+    double next_call = -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / rate;
+    for (int t = 0; t < TRAIN_STEPS; t++) {
+        while (next_call < t + 1) {
+            int source = 1 + rand_r(&seed) % TRAIN_FLOORS, dest;
+            do {
+                dest = 1 + rand_r(&seed) % TRAIN_FLOORS;
+            } while (dest == source);
+            next_call += -log((rand_r(&seed) + 1.0) / (RAND_MAX + 2.0)) / rate;
+            int c = costs ? policy_pick(costs, cars, source, dest) : greedy_choice(cars, source, dest, NULL);
+            out.calls++;
+            if (c < 0 || cars[c].queue_size + 2 > MAX_QUEUE_DEPTH || rider_count[c] >= TRAIN_MAX_RIDERS) {
+                out.waited += TRAIN_REFUSED_WAIT;
+                continue;
+            }
+            plan_insertion(&cars[c], source, dest);
+            riders[c][rider_count[c]++] = (rider_t){source, dest, 0, t};
+        }
+
+        for (int c = 0; c < TRAIN_CARS; c++) {
+            Car *car = &cars[c];
+            if (stop_left[c] > 0) {
+                stop_left[c]--;
+                continue;
+            }
+            if (car->queue_size == 0) {
+                strcpy(car->status, "Closed");
+                continue;
+            }
+            if (car->current_floor != car->queue[0]) {
+                car->current_floor += (car->queue[0] > car->current_floor) ? 1 : -1;
+                strcpy(car->status, "Between");
+            }
+            if (car->current_floor != car->queue[0]) continue;
+            int floor = car->queue[0];
+            remove_from_queue(car->queue, &car->queue_size, 0);
+            strcpy(car->status, "Closed");
+            stop_left[c] = TRAIN_STOP;
+            for (int r = 0; r < rider_count[c]; r++) {
+                rider_t *rider = &riders[c][r];
+                if (!rider->riding && rider->source == floor) {
+                    out.waited += t + 1 - rider->since;
+                    rider->riding = 1;
+                } else if (rider->riding && rider->dest == floor) {
+                    riders[c][r--] = riders[c][--rider_count[c]];
+                }
+            }
+        }
+    }
+    //Riders still waiting at the end have waited at least this long
+    for (int c = 0; c < TRAIN_CARS; c++) {
+        for (int r = 0; r < rider_count[c]; r++) {
+            if (!riders[c][r].riding) out.waited += TRAIN_STEPS - riders[c][r].since;
+        }
+    }
+    return out;
+}
+
+/// @brief Average wait over runs seeded from first
+static double score(const int16_t *costs, double rate, unsigned int first, int runs, long *calls) {
+    long waited = 0, total = 0;
+    for (int i = 0; i < runs; i++) {
+        outcome_t out = run(costs, rate, first + i * 7919u);
+        waited += out.waited;
+        total += out.calls;
+    }
+    if (calls != NULL) *calls += total;
+    return total ? (double)waited / total : 0;
+}
+
+static double gaussian(unsigned int *seed) {
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0), v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * v);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <output file> [calls per floor-time] [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    double rate = (argc > 2) ? atof(argv[2]) : 0.3;
+    int iterations = (argc > 3) ? atoi(argv[3]) : 25;
+    if (rate <= 0 || iterations < 1) {
+        fprintf(stderr, "Rate and iterations must be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    //Start at the greedy rule: the earlier the pickup in the queue, the better
+    double mean[WEIGHTS] = {0}, spread[WEIGHTS];
+    for (int p = 0; p < POLICY_BUCKETS; p++) mean[p] = 10.0 * p;
+    for (int i = 0; i < WEIGHTS; i++) spread[i] = 8.0;
+
+    static double population[TRAIN_POPULATION][WEIGHTS];
+    double scores[TRAIN_POPULATION];
+    int16_t costs[POLICY_CELLS];
+    unsigned int seed = 12345;
+    long trained_calls = 0;
+
+    printf("%d cars, %d floors, %.2f calls per floor-time, %d iterations\n", TRAIN_CARS, TRAIN_FLOORS, rate, iterations);
+    for (int it = 0; it < iterations; it++) {
+        unsigned int scenario = 1000u + it * 104729u; //The same runs for every candidate this round
+        for (int k = 0; k < TRAIN_POPULATION; k++) {
+            for (int i = 0; i < WEIGHTS; i++) population[k][i] = mean[i] + spread[i] * gaussian(&seed);
+            if (k == 0) memcpy(population[k], mean, sizeof(mean)); //Keep the incumbent in the running
+            weights_to_table(population[k], costs);
+            scores[k] = score(costs, rate, scenario, TRAIN_SEEDS, &trained_calls);
+        }
+        //Refit to the elite
+        int order[TRAIN_POPULATION];
+        for (int k = 0; k < TRAIN_POPULATION; k++) order[k] = k;
+        for (int a = 1; a < TRAIN_POPULATION; a++) {
+            for (int b = a; b > 0 && scores[order[b]] < scores[order[b - 1]]; b--) {
+                int tmp = order[b];
+                order[b] = order[b - 1];
+                order[b - 1] = tmp;
+            }
+        }
+        for (int i = 0; i < WEIGHTS; i++) {
+            double sum = 0, sum_sq = 0;
+            for (int e = 0; e < TRAIN_ELITE; e++) {
+                double v = population[order[e]][i];
+                sum += v;
+                sum_sq += v * v;
+            }
+            mean[i] = sum / TRAIN_ELITE;
+            double var = sum_sq / TRAIN_ELITE - mean[i] * mean[i];
+            spread[i] = sqrt(var > 0 ? var : 0) + 0.5; //A floor on the spread keeps the search moving
+        }
+        printf("iteration %2d: best avg wait %.2f floor-times\n", it + 1, scores[order[0]]);
+    }
+
+    weights_to_table(mean, costs);
+    double learned = score(costs, rate, 99991u, TRAIN_CHECK_SEEDS, NULL);
+    double greedy = score(NULL, rate, 99991u, TRAIN_CHECK_SEEDS, NULL);
+    printf("Fresh runs: greedy avg wait %.2f, learned %.2f floor-times (%+.1f%%)\n", greedy, learned,
+        greedy > 0 ? (learned - greedy) * 100 / greedy : 0.0);
+    printf("Weights (pickup index / distance / queued stops / idle,toward,away):\n");
+    for (int i = 0; i < WEIGHTS; i++) {
+        printf(" %6.1f%s", mean[i], (i % POLICY_BUCKETS == POLICY_BUCKETS - 1 || i == WEIGHTS - 1) ? "\n" : "");
+    }
+
+    if (policy_write(argv[1], costs, (uint32_t)trained_calls) != 0) return EXIT_FAILURE;
+    printf("Wrote version %d policy (%d cells) to %s\n", POLICY_VERSION, POLICY_CELLS, argv[1]);
+    return EXIT_SUCCESS;
+}
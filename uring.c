@@ -0,0 +1,678 @@
+/**
+ * io_uring backend for the controller (--io-uring).
+ *
+ * One thread serves every connection from a single ring, set up with the raw
+ * io_uring syscalls so nothing beyond the kernel headers is needed:
+ *   - a multishot accept on the listening socket yields every new connection;
+ *   - each connection has a multishot recv that draws from a provided-buffer
+ *     ring, so a receive buffer is only tied up once data has arrived. The
+ *     bytes are copied into the connection's frame buffer and the receive
+ *     buffer goes straight back to the ring;
+ *   - replies (FLOOR to cars, CAR or UNAVAILABLE to call pads) are appended to
+ *     the connection's output and go out as one SEND per connection per batch.
+ *     Closing a connection links its last SEND to a SHUTDOWN, so a call pad
+ *     always has its reply before the connection goes away.
+ * Completions are reaped in batches and everything they queue is submitted by
+ * the next io_uring_enter, so a busy controller handles many frames per call.
+ *
+ * Frames go through the same register_car/car_frame/handle_call_connection
+ * code the handler threads use; conn_send and conn_close route here while the
+ * ring is active. Both may only be called from the ring thread.
+ *
+ * uring_init checks the kernel can do all of the above (multishot recv, the
+ * newest piece, is tried out on a socketpair) and returns -1 otherwise, so the
+ * controller falls back to handler threads.
+ */
+
+#define _GNU_SOURCE
+#include "controller.h"
+
+int uring_active = 0;
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256 //Submission queue size
+#define URING_CQ_ENTRIES 4096 //Room for a burst of multishot completions
+#define URING_BUF_COUNT 512 //Provided receive buffers, a power of two
+#define URING_BUF_SIZE 2048
+#define URING_BUF_GROUP 1
+#define URING_MAX_FDS 2048 //Connections are indexed by fd
+#define URING_IN_SIZE 4096 //Largest frame taken from a client, with its length prefix
+#define URING_OUT_SIZE 8192 //Replies waiting to go out on one connection
+#define URING_SUBMIT_EVERY 32 //Completions handled before queued work is submitted mid-batch
+
+//What a completion belongs to. The fd travels in the low 32 bits of user_data
+typedef enum {
+    OP_PROBE,
+    OP_ACCEPT,
+    OP_ACCEPT_CALL,
+    OP_RECV,
+    OP_SEND,
+    OP_SHUTDOWN,
+    OP_STANDBY_POLL
+} uring_op_t;
+
+typedef struct {
+    int open;
+    int identified; //The first frame (CAR or CALL) has been seen
+    ConnClass klass; //The listener it came in on
+    int64_t accepted_ns;
+    int deferred; //On the deferred list, input waits for the end of the batch
+    int watched; //A call pad's pickup holds it open (NOTIFY) until the rider boards
+    Car *car; //Set while the connection is a registered car
+    int closing; //conn_close was called: ignore further frames, shut down once flushed
+    int recv_armed; //Multishot recv outstanding
+    int send_inflight;
+    int shutdown_inflight;
+    int shut; //SHUTDOWN has completed
+    int dirty; //On the flush list
+    size_t in_len;
+    char in[URING_IN_SIZE];
+    //The SEND in flight covers the start of out; replies are appended behind it
+    size_t out_len;
+    char out[URING_OUT_SIZE];
+} uring_conn_t;
+
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned local_tail; //Includes SQEs prepared but not yet published
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *bufs;
+    unsigned short buf_tail;
+    char *buf_mem;
+    void *maps[3]; //SQ ring, CQ ring (unless shared with the SQ ring), SQEs
+    size_t map_sizes[3];
+} ring = { .fd = -1 };
+
+static struct {
+    unsigned long long frames;
+    unsigned long long enters;
+    unsigned long long completions;
+} stats;
+
+static uring_conn_t conns[URING_MAX_FDS];
+static int dirty_fds[URING_MAX_FDS];
+static int dirty_count = 0;
+//Call pads with input waiting; handled once the batch's car traffic is done
+static int deferred_fds[URING_MAX_FDS];
+static int deferred_count = 0;
+
+static int car_listen_fd = -1;
+static int call_listen_fd = -1;
+
+static uint64_t make_data(uring_op_t op, int fd) {
+    return ((uint64_t)op << 32) | (uint32_t)fd;
+}
+
+/// @brief Publishes prepared SQEs and optionally waits for a completion
+static int ring_enter(unsigned min_complete) {
+    __atomic_store_n(ring.sq_tail, ring.local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring.local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    stats.enters++;
+    return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+                        min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/// @brief Makes sure n SQEs can be prepared back to back (a linked pair must not be split)
+static int sq_reserve(unsigned n) {
+    if (ring.local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) + n <= ring.sq_entries) return 0;
+    ring_enter(0);
+    return (ring.local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) + n <= ring.sq_entries) ? 0 : -1;
+}
+
+static struct io_uring_sqe *get_sqe(uring_op_t op, int fd) {
+    if (sq_reserve(1) != 0) return NULL;
+    unsigned idx = ring.local_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->user_data = make_data(op, fd);
+    ring.sq_array[idx] = idx;
+    ring.local_tail++;
+    return sqe;
+}
+
+/// @brief Hands receive buffer bid back to the kernel
+static void recycle_buffer(unsigned short bid) {
+    struct io_uring_buf *buf = &ring.bufs->bufs[ring.buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring.buf_mem + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ring.buf_tail++;
+    __atomic_store_n(&ring.bufs->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+static int arm_recv(uring_op_t op, int fd) {
+    struct io_uring_sqe *sqe = get_sqe(op, fd);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    return 0;
+}
+
+static int arm_accept(uring_op_t op, int listen_fd) {
+    struct io_uring_sqe *sqe = get_sqe(op, listen_fd);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    return 0;
+}
+
+static int arm_standby_poll(int fd) {
+    struct io_uring_sqe *sqe = get_sqe(OP_STANDBY_POLL, fd);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = POLLIN;
+    return 0;
+}
+
+static void mark_dirty(int fd) {
+    if (!conns[fd].dirty) {
+        conns[fd].dirty = 1;
+        dirty_fds[dirty_count++] = fd;
+    }
+}
+
+/**
+ * @brief Tears down the ring. Only used while uring_init is still failing, once
+ * the ring runs it lives as long as the process
+ */
+static void ring_free(void) {
+    if (ring.bufs != NULL) munmap(ring.bufs, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    free(ring.buf_mem);
+    for (int i = 0; i < 3; i++) {
+        if (ring.maps[i] != NULL && ring.maps[i] != MAP_FAILED) munmap(ring.maps[i], ring.map_sizes[i]);
+    }
+    if (ring.fd >= 0) close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+/**
+ * @brief Arms a multishot recv on one end of a socketpair and writes a byte to the
+ * other. Kernels without multishot recv fail the request or end it after one shot
+ */
+static int probe_multishot_recv(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return -1;
+    int ok = 0;
+    if (arm_recv(OP_PROBE, sv[0]) == 0) {
+        if (write(sv[1], "x", 1) == 1 && ring_enter(1) >= 0) {
+            unsigned head = *ring.cq_head;
+            if (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe cqe = ring.cqes[head & *ring.cq_mask];
+                __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+                ok = cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+                if (cqe.res > 0) recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+        }
+    }
+    //Closing the writer ends the probe with EOF; reap that so the queue starts empty
+    close(sv[1]);
+    if (ok) {
+        while (ring_enter(1) < 0 && errno == EINTR) {
+        }
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        __atomic_store_n(ring.cq_head, tail, __ATOMIC_RELEASE);
+    }
+    close(sv[0]);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Sets up the ring and the provided buffers, and checks multishot recv works
+ * @return 0 and sets uring_active, or -1 (with the reason printed) to fall back
+ */
+int uring_init(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    ring.fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ring.fd < 0) {
+        perror("io_uring_setup() failed");
+        ring.fd = -1;
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_NODROP)) {
+        printf("io_uring: kernel may drop completions.\n");
+        ring_free();
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    ring.maps[0] = sq;
+    ring.map_sizes[0] = sq_size;
+    ring.maps[1] = (cq != sq) ? cq : NULL;
+    ring.map_sizes[1] = cq_size;
+    ring.maps[2] = ring.sqes;
+    ring.map_sizes[2] = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        perror("io_uring mmap() failed");
+        ring_free();
+        return -1;
+    }
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.local_tail = *ring.sq_tail;
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    //Provided buffers: the ring of descriptors must be page aligned, hence mmap
+    ring.bufs = mmap(NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring.buf_mem = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (ring.bufs == MAP_FAILED || ring.buf_mem == NULL) {
+        if (ring.bufs == MAP_FAILED) ring.bufs = NULL;
+        perror("io_uring buffer allocation failed");
+        ring_free();
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring.bufs;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        perror("io_uring provided buffer ring unavailable");
+        ring_free();
+        return -1;
+    }
+    ring.buf_tail = 0;
+    for (unsigned short bid = 0; bid < URING_BUF_COUNT; bid++) {
+        recycle_buffer(bid);
+    }
+
+    if (probe_multishot_recv() != 0) {
+        printf("io_uring: multishot recv is not supported by this kernel.\n");
+        ring_free();
+        return -1;
+    }
+    uring_active = 1;
+    return 0;
+}
+
+/**
+ * @brief Queues a frame on a connection; it goes out with the next submission
+ * @return 0, or -1 if the connection is closing or its backlog is full
+ */
+int uring_send(int fd, const char *message) {
+    if (fd < 0 || fd >= URING_MAX_FDS || !conns[fd].open || conns[fd].closing) return -1;
+    uring_conn_t *c = &conns[fd];
+    size_t len = strlen(message);
+    if (len > UINT16_MAX || c->out_len + 2 + len > sizeof(c->out)) {
+        //A peer that stops reading gets cut off rather than stalling the ring
+        printf("Connection %d is not reading its replies, closing it.\n", fd);
+        uring_close(fd);
+        return -1;
+    }
+    uint16_t nlen = htons((uint16_t)len);
+    memcpy(c->out + c->out_len, &nlen, sizeof(nlen));
+    memcpy(c->out + c->out_len + sizeof(nlen), message, len);
+    c->out_len += sizeof(nlen) + len;
+    mark_dirty(fd);
+    return 0;
+}
+
+/// @brief Stops reading from a connection and closes it once its replies are out
+void uring_close(int fd) {
+    if (fd < 0 || fd >= URING_MAX_FDS || !conns[fd].open) return;
+    conns[fd].watched = 0;
+    conns[fd].closing = 1;
+    mark_dirty(fd);
+}
+
+/// @brief Submits each dirty connection's output, linked to a SHUTDOWN when closing
+static void flush_sends(void) {
+    for (int i = 0; i < dirty_count; i++) {
+        int fd = dirty_fds[i];
+        uring_conn_t *c = &conns[fd];
+        c->dirty = 0;
+        //Anything still queued goes out when the outstanding request completes
+        if (!c->open || c->send_inflight || c->shutdown_inflight) continue;
+        int want_shutdown = c->closing && !c->shut;
+        if (c->out_len > 0) {
+            if (sq_reserve(want_shutdown ? 2 : 1) != 0) {
+                mark_dirty(fd);
+                continue;
+            }
+            struct io_uring_sqe *sqe = get_sqe(OP_SEND, fd);
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t)(uintptr_t)c->out;
+            sqe->len = (uint32_t)c->out_len;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            c->send_inflight = 1;
+            if (!want_shutdown) continue;
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        if (want_shutdown) {
+            struct io_uring_sqe *sqe = get_sqe(OP_SHUTDOWN, fd);
+            if (sqe == NULL) {
+                mark_dirty(fd);
+                continue;
+            }
+            sqe->opcode = IORING_OP_SHUTDOWN;
+            sqe->len = SHUT_RDWR;
+            c->shutdown_inflight = 1;
+        }
+    }
+    //mark_dirty may have re-added entries past the ones just handled
+    int again = 0;
+    for (int i = 0; i < dirty_count; i++) {
+        if (conns[dirty_fds[i]].dirty) dirty_fds[again++] = dirty_fds[i];
+    }
+    dirty_count = again;
+}
+
+/// @brief Closes the descriptor once nothing is outstanding on a closing connection
+static void maybe_release(int fd) {
+    uring_conn_t *c = &conns[fd];
+    if (!c->open || !c->closing || !c->shut) return;
+    if (c->recv_armed || c->send_inflight || c->shutdown_inflight) return;
+    close(fd);
+    c->open = 0;
+    note_closed(c->klass);
+}
+
+/// @brief The peer went away (or the recv failed): release its car, then the connection
+static void conn_gone(int fd) {
+    uring_conn_t *c = &conns[fd];
+    if (c->car != NULL) {
+        Car *car = c->car;
+        c->car = NULL;
+        car_disconnected(car); //Calls conn_close
+    } else if (c->watched) {
+        //Keep the fd until the pickup closes it, so its number cannot be reused under it
+        return;
+    } else {
+        uring_close(fd);
+    }
+}
+
+static void dispatch_frame(int fd, const char *message) {
+    uring_conn_t *c = &conns[fd];
+    if (c->car != NULL) {
+        if (car_frame(c->car, message)) {
+            conn_gone(fd);
+        }
+        return;
+    }
+    if (c->identified) return; //Call pads only send the one frame
+    c->identified = 1;
+    note_first_frame(c->klass, monotonic_ns() - c->accepted_ns);
+    if (strncmp(message, "CAR", 3) == 0) {
+        c->car = register_car(fd, message);
+    } else if (strncmp(message, "CALL", 4) == 0) {
+        if (handle_call_connection(fd, message)) {
+            c->watched = 1;
+        } else {
+            uring_close(fd);
+        }
+    } else {
+        if (strncmp(message, "GATEWAY", 7) == 0) {
+            printf("Gateways need handler threads, closing gateway connection %d.\n", fd);
+        }
+        uring_close(fd);
+    }
+}
+
+/// @brief Splits the connection's input into frames and handles each one
+static void process_input(int fd) {
+    uring_conn_t *c = &conns[fd];
+    char message[URING_IN_SIZE];
+    size_t off = 0;
+    while (!c->closing && c->in_len - off >= sizeof(uint16_t)) {
+        uint16_t nlen;
+        memcpy(&nlen, c->in + off, sizeof(nlen));
+        size_t len = ntohs(nlen);
+        if (len + sizeof(nlen) > sizeof(c->in)) {
+            printf("Frame of %zu bytes on connection %d is too large, closing it.\n", len, fd);
+            conn_gone(fd);
+            break;
+        }
+        if (c->in_len - off < len + sizeof(nlen)) break;
+        memcpy(message, c->in + off + sizeof(nlen), len);
+        message[len] = '\0';
+        off += len + sizeof(nlen);
+        stats.frames++;
+        dispatch_frame(fd, message);
+    }
+    if (c->closing) {
+        c->in_len = 0;
+        return;
+    }
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+}
+
+static void new_connection(int fd, ConnClass klass) {
+    if (fd >= URING_MAX_FDS) {
+        printf("Max clients reached. rejecting new connection.\n");
+        note_rejected(klass);
+        if (klass != CONN_CAR) send_busy(fd);
+        close(fd);
+        return;
+    }
+    uring_conn_t *c = &conns[fd];
+    note_accepted(klass);
+    c->open = 1;
+    c->identified = 0;
+    c->klass = klass;
+    c->accepted_ns = monotonic_ns();
+    c->deferred = 0;
+    c->watched = 0;
+    c->car = NULL;
+    c->closing = 0;
+    c->send_inflight = 0;
+    c->shutdown_inflight = 0;
+    c->shut = 0;
+    c->in_len = 0;
+    c->out_len = 0;
+    c->recv_armed = arm_recv(OP_RECV, fd) == 0;
+    if (!c->recv_armed) {
+        close(fd);
+        c->open = 0;
+        note_closed(klass);
+    }
+}
+
+/// @brief Handles the input of every call pad deferred during the last batch
+static void process_deferred(void) {
+    for (int i = 0; i < deferred_count; i++) {
+        int fd = deferred_fds[i];
+        uring_conn_t *c = &conns[fd];
+        if (!c->deferred) continue; //Already handled, or the fd was reused
+        c->deferred = 0;
+        if (c->open) process_input(fd);
+    }
+    deferred_count = 0;
+}
+
+static void on_recv(int fd, const struct io_uring_cqe *cqe) {
+    uring_conn_t *c = &conns[fd];
+    if (cqe->res > 0) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        const char *data = ring.buf_mem + (size_t)bid * URING_BUF_SIZE;
+        size_t done = 0;
+        //Call pad input that fits waits until the cars in this batch are served
+        if (c->klass == CONN_CALL && !c->closing && (size_t)cqe->res <= sizeof(c->in) - c->in_len &&
+            (c->deferred || deferred_count < URING_MAX_FDS)) {
+            memcpy(c->in + c->in_len, data, cqe->res);
+            c->in_len += cqe->res;
+            done = cqe->res;
+            if (!c->deferred) {
+                c->deferred = 1;
+                deferred_fds[deferred_count++] = fd;
+            }
+        }
+        while (done < (size_t)cqe->res && !c->closing) {
+            size_t n = (size_t)cqe->res - done;
+            if (n > sizeof(c->in) - c->in_len) n = sizeof(c->in) - c->in_len;
+            memcpy(c->in + c->in_len, data + done, n);
+            c->in_len += n;
+            done += n;
+            process_input(fd);
+        }
+        recycle_buffer(bid);
+    }
+    if (cqe->flags & IORING_CQE_F_MORE) return;
+
+    //The multishot recv has ended. Running out of buffers is not the end of the
+    //stream, so read on (a closing connection reads on until its SHUTDOWN lands)
+    c->recv_armed = 0;
+    if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+        c->recv_armed = arm_recv(OP_RECV, fd) == 0;
+        if (c->recv_armed) return;
+    }
+    conn_gone(fd);
+    maybe_release(fd);
+}
+
+static void on_completion(const struct io_uring_cqe *cqe) {
+    uring_op_t op = (uring_op_t)(cqe->user_data >> 32);
+    int fd = (int)(uint32_t)cqe->user_data;
+    stats.completions++;
+    switch (op) {
+    case OP_ACCEPT:
+    case OP_ACCEPT_CALL:
+        if (cqe->res >= 0) {
+            //Without a call listener the one port serves both
+            ConnClass klass = (op == OP_ACCEPT_CALL) ? CONN_CALL
+                            : (call_listen_fd >= 0) ? CONN_CAR : CONN_SHARED;
+            new_connection(cqe->res, klass);
+        } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+            fprintf(stderr, "accept() failed: %s\n", strerror(-cqe->res));
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) arm_accept(op, fd);
+        break;
+    case OP_RECV:
+        on_recv(fd, cqe);
+        break;
+    case OP_SEND: {
+        uring_conn_t *c = &conns[fd];
+        c->send_inflight = 0;
+        if (cqe->res > 0) {
+            memmove(c->out, c->out + cqe->res, c->out_len - cqe->res);
+            c->out_len -= cqe->res;
+        } else {
+            c->out_len = 0; //The peer is gone; its recv will report that
+        }
+        if (c->out_len > 0 || c->closing) mark_dirty(fd);
+        maybe_release(fd);
+        break;
+    }
+    case OP_SHUTDOWN: {
+        uring_conn_t *c = &conns[fd];
+        c->shutdown_inflight = 0;
+        if (cqe->res == -ECANCELED) {
+            //The linked SEND was short; both go again with what is left
+            mark_dirty(fd);
+        } else {
+            c->shut = 1;
+        }
+        maybe_release(fd);
+        break;
+    }
+    case OP_STANDBY_POLL:
+        repl_accept_standby(fd);
+        arm_standby_poll(fd);
+        break;
+    case OP_PROBE:
+        break;
+    }
+}
+
+/**
+ * @brief Serves every connection from the ring until shutdown is requested.
+ * Call pads on their own listener are handled after each batch's car traffic.
+ */
+void uring_run(int listen_fd, int call_fd, int standby_listen_fd) {
+    car_listen_fd = listen_fd;
+    call_listen_fd = call_fd;
+    if (arm_accept(OP_ACCEPT, car_listen_fd) != 0) return;
+    if (call_listen_fd >= 0 && arm_accept(OP_ACCEPT_CALL, call_listen_fd) != 0) return;
+    if (standby_listen_fd >= 0) arm_standby_poll(standby_listen_fd);
+
+    while (!shutdown_requested) {
+        flush_sends();
+        if (ring_enter(1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter() failed");
+            break;
+        }
+        unsigned head = *ring.cq_head;
+        unsigned handled = 0;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring.cqes[head & *ring.cq_mask];
+            head++;
+            //Free the slot first, handlers may enter the ring to make room for SQEs
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            on_completion(&cqe);
+            //A long batch of car traffic should not hold back a call pad's next step
+            if (++handled % URING_SUBMIT_EVERY == 0) {
+                flush_sends();
+                ring_enter(0);
+            }
+        }
+        process_deferred();
+    }
+    printf("io_uring: %llu frames, %llu completions in %llu io_uring_enter calls\n",
+           stats.frames, stats.completions, stats.enters);
+}
+
+#else
+
+int uring_init(void) {
+    printf("io_uring is not available in this build.\n");
+    return -1;
+}
+
+void uring_run(int listen_fd, int call_fd, int standby_listen_fd) {
+    (void)listen_fd;
+    (void)call_fd;
+    (void)standby_listen_fd;
+}
+
+int uring_send(int fd, const char *message) {
+    (void)fd;
+    (void)message;
+    return -1;
+}
+
+void uring_close(int fd) {
+    (void)fd;
+}
+
+#endif